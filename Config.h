@@ -1,6 +1,7 @@
 #pragma once
 
 #include <optional>
+#include <vector>
 
 #include <spdlog/common.h>
 
@@ -17,6 +18,12 @@ struct StreamSource
         Url,
     };
 
+    enum class MotionEvents {
+        Poll, // PullMessages requests separated by timeout
+        Pump, // back-to-back PullMessages requests from dedicated thread
+        Push, // Notify messages sent by camera, falls back to Pump if not supported
+    };
+
     Type type;
 
     std::optional<WsServerConfig> localServer; // for RECORD
@@ -24,16 +31,74 @@ struct StreamSource
 
     std::optional<WsClientConfig> client;
     std::string uri;
+    std::string substreamUri; // for URL sources, shown until main stream is ready
     std::string accessToken;
 
     bool trackMotion; // for ONVIF sources
     std::chrono::seconds motionPreviewDuration = std::chrono::seconds(15);
+    bool motionPreviewStandby = false; // keep pipeline connected between motion events
+    std::chrono::seconds preMotionBuffer = std::chrono::seconds(0); // 0 - disabled
+    unsigned preMotionBufferSize = 32; // MiB
+    bool leanPipeline = false; // for rtsp:// streams
+    unsigned rtspLatency = 200; // ms, for lean pipeline
+    bool progressiveStartup = false; // for ONVIF sources, show the lightest profile until selected one is ready
+    bool adaptiveProfile = false; // for ONVIF sources without motion tracking, switch to lighter profile on high decode load
+    bool discoveryCache = true; // for ONVIF sources, start playback with stream uri discovered by previous run
+    MotionEvents motionEvents = MotionEvents::Poll;
+    unsigned short notifyPort = 0; // 0 - any free port
+    std::string notifyHost; // autodetected if empty
+    std::vector<std::string> eventTopics; // ONVIF topic expressions to subscribe to, all if empty
+    unsigned maxBitrate = 0; // kbps, to choose ONVIF profile, 0 - unlimited
+    unsigned maxPixelRate = 0; // pixels per second, to choose ONVIF profile, 0 - unlimited
+    int priority = 0; // for motion switch, camera with higher priority is preferred
 };
 
 struct VideoOutput
 {
+    enum class Backend {
+        Display,
+        FakeSink, // headless, frames are discarded
+        Trace, // headless, timing of every frame is written to trace file
+    };
+
+    Backend backend = Backend::Display;
+    std::string traceFile = "monitor-frames.trace";
     bool showStats = false;
     bool sync = true;
+    unsigned maxWidth = 0; // 0 - unlimited
+    unsigned maxHeight = 0; // 0 - unlimited
+    bool persistentSink = true; // keep last frame on screen while reconnecting
+    std::chrono::milliseconds stallTimeout = std::chrono::milliseconds(5000); // 0 - disabled
+    std::chrono::milliseconds latencyTarget = std::chrono::milliseconds(0); // time frames are allowed to wait in sink, 0 - disabled
+    unsigned maxCatchUpRate = 5; // percent of real time
+    bool decodeDegradation = true; // lower decoding load step by step on late frames
+    unsigned degradedFramerate = 15;
+    bool mediaThread = true; // run "url" source and mosaic pipelines on dedicated thread
+    unsigned mosaicWidth = 1920;
+    unsigned mosaicHeight = 1080;
+};
+
+struct MotionSwitch
+{
+    std::vector<StreamSource> cameras; // ONVIF sources
+    std::chrono::seconds dwellTime = std::chrono::seconds(5); // minimal time before switching to another camera
+};
+
+struct ThreadPolicy
+{
+    std::vector<unsigned> mediaCores; // for GStreamer streaming threads, empty - threads are not pinned
+    std::vector<unsigned> controlCores; // for all other threads, all cores except media ones if empty
+    bool realtime = false; // SCHED_FIFO for streaming threads
+    int realtimePriority = 10; // 1 - 99
+    int niceness = -5; // for streaming threads if not realtime
+    std::chrono::seconds cpuReportInterval = std::chrono::seconds(0); // per thread CPU usage, 0 - disabled
+};
+
+struct PlayerWorkerConfig
+{
+    bool enabled = false; // play "url" source in separate process
+    std::chrono::milliseconds heartbeatTimeout = std::chrono::milliseconds(2000); // hung worker is killed after it
+    std::chrono::seconds killInterval = std::chrono::seconds(0); // kill worker periodically to measure recovery, 0 - disabled
 };
 
 struct Config
@@ -41,9 +106,23 @@ struct Config
     spdlog::level::level_enum logLevel = spdlog::level::info;
     spdlog::level::level_enum lwsLogLevel = spdlog::level::warn;
 
+    bool stageTiming = false;
+    std::chrono::seconds stageTimingInterval = std::chrono::seconds(10);
+    std::string stageTimingFile; // only log is used if empty
+    std::chrono::milliseconds signallingLoad = std::chrono::milliseconds(0); // main loop busy time every 100 ms, to measure its effect on media
+
     std::shared_ptr<WebRTCConfig> webRTCConfig = std::make_shared<WebRTCConfig>();
 
     std::optional<StreamSource> source;
+    std::vector<StreamSource> sources; // for mosaic
+    MotionSwitch motionSwitch;
 
     VideoOutput videoOutput;
+
+    unsigned short metricsPort = 0; // 0 - metrics endpoint is disabled
+    bool metricsLoopbackOnly = false;
+
+    ThreadPolicy threadPolicy;
+
+    PlayerWorkerConfig playerWorker;
 };
@@ -0,0 +1,258 @@
+#include "DecodeDegrader.h"
+
+#include <algorithm>
+
+#include <CxxPtr/GstPtr.h>
+
+
+namespace {
+
+constexpr std::chrono::seconds EvaluateInterval = std::chrono::seconds(2);
+constexpr unsigned LateFramesThreshold = 3; // per EvaluateInterval
+constexpr std::chrono::seconds MinDegradeInterval = std::chrono::seconds(4); // to let previous step take effect
+constexpr std::chrono::seconds BaseRecoveryHoldTime = std::chrono::seconds(10);
+constexpr std::chrono::seconds MaxRecoveryHoldTime = std::chrono::seconds(160);
+constexpr std::chrono::seconds FlapWindow = std::chrono::seconds(60);
+
+// when encoded buffer entered decoder on this thread, 0 - no decoding in progress
+thread_local gint64 DecodeStartTime = 0;
+
+const char* LevelName(DecodeDegrader::Level level)
+{
+    switch(level) {
+    case DecodeDegrader::Level::Full:
+        return "full";
+    case DecodeDegrader::Level::SkipNonReference:
+        return "skip non-reference frames";
+    case DecodeDegrader::Level::CapFramerate:
+        return "capped framerate";
+    case DecodeDegrader::Level::KeyframesOnly:
+        return "keyframes only";
+    }
+
+    return "unknown";
+}
+
+}
+
+struct DecodeDegrader::DecoderProbeData
+{
+    std::shared_ptr<State> state;
+    bool waitKeyframe = false; // encoded side only
+    GstClockTime lastPts = GST_CLOCK_TIME_NONE; // decoded side only
+};
+
+DecodeDegrader::DecodeDegrader(unsigned degradedFramerate, const std::string& name, bool measureOnly) noexcept :
+    _log(MonitorLog()),
+    _name(name),
+    _state(std::make_shared<State>()),
+    _recoveryHoldTime(BaseRecoveryHoldTime),
+    _levelMetric(
+        RegisterMetric(MetricType::Gauge, "monitor_decode_degradation_level", "0 - full decoding, 3 - keyframes only", { { "player", name } })),
+    _busyMetric(
+        RegisterMetric(MetricType::Gauge, "monitor_decoder_busy_percent", "Share of time decoder was busy", { { "player", name } }))
+{
+    _state->measureOnly = measureOnly;
+    // 10% tolerance to not drop every other frame because of timestamps jitter
+    _state->minFrameInterval = GST_SECOND / std::max(degradedFramerate, 1u) * 9 / 10;
+    _state->skippedFrames =
+        RegisterMetric(MetricType::Counter, "monitor_degradation_skipped_frames_total", "Frames skipped to lower decoding load", { { "player", name } });
+}
+
+DecodeDegrader::~DecodeDegrader()
+{
+    stop();
+}
+
+void DecodeDegrader::instrumentDecoder(GstElement* decoder) noexcept
+{
+    auto addProbe =
+        [this] (GstElement* decoder, const char* padName, GstPadProbeCallback callback) {
+            GstPadPtr padPtr(gst_element_get_static_pad(decoder, padName));
+            if(!padPtr)
+                return;
+
+            gst_pad_add_probe(
+                padPtr.get(),
+                GST_PAD_PROBE_TYPE_BUFFER,
+                callback,
+                new DecoderProbeData { _state },
+                [] (gpointer userData) { delete static_cast<DecoderProbeData*>(userData); });
+        };
+
+    addProbe(decoder, "sink", onEncodedBuffer);
+    addProbe(decoder, "src", onDecodedBuffer);
+}
+
+GstPadProbeReturn DecodeDegrader::onEncodedBuffer(GstPad*, GstPadProbeInfo* info, gpointer userData)
+{
+    DecoderProbeData* data = static_cast<DecoderProbeData*>(userData);
+    const Level level =
+        data->state->measureOnly ?
+            Level::Full :
+            static_cast<Level>(data->state->level.load(std::memory_order_relaxed));
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    const bool deltaUnit = GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    if(deltaUnit && (level >= Level::KeyframesOnly || data->waitKeyframe)) {
+        // reference chain is broken, so decoding could be resumed only from the next keyframe
+        data->waitKeyframe = true;
+        data->state->skippedFrames->add();
+        return GST_PAD_PROBE_DROP;
+    }
+    data->waitKeyframe = false;
+
+    if(level >= Level::SkipNonReference && GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DROPPABLE)) {
+        data->state->skippedFrames->add();
+        return GST_PAD_PROBE_DROP;
+    }
+
+    DecodeStartTime = g_get_monotonic_time();
+
+    return GST_PAD_PROBE_OK;
+}
+
+GstPadProbeReturn DecodeDegrader::onDecodedBuffer(GstPad*, GstPadProbeInfo* info, gpointer userData)
+{
+    DecoderProbeData* data = static_cast<DecoderProbeData*>(userData);
+    const Level level =
+        data->state->measureOnly ?
+            Level::Full :
+            static_cast<Level>(data->state->level.load(std::memory_order_relaxed));
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+    if(DecodeStartTime) {
+        data->state->busyTime.fetch_add(g_get_monotonic_time() - DecodeStartTime, std::memory_order_relaxed);
+        DecodeStartTime = 0;
+    }
+
+    if(level < Level::CapFramerate || !GST_BUFFER_PTS_IS_VALID(buffer)) {
+        data->lastPts = GST_CLOCK_TIME_NONE;
+        return GST_PAD_PROBE_OK;
+    }
+
+    const GstClockTime pts = GST_BUFFER_PTS(buffer);
+    if(GST_CLOCK_TIME_IS_VALID(data->lastPts) &&
+        pts >= data->lastPts && pts - data->lastPts < data->state->minFrameInterval)
+    {
+        data->state->skippedFrames->add();
+        return GST_PAD_PROBE_DROP;
+    }
+
+    data->lastPts = pts;
+
+    return GST_PAD_PROBE_OK;
+}
+
+void DecodeDegrader::setLoadCallback(const LoadCallback& callback) noexcept
+{
+    _loadCallback = callback;
+}
+
+void DecodeDegrader::start() noexcept
+{
+    stop();
+
+    if(level() != Level::Full) {
+        if(!_state->measureOnly)
+            _log->info("[{}] Restoring full decoding for new stream", _name);
+        setLevel(Level::Full);
+    }
+
+    _recoveryHoldTime = BaseRecoveryHoldTime;
+    _lastChangeWasRecovery = false;
+    _state->busyTime = 0;
+    _lateFrames = 0;
+    _lastLateTime = std::chrono::steady_clock::now();
+
+    _evaluateTimeoutSourcePtr.reset(
+        g_timeout_source_new(std::chrono::duration_cast<std::chrono::milliseconds>(EvaluateInterval).count()));
+    GSource* timeoutSource = _evaluateTimeoutSourcePtr.get();
+    g_source_set_callback(
+        timeoutSource,
+        [] (gpointer userData) -> gboolean {
+            static_cast<DecodeDegrader*>(userData)->evaluate();
+            return G_SOURCE_CONTINUE;
+        },
+        this,
+        nullptr);
+    g_source_attach(timeoutSource, g_main_context_get_thread_default());
+}
+
+void DecodeDegrader::stop() noexcept
+{
+    if(_evaluateTimeoutSourcePtr) {
+        g_source_destroy(_evaluateTimeoutSourcePtr.get());
+        _evaluateTimeoutSourcePtr.reset();
+    }
+}
+
+void DecodeDegrader::evaluate() noexcept
+{
+    const unsigned lateFrames = _lateFrames;
+    _lateFrames = 0;
+
+    const int64_t busyTime = _state->busyTime.exchange(0, std::memory_order_relaxed);
+    const double busyRatio =
+        std::min(1.0, static_cast<double>(busyTime) / std::chrono::microseconds(EvaluateInterval).count());
+    _busyMetric->set(static_cast<int64_t>(busyRatio * 100));
+
+    stepLevel(lateFrames);
+
+    if(_loadCallback)
+        _loadCallback(level(), lateFrames, busyRatio);
+}
+
+void DecodeDegrader::stepLevel(unsigned lateFrames) noexcept
+{
+    const auto now = std::chrono::steady_clock::now();
+    const Level level = this->level();
+
+    if(lateFrames > 0)
+        _lastLateTime = now;
+
+    if(lateFrames >= LateFramesThreshold) {
+        if(level == Level::KeyframesOnly || now - _lastChangeTime < MinDegradeInterval)
+            return;
+
+        // load came back soon after recovery, so the next one should wait longer
+        if(_lastChangeWasRecovery && now - _lastChangeTime < FlapWindow)
+            _recoveryHoldTime = std::min(_recoveryHoldTime * 2, MaxRecoveryHoldTime);
+        else
+            _recoveryHoldTime = BaseRecoveryHoldTime;
+
+        _log->log(
+            _state->measureOnly ? spdlog::level::debug : spdlog::level::warn,
+            "[{}] {} late frames during last {} s. {} decoding level to \"{}\"",
+            _name,
+            lateFrames,
+            EvaluateInterval.count(),
+            _state->measureOnly ? "Would lower" : "Lowering",
+            LevelName(static_cast<Level>(static_cast<unsigned>(level) + 1)));
+
+        setLevel(static_cast<Level>(static_cast<unsigned>(level) + 1));
+        _lastChangeWasRecovery = false;
+    } else if(
+        level != Level::Full &&
+        now - _lastLateTime >= _recoveryHoldTime &&
+        now - _lastChangeTime >= _recoveryHoldTime)
+    {
+        _log->log(
+            _state->measureOnly ? spdlog::level::debug : spdlog::level::info,
+            "[{}] No late frames during last {} s. {} decoding level to \"{}\"",
+            _name,
+            _recoveryHoldTime.count(),
+            _state->measureOnly ? "Would raise" : "Raising",
+            LevelName(static_cast<Level>(static_cast<unsigned>(level) - 1)));
+
+        setLevel(static_cast<Level>(static_cast<unsigned>(level) - 1));
+        _lastChangeWasRecovery = true;
+    }
+}
+
+void DecodeDegrader::setLevel(Level level) noexcept
+{
+    _state->level.store(static_cast<unsigned>(level), std::memory_order_relaxed);
+    _lastChangeTime = std::chrono::steady_clock::now();
+    _levelMetric->set(static_cast<unsigned>(level));
+}
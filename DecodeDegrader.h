@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <gst/gst.h>
+
+#include <CxxPtr/GlibPtr.h>
+
+#include "Log.h"
+#include "Metrics.h"
+
+
+// Lowers decoding load step by step while video sink keeps getting late frames
+// and steps back when there were no late frames for a while.
+// In measure only mode level is evaluated and reported the same way, but no frames are skipped.
+// Decoding time is measured as time from encoded buffer entering decoder
+// to decoded frame leaving it on the same thread, so decoders pushing frames
+// from their own threads are seen as idle.
+class DecodeDegrader
+{
+public:
+    enum class Level : unsigned {
+        Full,
+        SkipNonReference, // frames flagged as droppable by parser are not decoded
+        CapFramerate, // decoded frames above degraded framerate are not converted/rendered
+        KeyframesOnly,
+    };
+
+    // called after every evaluation with late frames count and
+    // share of time decoder was busy during evaluation interval
+    typedef std::function<void (Level, unsigned lateFrames, double busyRatio)> LoadCallback;
+
+    DecodeDegrader(unsigned degradedFramerate, const std::string& name, bool measureOnly = false) noexcept;
+    ~DecodeDegrader();
+
+    // could be called from streaming thread,
+    // installed probes stay valid even after DecodeDegrader destruction
+    void instrumentDecoder(GstElement* decoder) noexcept;
+
+    void setLoadCallback(const LoadCallback&) noexcept;
+
+    // resets level to Full since new stream could be lighter
+    void start() noexcept;
+    void stop() noexcept;
+
+    // to be called on QoS messages about dropped/late frames
+    void onLateFrame() noexcept { ++_lateFrames; }
+
+    Level level() const noexcept { return static_cast<Level>(_state->level.load(std::memory_order_relaxed)); }
+
+private:
+    struct State
+    {
+        std::atomic<unsigned> level = static_cast<unsigned>(Level::Full);
+        bool measureOnly;
+        GstClockTime minFrameInterval;
+        MetricValue* skippedFrames;
+        std::atomic<int64_t> busyTime = 0; // us, since last evaluation
+    };
+
+    struct DecoderProbeData;
+
+    static GstPadProbeReturn onEncodedBuffer(GstPad*, GstPadProbeInfo*, gpointer userData);
+    static GstPadProbeReturn onDecodedBuffer(GstPad*, GstPadProbeInfo*, gpointer userData);
+
+    void evaluate() noexcept;
+    void stepLevel(unsigned lateFrames) noexcept;
+    void setLevel(Level) noexcept;
+
+private:
+    const std::shared_ptr<spdlog::logger> _log;
+    const std::string _name;
+    const std::shared_ptr<State> _state;
+
+    LoadCallback _loadCallback;
+
+    GSourcePtr _evaluateTimeoutSourcePtr;
+    unsigned _lateFrames = 0; // since last evaluation
+    std::chrono::steady_clock::time_point _lastLateTime;
+    std::chrono::steady_clock::time_point _lastChangeTime;
+    bool _lastChangeWasRecovery = false;
+    std::chrono::seconds _recoveryHoldTime;
+
+    MetricValue *const _levelMetric;
+    MetricValue *const _busyMetric; // percent
+};
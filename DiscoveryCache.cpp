@@ -0,0 +1,132 @@
+#include "DiscoveryCache.h"
+
+#include <memory>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <CxxPtr/GlibPtr.h>
+
+#include "Log.h"
+
+
+namespace {
+
+struct KeyFileUnref
+{
+    void operator() (GKeyFile* keyFile) { g_key_file_unref(keyFile); }
+};
+
+typedef std::unique_ptr<GKeyFile, KeyFileUnref> KeyFilePtr;
+
+const char *const CacheFileName = "discovery-cache.ini";
+
+const char *const MediaEndpointKey = "media-endpoint";
+const char *const EventsEndpointKey = "events-endpoint";
+const char *const StreamUriKey = "stream-uri";
+const char *const SubstreamUriKey = "substream-uri";
+
+std::string CacheDir()
+{
+    if(const gchar* snapData = g_getenv("SNAP_DATA"))
+        return snapData;
+
+    GCharPtr cacheDirPtr(g_build_filename(g_get_user_cache_dir(), "webrtsp-monitor", nullptr));
+    return cacheDirPtr.get();
+}
+
+std::string CacheFile()
+{
+    GCharPtr cacheFilePtr(g_build_filename(CacheDir().c_str(), CacheFileName, nullptr));
+    return cacheFilePtr.get();
+}
+
+// device urls are not valid key file group names in general
+std::string GroupName(const std::string& key)
+{
+    GCharPtr checksumPtr(g_compute_checksum_for_string(G_CHECKSUM_SHA1, key.c_str(), key.size()));
+    return checksumPtr.get();
+}
+
+std::string LookupString(GKeyFile* keyFile, const std::string& group, const char* key)
+{
+    GCharPtr valuePtr(g_key_file_get_string(keyFile, group.c_str(), key, nullptr));
+    return valuePtr ? valuePtr.get() : std::string();
+}
+
+}
+
+std::optional<DiscoveryCacheEntry> LoadDiscoveryCache(const std::string& key) noexcept
+{
+    const std::string cacheFile = CacheFile();
+    const std::string group = GroupName(key);
+
+    KeyFilePtr keyFilePtr(g_key_file_new());
+    GKeyFile* keyFile = keyFilePtr.get();
+    if(!g_key_file_load_from_file(keyFile, cacheFile.c_str(), G_KEY_FILE_NONE, nullptr))
+        return {};
+
+    if(!g_key_file_has_group(keyFile, group.c_str()))
+        return {};
+
+    DiscoveryCacheEntry entry {
+        .mediaEndpoint = LookupString(keyFile, group, MediaEndpointKey),
+        .eventsEndpoint = LookupString(keyFile, group, EventsEndpointKey),
+        .streamUri = LookupString(keyFile, group, StreamUriKey),
+        .substreamUri = LookupString(keyFile, group, SubstreamUriKey),
+    };
+    if(entry.streamUri.empty())
+        return {};
+
+    return entry;
+}
+
+void SaveDiscoveryCache(const std::string& key, const DiscoveryCacheEntry& entry) noexcept
+{
+    const std::string cacheDir = CacheDir();
+    const std::string cacheFile = CacheFile();
+    const std::string group = GroupName(key);
+
+    // entries of other devices have to be kept
+    KeyFilePtr keyFilePtr(g_key_file_new());
+    GKeyFile* keyFile = keyFilePtr.get();
+    g_key_file_load_from_file(keyFile, cacheFile.c_str(), G_KEY_FILE_NONE, nullptr);
+
+    if(LookupString(keyFile, group, MediaEndpointKey) == entry.mediaEndpoint &&
+        LookupString(keyFile, group, EventsEndpointKey) == entry.eventsEndpoint &&
+        LookupString(keyFile, group, StreamUriKey) == entry.streamUri &&
+        LookupString(keyFile, group, SubstreamUriKey) == entry.substreamUri)
+    {
+        return;
+    }
+
+    g_key_file_set_string(keyFile, group.c_str(), MediaEndpointKey, entry.mediaEndpoint.c_str());
+    g_key_file_set_string(keyFile, group.c_str(), EventsEndpointKey, entry.eventsEndpoint.c_str());
+    g_key_file_set_string(keyFile, group.c_str(), StreamUriKey, entry.streamUri.c_str());
+    g_key_file_set_string(keyFile, group.c_str(), SubstreamUriKey, entry.substreamUri.c_str());
+
+    if(g_mkdir_with_parents(cacheDir.c_str(), 0700) != 0) {
+        MonitorLog()->warn("Failed to create discovery cache dir \"{}\"", cacheDir);
+        return;
+    }
+
+    gsize size = 0;
+    GCharPtr dataPtr(g_key_file_to_data(keyFile, &size, nullptr));
+
+    // stream uris could contain credentials
+    GError* error = nullptr;
+    if(!g_file_set_contents_full(
+        cacheFile.c_str(),
+        dataPtr.get(),
+        size,
+        G_FILE_SET_CONTENTS_CONSISTENT,
+        0600,
+        &error))
+    {
+        GErrorPtr errorPtr(error);
+        MonitorLog()->warn("Failed to save discovery cache: {}", errorPtr->message);
+        return;
+    }
+
+    MonitorLog()->debug("Discovery cache saved to \"{}\"", cacheFile);
+}
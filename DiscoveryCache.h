@@ -0,0 +1,21 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+
+// Last good ONVIF discovery results persisted between runs
+// (in $SNAP_DATA or user cache dir), so playback could be started
+// before device answered, while discovery revalidates them.
+struct DiscoveryCacheEntry
+{
+    std::string mediaEndpoint;
+    std::string eventsEndpoint;
+    std::string streamUri;
+    std::string substreamUri;
+};
+
+// key has to include everything affecting discovery results
+// (device url, profile selection settings)
+std::optional<DiscoveryCacheEntry> LoadDiscoveryCache(const std::string& key) noexcept;
+void SaveDiscoveryCache(const std::string& key, const DiscoveryCacheEntry&) noexcept;
@@ -0,0 +1,150 @@
+#include "FrameRing.h"
+
+#include <cassert>
+#include <cstring>
+
+
+FrameRing::FrameRing(size_t capacity, size_t maxFrames, uint64_t window) noexcept :
+    _capacity(capacity),
+    _maxFrames(maxFrames),
+    _window(window),
+    _arena(new uint8_t[capacity]),
+    _entries(new Entry[maxFrames])
+{
+    assert(capacity > 0 && maxFrames > 0);
+}
+
+void FrameRing::clear() noexcept
+{
+    _count = 0;
+    _keyframes = 0;
+}
+
+void FrameRing::evictFirstGop() noexcept
+{
+    assert(!empty());
+
+    do {
+        if(entry(firstSequence()).keyframe)
+            --_keyframes;
+        --_count;
+    } while(!empty() && !entry(firstSequence()).keyframe);
+}
+
+// returns offset in arena or capacity if there is no room even after eviction
+size_t FrameRing::allocate(size_t size) noexcept
+{
+    if(size > _capacity)
+        return _capacity;
+
+    while(!empty()) {
+        const Entry& first = entry(firstSequence());
+        const Entry& last = entry(_nextSequence - 1);
+        const size_t head = first.offset;
+        const size_t tail = last.offset + last.size;
+        const bool wrapped = _count > 1 && last.offset < head;
+
+        if(wrapped) {
+            if(head - tail >= size)
+                return tail;
+        } else {
+            if(_capacity - tail >= size)
+                return tail;
+            if(head >= size)
+                return 0;
+        }
+
+        evictFirstGop();
+    }
+
+    return 0;
+}
+
+bool FrameRing::push(
+    const uint8_t* data,
+    size_t size,
+    uint64_t pts,
+    uint64_t duration,
+    bool keyframe) noexcept
+{
+    if(size == 0)
+        return false;
+
+    if(empty() && !keyframe)
+        return false; // undecodable without previous keyframe
+
+    if(_count == _maxFrames)
+        evictFirstGop();
+
+    const size_t offset = allocate(size);
+    if(offset == _capacity) {
+        clear(); // the rest of GOP would be undecodable anyway
+        return false;
+    }
+
+    if(empty() && !keyframe)
+        return false; // whole GOP was evicted to free space
+
+    memcpy(_arena.get() + offset, data, size);
+    _entries[_nextSequence % _maxFrames] = Entry { offset, size, pts, duration, keyframe };
+    ++_nextSequence;
+    ++_count;
+    if(keyframe)
+        ++_keyframes;
+
+    // keep at least window starting from keyframe
+    while(_keyframes > 1) {
+        uint64_t secondKeyframe = firstSequence() + 1;
+        while(!entry(secondKeyframe).keyframe)
+            ++secondKeyframe;
+
+        if(pts < entry(secondKeyframe).pts || pts - entry(secondKeyframe).pts < _window)
+            break;
+
+        evictFirstGop();
+    }
+
+    return true;
+}
+
+uint64_t FrameRing::keyframeSequenceBefore(uint64_t pts) const noexcept
+{
+    uint64_t found = firstSequence();
+    for(uint64_t sequence = firstSequence(); sequence < _nextSequence; ++sequence) {
+        const Entry& e = entry(sequence);
+        if(e.pts > pts)
+            break;
+        if(e.keyframe)
+            found = sequence;
+    }
+
+    return found;
+}
+
+uint64_t FrameRing::firstPts() const noexcept
+{
+    return empty() ? 0 : entry(firstSequence()).pts;
+}
+
+uint64_t FrameRing::lastPts() const noexcept
+{
+    return empty() ? 0 : entry(_nextSequence - 1).pts;
+}
+
+bool FrameRing::get(uint64_t sequence, Frame* frame) const noexcept
+{
+    if(sequence < firstSequence() || sequence >= _nextSequence)
+        return false;
+
+    const Entry& e = entry(sequence);
+    *frame = Frame {
+        .sequence = sequence,
+        .pts = e.pts,
+        .duration = e.duration,
+        .keyframe = e.keyframe,
+        .data = _arena.get() + e.offset,
+        .size = e.size,
+    };
+
+    return true;
+}
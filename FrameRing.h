@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+
+// Fixed size storage of the latest encoded frames.
+// All memory is allocated in constructor. Oldest frames are evicted by whole GOPs,
+// so the first stored frame is always a keyframe.
+// Not thread safe.
+class FrameRing
+{
+public:
+    struct Frame
+    {
+        uint64_t sequence; // grows by 1 with every pushed frame
+        uint64_t pts; // nanoseconds
+        uint64_t duration; // nanoseconds
+        bool keyframe;
+        const uint8_t* data; // valid until next push()
+        size_t size;
+    };
+
+    FrameRing(size_t capacity, size_t maxFrames, uint64_t window) noexcept;
+
+    // frames before first keyframe and frames not fitting capacity are dropped
+    bool push(
+        const uint8_t* data,
+        size_t size,
+        uint64_t pts,
+        uint64_t duration,
+        bool keyframe) noexcept;
+    void clear() noexcept;
+
+    bool empty() const noexcept { return _count == 0; }
+    uint64_t firstSequence() const noexcept { return _nextSequence - _count; }
+    uint64_t nextSequence() const noexcept { return _nextSequence; }
+
+    // sequence of the latest keyframe not newer than pts or of the first frame
+    uint64_t keyframeSequenceBefore(uint64_t pts) const noexcept;
+    uint64_t firstPts() const noexcept;
+    uint64_t lastPts() const noexcept;
+
+    bool get(uint64_t sequence, Frame*) const noexcept;
+
+private:
+    struct Entry
+    {
+        size_t offset;
+        size_t size;
+        uint64_t pts;
+        uint64_t duration;
+        bool keyframe;
+    };
+
+    const Entry& entry(uint64_t sequence) const noexcept
+        { return _entries[sequence % _maxFrames]; }
+
+    void evictFirstGop() noexcept;
+    size_t allocate(size_t size) noexcept;
+
+private:
+    const size_t _capacity;
+    const size_t _maxFrames;
+    const uint64_t _window;
+
+    const std::unique_ptr<uint8_t[]> _arena;
+    const std::unique_ptr<Entry[]> _entries;
+
+    uint64_t _nextSequence = 0;
+    size_t _count = 0;
+    size_t _keyframes = 0;
+};
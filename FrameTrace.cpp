@@ -0,0 +1,183 @@
+#include "FrameTrace.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#include <CxxPtr/GstPtr.h>
+
+#include "FrameTraceFormat.h"
+#include "Log.h"
+
+
+namespace {
+
+// frames dropped between decoder and sink are never matched
+const size_t MaxPendingFrames = 128;
+const unsigned FlushInterval = 256; // records
+
+struct FrameTimes
+{
+    int64_t arrivalTime = 0;
+    int64_t decodedTime = 0;
+};
+
+struct FrameTraceState
+{
+    std::string file;
+
+    std::mutex mutex;
+    FILE* out = nullptr;
+    bool openFailed = false;
+    std::map<GstClockTime, FrameTimes> pendingFrames;
+    unsigned unflushedRecords = 0;
+};
+
+FrameTraceState* State = nullptr; // lives until process exit
+
+// has to be called with State->mutex locked
+FrameTimes& PendingFrame(GstClockTime pts)
+{
+    const auto it = State->pendingFrames.find(pts);
+    if(it != State->pendingFrames.end())
+        return it->second;
+
+    // evicting before insert, so returned frame is never the evicted one
+    if(State->pendingFrames.size() >= MaxPendingFrames)
+        State->pendingFrames.erase(State->pendingFrames.begin());
+
+    return State->pendingFrames[pts];
+}
+
+// has to be called with State->mutex locked
+bool OpenTraceFile()
+{
+    if(State->out)
+        return true;
+    if(State->openFailed)
+        return false;
+
+    State->out = fopen(State->file.c_str(), "wb");
+    if(!State->out) {
+        State->openFailed = true;
+        MonitorLog()->error("Failed to open frame trace file \"{}\": {}", State->file, strerror(errno));
+        return false;
+    }
+
+    FrameTraceHeader header {};
+    memcpy(header.magic, FrameTraceMagic, sizeof(header.magic));
+    header.version = FrameTraceVersion;
+    header.recordSize = sizeof(FrameTraceRecord);
+    fwrite(&header, sizeof(header), 1, State->out);
+
+    MonitorLog()->info("Writing frame trace to \"{}\"", State->file);
+
+    return true;
+}
+
+void OnHandoff(GstElement*, GstBuffer* buffer, GstPad*, gpointer)
+{
+    const int64_t renderTime = g_get_monotonic_time();
+    const GstClockTime pts = GST_BUFFER_PTS(buffer);
+
+    std::lock_guard<std::mutex> lock(State->mutex);
+    if(!OpenTraceFile())
+        return;
+
+    FrameTraceRecord record {
+        .pts = GST_CLOCK_TIME_IS_VALID(pts) ? pts : UINT64_MAX,
+        .renderTime = renderTime,
+    };
+    if(GST_CLOCK_TIME_IS_VALID(pts)) {
+        const auto it = State->pendingFrames.find(pts);
+        if(it != State->pendingFrames.end()) {
+            record.arrivalTime = it->second.arrivalTime;
+            record.decodedTime = it->second.decodedTime;
+            State->pendingFrames.erase(it);
+        }
+    }
+
+    fwrite(&record, sizeof(record), 1, State->out);
+
+    // to lose not much on crash or kill
+    if(++State->unflushedRecords >= FlushInterval) {
+        fflush(State->out);
+        State->unflushedRecords = 0;
+    }
+}
+
+}
+
+void StartFrameTrace(const std::string& file) noexcept
+{
+    if(State)
+        return;
+
+    State = new FrameTraceState;
+    State->file = file;
+}
+
+void TraceDecoder(GstElement* decoder) noexcept
+{
+    if(!State)
+        return;
+
+    GstPadPtr sinkPadPtr(gst_element_get_static_pad(decoder, "sink"));
+    GstPadPtr srcPadPtr(gst_element_get_static_pad(decoder, "src"));
+    if(!sinkPadPtr || !srcPadPtr)
+        return;
+
+    {
+        // PTS restarts after reconnect, so frames of previous decoder will never be matched
+        std::lock_guard<std::mutex> lock(State->mutex);
+        State->pendingFrames.clear();
+    }
+
+    gst_pad_add_probe(
+        sinkPadPtr.get(),
+        GST_PAD_PROBE_TYPE_BUFFER,
+        [] (GstPad*, GstPadProbeInfo* info, gpointer) -> GstPadProbeReturn {
+            const GstClockTime pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+            if(!GST_CLOCK_TIME_IS_VALID(pts))
+                return GST_PAD_PROBE_OK;
+
+            const int64_t now = g_get_monotonic_time();
+            std::lock_guard<std::mutex> lock(State->mutex);
+            FrameTimes& times = PendingFrame(pts);
+            // the first part of frame split to several buffers
+            if(!times.arrivalTime)
+                times.arrivalTime = now;
+
+            return GST_PAD_PROBE_OK;
+        },
+        nullptr,
+        nullptr);
+
+    gst_pad_add_probe(
+        srcPadPtr.get(),
+        GST_PAD_PROBE_TYPE_BUFFER,
+        [] (GstPad*, GstPadProbeInfo* info, gpointer) -> GstPadProbeReturn {
+            const GstClockTime pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+            if(!GST_CLOCK_TIME_IS_VALID(pts))
+                return GST_PAD_PROBE_OK;
+
+            const int64_t now = g_get_monotonic_time();
+            std::lock_guard<std::mutex> lock(State->mutex);
+            PendingFrame(pts).decodedTime = now;
+
+            return GST_PAD_PROBE_OK;
+        },
+        nullptr,
+        nullptr);
+}
+
+void TraceSink(GstElement* fakeSink) noexcept
+{
+    if(!State)
+        return;
+
+    g_object_set(fakeSink, "signal-handoffs", TRUE, nullptr);
+    g_signal_connect(fakeSink, "handoff", G_CALLBACK(OnHandoff), nullptr);
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+#include <gst/gst.h>
+
+
+// Writes FrameTraceRecord (see FrameTraceFormat.h) for every frame rendered by traced sink.
+// Frames are matched between decoder and sink by PTS.
+
+// file is (re)written when the first sink is traced
+void StartFrameTrace(const std::string& file) noexcept;
+
+// do nothing if frame trace is not started
+void TraceDecoder(GstElement* decoder) noexcept;
+void TraceSink(GstElement* fakeSink) noexcept;
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+
+// Binary per frame timing trace written by "trace" video output backend:
+// FrameTraceHeader followed by FrameTraceRecord for every rendered frame,
+// all fields are in host byte order.
+
+constexpr char FrameTraceMagic[8] = { 'M', 'O', 'N', 'F', 'T', 'R', 'C', '\0' };
+constexpr uint32_t FrameTraceVersion = 1;
+
+struct FrameTraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+};
+
+// times are microseconds of monotonic clock, 0 - unknown
+struct FrameTraceRecord
+{
+    uint64_t pts; // ns, UINT64_MAX - unknown
+    int64_t arrivalTime; // encoded frame reached decoder
+    int64_t decodedTime; // decoded frame left decoder
+    int64_t renderTime; // frame was handed to sink for rendering
+};
+
+static_assert(sizeof(FrameTraceHeader) == 16);
+static_assert(sizeof(FrameTraceRecord) == 32);
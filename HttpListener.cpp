@@ -0,0 +1,335 @@
+#include "HttpListener.h"
+
+#include <cassert>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+
+#include <CxxPtr/GlibPtr.h>
+
+
+namespace {
+
+const guint IoTimeout = 5; // seconds
+const gsize MaxBodySize = 1024 * 1024;
+const size_t MaxLineLength = 8 * 1024;
+const unsigned MaxHeadersCount = 100;
+
+const char* StatusText(unsigned status)
+{
+    switch(status) {
+    case 200: return "OK";
+    case 202: return "Accepted";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Payload Too Large";
+    default: return "Internal Server Error";
+    }
+}
+
+// returns line without trailing CR LF or null on error or too long line
+GCharPtr ReadLine(GDataInputStream* input)
+{
+    // input is buffered, so reading byte by byte is cheap
+    std::string line;
+    for(;;) {
+        GError* error = nullptr;
+        const guchar c = g_data_input_stream_read_byte(input, nullptr, &error);
+        if(error) {
+            g_error_free(error);
+            return nullptr;
+        }
+
+        if(c == '\n')
+            break;
+
+        if(line.size() >= MaxLineLength)
+            return nullptr;
+
+        line += static_cast<char>(c);
+    }
+
+    if(!line.empty() && line.back() == '\r')
+        line.pop_back();
+
+    return GCharPtr(g_strdup(line.c_str()));
+}
+
+bool ReadBody(GDataInputStream* input, gsize size, std::string* body)
+{
+    const gsize offset = body->size();
+    body->resize(offset + size);
+
+    gsize bytesRead = 0;
+    return
+        g_input_stream_read_all(
+            G_INPUT_STREAM(input),
+            body->data() + offset,
+            size,
+            &bytesRead,
+            nullptr,
+            nullptr) &&
+        bytesRead == size;
+}
+
+// returns 0 on success or HTTP status to respond with
+unsigned ReadRequest(GDataInputStream* input, HttpListener::Request* request)
+{
+    GCharPtr requestLinePtr = ReadLine(input);
+    if(!requestLinePtr)
+        return 400;
+
+    const std::string requestLine = requestLinePtr.get();
+    const std::string::size_type methodEnd = requestLine.find(' ');
+    if(methodEnd == std::string::npos)
+        return 400;
+    const std::string::size_type pathEnd = requestLine.find(' ', methodEnd + 1);
+    if(pathEnd == std::string::npos)
+        return 400;
+
+    request->method = requestLine.substr(0, methodEnd);
+    request->path = requestLine.substr(methodEnd + 1, pathEnd - methodEnd - 1);
+
+    guint64 contentLength = 0;
+    bool chunked = false;
+    for(unsigned headersCount = 0;; ++headersCount) {
+        if(headersCount > MaxHeadersCount)
+            return 400;
+
+        GCharPtr headerPtr = ReadLine(input);
+        if(!headerPtr)
+            return 400;
+
+        const gchar* header = headerPtr.get();
+        if(header[0] == '\0')
+            break;
+
+        if(0 == g_ascii_strncasecmp(header, "Content-Length:", 15)) {
+            contentLength = g_ascii_strtoull(header + 15, nullptr, 10);
+        } else if(0 == g_ascii_strncasecmp(header, "Transfer-Encoding:", 18)) {
+            chunked = strstr(header + 18, "chunked") != nullptr;
+        }
+    }
+
+    if(chunked) {
+        for(;;) {
+            GCharPtr chunkSizePtr = ReadLine(input);
+            if(!chunkSizePtr)
+                return 400;
+
+            const guint64 chunkSize = g_ascii_strtoull(chunkSizePtr.get(), nullptr, 16);
+            if(chunkSize == 0) {
+                // skip trailer
+                unsigned trailersCount = 0;
+                for(GCharPtr trailerPtr = ReadLine(input);
+                    trailerPtr && trailerPtr.get()[0] != '\0' && trailersCount < MaxHeadersCount;
+                    trailerPtr = ReadLine(input), ++trailersCount);
+                break;
+            }
+
+            if(request->body.size() + chunkSize > MaxBodySize)
+                return 413;
+
+            if(!ReadBody(input, chunkSize, &request->body))
+                return 400;
+
+            if(!ReadLine(input)) // CR LF after chunk data
+                return 400;
+        }
+    } else if(contentLength > 0) {
+        if(contentLength > MaxBodySize)
+            return 413;
+
+        if(!ReadBody(input, contentLength, &request->body))
+            return 400;
+    }
+
+    return 0;
+}
+
+void WriteResponse(GOutputStream* output, const HttpListener::Response& response)
+{
+    std::string message =
+        "HTTP/1.1 " + std::to_string(response.status) + " " + StatusText(response.status) + "\r\n"
+        "Connection: close\r\n"
+        "Content-Length: " + std::to_string(response.body.size()) + "\r\n";
+    if(!response.contentType.empty())
+        message += "Content-Type: " + response.contentType + "\r\n";
+    message += "\r\n";
+    message += response.body;
+
+    gsize bytesWritten = 0;
+    g_output_stream_write_all(
+        output,
+        message.data(),
+        message.size(),
+        &bytesWritten,
+        nullptr,
+        nullptr);
+}
+
+}
+
+struct HttpListener::Shared
+{
+    std::shared_ptr<spdlog::logger> log;
+    Handler handler;
+
+    std::mutex mutex;
+    std::condition_variable handlerFinished;
+    bool stopped = false;
+    bool handlerRunning = false;
+};
+
+HttpListener::HttpListener(const Handler& handler) noexcept :
+    _log(MonitorLog()),
+    _shared(std::make_shared<Shared>())
+{
+    _shared->log = _log;
+    _shared->handler = handler;
+}
+
+HttpListener::~HttpListener()
+{
+    stop();
+}
+
+void HttpListener::stop() noexcept
+{
+    if(!_service)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_shared->mutex);
+        _shared->stopped = true;
+    }
+
+    g_socket_service_stop(_service);
+    g_socket_listener_close(G_SOCKET_LISTENER(_service));
+    g_object_unref(_service);
+
+    _service = nullptr;
+
+    // handler refers to owner of the listener, so it has to be finished before owner is destroyed,
+    // connections accepted later are dropped without calling it
+    std::unique_lock<std::mutex> lock(_shared->mutex);
+    _shared->handlerFinished.wait(lock, [this] () { return !_shared->handlerRunning; });
+}
+
+bool HttpListener::listen(unsigned short port, bool loopbackOnly) noexcept
+{
+    assert(!_service);
+
+    // single thread guarantees requests are handled one by one
+    GSocketService* service = g_threaded_socket_service_new(1);
+    GSocketListener* listener = G_SOCKET_LISTENER(service);
+
+    GError* error = nullptr;
+    guint16 boundPort = 0;
+    if(loopbackOnly) {
+        GInetAddress* loopbackAddress = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+        GSocketAddress* address = g_inet_socket_address_new(loopbackAddress, port);
+        GSocketAddress* effectiveAddress = nullptr;
+        if(g_socket_listener_add_address(
+            listener,
+            address,
+            G_SOCKET_TYPE_STREAM,
+            G_SOCKET_PROTOCOL_TCP,
+            nullptr,
+            &effectiveAddress,
+            &error))
+        {
+            boundPort = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(effectiveAddress));
+            g_object_unref(effectiveAddress);
+        }
+        g_object_unref(address);
+        g_object_unref(loopbackAddress);
+    } else if(port) {
+        if(g_socket_listener_add_inet_port(listener, port, nullptr, &error))
+            boundPort = port;
+    } else {
+        boundPort = g_socket_listener_add_any_inet_port(listener, nullptr, &error);
+    }
+
+    GErrorPtr errorPtr(error);
+    if(!boundPort) {
+        _log->error(
+            "Failed to listen HTTP requests on port {}: {}",
+            port,
+            errorPtr ? errorPtr->message : "unknown error");
+        g_object_unref(service);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_shared->mutex);
+        _shared->stopped = false;
+    }
+
+    g_signal_connect_data(
+        service,
+        "run",
+        G_CALLBACK(onConnection),
+        new std::shared_ptr<Shared>(_shared),
+        [] (gpointer userData, GClosure*) { delete static_cast<std::shared_ptr<Shared>*>(userData); },
+        static_cast<GConnectFlags>(0));
+    g_socket_service_start(service);
+
+    _service = service;
+    _port = boundPort;
+
+    _log->info("Listening HTTP requests on port {}", _port);
+
+    return true;
+}
+
+gboolean HttpListener::onConnection(
+    GThreadedSocketService*,
+    GSocketConnection* connection,
+    GObject* /*sourceObject*/,
+    gpointer userData)
+{
+    handleConnection(**static_cast<std::shared_ptr<Shared>*>(userData), connection);
+
+    return TRUE;
+}
+
+void HttpListener::handleConnection(Shared& shared, GSocketConnection* connection) noexcept
+{
+    g_socket_set_timeout(g_socket_connection_get_socket(connection), IoTimeout);
+
+    GInputStream* input = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+    GOutputStream* output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+
+    GDataInputStream* dataInput = g_data_input_stream_new(input);
+    g_data_input_stream_set_newline_type(dataInput, G_DATA_STREAM_NEWLINE_TYPE_LF);
+
+    Request request;
+    Response response;
+    if(const unsigned errorStatus = ReadRequest(dataInput, &request)) {
+        shared.log->warn("Failed to read HTTP request");
+        response.status = errorStatus;
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            if(shared.stopped) {
+                g_object_unref(dataInput);
+                return;
+            }
+            shared.handlerRunning = true;
+        }
+
+        response = shared.handler(request);
+
+        {
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            shared.handlerRunning = false;
+        }
+        shared.handlerFinished.notify_all();
+    }
+
+    WriteResponse(output, response);
+
+    g_object_unref(dataInput);
+}
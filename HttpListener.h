@@ -0,0 +1,63 @@
+#pragma once
+
+#include <string>
+#include <functional>
+#include <memory>
+
+#include <gio/gio.h>
+
+#include "Log.h"
+
+
+// Minimal HTTP/1.1 server for small machine-to-machine requests.
+// Every connection serves single request and is handled in dedicated listener thread,
+// one connection at a time.
+class HttpListener
+{
+public:
+    struct Request
+    {
+        std::string method;
+        std::string path;
+        std::string body;
+    };
+
+    struct Response
+    {
+        unsigned status = 200;
+        std::string contentType;
+        std::string body;
+    };
+
+    // called from listener thread
+    typedef std::function<Response (const Request&)> Handler;
+
+    explicit HttpListener(const Handler&) noexcept;
+    ~HttpListener();
+
+    // port 0 means any free port
+    bool listen(unsigned short port, bool loopbackOnly) noexcept;
+    // stops accepting new connections
+    // and waits for handler which is running already
+    void stop() noexcept;
+    unsigned short port() const noexcept { return _port; }
+
+private:
+    struct Shared;
+
+    static gboolean onConnection(
+        GThreadedSocketService*,
+        GSocketConnection*,
+        GObject* sourceObject,
+        gpointer userData);
+
+    static void handleConnection(Shared&, GSocketConnection*) noexcept;
+
+private:
+    const std::shared_ptr<spdlog::logger> _log;
+    // shared with listener thread, which could outlive the listener
+    const std::shared_ptr<Shared> _shared;
+
+    GSocketService* _service = nullptr;
+    unsigned short _port = 0;
+};
@@ -0,0 +1,196 @@
+#include "LatencyController.h"
+
+#include <algorithm>
+#include <limits>
+
+
+namespace {
+
+constexpr std::chrono::milliseconds AdjustInterval = std::chrono::milliseconds(250);
+constexpr GstClockTimeDiff Hysteresis = 10 * GST_MSECOND;
+constexpr int64_t NoLateness = std::numeric_limits<int64_t>::min();
+
+}
+
+LatencyController::LatencyController(
+    std::chrono::milliseconds target,
+    unsigned maxCatchUpRate,
+    const std::string& name) noexcept :
+    _log(MonitorLog()),
+    _target(std::chrono::duration_cast<std::chrono::nanoseconds>(target).count()),
+    _maxCatchUpRate(std::clamp(maxCatchUpRate, 1u, 50u)),
+    _maxLateness(NoLateness),
+    _slackMetric(
+        RegisterMetric(MetricType::Gauge, "monitor_playout_slack_ms", "Time frames wait in video sink before render", { { "player", name } })),
+    _tsOffsetMetric(
+        RegisterMetric(MetricType::Gauge, "monitor_sink_ts_offset_ms", "Render time offset set by latency controller", { { "player", name } })),
+    _catchUpStepsMetric(
+        RegisterMetric(MetricType::Counter, "monitor_latency_catch_up_steps_total", "Render time offset decreases", { { "player", name } })),
+    _backOffStepsMetric(
+        RegisterMetric(MetricType::Counter, "monitor_latency_back_off_steps_total", "Render time offset increases due to late frames", { { "player", name } }))
+{
+}
+
+LatencyController::~LatencyController()
+{
+    detach();
+}
+
+void LatencyController::attach(GstElement* pipeline, GstElement* videoSink) noexcept
+{
+    detach();
+
+    GstPadPtr sinkPadPtr(gst_element_get_static_pad(videoSink, "sink"));
+    if(!sinkPadPtr) {
+        _log->warn("Failed to get video sink pad. Latency control is disabled");
+        return;
+    }
+
+    _pipeline = pipeline;
+    _videoSink = videoSink;
+    _sinkPadPtr.swap(sinkPadPtr);
+    _maxLateness = NoLateness;
+    _tsOffset = 0;
+
+    _probeId = gst_pad_add_probe(_sinkPadPtr.get(), GST_PAD_PROBE_TYPE_BUFFER, onBuffer, this, nullptr);
+
+    _adjustTimeoutSourcePtr.reset(g_timeout_source_new(AdjustInterval.count()));
+    GSource* timeoutSource = _adjustTimeoutSourcePtr.get();
+    g_source_set_callback(
+        timeoutSource,
+        [] (gpointer userData) -> gboolean {
+            static_cast<LatencyController*>(userData)->adjust();
+            return G_SOURCE_CONTINUE;
+        },
+        this,
+        nullptr);
+    g_source_attach(timeoutSource, g_main_context_get_thread_default());
+}
+
+void LatencyController::detach() noexcept
+{
+    if(_adjustTimeoutSourcePtr) {
+        g_source_destroy(_adjustTimeoutSourcePtr.get());
+        _adjustTimeoutSourcePtr.reset();
+    }
+
+    if(_probeId) {
+        gst_pad_remove_probe(_sinkPadPtr.get(), _probeId);
+        _probeId = 0;
+    }
+
+    _sinkPadPtr.reset();
+    _pipeline = nullptr;
+    _videoSink = nullptr;
+}
+
+GstPadProbeReturn LatencyController::onBuffer(GstPad* pad, GstPadProbeInfo* info, gpointer userData)
+{
+    LatencyController* self = static_cast<LatencyController*>(userData);
+
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if(!GST_BUFFER_PTS_IS_VALID(buffer))
+        return GST_PAD_PROBE_OK;
+
+    GstEvent* segmentEvent = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+    if(!segmentEvent)
+        return GST_PAD_PROBE_OK;
+
+    const GstSegment* segment = nullptr;
+    gst_event_parse_segment(segmentEvent, &segment);
+    const GstClockTime bufferRunningTime =
+        gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+    gst_event_unref(segmentEvent);
+
+    if(!GST_CLOCK_TIME_IS_VALID(bufferRunningTime))
+        return GST_PAD_PROBE_OK;
+
+    GstElement* element = GST_ELEMENT(gst_pad_get_parent_element(pad));
+    if(!element)
+        return GST_PAD_PROBE_OK;
+
+    GstClock* clock = gst_element_get_clock(element);
+    const GstClockTime baseTime = gst_element_get_base_time(element);
+    gst_object_unref(element);
+    if(!clock)
+        return GST_PAD_PROBE_OK;
+
+    const GstClockTime arrivalRunningTime = gst_clock_get_time(clock) - baseTime;
+    gst_object_unref(clock);
+
+    const int64_t lateness = GST_CLOCK_DIFF(bufferRunningTime, arrivalRunningTime);
+    int64_t maxLateness = self->_maxLateness.load(std::memory_order_relaxed);
+    while(lateness > maxLateness &&
+        !self->_maxLateness.compare_exchange_weak(maxLateness, lateness, std::memory_order_relaxed));
+
+    return GST_PAD_PROBE_OK;
+}
+
+// autovideosink and fpsdisplaysink are bins, so actual sink is searched inside
+GstElement* LatencyController::findOffsetSink() noexcept
+{
+    if(!GST_IS_BIN(_videoSink))
+        return GST_ELEMENT(gst_object_ref(_videoSink));
+
+    GstElement* found = nullptr;
+    GstIterator* iterator = gst_bin_iterate_sinks(GST_BIN(_videoSink));
+    GValue item = G_VALUE_INIT;
+    while(!found && gst_iterator_next(iterator, &item) == GST_ITERATOR_OK) {
+        GstElement* element = GST_ELEMENT(g_value_get_object(&item));
+        if(!GST_IS_BIN(element) && g_object_class_find_property(G_OBJECT_GET_CLASS(element), "ts-offset"))
+            found = GST_ELEMENT(gst_object_ref(element));
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iterator);
+
+    return found;
+}
+
+void LatencyController::adjust() noexcept
+{
+    const int64_t maxLateness = _maxLateness.exchange(NoLateness, std::memory_order_relaxed);
+    if(maxLateness == NoLateness)
+        return; // no frames since last adjust
+
+    GstQuery* query = gst_query_new_latency();
+    GstClockTime latency = 0;
+    if(gst_element_query(_pipeline, query))
+        gst_query_parse_latency(query, nullptr, &latency, nullptr);
+    gst_query_unref(query);
+
+    // how long the most delayed frame of the interval waited before render
+    const GstClockTimeDiff slack = static_cast<GstClockTimeDiff>(latency) + _tsOffset - maxLateness;
+    _slackMetric->set(slack / GST_MSECOND);
+
+    GstClockTimeDiff tsOffset = _tsOffset;
+    if(slack > _target + Hysteresis) {
+        const GstClockTimeDiff maxStep =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(AdjustInterval).count() * _maxCatchUpRate / 100;
+        tsOffset -= std::min(slack - _target, maxStep);
+        _catchUpStepsMetric->add();
+    } else if(slack < 0 && _tsOffset < 0) {
+        tsOffset = std::min<GstClockTimeDiff>(0, _tsOffset - slack + Hysteresis);
+        _backOffStepsMetric->add();
+    }
+
+    if(tsOffset == _tsOffset)
+        return;
+
+    GstElement* sink = findOffsetSink();
+    if(!sink)
+        return;
+
+    _log->debug(
+        "Playout slack {} ms, target {} ms. Changing render offset {} -> {} ms",
+        slack / GST_MSECOND,
+        _target / GST_MSECOND,
+        _tsOffset / GST_MSECOND,
+        tsOffset / GST_MSECOND);
+
+    g_object_set(sink, "ts-offset", static_cast<gint64>(tsOffset), nullptr);
+    gst_object_unref(sink);
+
+    _tsOffset = tsOffset;
+    _tsOffsetMetric->set(_tsOffset / GST_MSECOND);
+}
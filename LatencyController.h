@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <gst/gst.h>
+
+#include <CxxPtr/GlibPtr.h>
+#include <CxxPtr/GstPtr.h>
+
+#include "Log.h"
+#include "Metrics.h"
+
+
+// Trims playout delay accumulated in front of synchronized video sink.
+// Frames waiting for render longer than target make sink "ts-offset" go down,
+// but not faster than max catch up rate (i.e. playback is only slightly faster than real time),
+// while late frames move offset back immediately.
+class LatencyController
+{
+public:
+    LatencyController(
+        std::chrono::milliseconds target,
+        unsigned maxCatchUpRate, // percent of real time
+        const std::string& name) noexcept;
+    ~LatencyController();
+
+    // pipeline and sink have to stay alive until detach()
+    void attach(GstElement* pipeline, GstElement* videoSink) noexcept;
+    void detach() noexcept;
+
+private:
+    static GstPadProbeReturn onBuffer(GstPad*, GstPadProbeInfo*, gpointer userData);
+    void adjust() noexcept;
+    GstElement* findOffsetSink() noexcept;
+
+private:
+    const std::shared_ptr<spdlog::logger> _log;
+    const GstClockTimeDiff _target;
+    const unsigned _maxCatchUpRate;
+
+    GstElement* _pipeline = nullptr;
+    GstElement* _videoSink = nullptr;
+    GstPadPtr _sinkPadPtr;
+    gulong _probeId = 0;
+    GSourcePtr _adjustTimeoutSourcePtr;
+
+    // max of (arrival running time - buffer running time) since last adjust
+    std::atomic<int64_t> _maxLateness;
+
+    GstClockTimeDiff _tsOffset = 0;
+
+    MetricValue *const _slackMetric; // milliseconds
+    MetricValue *const _tsOffsetMetric; // milliseconds
+    MetricValue *const _catchUpStepsMetric;
+    MetricValue *const _backOffStepsMetric;
+};
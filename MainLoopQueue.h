@@ -0,0 +1,107 @@
+#pragma once
+
+#include <functional>
+
+#include <glib.h>
+
+#include "SpscQueue.h"
+
+
+// Delivers items posted from single worker thread
+// to handler called from GMainContext thread
+template<typename T, size_t Capacity>
+class MainLoopQueue
+{
+public:
+    typedef std::function<void (T&)> Handler;
+
+    MainLoopQueue(GMainContext* context, const Handler& handler) noexcept;
+    ~MainLoopQueue();
+
+    // to call only from single producer thread
+    bool post(T&& item) noexcept;
+
+private:
+    struct Source
+    {
+        GSource source;
+        MainLoopQueue* queue;
+    };
+
+    static gboolean prepare(GSource*, gint* timeout);
+    static gboolean check(GSource*);
+    static gboolean dispatch(GSource*, GSourceFunc, gpointer);
+
+    static GSourceFuncs SourceFuncs;
+
+private:
+    GMainContext *const _context;
+    const Handler _handler;
+
+    SpscQueue<T, Capacity> _queue;
+    GSource* _source;
+};
+
+template<typename T, size_t Capacity>
+GSourceFuncs MainLoopQueue<T, Capacity>::SourceFuncs = {
+    MainLoopQueue::prepare,
+    MainLoopQueue::check,
+    MainLoopQueue::dispatch,
+    nullptr,
+    nullptr,
+    nullptr,
+};
+
+template<typename T, size_t Capacity>
+MainLoopQueue<T, Capacity>::MainLoopQueue(GMainContext* context, const Handler& handler) noexcept :
+    _context(context ? context : g_main_context_default()),
+    _handler(handler),
+    _source(g_source_new(&SourceFuncs, sizeof(Source)))
+{
+    reinterpret_cast<Source*>(_source)->queue = this;
+    g_source_attach(_source, _context);
+}
+
+template<typename T, size_t Capacity>
+MainLoopQueue<T, Capacity>::~MainLoopQueue()
+{
+    g_source_destroy(_source);
+    g_source_unref(_source);
+}
+
+template<typename T, size_t Capacity>
+bool MainLoopQueue<T, Capacity>::post(T&& item) noexcept
+{
+    if(!_queue.push(std::move(item)))
+        return false;
+
+    g_main_context_wakeup(_context);
+
+    return true;
+}
+
+template<typename T, size_t Capacity>
+gboolean MainLoopQueue<T, Capacity>::prepare(GSource* source, gint* timeout)
+{
+    *timeout = -1;
+
+    return !reinterpret_cast<Source*>(source)->queue->_queue.empty();
+}
+
+template<typename T, size_t Capacity>
+gboolean MainLoopQueue<T, Capacity>::check(GSource* source)
+{
+    return !reinterpret_cast<Source*>(source)->queue->_queue.empty();
+}
+
+template<typename T, size_t Capacity>
+gboolean MainLoopQueue<T, Capacity>::dispatch(GSource* source, GSourceFunc, gpointer)
+{
+    MainLoopQueue* self = reinterpret_cast<Source*>(source)->queue;
+
+    T item;
+    while(self->_queue.pop(&item))
+        self->_handler(item);
+
+    return G_SOURCE_CONTINUE;
+}
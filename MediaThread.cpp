@@ -0,0 +1,60 @@
+#include "MediaThread.h"
+
+
+MediaThread::MediaThread() noexcept :
+    _log(MonitorLog()),
+    _contextPtr(g_main_context_new()),
+    _loopPtr(g_main_loop_new(_contextPtr.get(), FALSE))
+{
+    auto runTask = [] (Task& task) { if(task) task(); };
+
+    _commandQueue = std::make_unique<MainLoopQueue<Task, QueueCapacity>>(_contextPtr.get(), runTask);
+    _eventQueue = std::make_unique<MainLoopQueue<Task, QueueCapacity>>(g_main_context_get_thread_default(), runTask);
+
+    _thread = std::thread(&MediaThread::threadFunc, this);
+}
+
+MediaThread::~MediaThread()
+{
+    // commands are run in order, so quit is the last one
+    GMainLoop* loop = _loopPtr.get();
+    while(!_commandQueue->post([loop] () { g_main_loop_quit(loop); }))
+        std::this_thread::yield();
+
+    _thread.join();
+
+    _commandQueue.reset();
+    _eventQueue.reset();
+}
+
+bool MediaThread::post(Task&& task) noexcept
+{
+    if(!_commandQueue->post(std::move(task))) {
+        _log->error("Media thread command queue is full. Command is dropped");
+        return false;
+    }
+
+    return true;
+}
+
+bool MediaThread::postEvent(Task&& task) noexcept
+{
+    if(!_eventQueue->post(std::move(task))) {
+        _log->error("Media thread event queue is full. Event is dropped");
+        return false;
+    }
+
+    return true;
+}
+
+void MediaThread::threadFunc() noexcept
+{
+    GMainContext* context = _contextPtr.get();
+
+    g_main_context_push_thread_default(context);
+    _log->info("Media thread started");
+
+    g_main_loop_run(_loopPtr.get());
+
+    g_main_context_pop_thread_default(context);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include <glib.h>
+
+#include <CxxPtr/GlibPtr.h>
+
+#include "Log.h"
+#include "MainLoopQueue.h"
+
+
+// Thread with its own GMainContext to run pipelines and their bus watches,
+// so slow signalling/SOAP handling on main loop doesn't delay them.
+// Objects created by commands get media context as thread default
+// and should be used and destroyed only by following commands.
+class MediaThread
+{
+public:
+    typedef std::function<void ()> Task;
+
+    // has to be created on the thread running main loop
+    MediaThread() noexcept;
+    // runs already posted commands before exit
+    ~MediaThread();
+
+    // to call only from main thread, task is run on media thread
+    bool post(Task&&) noexcept;
+    // to call only from media thread, task is run on main thread
+    bool postEvent(Task&&) noexcept;
+
+private:
+    void threadFunc() noexcept;
+
+private:
+    static constexpr size_t QueueCapacity = 64;
+
+    const std::shared_ptr<spdlog::logger> _log;
+
+    GMainContextPtr _contextPtr;
+    GMainLoopPtr _loopPtr;
+    std::unique_ptr<MainLoopQueue<Task, QueueCapacity>> _commandQueue; // consumed on media thread
+    std::unique_ptr<MainLoopQueue<Task, QueueCapacity>> _eventQueue; // consumed on main thread
+
+    std::thread _thread;
+};
@@ -0,0 +1,108 @@
+#include "Metrics.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <glib.h>
+
+#include <CxxPtr/GlibPtr.h>
+
+
+namespace {
+
+struct MetricFamily
+{
+    MetricType type;
+    std::string help;
+    std::list<std::pair<MetricLabels, std::unique_ptr<MetricValue>>> metrics;
+};
+
+std::mutex RegistryMutex;
+std::map<std::string, MetricFamily> Registry;
+
+void AppendLabelValue(std::string* out, const std::string& value)
+{
+    for(const char c: value) {
+        switch(c) {
+        case '\\':
+            *out += "\\\\";
+            break;
+        case '"':
+            *out += "\\\"";
+            break;
+        case '\n':
+            *out += "\\n";
+            break;
+        default:
+            *out += c;
+        }
+    }
+}
+
+}
+
+MetricValue* RegisterMetric(
+    MetricType type,
+    const std::string& name,
+    const char* help,
+    const MetricLabels& labels) noexcept
+{
+    std::lock_guard<std::mutex> lock(RegistryMutex);
+
+    auto familyIt = Registry.find(name);
+    if(familyIt == Registry.end())
+        familyIt = Registry.emplace(name, MetricFamily { type, help, {} }).first;
+
+    MetricFamily& family = familyIt->second;
+    for(auto& [metricLabels, value]: family.metrics) {
+        if(metricLabels == labels)
+            return value.get();
+    }
+
+    family.metrics.emplace_back(labels, std::make_unique<MetricValue>());
+
+    return family.metrics.back().second.get();
+}
+
+std::string RenderMetrics() noexcept
+{
+    std::lock_guard<std::mutex> lock(RegistryMutex);
+
+    std::string out;
+    for(const auto& [name, family]: Registry) {
+        out += "# HELP " + name + " " + family.help + "\n";
+        out += "# TYPE " + name + (family.type == MetricType::Counter ? " counter\n" : " gauge\n");
+
+        for(const auto& [labels, value]: family.metrics) {
+            out += name;
+            if(!labels.empty()) {
+                out += '{';
+                for(size_t i = 0; i < labels.size(); ++i) {
+                    if(i > 0)
+                        out += ',';
+                    out += labels[i].first + "=\"";
+                    AppendLabelValue(&out, labels[i].second);
+                    out += '"';
+                }
+                out += '}';
+            }
+            out += ' ' + std::to_string(value->get()) + '\n';
+        }
+    }
+
+    return out;
+}
+
+std::string MetricsUrlLabel(const std::string& url) noexcept
+{
+    GUri* uri = g_uri_parse(url.c_str(), G_URI_FLAGS_NONE, nullptr);
+    if(!uri)
+        return std::string();
+
+    GCharPtr labelPtr(g_uri_to_string_partial(uri, G_URI_HIDE_USERINFO));
+    g_uri_unref(uri);
+
+    return labelPtr.get();
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// Process wide metrics rendered in Prometheus text exposition format.
+// Registered metrics are never destroyed, so pointers to them could be kept forever,
+// and their updates are relaxed atomic operations safe to do from streaming threads.
+
+enum class MetricType {
+    Counter,
+    Gauge,
+};
+
+typedef std::vector<std::pair<std::string, std::string>> MetricLabels;
+
+class MetricValue
+{
+public:
+    void add(int64_t delta = 1) noexcept { _value.fetch_add(delta, std::memory_order_relaxed); }
+    void set(int64_t value) noexcept { _value.store(value, std::memory_order_relaxed); }
+    int64_t get() const noexcept { return _value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> _value = 0;
+};
+
+// returns the same metric for the same name and labels,
+// so it's cheap only relatively to network round trip - keep returned pointer
+MetricValue* RegisterMetric(
+    MetricType,
+    const std::string& name,
+    const char* help,
+    const MetricLabels& = {}) noexcept;
+
+std::string RenderMetrics() noexcept;
+
+// url without user info to be used as label value
+std::string MetricsUrlLabel(const std::string& url) noexcept;
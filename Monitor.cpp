@@ -10,20 +10,27 @@
 #include "RtStreaming/GstRtStreaming/GstStreamingSource.h"
 
 #include "Log.h"
+#include "HttpListener.h"
+#include "MediaThread.h"
+#include "Metrics.h"
 #include "RecordSession.h"
 #include "Session.h"
 #include "UrlPlayer.h"
 #include "OnvifPlayer.h"
+#include "MosaicPlayer.h"
+#include "MotionSwitcher.h"
+#include "PlayerWorker.h"
+#include "OnvifSession.h"
+#include "ReconnectScheduler.h"
+#include "StageTiming.h"
+#include "Startup.h"
+#include "ThreadPolicy.h"
+#include "VideoSink.h"
 
 
 static const auto Log = MonitorLog;
 typedef std::map<std::string, std::unique_ptr<GstStreamingSource>> MountPoints;
 
-enum {
-    MIN_RECONNECT_TIMEOUT = 3, // seconds
-    MAX_RECONNECT_TIMEOUT = 10, // seconds
-};
-
 static std::unique_ptr<WebRTCPeer>
 CreatePeer(
     const Config* config,
@@ -42,6 +49,44 @@ CreateRecordPeer(
         config->videoOutput.sync);
 }
 
+// imitates slow signalling callbacks blocking main loop
+static GSourcePtr StartSignallingLoad(std::chrono::milliseconds busyTime)
+{
+    constexpr std::chrono::milliseconds SignallingLoadPeriod = std::chrono::milliseconds(100);
+
+    Log()->warn(
+        "Synthetic signalling load: main loop is busy {} ms every {} ms",
+        busyTime.count(),
+        SignallingLoadPeriod.count());
+
+    GSourcePtr timeoutSourcePtr(g_timeout_source_new(SignallingLoadPeriod.count()));
+    GSource* timeoutSource = timeoutSourcePtr.get();
+    g_source_set_callback(
+        timeoutSource,
+        [] (gpointer userData) -> gboolean {
+            const gint64 busyTime = GPOINTER_TO_INT(userData) * G_TIME_SPAN_MILLISECOND;
+            const gint64 startTime = g_get_monotonic_time();
+            while(g_get_monotonic_time() - startTime < busyTime);
+            return G_SOURCE_CONTINUE;
+        },
+        GINT_TO_POINTER(busyTime.count()),
+        nullptr);
+    g_source_attach(timeoutSource, g_main_context_get_thread_default());
+
+    return timeoutSourcePtr;
+}
+
+// has to be called before anything using GStreamer
+static void StartMedia(const Config& config)
+{
+    WaitGstInit();
+
+    SetVideoOutputBackend(config.videoOutput);
+
+    if(config.stageTiming)
+        StartStageTiming(config.stageTimingInterval, config.stageTimingFile);
+}
+
 static void OnRecorderConnected(const std::string& uri)
 {
     Log()->info("Recorder connected to \"{}\" streamer", uri);
@@ -61,80 +106,6 @@ CreateClientPeer(const Config* config)
         config->videoOutput.sync);
 }
 
-GSourcePtr reconnectTimeoutSourcePtr;
-
-static void ClientDisconnected(WsClient& client)
-{
-    if(reconnectTimeoutSourcePtr) {
-        Log()->warn("Trying to create new reconnect timout source while previous one is still active");
-        return;
-    }
-
-    const unsigned reconnectTimeout =
-        g_random_int_range(MIN_RECONNECT_TIMEOUT, MAX_RECONNECT_TIMEOUT + 1);
-    Log()->info("Scheduling reconnect within {} seconds...", reconnectTimeout);
-    reconnectTimeoutSourcePtr.reset(g_timeout_source_new_seconds(reconnectTimeout));
-    GSource* timeoutSource = reconnectTimeoutSourcePtr.get();
-    g_source_set_callback(timeoutSource,
-        [] (gpointer userData) -> gboolean {
-            reconnectTimeoutSourcePtr.reset();
-            static_cast<WsClient*>(userData)->connect();
-            return false;
-        }, &client, nullptr);
-    g_source_attach(timeoutSource, g_main_context_get_thread_default());
-}
-
-static void onUrlPlayerEos(UrlPlayer& player, const std::string& url)
-{
-    if(reconnectTimeoutSourcePtr) {
-        Log()->warn("Trying to create new reconnect timout source while previous one is still active");
-        return;
-    }
-
-    struct Data {
-        UrlPlayer *const  player;
-        const std::string url;
-    };
-
-    const unsigned reconnectTimeout =
-        g_random_int_range(MIN_RECONNECT_TIMEOUT, MAX_RECONNECT_TIMEOUT + 1);
-    Log()->info("Scheduling playback restart within {} seconds...", reconnectTimeout);
-    reconnectTimeoutSourcePtr.reset(g_timeout_source_new_seconds(reconnectTimeout));
-    GSource* timeoutSource = reconnectTimeoutSourcePtr.get();
-    g_source_set_callback(
-        timeoutSource,
-        [] (gpointer userData) -> gboolean {
-            reconnectTimeoutSourcePtr.reset();
-            Data* data = static_cast<Data*>(userData);
-            data->player->play(data->url);
-            return false;
-        },
-        new Data { &player, url },
-        [] (gpointer userData) { delete static_cast<Data*>(userData); });
-    g_source_attach(timeoutSource, g_main_context_get_thread_default());
-}
-
-static void onOnvifPlayerEos(OnvifPlayer& player)
-{
-    if(reconnectTimeoutSourcePtr) {
-        Log()->warn("Trying to create new reconnect timout source while previous one is still active");
-        return;
-    }
-
-    const unsigned reconnectTimeout =
-        g_random_int_range(MIN_RECONNECT_TIMEOUT, MAX_RECONNECT_TIMEOUT + 1);
-    Log()->info("Scheduling playback restart within {} seconds...", reconnectTimeout);
-    reconnectTimeoutSourcePtr.reset(g_timeout_source_new_seconds(reconnectTimeout));
-    GSource* timeoutSource = reconnectTimeoutSourcePtr.get();
-    g_source_set_callback(timeoutSource,
-        [] (gpointer userData) -> gboolean {
-            reconnectTimeoutSourcePtr.reset();
-            static_cast<OnvifPlayer*>(userData)->play();
-            return false;
-        }, &player, nullptr);
-    g_source_attach(timeoutSource, g_main_context_get_thread_default());
-}
-
 namespace {
 
 struct ServerSessionFactory: public WsServer::SessionFactory
@@ -164,12 +135,16 @@ private:
 
 struct ClientSessionFactory: public WsClient::SessionFactory
 {
-    ClientSessionFactory(const Config* config) : config(config) {}
+    ClientSessionFactory(const Config* config, ReconnectScheduler* reconnectScheduler) :
+        config(config), reconnectScheduler(reconnectScheduler) {}
 
     std::unique_ptr<rtsp::Session> createSession(
         const rtsp::Session::SendRequest& sendRequest,
         const rtsp::Session::SendResponse& sendResponse) noexcept override
     {
+        // session is created only for established connection
+        reconnectScheduler->onSuccess();
+
         return std::make_unique<Session>(
             config,
             [config = config] () {
@@ -181,13 +156,14 @@ struct ClientSessionFactory: public WsClient::SessionFactory
 
 private:
     const Config *const config;
+    ReconnectScheduler *const reconnectScheduler;
 };
 
 }
 
 int MonitorMain(const Config& config)
 {
-    if(!config.source)
+    if(!config.source && config.sources.empty() && config.motionSwitch.cameras.empty())
         return -1;
 
     GMainContextPtr contextPtr(g_main_context_new());
@@ -197,7 +173,61 @@ int MonitorMain(const Config& config)
     GMainLoopPtr loopPtr(g_main_loop_new(context, FALSE));
     GMainLoop* loop = loopPtr.get();
 
-    if(config.source->type == StreamSource::Type::WebRTSP) {
+    StartThreadPolicy(config.threadPolicy);
+
+    HttpListener metricsListener(
+        [] (const HttpListener::Request& request) -> HttpListener::Response {
+            if(request.method != "GET")
+                return { .status = 405 };
+            if(request.path != "/metrics")
+                return { .status = 404 };
+
+            return {
+                .contentType = "text/plain; version=0.0.4",
+                .body = RenderMetrics(),
+            };
+        });
+    if(config.metricsPort && !metricsListener.listen(config.metricsPort, config.metricsLoopbackOnly))
+        Log()->error("Failed to start metrics endpoint on port {}", config.metricsPort);
+
+    GSourcePtr signallingLoadSourcePtr;
+    if(config.signallingLoad.count() > 0)
+        signallingLoadSourcePtr = StartSignallingLoad(config.signallingLoad);
+
+    // ONVIF discovery doesn't need GStreamer, so it's started first,
+    // unless OnvifPlayer has to create pre-motion buffer (GstBufferPool) in constructor
+    const bool overlapGstInit =
+        config.source &&
+        config.source->type == StreamSource::Type::Onvif &&
+        !(config.source->trackMotion && config.source->preMotionBuffer.count() > 0);
+    if(!overlapGstInit)
+        StartMedia(config);
+
+    if(!config.source && !config.motionSwitch.cameras.empty()) {
+        MotionSwitcher switcher(config.motionSwitch, config.videoOutput);
+        switcher.start();
+
+        g_main_loop_run(loop);
+        return 0;
+    } else if(!config.source && config.videoOutput.mediaThread) {
+        std::unique_ptr<MosaicPlayer> player; // to use only on media thread
+        MediaThread mediaThread;
+        mediaThread.post([&player, &config] () {
+            player = std::make_unique<MosaicPlayer>(config.sources, config.videoOutput);
+            player->play();
+        });
+
+        g_main_loop_run(loop);
+
+        mediaThread.post([&player] () { player.reset(); });
+        return 0;
+    } else if(!config.source) {
+        MosaicPlayer player(config.sources, config.videoOutput);
+        player.play();
+
+        g_main_loop_run(loop);
+        return 0;
+    } else if(config.source->type == StreamSource::Type::WebRTSP) {
         if(config.source->localServer) {
             lws_context_creation_info lwsInfo {};
             lwsInfo.gid = -1;
@@ -222,12 +252,14 @@ int MonitorMain(const Config& config)
                 return 0;
             }
         } else if(config.source->client) {
-            ClientSessionFactory sessionFactory(&config);
+            ReconnectScheduler reconnectScheduler("client");
+            ClientSessionFactory sessionFactory(&config, &reconnectScheduler);
 
             WsClient client(
                 config.source->client.value(),
                 &sessionFactory,
-                ClientDisconnected);
+                [&reconnectScheduler] (WsClient&) { reconnectScheduler.onFailure(); });
+            reconnectScheduler.setReconnectCallback([&client] () { client.connect(); });
 
             if(client.init(loop)) {
                 client.connect();
@@ -235,72 +267,96 @@ int MonitorMain(const Config& config)
                 return 0;
             }
         }
+    } else if(config.source->type == StreamSource::Type::Url && config.playerWorker.enabled) {
+        ReconnectScheduler reconnectScheduler("url");
+        PlayerWorkerSupervisor supervisor(
+            config.playerWorker,
+            [&reconnectScheduler] () { reconnectScheduler.onFailure(); },
+            [&reconnectScheduler] () { reconnectScheduler.onSuccess(); });
+        reconnectScheduler.setReconnectCallback(
+            [&supervisor, &source = config.source.value()] () {
+                supervisor.play(source.uri, source.substreamUri);
+            });
+        supervisor.play(config.source->uri, config.source->substreamUri);
+
+        g_main_loop_run(loop);
+        return 0;
+    } else if(config.source->type == StreamSource::Type::Url && config.videoOutput.mediaThread) {
+        // reconnect decisions stay on main loop,
+        // player gets commands and reports events through media thread queues
+        ReconnectScheduler reconnectScheduler("url");
+        std::unique_ptr<UrlPlayer> player; // to use only on media thread
+        MediaThread mediaThread;
+        const StreamSource& source = config.source.value();
+
+        mediaThread.post([&player, &mediaThread, &reconnectScheduler, &config, &source] () {
+            player = std::make_unique<UrlPlayer>(
+                config.videoOutput.showStats,
+                config.videoOutput.sync,
+                [&mediaThread, &reconnectScheduler] (UrlPlayer&) {
+                    mediaThread.postEvent([&reconnectScheduler] () { reconnectScheduler.onFailure(); });
+                });
+            player->setLeanRtspPipeline(source.leanPipeline, source.rtspLatency);
+            player->setStallTimeout(config.videoOutput.stallTimeout);
+            player->setLatencyControl(config.videoOutput.latencyTarget, config.videoOutput.maxCatchUpRate);
+            player->setDecodeDegradation(config.videoOutput.decodeDegradation, config.videoOutput.degradedFramerate);
+            player->setPersistentSink(config.videoOutput.persistentSink);
+            player->setFirstFrameCallback(
+                [&mediaThread, &reconnectScheduler] (UrlPlayer&) {
+                    mediaThread.postEvent([&reconnectScheduler] () { reconnectScheduler.onSuccess(); });
+                });
+            player->play(source.uri, source.substreamUri);
+        });
+        reconnectScheduler.setReconnectCallback(
+            [&player, &mediaThread, &source] () {
+                mediaThread.post([&player, &source] () { player->play(source.uri, source.substreamUri); });
+            });
+
+        g_main_loop_run(loop);
+
+        mediaThread.post([&player] () { player.reset(); });
+        return 0;
     } else if(config.source->type == StreamSource::Type::Url) {
+        ReconnectScheduler reconnectScheduler("url");
         UrlPlayer player(
             config.videoOutput.showStats,
             config.videoOutput.sync,
-            std::bind(
-                onUrlPlayerEos,
-                std::placeholders::_1,
-                config.source->uri));
-        player.play(config.source->uri);
+            [&reconnectScheduler] (UrlPlayer&) { reconnectScheduler.onFailure(); });
+        player.setLeanRtspPipeline(config.source->leanPipeline, config.source->rtspLatency);
+        player.setStallTimeout(config.videoOutput.stallTimeout);
+        player.setLatencyControl(config.videoOutput.latencyTarget, config.videoOutput.maxCatchUpRate);
+        player.setDecodeDegradation(config.videoOutput.decodeDegradation, config.videoOutput.degradedFramerate);
+        player.setPersistentSink(config.videoOutput.persistentSink);
+        player.setFirstFrameCallback([&reconnectScheduler] (UrlPlayer&) { reconnectScheduler.onSuccess(); });
+        reconnectScheduler.setReconnectCallback(
+            [&player, &source = config.source.value()] () {
+                player.play(source.uri, source.substreamUri);
+            });
+        player.play(config.source->uri, config.source->substreamUri);
 
         g_main_loop_run(loop);
         return 0;
     } else if(config.source->type == StreamSource::Type::Onvif) {
-        gchar *scheme;
-        gchar *user;
-        gchar *password;
-        gchar *authParams;
-        gchar *host;
-        gint port;
-        gchar *path;
-        gchar *query;
-        gchar *fragment;
-        if(g_uri_split_with_user(
-            config.source->uri.c_str(),
-            G_URI_FLAGS_HAS_PASSWORD,
-            &scheme,
-            &user,
-            &password,
-            &authParams,
-            &host,
-            &port,
-            &path,
-            &query,
-            &fragment,
-            nullptr))
-        {
-            GCharPtr schemePtr(scheme);
-            GCharPtr userPtr(user);
-            GCharPtr passwordPtr(password);
-            GCharPtr authParamsPtr(authParams);
-            GCharPtr hostPtr(host);
-            GCharPtr pathPtr(path);
-            GCharPtr queryPtr(query);
-            GCharPtr fragmentPtr(fragment);
-            GCharPtr urlPtr(
-                g_uri_join(
-                    G_URI_FLAGS_NONE,
-                    scheme,
-                    nullptr, // userinfo
-                    host,
-                    port,
-                    path,
-                    query,
-                    fragment));
-
+        std::string deviceUrl;
+        std::optional<std::string> username;
+        std::optional<std::string> password;
+        if(SplitOnvifUrl(config.source->uri, &deviceUrl, &username, &password)) {
+            ReconnectScheduler reconnectScheduler("onvif");
             OnvifPlayer player(
-                urlPtr.get(),
-                userPtr ? std::optional<std::string>(userPtr.get()) : std::optional<std::string>(),
-                passwordPtr ? std::optional<std::string>(passwordPtr.get()) : std::optional<std::string>(),
-                config.source->trackMotion,
-                config.source->motionPreviewDuration,
-                config.videoOutput.showStats,
-                config.videoOutput.sync,
-                onOnvifPlayerEos);
+                deviceUrl,
+                username,
+                password,
+                config.source.value(),
+                config.videoOutput,
+                [&reconnectScheduler] (OnvifPlayer&) { reconnectScheduler.onFailure(); });
+            player.setConnectedCallback([&reconnectScheduler] (OnvifPlayer&) { reconnectScheduler.onSuccess(); });
+            reconnectScheduler.setReconnectCallback([&player] () { player.play(); });
             player.play();
 
+            // playback is started from main loop
+            if(overlapGstInit)
+                StartMedia(config);
+
             g_main_loop_run(loop);
             return 0;
         }
@@ -0,0 +1,520 @@
+#include "MosaicPlayer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <gst/gst.h>
+
+#include <CxxPtr/GlibPtr.h>
+#include <CxxPtr/GstPtr.h>
+
+#include "Log.h"
+#include "ProcessStats.h"
+#include "StageTiming.h"
+#include "ThreadPolicy.h"
+#include "VideoSink.h"
+#include "VideoSourceBin.h"
+
+
+namespace {
+
+const char *const TileUpMessageName = "tile-up";
+const char *const TileEosMessageName = "tile-eos";
+
+const gint BackgroundFrameRate = 25;
+
+enum {
+    MIN_TILE_RECONNECT_TIMEOUT = 3, // seconds
+    MAX_TILE_RECONNECT_TIMEOUT = 30, // seconds
+    RESTART_TIMEOUT = 5, // seconds
+    STATS_INTERVAL = 60, // seconds
+};
+
+}
+
+struct MosaicPlayer::Private
+{
+    struct Tile
+    {
+        std::string url;
+        gint x;
+        gint y;
+        gint width;
+        gint height;
+
+        GstElement* bin = nullptr; // owned by pipeline
+        GstPadPtr compositorPadPtr;
+        GSourcePtr reconnectTimeoutSourcePtr;
+        unsigned failures = 0;
+        bool up = false;
+    };
+
+    Private(
+        const std::vector<StreamSource>& sources,
+        const VideoOutput& videoOutput) noexcept;
+
+    bool createPipeline() noexcept;
+    bool startTile(Tile&) noexcept;
+    void stopTile(Tile&) noexcept;
+    void onTileDown(Tile&, const char* reason) noexcept;
+    void scheduleTileReconnect(Tile&) noexcept;
+    void scheduleRestart() noexcept;
+    void startStatsTimer() noexcept;
+    void logStats() noexcept;
+
+    Tile* findTile(GstObject*) noexcept;
+    bool isDetached(GstObject*) const noexcept;
+    gboolean onBusMessage(GstMessage*) noexcept;
+
+    MosaicPlayer* owner;
+
+    const std::shared_ptr<spdlog::logger> log;
+    const bool showVideoStats;
+    const bool sync;
+    const gint width;
+    const gint height;
+
+    std::vector<Tile> tiles;
+
+    GstElementPtr pipelinePtr;
+    GstElement* compositor = nullptr; // owned by pipeline
+
+    GSourcePtr restartTimeoutSourcePtr;
+    GSourcePtr statsTimeoutSourcePtr;
+    std::chrono::steady_clock::time_point statsTime;
+    std::chrono::microseconds statsCpuTime;
+};
+
+MosaicPlayer::Private::Private(
+    const std::vector<StreamSource>& sources,
+    const VideoOutput& videoOutput) noexcept :
+    log(MonitorLog()),
+    showVideoStats(videoOutput.showStats),
+    sync(videoOutput.sync),
+    width(videoOutput.mosaicWidth),
+    height(videoOutput.mosaicHeight)
+{
+    const size_t count = sources.size();
+    const gint columns = std::max<gint>(1, std::ceil(std::sqrt(count)));
+    const gint rows = std::max<gint>(1, (count + columns - 1) / columns);
+    const gint tileWidth = width / columns;
+    const gint tileHeight = height / rows;
+
+    tiles.resize(count);
+    for(size_t i = 0; i < count; ++i) {
+        Tile& tile = tiles[i];
+        tile.url = sources[i].uri;
+        tile.x = (i % columns) * tileWidth;
+        tile.y = (i / columns) * tileHeight;
+        tile.width = tileWidth;
+        tile.height = tileHeight;
+    }
+
+    log->info("Mosaic of {} tiles in {}x{} grid, {}x{} each", count, columns, rows, tileWidth, tileHeight);
+}
+
+bool MosaicPlayer::Private::createPipeline() noexcept
+{
+    GstElementPtr pipelinePtr(gst_pipeline_new(nullptr));
+    GstElement* pipeline = pipelinePtr.get();
+    if(!pipeline) {
+        log->error("Failed to create pipeline element");
+        return false;
+    }
+
+    // live background keeps compositor producing frames even if all tiles are down
+    GstElement* background = gst_element_factory_make("videotestsrc", nullptr);
+    GstElement* backgroundFilter = gst_element_factory_make("capsfilter", nullptr);
+    GstElement* compositor = gst_element_factory_make("compositor", nullptr);
+    GstElement* convert = gst_element_factory_make("videoconvert", nullptr);
+    GstElement* sink = CreateVideoSink(showVideoStats, sync).release();
+    if(!background || !backgroundFilter || !compositor || !convert || !sink) {
+        log->error("Failed to create mosaic pipeline elements");
+        if(background) gst_object_unref(background);
+        if(backgroundFilter) gst_object_unref(backgroundFilter);
+        if(compositor) gst_object_unref(compositor);
+        if(convert) gst_object_unref(convert);
+        if(sink) gst_object_unref(sink);
+        return false;
+    }
+
+    gst_util_set_object_arg(G_OBJECT(background), "pattern", "black");
+    g_object_set(background, "is-live", TRUE, nullptr);
+
+    GstCaps* backgroundCaps =
+        gst_caps_new_simple(
+            "video/x-raw",
+            "width", G_TYPE_INT, width,
+            "height", G_TYPE_INT, height,
+            "framerate", GST_TYPE_FRACTION, BackgroundFrameRate, 1,
+            nullptr);
+    g_object_set(backgroundFilter, "caps", backgroundCaps, nullptr);
+    gst_caps_unref(backgroundCaps);
+
+    gst_bin_add_many(GST_BIN(pipeline), background, backgroundFilter, compositor, convert, sink, nullptr);
+    if(
+        !gst_element_link_many(background, backgroundFilter, compositor, nullptr) ||
+        !gst_element_link_many(compositor, convert, sink, nullptr))
+    {
+        log->error("Failed to link mosaic pipeline");
+        return false;
+    }
+
+    auto onBusMessageCallback =
+        + [] (GstBus* bus, GstMessage* message, gpointer userData) -> gboolean
+    {
+        return static_cast<Private*>(userData)->onBusMessage(message);
+    };
+    GstBusPtr busPtr(gst_pipeline_get_bus(GST_PIPELINE(pipeline)));
+    gst_bus_add_watch(busPtr.get(), onBusMessageCallback, this);
+
+    InstrumentPipeline(pipeline);
+    ApplyThreadPolicy(pipeline);
+
+    this->pipelinePtr.swap(pipelinePtr);
+    this->compositor = compositor;
+
+    return true;
+}
+
+bool MosaicPlayer::Private::startTile(Tile& tile) noexcept
+{
+    GstElement* pipeline = pipelinePtr.get();
+
+    GstElement* bin = CreateVideoSourceBin(tile.url);
+    if(!bin)
+        return false;
+    gst_bin_add(GST_BIN(pipeline), bin);
+
+    GstPadPtr compositorPadPtr(gst_element_request_pad_simple(compositor, "sink_%u"));
+    GstPad* compositorPad = compositorPadPtr.get();
+    g_object_set(
+        compositorPad,
+        "xpos", tile.x,
+        "ypos", tile.y,
+        "width", tile.width,
+        "height", tile.height,
+        "zorder", 1u,
+        "alpha", 0.0, // until first frame
+        nullptr);
+    if(g_object_class_find_property(G_OBJECT_GET_CLASS(compositorPad), "sizing-policy"))
+        gst_util_set_object_arg(G_OBJECT(compositorPad), "sizing-policy", "keep-aspect-ratio");
+
+    GstPadPtr srcPadPtr(gst_element_get_static_pad(bin, "src"));
+    GstPad* srcPad = srcPadPtr.get();
+    if(gst_pad_link(srcPad, compositorPad) != GST_PAD_LINK_OK) {
+        log->error("Failed to link tile of \"{}\"", tile.url);
+        gst_element_release_request_pad(compositor, compositorPad);
+        gst_bin_remove(GST_BIN(pipeline), bin);
+        return false;
+    }
+
+    auto firstBufferCallback =
+        [] (GstPad* pad, GstPadProbeInfo* info, gpointer userData) -> GstPadProbeReturn {
+            GstElement* bin = gst_pad_get_parent_element(pad);
+            if(bin) {
+                gst_element_post_message(
+                    bin,
+                    gst_message_new_application(
+                        GST_OBJECT(bin),
+                        gst_structure_new_empty(TileUpMessageName)));
+                gst_object_unref(bin);
+            }
+
+            return GST_PAD_PROBE_REMOVE;
+        };
+    gst_pad_add_probe(srcPad, GST_PAD_PROBE_TYPE_BUFFER, firstBufferCallback, nullptr, nullptr);
+
+    // EOS of single tile should not finish whole mosaic
+    auto eosCallback =
+        [] (GstPad* pad, GstPadProbeInfo* info, gpointer userData) -> GstPadProbeReturn {
+            GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+            if(GST_EVENT_TYPE(event) != GST_EVENT_EOS)
+                return GST_PAD_PROBE_OK;
+
+            GstElement* bin = gst_pad_get_parent_element(pad);
+            if(bin) {
+                gst_element_post_message(
+                    bin,
+                    gst_message_new_application(
+                        GST_OBJECT(bin),
+                        gst_structure_new_empty(TileEosMessageName)));
+                gst_object_unref(bin);
+            }
+
+            return GST_PAD_PROBE_DROP;
+        };
+    gst_pad_add_probe(srcPad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, eosCallback, nullptr, nullptr);
+
+    tile.bin = bin;
+    tile.compositorPadPtr.swap(compositorPadPtr);
+
+    gst_element_sync_state_with_parent(bin);
+
+    return true;
+}
+
+void MosaicPlayer::Private::stopTile(Tile& tile) noexcept
+{
+    tile.up = false;
+
+    if(!tile.bin)
+        return;
+
+    GstElement* bin = tile.bin;
+    tile.bin = nullptr;
+
+    gst_element_set_locked_state(bin, TRUE);
+    gst_element_set_state(bin, GST_STATE_NULL);
+    gst_bin_remove(GST_BIN(pipelinePtr.get()), bin);
+
+    gst_element_release_request_pad(compositor, tile.compositorPadPtr.get());
+    tile.compositorPadPtr.reset();
+}
+
+void MosaicPlayer::Private::onTileDown(Tile& tile, const char* reason) noexcept
+{
+    log->warn("Tile of \"{}\" is down: {}", tile.url, reason);
+
+    stopTile(tile);
+    ++tile.failures;
+    scheduleTileReconnect(tile);
+}
+
+void MosaicPlayer::Private::scheduleTileReconnect(Tile& tile) noexcept
+{
+    if(tile.reconnectTimeoutSourcePtr)
+        return;
+
+    const unsigned timeout =
+        std::min<unsigned>(
+            MIN_TILE_RECONNECT_TIMEOUT << std::min(tile.failures, 4u),
+            MAX_TILE_RECONNECT_TIMEOUT);
+    log->info("Scheduling reconnect of \"{}\" within {} seconds...", tile.url, timeout);
+
+    struct Data {
+        Private* self;
+        Tile* tile;
+    };
+
+    tile.reconnectTimeoutSourcePtr.reset(g_timeout_source_new_seconds(timeout));
+    GSource* timeoutSource = tile.reconnectTimeoutSourcePtr.get();
+    g_source_set_callback(
+        timeoutSource,
+        [] (gpointer userData) -> gboolean {
+            Data* data = static_cast<Data*>(userData);
+            Tile& tile = *data->tile;
+            Private* self = data->self;
+
+            tile.reconnectTimeoutSourcePtr.reset();
+            if(!self->startTile(tile)) {
+                ++tile.failures;
+                self->scheduleTileReconnect(tile);
+            }
+
+            return G_SOURCE_REMOVE;
+        },
+        new Data { this, &tile },
+        [] (gpointer userData) { delete static_cast<Data*>(userData); });
+    g_source_attach(timeoutSource, g_main_context_get_thread_default());
+}
+
+void MosaicPlayer::Private::scheduleRestart() noexcept
+{
+    if(restartTimeoutSourcePtr)
+        return;
+
+    log->info("Restarting mosaic within {} seconds...", static_cast<unsigned>(RESTART_TIMEOUT));
+
+    restartTimeoutSourcePtr.reset(g_timeout_source_new_seconds(RESTART_TIMEOUT));
+    GSource* timeoutSource = restartTimeoutSourcePtr.get();
+    g_source_set_callback(
+        timeoutSource,
+        [] (gpointer userData) -> gboolean {
+            Private* self = static_cast<Private*>(userData);
+            self->restartTimeoutSourcePtr.reset();
+            if(!self->owner->play())
+                self->scheduleRestart();
+
+            return G_SOURCE_REMOVE;
+        },
+        this,
+        nullptr);
+    g_source_attach(timeoutSource, g_main_context_get_thread_default());
+}
+
+void MosaicPlayer::Private::startStatsTimer() noexcept
+{
+    statsTime = std::chrono::steady_clock::now();
+    statsCpuTime = ProcessCpuTime();
+
+    statsTimeoutSourcePtr.reset(g_timeout_source_new_seconds(STATS_INTERVAL));
+    GSource* timeoutSource = statsTimeoutSourcePtr.get();
+    g_source_set_callback(
+        timeoutSource,
+        [] (gpointer userData) -> gboolean {
+            static_cast<Private*>(userData)->logStats();
+            return G_SOURCE_CONTINUE;
+        },
+        this,
+        nullptr);
+    g_source_attach(timeoutSource, g_main_context_get_thread_default());
+}
+
+void MosaicPlayer::Private::logStats() noexcept
+{
+    const auto now = std::chrono::steady_clock::now();
+    const std::chrono::microseconds cpuTime = ProcessCpuTime();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - statsTime);
+
+    const size_t tilesUp =
+        std::count_if(tiles.begin(), tiles.end(), [] (const Tile& tile) { return tile.up; });
+
+    log->info(
+        "Mosaic: {} of {} tiles up, CPU: {}%, threads: {}, RSS: {}",
+        tilesUp,
+        tiles.size(),
+        elapsed.count() > 0 ? (cpuTime - statsCpuTime).count() * 100 / elapsed.count() : 0,
+        ProcStatusValue("Threads"),
+        ProcStatusValue("VmRSS"));
+
+    statsTime = now;
+    statsCpuTime = cpuTime;
+}
+
+MosaicPlayer::Private::Tile* MosaicPlayer::Private::findTile(GstObject* object) noexcept
+{
+    for(Tile& tile: tiles) {
+        if(tile.bin && (object == GST_OBJECT(tile.bin) || gst_object_has_as_ancestor(object, GST_OBJECT(tile.bin))))
+            return &tile;
+    }
+
+    return nullptr;
+}
+
+// failed elements could post several errors,
+// and the following ones are dispatched when tile is already removed from pipeline
+bool MosaicPlayer::Private::isDetached(GstObject* object) const noexcept
+{
+    GstObject* pipeline = GST_OBJECT(pipelinePtr.get());
+    return !pipeline || (object != pipeline && !gst_object_has_as_ancestor(object, pipeline));
+}
+
+gboolean MosaicPlayer::Private::onBusMessage(GstMessage* message) noexcept
+{
+    OnBusMessageDispatched(message);
+
+    switch(GST_MESSAGE_TYPE(message)) {
+        case GST_MESSAGE_ERROR: {
+            if(isDetached(GST_MESSAGE_SRC(message)))
+                break; // from already stopped tile
+
+            GError* error = nullptr;
+            gst_message_parse_error(message, &error, nullptr);
+            GErrorPtr errorPtr(error);
+
+            if(Tile* tile = findTile(GST_MESSAGE_SRC(message))) {
+                onTileDown(*tile, error->message);
+                break;
+            }
+
+            log->error("Got error from mosaic pipeline: {}", error->message);
+            owner->stop();
+            scheduleRestart();
+            break;
+        }
+        case GST_MESSAGE_EOS:
+            if(isDetached(GST_MESSAGE_SRC(message)))
+                break; // from already stopped tile
+
+            log->error("Mosaic pipeline got EOS");
+            owner->stop();
+            scheduleRestart();
+            break;
+        case GST_MESSAGE_APPLICATION: {
+            Tile* tile = findTile(GST_MESSAGE_SRC(message));
+            if(!tile)
+                break;
+
+            const GstStructure* structure = gst_message_get_structure(message);
+            if(gst_structure_has_name(structure, TileUpMessageName)) {
+                log->info("Tile of \"{}\" is up", tile->url);
+                tile->up = true;
+                tile->failures = 0;
+                g_object_set(tile->compositorPadPtr.get(), "alpha", 1.0, nullptr);
+            } else if(gst_structure_has_name(structure, TileEosMessageName)) {
+                onTileDown(*tile, "end of stream");
+            }
+            break;
+        }
+        default:
+            break;
+    }
+
+    return TRUE;
+}
+
+MosaicPlayer::MosaicPlayer(
+    const std::vector<StreamSource>& sources,
+    const VideoOutput& videoOutput) noexcept :
+    _p(std::make_unique<Private>(sources, videoOutput))
+{
+    _p->owner = this;
+}
+
+MosaicPlayer::~MosaicPlayer()
+{
+    stop();
+
+    if(_p->restartTimeoutSourcePtr)
+        g_source_destroy(_p->restartTimeoutSourcePtr.get());
+}
+
+bool MosaicPlayer::play() noexcept
+{
+    stop();
+
+    if(!_p->createPipeline())
+        return false;
+
+    for(Private::Tile& tile: _p->tiles) {
+        if(!_p->startTile(tile))
+            _p->scheduleTileReconnect(tile);
+    }
+
+    gst_element_set_state(_p->pipelinePtr.get(), GST_STATE_PLAYING);
+
+    _p->startStatsTimer();
+
+    return true;
+}
+
+void MosaicPlayer::stop() noexcept
+{
+    if(_p->statsTimeoutSourcePtr) {
+        g_source_destroy(_p->statsTimeoutSourcePtr.get());
+        _p->statsTimeoutSourcePtr.reset();
+    }
+
+    for(Private::Tile& tile: _p->tiles) {
+        if(tile.reconnectTimeoutSourcePtr) {
+            g_source_destroy(tile.reconnectTimeoutSourcePtr.get());
+            tile.reconnectTimeoutSourcePtr.reset();
+        }
+        tile.bin = nullptr;
+        tile.up = false;
+        tile.compositorPadPtr.reset();
+    }
+
+    if(!_p->pipelinePtr)
+        return;
+
+    GstElement* pipeline = _p->pipelinePtr.get();
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+
+    GstBusPtr busPtr(gst_pipeline_get_bus(GST_PIPELINE(pipeline)));
+    gst_bus_remove_watch(busPtr.get());
+
+    _p->pipelinePtr.reset();
+    _p->compositor = nullptr;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "Config.h"
+
+
+// Plays every source in its own tile of a grid composed into single video output.
+// Every tile is reconnected independently, tiles without video show background.
+class MosaicPlayer
+{
+public:
+    MosaicPlayer(
+        const std::vector<StreamSource>& sources,
+        const VideoOutput& videoOutput) noexcept;
+    ~MosaicPlayer();
+
+    bool play() noexcept;
+    void stop() noexcept;
+
+private:
+    struct Private;
+    std::unique_ptr<Private> _p;
+};
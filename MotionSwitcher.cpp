@@ -0,0 +1,322 @@
+#include "MotionSwitcher.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+
+#include <CxxPtr/GlibPtr.h>
+
+#include "Log.h"
+#include "OnvifPlayer.h"
+#include "OnvifSession.h"
+#include "ReconnectScheduler.h"
+#include "UrlPlayer.h"
+
+
+namespace {
+
+constexpr std::chrono::seconds HousekeepingInterval = std::chrono::seconds(10);
+constexpr std::chrono::seconds PlayerRestartTimeout = std::chrono::seconds(5);
+
+}
+
+struct MotionSwitcher::Private
+{
+    typedef std::chrono::steady_clock Clock;
+
+    static constexpr size_t None = SIZE_MAX;
+
+    struct Camera
+    {
+        std::string url;
+        int priority;
+        std::chrono::seconds previewDuration;
+        // retries discovery and motion events subscription
+        std::unique_ptr<ReconnectScheduler> reconnectScheduler;
+        std::unique_ptr<OnvifPlayer> watcher;
+        std::optional<Clock::time_point> lastMotion;
+    };
+
+    Private(const MotionSwitch&, const VideoOutput&) noexcept;
+
+    bool isActive(size_t index, Clock::time_point now) const noexcept;
+    bool isPreferred(size_t candidate, size_t other) const noexcept;
+
+    void onMotion(size_t index) noexcept;
+    void onPlayerEos(UrlPlayer&) noexcept;
+
+    void evaluate() noexcept;
+    void switchTo(size_t index, Clock::time_point now) noexcept;
+    void prepareStandby(Clock::time_point now) noexcept;
+    void scheduleEvaluation(Clock::duration delay) noexcept;
+
+    const std::shared_ptr<spdlog::logger> log;
+    const std::chrono::seconds dwellTime;
+
+    std::vector<Camera> cameras;
+
+    std::unique_ptr<UrlPlayer> output;
+    size_t shown = None;
+    Clock::time_point shownSince;
+
+    // connected to the next likely camera
+    std::unique_ptr<UrlPlayer> standby;
+    size_t standbyIndex = None;
+    Clock::time_point standbyRetryTime;
+
+    GSourcePtr evaluationTimeoutSourcePtr;
+};
+
+MotionSwitcher::Private::Private(
+    const MotionSwitch& motionSwitch,
+    const VideoOutput& videoOutput) noexcept :
+    log(MonitorLog()),
+    dwellTime(motionSwitch.dwellTime)
+{
+    const UrlPlayer::EosCallback eosCallback =
+        [this] (UrlPlayer& player) { onPlayerEos(player); };
+    output = std::make_unique<UrlPlayer>(videoOutput.showStats, videoOutput.sync, eosCallback);
+    standby = std::make_unique<UrlPlayer>(videoOutput.showStats, videoOutput.sync, eosCallback);
+    output->setStallTimeout(videoOutput.stallTimeout);
+    standby->setStallTimeout(videoOutput.stallTimeout);
+    output->setLatencyControl(videoOutput.latencyTarget, videoOutput.maxCatchUpRate);
+    standby->setLatencyControl(videoOutput.latencyTarget, videoOutput.maxCatchUpRate);
+    output->setDecodeDegradation(videoOutput.decodeDegradation, videoOutput.degradedFramerate);
+    standby->setDecodeDegradation(videoOutput.decodeDegradation, videoOutput.degradedFramerate);
+    output->setPersistentSink(videoOutput.persistentSink);
+    standby->setPersistentSink(videoOutput.persistentSink);
+    // players swap their roles, so names are not "output" and "standby"
+    output->setMetricsName("switcher-a");
+    standby->setMetricsName("switcher-b");
+
+    cameras.reserve(motionSwitch.cameras.size());
+    for(const StreamSource& source: motionSwitch.cameras) {
+        std::string deviceUrl;
+        std::optional<std::string> username;
+        std::optional<std::string> password;
+        if(!SplitOnvifUrl(source.uri, &deviceUrl, &username, &password)) {
+            log->error("Invalid ONVIF url \"{}\". Camera skipped", source.uri);
+            continue;
+        }
+
+        const size_t index = cameras.size();
+
+        auto reconnectScheduler = std::make_unique<ReconnectScheduler>(deviceUrl);
+        ReconnectScheduler* scheduler = reconnectScheduler.get();
+
+        auto watcher =
+            std::make_unique<OnvifPlayer>(
+                deviceUrl,
+                username,
+                password,
+                source,
+                videoOutput,
+                [scheduler] (OnvifPlayer&) { scheduler->onFailure(); });
+        watcher->setMotionCallback([this, index] (OnvifPlayer&) { onMotion(index); });
+        watcher->setConnectedCallback([scheduler] (OnvifPlayer&) { scheduler->onSuccess(); });
+        OnvifPlayer* player = watcher.get();
+        scheduler->setReconnectCallback([player] () { player->play(); });
+
+        cameras.push_back(Camera {
+            .url = deviceUrl,
+            .priority = source.priority,
+            .previewDuration = source.motionPreviewDuration,
+            .reconnectScheduler = std::move(reconnectScheduler),
+            .watcher = std::move(watcher),
+            .lastMotion = {},
+        });
+    }
+}
+
+bool MotionSwitcher::Private::isActive(size_t index, Clock::time_point now) const noexcept
+{
+    const Camera& camera = cameras[index];
+    return
+        camera.lastMotion &&
+        now < *camera.lastMotion + camera.previewDuration &&
+        !camera.watcher->streamUri().empty();
+}
+
+bool MotionSwitcher::Private::isPreferred(size_t candidate, size_t other) const noexcept
+{
+    const Camera& a = cameras[candidate];
+    const Camera& b = cameras[other];
+
+    if(a.priority != b.priority)
+        return a.priority > b.priority;
+
+    return a.lastMotion > b.lastMotion;
+}
+
+void MotionSwitcher::Private::onMotion(size_t index) noexcept
+{
+    log->info("Motion on \"{}\"", cameras[index].url);
+
+    cameras[index].lastMotion = Clock::now();
+
+    evaluate();
+}
+
+void MotionSwitcher::Private::onPlayerEos(UrlPlayer& player) noexcept
+{
+    // player is stopped right after callback returns,
+    // so it's restarted by following evaluation
+    if(&player == output.get()) {
+        log->warn("Playback of \"{}\" stopped unexpectedly", shown != None ? cameras[shown].url : "");
+        shown = None;
+    } else if(&player == standby.get()) {
+        standbyIndex = None;
+        standbyRetryTime = Clock::now() + PlayerRestartTimeout;
+    }
+
+    scheduleEvaluation(PlayerRestartTimeout);
+}
+
+void MotionSwitcher::Private::evaluate() noexcept
+{
+    const Clock::time_point now = Clock::now();
+
+    if(shown != None && !isActive(shown, now)) {
+        log->info("Stopping preview of \"{}\"...", cameras[shown].url);
+        output->stop();
+        shown = None;
+    }
+
+    size_t best = None;
+    for(size_t i = 0; i < cameras.size(); ++i) {
+        if(isActive(i, now) && (best == None || isPreferred(i, best)))
+            best = i;
+    }
+
+    Clock::time_point nextEvaluation = now + HousekeepingInterval;
+
+    if(best != None && best != shown) {
+        if(shown == None) {
+            switchTo(best, now);
+        } else if(isPreferred(best, shown)) {
+            const Clock::time_point dwellEnd = shownSince + dwellTime;
+            if(now >= dwellEnd)
+                switchTo(best, now);
+            else
+                nextEvaluation = std::min(nextEvaluation, dwellEnd);
+        }
+    }
+
+    if(shown != None)
+        nextEvaluation = std::min(nextEvaluation, *cameras[shown].lastMotion + cameras[shown].previewDuration);
+
+    prepareStandby(now);
+
+    scheduleEvaluation(nextEvaluation - now);
+}
+
+void MotionSwitcher::Private::switchTo(size_t index, Clock::time_point now) noexcept
+{
+    const Camera& camera = cameras[index];
+    const std::string& streamUri = camera.watcher->streamUri();
+
+    const bool fromStandby = standbyIndex == index && standby->isPrepared();
+
+    log->info("Switching to \"{}\"{}...", camera.url, fromStandby ? " from standby" : "");
+
+    bool started;
+    if(fromStandby) {
+        output.swap(standby);
+        standbyIndex = None;
+        started = output->play(streamUri);
+        standby->stop(); // previously shown camera
+    } else {
+        started = output->play(streamUri, camera.watcher->substreamUri());
+    }
+
+    if(started) {
+        shown = index;
+        shownSince = now;
+    } else {
+        log->error("Failed to start playback of \"{}\"", camera.url);
+        shown = None;
+    }
+}
+
+void MotionSwitcher::Private::prepareStandby(Clock::time_point now) noexcept
+{
+    size_t candidate = None;
+    for(size_t i = 0; i < cameras.size(); ++i) {
+        if(i == shown || cameras[i].watcher->streamUri().empty())
+            continue;
+
+        if(candidate == None || isPreferred(i, candidate))
+            candidate = i;
+    }
+
+    if(candidate == None)
+        return;
+
+    if(candidate == standbyIndex && standby->isPrepared())
+        return;
+
+    if(now < standbyRetryTime)
+        return;
+
+    log->info("Preparing standby pipeline for \"{}\"...", cameras[candidate].url);
+
+    if(standby->prepare(cameras[candidate].watcher->streamUri())) {
+        standbyIndex = candidate;
+    } else {
+        log->warn("Failed to prepare standby pipeline for \"{}\"", cameras[candidate].url);
+        standbyIndex = None;
+        standbyRetryTime = now + PlayerRestartTimeout;
+    }
+}
+
+void MotionSwitcher::Private::scheduleEvaluation(Clock::duration delay) noexcept
+{
+    if(evaluationTimeoutSourcePtr)
+        g_source_destroy(evaluationTimeoutSourcePtr.get());
+
+    const auto delayMs =
+        std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(delay).count());
+
+    evaluationTimeoutSourcePtr.reset(g_timeout_source_new(delayMs));
+    GSource* timeoutSource = evaluationTimeoutSourcePtr.get();
+    g_source_set_callback(
+        timeoutSource,
+        [] (gpointer userData) -> gboolean {
+            Private* self = static_cast<Private*>(userData);
+            self->evaluationTimeoutSourcePtr.reset();
+            self->evaluate();
+            return G_SOURCE_REMOVE;
+        },
+        this,
+        nullptr);
+    g_source_attach(timeoutSource, g_main_context_get_thread_default());
+}
+
+
+MotionSwitcher::MotionSwitcher(
+    const MotionSwitch& motionSwitch,
+    const VideoOutput& videoOutput) noexcept :
+    _p(std::make_unique<Private>(motionSwitch, videoOutput))
+{
+}
+
+MotionSwitcher::~MotionSwitcher()
+{
+    if(_p->evaluationTimeoutSourcePtr)
+        g_source_destroy(_p->evaluationTimeoutSourcePtr.get());
+
+    _p->output->stop();
+    _p->standby->stop();
+}
+
+void MotionSwitcher::start() noexcept
+{
+    _p->log->info("Watching motion events of {} cameras", _p->cameras.size());
+
+    for(Private::Camera& camera: _p->cameras)
+        camera.watcher->play();
+
+    // media uris are discovered asynchronously,
+    // so standby is prepared by the first housekeeping evaluation
+    _p->scheduleEvaluation(HousekeepingInterval);
+}
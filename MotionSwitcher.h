@@ -0,0 +1,24 @@
+#pragma once
+
+#include <memory>
+
+#include "Config.h"
+
+
+// Keeps motion event subscriptions of every camera
+// and shows the one with motion on single video output.
+// Camera with higher priority (or with more recent motion if priorities are equal)
+// replaces the shown one, but not before it was shown for dwell time.
+// The next likely camera is kept connected in standby to switch to it faster.
+class MotionSwitcher
+{
+public:
+    MotionSwitcher(const MotionSwitch&, const VideoOutput&) noexcept;
+    ~MotionSwitcher();
+
+    void start() noexcept;
+
+private:
+    struct Private;
+    std::unique_ptr<Private> _p;
+};
@@ -0,0 +1,261 @@
+#include "OnvifNotification.h"
+
+
+namespace {
+
+bool IsSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+std::string_view Trim(std::string_view text)
+{
+    while(!text.empty() && IsSpace(text.front()))
+        text.remove_prefix(1);
+    while(!text.empty() && IsSpace(text.back()))
+        text.remove_suffix(1);
+
+    return text;
+}
+
+std::string_view LocalName(std::string_view name)
+{
+    const std::string_view::size_type colon = name.rfind(':');
+    return colon == std::string_view::npos ? name : name.substr(colon + 1);
+}
+
+struct Tag
+{
+    std::string_view name; // without namespace prefix
+    std::string_view attributes;
+    bool closing;
+    bool empty; // i.e. <Tag/>
+};
+
+// returns position right after tag end or npos if tag is not terminated
+std::string_view::size_type ParseTag(
+    std::string_view message,
+    std::string_view::size_type tagStart,
+    Tag* tag)
+{
+    std::string_view::size_type pos = tagStart + 1;
+
+    tag->closing = pos < message.size() && message[pos] == '/';
+    if(tag->closing)
+        ++pos;
+
+    const std::string_view::size_type nameStart = pos;
+    while(pos < message.size() && !IsSpace(message[pos]) && message[pos] != '>' && message[pos] != '/')
+        ++pos;
+    tag->name = LocalName(message.substr(nameStart, pos - nameStart));
+
+    const std::string_view::size_type attributesStart = pos;
+    char quote = 0;
+    for(; pos < message.size(); ++pos) {
+        const char c = message[pos];
+        if(quote) {
+            if(c == quote)
+                quote = 0;
+        } else if(c == '"' || c == '\'') {
+            quote = c;
+        } else if(c == '>') {
+            break;
+        }
+    }
+
+    if(pos == message.size())
+        return std::string_view::npos;
+
+    tag->empty = pos > attributesStart && message[pos - 1] == '/';
+    tag->attributes =
+        message.substr(attributesStart, pos - attributesStart - (tag->empty ? 1 : 0));
+
+    return pos + 1;
+}
+
+// calls callback(localName, value) for every attribute,
+// returns false if attributes are malformed
+template<typename Callback>
+bool ForEachAttribute(std::string_view attributes, const Callback& callback)
+{
+    for(;;) {
+        attributes = Trim(attributes);
+        if(attributes.empty())
+            return true;
+
+        const std::string_view::size_type equal = attributes.find('=');
+        if(equal == std::string_view::npos)
+            return false;
+
+        const std::string_view name = LocalName(Trim(attributes.substr(0, equal)));
+        attributes = Trim(attributes.substr(equal + 1));
+        if(attributes.empty() || (attributes.front() != '"' && attributes.front() != '\''))
+            return false;
+
+        const std::string_view::size_type valueEnd = attributes.find(attributes.front(), 1);
+        if(valueEnd == std::string_view::npos)
+            return false;
+
+        callback(name, attributes.substr(1, valueEnd - 1));
+
+        attributes.remove_prefix(valueEnd + 1);
+    }
+}
+
+// returns position right after skipped markup or npos if it's not terminated
+std::string_view::size_type SkipSpecialMarkup(
+    std::string_view message,
+    std::string_view::size_type markupStart)
+{
+    const std::string_view markup = message.substr(markupStart);
+
+    std::string_view terminator = ">";
+    if(markup.starts_with("<?"))
+        terminator = "?>";
+    else if(markup.starts_with("<!--"))
+        terminator = "-->";
+    else if(markup.starts_with("<![CDATA["))
+        terminator = "]]>";
+
+    const std::string_view::size_type end = message.find(terminator, markupStart);
+    return end == std::string_view::npos ? end : end + terminator.size();
+}
+
+}
+
+const std::string_view* OnvifEvent::value(Section section, std::string_view name) const noexcept
+{
+    for(uint8_t i = 0; i < itemsCount; ++i) {
+        const SimpleItem& item = items[i];
+        if(item.section == section && item.name == name)
+            return &item.value;
+    }
+
+    return nullptr;
+}
+
+OnvifNotificationParseResult ParseOnvifNotifications(
+    std::string_view message,
+    OnvifEvent* events,
+    size_t maxEvents,
+    size_t* eventsCount) noexcept
+{
+    *eventsCount = 0;
+
+    bool inNotificationMessage = false;
+    OnvifEvent* event = nullptr; // null if notification message is skipped
+    std::string_view::size_type topicStart = std::string_view::npos;
+    bool inSection = false;
+    OnvifEvent::Section section = OnvifEvent::Section::Data;
+
+    std::string_view::size_type pos = 0;
+    for(;;) {
+        const std::string_view::size_type tagStart = message.find('<', pos);
+        if(tagStart == std::string_view::npos)
+            break;
+
+        if(tagStart + 1 < message.size() && (message[tagStart + 1] == '?' || message[tagStart + 1] == '!')) {
+            pos = SkipSpecialMarkup(message, tagStart);
+            if(pos == std::string_view::npos)
+                return OnvifNotificationParseResult::Malformed;
+            continue;
+        }
+
+        Tag tag;
+        pos = ParseTag(message, tagStart, &tag);
+        if(pos == std::string_view::npos || tag.name.empty())
+            return OnvifNotificationParseResult::Malformed;
+
+        if(tag.closing) {
+            if(tag.name == "NotificationMessage") {
+                if(event)
+                    ++*eventsCount;
+                inNotificationMessage = false;
+                event = nullptr;
+            } else if(event && tag.name == "Topic" && topicStart != std::string_view::npos) {
+                event->topic = Trim(message.substr(topicStart, tagStart - topicStart));
+                topicStart = std::string_view::npos;
+            } else if(tag.name == "Source" || tag.name == "Key" || tag.name == "Data") {
+                inSection = false;
+            }
+
+            continue;
+        }
+
+        if(tag.name == "Fault")
+            return OnvifNotificationParseResult::Fault;
+
+        if(tag.name == "NotificationMessage") {
+            if(inNotificationMessage)
+                return OnvifNotificationParseResult::Malformed;
+
+            inNotificationMessage = !tag.empty;
+            event = nullptr;
+            if(inNotificationMessage && *eventsCount < maxEvents) {
+                event = &events[*eventsCount];
+                *event = OnvifEvent {};
+            }
+            inSection = false;
+            continue;
+        }
+
+        if(!event)
+            continue;
+
+        if(tag.name == "Topic") {
+            if(!tag.empty)
+                topicStart = pos;
+        } else if(tag.name == "Message") {
+            // both wsnt:Message and tt:Message, but only the latter has attributes
+            const bool valid = ForEachAttribute(
+                tag.attributes,
+                [event] (std::string_view name, std::string_view value) {
+                    if(name == "UtcTime")
+                        event->utcTime = value;
+                    else if(name == "PropertyOperation")
+                        event->propertyOperation = value;
+                });
+            if(!valid)
+                return OnvifNotificationParseResult::Malformed;
+        } else if(tag.name == "Source" || tag.name == "Key" || tag.name == "Data") {
+            inSection = !tag.empty;
+            section =
+                tag.name == "Source" ? OnvifEvent::Section::Source :
+                tag.name == "Key" ? OnvifEvent::Section::Key :
+                OnvifEvent::Section::Data;
+        } else if(tag.name == "SimpleItem" && inSection) {
+            if(event->itemsCount == OnvifEvent::MaxSimpleItems)
+                continue;
+
+            OnvifEvent::SimpleItem& item = event->items[event->itemsCount];
+            item = OnvifEvent::SimpleItem { section, {}, {} };
+            bool hasName = false;
+            const bool valid = ForEachAttribute(
+                tag.attributes,
+                [&item, &hasName] (std::string_view name, std::string_view value) {
+                    if(name == "Name") {
+                        item.name = value;
+                        hasName = true;
+                    } else if(name == "Value") {
+                        item.value = value;
+                    }
+                });
+            if(!valid)
+                return OnvifNotificationParseResult::Malformed;
+
+            if(hasName)
+                ++event->itemsCount;
+        }
+    }
+
+    if(inNotificationMessage)
+        return OnvifNotificationParseResult::Malformed;
+
+    return OnvifNotificationParseResult::Ok;
+}
+
+bool IsXsdTrue(std::string_view value) noexcept
+{
+    value = Trim(value);
+    return value == "true" || value == "1";
+}
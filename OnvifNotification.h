@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+
+// Single wsnt:NotificationMessage.
+// All fields point into parsed buffer and are valid only while it's alive.
+// Values are kept as is, i.e. XML entities are not decoded.
+struct OnvifEvent
+{
+    enum {
+        MaxSimpleItems = 8,
+    };
+
+    enum class Section: uint8_t {
+        Source,
+        Key,
+        Data,
+    };
+
+    struct SimpleItem
+    {
+        Section section;
+        std::string_view name;
+        std::string_view value;
+    };
+
+    std::string_view topic;
+    std::string_view utcTime;
+    std::string_view propertyOperation;
+
+    SimpleItem items[MaxSimpleItems];
+    uint8_t itemsCount;
+
+    // returns Value of first tt:SimpleItem with specified Name from specified section
+    const std::string_view* value(Section, std::string_view name) const noexcept;
+};
+
+enum class OnvifNotificationParseResult {
+    Ok,
+    Fault, // SOAP Fault was received instead of notifications
+    Malformed,
+};
+
+// Extracts notification messages from PullMessagesResponse or Notify SOAP message
+// in document order without any memory allocation.
+// Messages exceeding maxEvents and SimpleItems exceeding OnvifEvent::MaxSimpleItems are skipped.
+OnvifNotificationParseResult ParseOnvifNotifications(
+    std::string_view message,
+    OnvifEvent* events,
+    size_t maxEvents,
+    size_t* eventsCount) noexcept;
+
+bool IsXsdTrue(std::string_view) noexcept;
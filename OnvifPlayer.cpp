@@ -1,16 +1,26 @@
 #include "OnvifPlayer.h"
 
 #include <algorithm>
-
-#include <gsoap/plugin/wsseapi.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 #include "ONVIF/onvif.nsmap"
-#include "ONVIF/SOAP.h"
 
 #include "CxxPtr/GlibPtr.h"
 #include "CxxPtr/GioPtr.h"
 
+#include "DiscoveryCache.h"
 #include "Log.h"
+#include "HttpListener.h"
+#include "MainLoopQueue.h"
+#include "Metrics.h"
+#include "OnvifNotification.h"
+#include "OnvifProfile.h"
+#include "OnvifSession.h"
+#include "PreMotionBuffer.h"
+#include "Startup.h"
 
 
 namespace {
@@ -19,25 +29,158 @@ const char *const PullSubscriptionDuration = "PT1M"; // 1 minute, relative
 const char *const PullMessagesTimeout = "PT5S"; // 5 seconds
 const int PullMessagesLimit = 50;
 constexpr std::chrono::seconds PullSubscriptionRefreshInterval = std::chrono::seconds(30);
+// some cameras answer PullMessages immediately even without new events
+constexpr std::chrono::milliseconds MinPullMessagesInterval = std::chrono::milliseconds(500);
+// renewed every PullSubscriptionRefreshInterval too, but Notify delivery is not confirmed by our requests,
+// so termination time leaves room for a few failed Renew attempts
+const char *const PushSubscriptionDuration = "PT2M"; // 2 minutes, relative
+
+const char *const NotifyPath = "/onvif/notify";
+const char *const PreMotionBufferUri = "appsrc://";
+const char *const WsntNamespace = "http://docs.oasis-open.org/wsn/b-2";
+const char *const TopicExpressionDialect = "http://www.onvif.org/ver10/tev/topicExpression/ConcreteSet";
+const int NotifyMessagesLimit = 16;
+
+// adaptive profile
+constexpr double OverBudgetBusyRatio = 0.85;
+constexpr double StepUpBusyRatioBudget = 0.6; // expected busy ratio with heavier profile
+constexpr std::chrono::seconds OverloadHoldTime = std::chrono::seconds(10);
+constexpr std::chrono::seconds HeadroomHoldTime = std::chrono::seconds(60);
+constexpr std::chrono::seconds ProfileSwitchHoldTime = std::chrono::seconds(30);
+
+struct ObjectUnref
+{
+    void operator() (gpointer object) { g_object_unref(object); }
+};
 
-void AddAuth(
-    struct soap* soap,
-    const std::optional<std::string>& username,
-    const std::optional<std::string>& password) noexcept
+template<typename T>
+using ObjectPtr = std::unique_ptr<T, ObjectUnref>;
+
+// reports motion if any "IsMotion" of notification messages is true,
+// since short motion could be already over within the same batch
+// and preview is started on motion start only
+bool FindMotionState(const OnvifEvent* events, size_t eventsCount, gboolean* isMotion)
 {
-    if(!username && !password) return;
+    bool found = false;
+    *isMotion = FALSE;
+    for(size_t i = 0; i < eventsCount; ++i) {
+        const std::string_view* value = events[i].value(OnvifEvent::Section::Data, "IsMotion");
+        if(!value)
+            continue;
+
+        found = true;
+        if(IsXsdTrue(*value)) {
+            *isMotion = TRUE;
+            break;
+        }
+    }
 
-    soap_wsse_add_UsernameTokenDigest(
+    return found;
+}
+
+std::string JoinTopicExpressions(const std::vector<std::string>& topics)
+{
+    std::string expression;
+    for(const std::string& topic: topics) {
+        if(!expression.empty())
+            expression += '|'; // ConcreteSet union
+        expression += topic;
+    }
+
+    return expression;
+}
+
+// filter is allocated in SOAP context and released with it
+wsnt__FilterType* NewTopicFilter(struct soap* soap, const std::string& topicExpression)
+{
+    wsnt__FilterType* filter = soap_new_wsnt__FilterType(soap);
+
+    soap_dom_element topicExpressionElement(
         soap,
-        nullptr,
-        username ? username->c_str() : "",
-        password ? password->c_str() : "");
+        WsntNamespace,
+        "TopicExpression",
+        topicExpression.c_str());
+    topicExpressionElement.att("Dialect") = TopicExpressionDialect;
+    filter->__any.push_back(topicExpressionElement);
+
+    return filter;
+}
+
+// camera doesn't support request as is (vs network or auth problems)
+bool IsRequestRejected(soap_status status)
+{
+    return status == SOAP_FAULT || status == 400 || status == 500;
+}
+
+// discovery results depend on device and profile selection settings
+std::string DiscoveryCacheKey(
+    const std::string& url,
+    const StreamSource& source,
+    const VideoOutput& videoOutput)
+{
+    return
+        url +
+        "\n" + std::to_string(videoOutput.maxWidth) + "x" + std::to_string(videoOutput.maxHeight) +
+        "\n" + std::to_string(source.maxBitrate) +
+        "\n" + std::to_string(source.maxPixelRate) +
+        "\n" + (source.progressiveStartup ? "progressive" : "") +
+        "\n" + (source.adaptiveProfile && !source.trackMotion ? "adaptive" : "");
+}
+
+OnvifProfileInfo ProfileInfo(const tt__Profile& profile)
+{
+    OnvifProfileInfo info;
+    info.token = profile.token;
+
+    const tt__VideoEncoderConfiguration* encoder = profile.VideoEncoderConfiguration;
+    if(!encoder)
+        return info;
+
+    switch(encoder->Encoding) {
+    case tt__VideoEncoding::JPEG:
+        info.encoding = "JPEG";
+        break;
+    case tt__VideoEncoding::MPEG4:
+        info.encoding = "MPEG4";
+        break;
+    case tt__VideoEncoding::H264:
+        info.encoding = "H264";
+        break;
+    }
+
+    if(encoder->Resolution) {
+        info.width = std::max(0, encoder->Resolution->Width);
+        info.height = std::max(0, encoder->Resolution->Height);
+    }
+
+    if(encoder->RateControl) {
+        info.frameRate = std::max(0, encoder->RateControl->FrameRateLimit);
+        info.bitrate = std::max(0, encoder->RateControl->BitrateLimit);
+    }
+
+    return info;
+}
+
+bool IsNetworkError(const GError* error, GQuark soapDomain)
+{
+    if(error->domain != soapDomain)
+        return error->domain == G_IO_ERROR || error->domain == G_RESOLVER_ERROR;
+
+    switch(error->code) {
+    case SOAP_TCP_ERROR:
+    case SOAP_EOF:
+        return true;
+    default:
+        return false;
+    }
 }
 
 }
 
 enum {
     MOTION_EVENT_REQUEST_TIMEOUT = 1,
+    MAX_MOTION_EVENT_REQUEST_TIMEOUT = 16,
+    STANDBY_RESTART_TIMEOUT = 5,
 };
 
 struct OnvifPlayer::Private
@@ -51,14 +194,35 @@ struct OnvifPlayer::Private
         gpointer taskData,
         GCancellable* cancellable);
 
+    bool requestStreamUri(
+        const std::string& mediaEndpoint,
+        const std::string& profileToken,
+        std::string* streamUri,
+        GError**) noexcept;
+
     static void requestMotionEventTaskFunc(
         GTask* task,
         gpointer sourceObject,
         gpointer taskData,
         GCancellable* cancellable);
 
+    struct ProfileStep {
+        OnvifProfileInfo profile;
+        std::string streamUri;
+    };
+
     struct MediaUris {
         std::string streamUri;
+        std::string substreamUri; // for progressive startup
+        std::vector<ProfileStep> profileSteps; // for adaptive profile, from the lightest to selected one
+        size_t profileStep = 0; // currently played
+        std::string mediaEndpoint; // for discovery cache
+        std::string eventsEndpoint; // ^^^ the same ^^^
+    };
+
+    struct MotionEvent {
+        gboolean isMotion;
+        std::chrono::steady_clock::time_point pullTime;
     };
 
     Private(
@@ -66,8 +230,8 @@ struct OnvifPlayer::Private
         const std::string& url,
         const std::optional<std::string>& username,
         const std::optional<std::string>& password,
-        bool trackMotion,
-        std::chrono::seconds motionPreviewDuration,
+        const StreamSource&,
+        const VideoOutput&,
         const EosCallback&);
 
     GSourcePtr timeoutAddSeconds(
@@ -77,41 +241,138 @@ struct OnvifPlayer::Private
 
     void onError() noexcept;
 
+    // task thread functions use Private,
+    // so it can't be destroyed until all of them are finished
+    struct RunningTask
+    {
+        explicit RunningTask(Private& p) noexcept : p(p) {}
+        ~RunningTask();
+
+        Private& p;
+    };
+    void runTask(GTask*, GTaskThreadFunc) noexcept;
+    void waitTasks() noexcept;
+
     void requestMediaUris() noexcept;
     void onMediaUris(std::unique_ptr<MediaUris>&) noexcept;
 
+    void startFromDiscoveryCache() noexcept;
+    void playCachedMediaUris() noexcept;
+    void saveDiscoveryCache() noexcept;
+    void onPlaybackEos() noexcept;
+
     void startMotionEventRequestTimeout(bool increaseDelay = false) noexcept;
 
+    bool pullMotionEvent(gboolean* isMotion, GError**) noexcept;
+
+    bool useEventTopicFilter() const noexcept;
+    void onEventTopicFilterRejected(const char* request) noexcept;
+
     void requestMotionEvent() noexcept;
     void onMotionEvent(gboolean isMotion) noexcept;
 
+    void startEventPump() noexcept;
+    void eventPumpThreadFunc() noexcept;
+    void onQueuedMotionEvent(const MotionEvent&) noexcept;
+    void stopEventPump() noexcept;
+
+    static void pushSubscriptionTaskFunc(
+        GTask* task,
+        gpointer sourceObject,
+        gpointer taskData,
+        GCancellable* cancellable);
+
+    void startPushSubscription() noexcept;
+    bool resolveNotifyConsumerAddress(const std::string& eventsEndpoint, GError**) noexcept;
+    bool subscribePush(GError**) noexcept;
+    void requestPushSubscription() noexcept;
+    void startPushSubscriptionTimeout(unsigned timeout) noexcept;
+    void onPushSubscriptionFailed(const GError*) noexcept;
+    HttpListener::Response onNotify(const HttpListener::Request&) noexcept;
+    void fallbackToPull() noexcept;
+
     void startPreviewStopTimeout() noexcept;
 
+    void prepareStandby() noexcept;
+    void onSourceSetup(GstElement* source) noexcept;
+    void onStandbyEos() noexcept;
+
+    void onDecodeLoad(const UrlPlayer::DecodeLoad&) noexcept;
+    void switchProfileStep(size_t step) noexcept;
+
     std::shared_ptr<spdlog::logger> log;
 
     OnvifPlayer *const owner;
 
-    const std::string url;
-    const std::optional<std::string> username;
-    const std::optional<std::string> password;
+    OnvifSession session; // to use only in task threads
     const bool trackMotion = false;
     const std::chrono::seconds motionPreviewDuration;
+    const bool motionPreviewStandby = false;
+    const bool progressiveStartup = false;
+    const bool adaptiveProfile = false;
+    const bool discoveryCache = false;
+    const std::string discoveryCacheKey;
+    const StreamSource::MotionEvents motionEvents;
+    const unsigned short notifyPort;
+    const std::string notifyHost;
+    const std::string eventTopicExpression;
+    const OnvifProfileLimits profileLimits;
     const EosCallback eosCallback;
+    MotionCallback motionCallback;
+    ConnectedCallback connectedCallback;
+
+    MetricValue *const motionEventsMetric;
+    MetricValue *const profileStepMetric;
+    MetricValue *const profileSwitchesMetric;
+
+    std::unique_ptr<PreMotionBuffer> preMotionBuffer;
 
     GCancellablePtr mediaUrlRequestTaskCancellablePtr;
     GTaskPtr mediaUrlRequestTaskPtr;
 
     std::unique_ptr<MediaUris> mediaUris;
 
+    bool coldStart = true;
+    std::unique_ptr<MediaUris> cachedMediaUris; // waiting for main loop to be played
+    GSourcePtr cachedPlaySource;
+    bool playingCachedUris = false; // not confirmed by discovery yet
+
     GSourcePtr moitionEventRequestTimeoutSource;
     unsigned lastMoitionEventRequestTimeout = MOTION_EVENT_REQUEST_TIMEOUT;
 
     GCancellablePtr motionEventRequestTaskCancellablePtr;
     GTaskPtr motionEventRequestTaskPtr;
-    std::string eventSubscriptionEndpoint; // not thread safe, to use only in motionEventRequestTask
+    std::string eventSubscriptionEndpoint; // not thread safe, to use only in motionEventRequestTask or event pump thread
     std::chrono::steady_clock::time_point eventSubscriptionTime; // ^^^ the same ^^^
+    std::atomic<bool> eventTopicFilterRejected = false;
+
+    std::unique_ptr<MainLoopQueue<MotionEvent, 16>> motionEventQueue;
+    std::thread eventPumpThread;
+    std::atomic<bool> eventPumpStopRequested = false;
+    std::mutex eventPumpMutex;
+    std::condition_variable eventPumpStopCondition;
+
+    std::unique_ptr<HttpListener> notifyListener;
+    std::unique_ptr<MainLoopQueue<MotionEvent, 16>> notifyEventQueue;
+    GSourcePtr pushSubscriptionTimeoutSource;
+    unsigned lastPushSubscriptionRetryTimeout = 0;
+    GCancellablePtr pushSubscriptionTaskCancellablePtr;
+    GTaskPtr pushSubscriptionTaskPtr;
+    std::string notifyConsumerAddress; // not thread safe, to use only in pushSubscriptionTask
+    std::string pushSubscriptionEndpoint; // ^^^ the same ^^^
 
     GSourcePtr previewStopTimeoutSource;
+
+    GSourcePtr standbyRestartTimeoutSource;
+
+    std::mutex tasksMutex;
+    std::condition_variable tasksFinishedCondition;
+    unsigned runningTasks = 0; // including not started yet
+
+    // adaptive profile, default value - condition is not met
+    std::chrono::steady_clock::time_point overloadStartTime;
+    std::chrono::steady_clock::time_point headroomStartTime;
+    std::chrono::steady_clock::time_point profileSwitchTime;
 };
 
 GQuark OnvifPlayer::Private::SoapDomain = g_quark_from_static_string("OnvifPlayer::SOAP");
@@ -122,17 +383,47 @@ OnvifPlayer::Private::Private(
     const std::string& url,
     const std::optional<std::string>& username,
     const std::optional<std::string>& password,
-    bool trackMotion,
-    std::chrono::seconds motionPreviewDuration,
+    const StreamSource& source,
+    const VideoOutput& videoOutput,
     const EosCallback& eosCallback) :
     log(MonitorLog()),
     owner(owner),
-    url(url),
-    username(username),
-    password(password),
-    trackMotion(trackMotion),
-    motionPreviewDuration(motionPreviewDuration),
-    eosCallback(eosCallback)
+    session(url, username, password),
+    trackMotion(source.trackMotion),
+    motionPreviewDuration(source.motionPreviewDuration),
+    motionPreviewStandby(source.motionPreviewStandby),
+    progressiveStartup(source.progressiveStartup),
+    adaptiveProfile(source.adaptiveProfile && !source.trackMotion),
+    discoveryCache(source.discoveryCache),
+    discoveryCacheKey(DiscoveryCacheKey(url, source, videoOutput)),
+    motionEvents(source.motionEvents),
+    notifyPort(source.notifyPort),
+    notifyHost(source.notifyHost),
+    eventTopicExpression(JoinTopicExpressions(source.eventTopics)),
+    profileLimits {
+        .maxWidth = videoOutput.maxWidth,
+        .maxHeight = videoOutput.maxHeight,
+        .maxBitrate = source.maxBitrate,
+        .maxPixelRate = source.maxPixelRate },
+    eosCallback(eosCallback),
+    motionEventsMetric(
+        RegisterMetric(
+            MetricType::Counter,
+            "monitor_motion_events_total",
+            "Motion events received from ONVIF device",
+            { { "device", MetricsUrlLabel(url) } })),
+    profileStepMetric(
+        RegisterMetric(
+            MetricType::Gauge,
+            "monitor_profile_step",
+            "Index of played media profile among adaptive ones, 0 - the lightest",
+            { { "device", MetricsUrlLabel(url) } })),
+    profileSwitchesMetric(
+        RegisterMetric(
+            MetricType::Counter,
+            "monitor_profile_switches_total",
+            "Media profile switches caused by decode load",
+            { { "device", MetricsUrlLabel(url) } }))
 {
 }
 
@@ -158,48 +449,67 @@ void OnvifPlayer::Private::onError() noexcept
         eosCallback(*owner);
 }
 
+OnvifPlayer::Private::RunningTask::~RunningTask()
+{
+    std::lock_guard<std::mutex> lock(p.tasksMutex);
+    --p.runningTasks;
+    p.tasksFinishedCondition.notify_all();
+}
+
+// cancelled task returns to main loop immediately,
+// but its thread function keeps running until the end
+void OnvifPlayer::Private::runTask(GTask* task, GTaskThreadFunc taskFunc) noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(tasksMutex);
+        ++runningTasks;
+    }
+
+    g_task_run_in_thread(task, taskFunc);
+}
+
+void OnvifPlayer::Private::waitTasks() noexcept
+{
+    std::unique_lock<std::mutex> lock(tasksMutex);
+    tasksFinishedCondition.wait(lock, [this] () { return runningTasks == 0; });
+}
+
 void OnvifPlayer::Private::requestMediaUrisTaskFunc(
     GTask* task,
     gpointer sourceObject,
     gpointer taskData,
     GCancellable* cancellable)
 {
-    const OnvifPlayer::Private& p = *static_cast<const OnvifPlayer::Private*>(taskData);
+    OnvifPlayer::Private& p = *static_cast<OnvifPlayer::Private*>(taskData);
+    RunningTask runningTask(p);
 
     soap_status status;
 
-    SOAP soap;
+    OnvifSession::Lock lock(p.session);
 
-    _tds__GetCapabilities getCapabilities;
-    tt__CapabilityCategory category = tt__CapabilityCategory::Media;
-    getCapabilities.Category.push_back(category);
-    _tds__GetCapabilitiesResponse getCapabilitiesResponse;
-    AddAuth(soap, p.username, p.password);
-    status = soap_call___tds__GetCapabilities(
-        soap,
-        p.url.c_str(),
-        nullptr,
-        &getCapabilities, getCapabilitiesResponse);
+    std::string mediaEndpoint;
+    status = p.session.mediaEndpoint(&mediaEndpoint);
     if(status != SOAP_OK) {
-        const char* faultString = soap_fault_string(soap);
+        const char* faultString = p.session.faultString();
         GError* error = g_error_new_literal(SoapDomain, status, faultString ? faultString : "GetCapabilities failed");
         g_task_return_error(task, error);
         return;
     }
 
-    const std::string& mediaEndpoint = getCapabilitiesResponse.Capabilities->Media->XAddr;
-
     _trt__GetProfiles getProfiles;
     _trt__GetProfilesResponse getProfilesResponse;
-    AddAuth(soap, p.username, p.password);
-    status = soap_call___trt__GetProfiles(
-        soap,
-        mediaEndpoint.c_str(),
-        nullptr,
-        &getProfiles,
-        getProfilesResponse);
+    status = p.session.call(
+        "GetProfiles",
+        [&] (struct soap* soap) {
+            return soap_call___trt__GetProfiles(
+                soap,
+                mediaEndpoint.c_str(),
+                nullptr,
+                &getProfiles,
+                getProfilesResponse);
+        });
     if(status != SOAP_OK) {
-        const char* faultString = soap_fault_string(soap);
+        const char* faultString = p.session.faultString();
         GError* error = g_error_new_literal(SoapDomain, status, faultString ? faultString : "GetProfiles failed");
         g_task_return_error(task, error);
         return;
@@ -215,11 +525,105 @@ void OnvifPlayer::Private::requestMediaUrisTaskFunc(
         return;
     }
 
-    const tt__Profile *const mediaProfile = getProfilesResponse.Profiles[0];
+    std::vector<OnvifProfileInfo> profiles;
+    profiles.reserve(getProfilesResponse.Profiles.size());
+    for(const tt__Profile* profile: getProfilesResponse.Profiles)
+        profiles.push_back(ProfileInfo(*profile));
+
+    const char* selectionReason = nullptr;
+    const size_t profileIndex = SelectOnvifProfile(profiles, p.profileLimits, &selectionReason);
+    const OnvifProfileInfo& profileInfo = profiles[profileIndex];
+    p.log->info(
+        "Using media profile \"{}\" ({}x{} {} @ {} fps, {} kbps): {}",
+        profileInfo.token,
+        profileInfo.width,
+        profileInfo.height,
+        profileInfo.encoding.empty() ? "unknown codec" : profileInfo.encoding,
+        profileInfo.frameRate,
+        profileInfo.bitrate,
+        selectionReason);
+
+    std::string streamUri;
+    GError* error = nullptr;
+    if(!p.requestStreamUri(mediaEndpoint, profileInfo.token, &streamUri, &error)) {
+        g_task_return_error(task, error);
+        return;
+    }
+
+    // the same GetProfiles response is used for every step,
+    // so switching later needs no more requests
+    std::vector<ProfileStep> profileSteps;
+    if(p.adaptiveProfile) {
+        for(const size_t index: OnvifProfileLadder(profiles, profileIndex)) {
+            const OnvifProfileInfo& stepInfo = profiles[index];
+            if(index == profileIndex) {
+                profileSteps.push_back({ stepInfo, streamUri });
+                continue;
+            }
+
+            std::string stepUri;
+            GError* stepError = nullptr;
+            if(!p.requestStreamUri(mediaEndpoint, stepInfo.token, &stepUri, &stepError)) {
+                GErrorPtr stepErrorPtr(stepError);
+                p.log->warn(
+                    "Failed to get uri of media profile \"{}\": {}",
+                    stepInfo.token,
+                    stepErrorPtr->message);
+                continue;
+            }
+
+            p.log->info(
+                "Media profile \"{}\" ({}x{} @ {} fps) could be used under high decode load",
+                stepInfo.token,
+                stepInfo.width,
+                stepInfo.height,
+                stepInfo.frameRate);
+            profileSteps.push_back({ stepInfo, stepUri });
+        }
+    }
+    const size_t profileStep = profileSteps.empty() ? 0 : profileSteps.size() - 1;
+
+    std::string substreamUri;
+    if(p.progressiveStartup) {
+        const size_t substreamIndex = LightestOnvifProfile(profiles);
+        const OnvifProfileInfo& substreamInfo = profiles[substreamIndex];
+        if(substreamIndex == profileIndex) {
+            p.log->info("There is no lighter media profile to use as substream");
+        } else if(!p.requestStreamUri(mediaEndpoint, substreamInfo.token, &substreamUri, &error)) {
+            GErrorPtr errorPtr(error);
+            p.log->warn("Failed to get substream uri: {}", errorPtr->message);
+        } else {
+            p.log->info(
+                "Using media profile \"{}\" ({}x{}) as substream for progressive startup",
+                substreamInfo.token,
+                substreamInfo.width,
+                substreamInfo.height);
+        }
+    }
+
+    g_task_return_pointer(
+        task,
+        new MediaUris {
+            streamUri,
+            substreamUri,
+            std::move(profileSteps),
+            profileStep,
+            mediaEndpoint,
+            p.session.knownEventsEndpoint() },
+        [] (gpointer mediaUris) { delete(static_cast<MediaUris*>(mediaUris)); });
+}
+
+bool OnvifPlayer::Private::requestStreamUri(
+    const std::string& mediaEndpoint,
+    const std::string& profileToken,
+    std::string* streamUri,
+    GError** outError) noexcept
+{
+    soap_status status;
 
     _trt__GetStreamUri getStreamUri;
     _trt__GetStreamUriResponse getStreamUriResponse;
-    getStreamUri.ProfileToken = mediaProfile->token;
+    getStreamUri.ProfileToken = profileToken;
 
     tt__StreamSetup streamSetup;
 
@@ -230,18 +634,21 @@ void OnvifPlayer::Private::requestMediaUrisTaskFunc(
 
     getStreamUri.StreamSetup = &streamSetup;
 
-    AddAuth(soap, p.username, p.password);
-    status = soap_call___trt__GetStreamUri(
-        soap,
-        mediaEndpoint.c_str(),
-        nullptr,
-        &getStreamUri,
-        getStreamUriResponse);
+    status = session.call(
+        "GetStreamUri",
+        [&] (struct soap* soap) {
+            return soap_call___trt__GetStreamUri(
+                soap,
+                mediaEndpoint.c_str(),
+                nullptr,
+                &getStreamUri,
+                getStreamUriResponse);
+        });
     if(status != SOAP_OK) {
-        const char* faultString = soap_fault_string(soap);
+        const char* faultString = session.faultString();
         GError* error = g_error_new_literal(SoapDomain, status, faultString ? faultString : "GetStreamUri failed");
-        g_task_return_error(task, error);
-        return;
+        g_propagate_error(outError, error);
+        return false;
     }
 
     const tt__MediaUri *const mediaUri = getStreamUriResponse.MediaUri;
@@ -251,26 +658,28 @@ void OnvifPlayer::Private::requestMediaUrisTaskFunc(
                 Domain,
                 DEVICE_MEDIA_PROFILE_HAS_NO_STREAM_URI,
                 "Device Media Profile has no stream uri");
-        g_task_return_error(task, error);
-        return;
+        g_propagate_error(outError, error);
+        return false;
     }
 
     GCharPtr uriStringPtr;
-    if(p.username || p.password) {
+    const std::optional<std::string>& username = session.username();
+    const std::optional<std::string>& password = session.password();
+    if(username || password) {
         GUriPtr uriPtr(g_uri_parse(mediaUri->Uri.c_str(), G_URI_FLAGS_ENCODED, nullptr));
         GUri* uri = uriPtr.get();
         if(!g_uri_get_user(uri) && !g_uri_get_password(uri)) {
             GCharPtr userPtr(
-                p.username ?
+                username ?
                     g_uri_escape_string(
-                        p.username->c_str(),
+                        username->c_str(),
                         G_URI_RESERVED_CHARS_SUBCOMPONENT_DELIMITERS,
                         false) :
                         nullptr);
             GCharPtr passwordPtr(
-                p.password ?
+                password ?
                     g_uri_escape_string(
-                        p.password->c_str(),
+                        password->c_str(),
                         G_URI_RESERVED_CHARS_SUBCOMPONENT_DELIMITERS,
                         false) :
                         nullptr);
@@ -288,12 +697,9 @@ void OnvifPlayer::Private::requestMediaUrisTaskFunc(
                     g_uri_get_fragment(uri)));
         }
     }
-    const std::string& mediaUriUri = uriStringPtr ? std::string(uriStringPtr.get()) : mediaUri->Uri;
+    *streamUri = uriStringPtr ? std::string(uriStringPtr.get()) : mediaUri->Uri;
 
-    g_task_return_pointer(
-        task,
-        new MediaUris { mediaUriUri },
-        [] (gpointer mediaUris) { delete(static_cast<MediaUris*>(mediaUris)); });
+    return true;
 }
 
 void OnvifPlayer::Private::requestMotionEventTaskFunc(
@@ -302,56 +708,68 @@ void OnvifPlayer::Private::requestMotionEventTaskFunc(
     gpointer taskData,
     GCancellable* cancellable)
 {
-    soap_status status;
-
     OnvifPlayer::Private& self = *static_cast<OnvifPlayer::Private*>(taskData);
+    RunningTask runningTask(self);
 
-    SOAP soap;
+    GError* error = nullptr;
+    gboolean isMotion = FALSE;
+    if(self.pullMotionEvent(&isMotion, &error))
+        g_task_return_boolean(task, isMotion);
+    else
+        g_task_return_error(task, error);
+}
 
-    _tds__GetCapabilities getCapabilities;
-    tt__CapabilityCategory category = tt__CapabilityCategory::Events;
-    getCapabilities.Category.push_back(category);
-    _tds__GetCapabilitiesResponse getCapabilitiesResponse;
-    AddAuth(soap, self.username, self.password);
-    status = soap_call___tds__GetCapabilities(
-        soap,
-        self.url.c_str(),
-        nullptr,
-        &getCapabilities, getCapabilitiesResponse);
+bool OnvifPlayer::Private::pullMotionEvent(gboolean* isMotion, GError** outError) noexcept
+{
+    soap_status status;
+
+    OnvifSession::Lock lock(session);
+
+    std::string eventsEndpoint;
+    status = session.eventsEndpoint(&eventsEndpoint);
     if(status != SOAP_OK) {
-        const char* faultString = soap_fault_string(soap);
+        const char* faultString = session.faultString();
         GError* error = g_error_new_literal(SoapDomain, status, faultString ? faultString : "GetCapabilities failed");
-        g_task_return_error(task, error);
-        return;
+        g_propagate_error(outError, error);
+        return false;
     }
 
-    const std::string& eventsEndpoint = getCapabilitiesResponse.Capabilities->Events->XAddr;
-
     bool renewRequired = true;
-    if(self.eventSubscriptionEndpoint.empty()) {
+    if(eventSubscriptionEndpoint.empty()) {
         _tev__CreatePullPointSubscription ceatePullPointSubscription;
         std::string InitialTerminationTime = PullSubscriptionDuration;
         ceatePullPointSubscription.InitialTerminationTime = &InitialTerminationTime;
         _tev__CreatePullPointSubscriptionResponse createPullPointSubscriptionResponse;
-        AddAuth(soap, self.username, self.password);
-        status = soap_call___tev__CreatePullPointSubscription(
-            soap,
-            eventsEndpoint.c_str(),
-            nullptr,
-            &ceatePullPointSubscription,
-            createPullPointSubscriptionResponse);
+        bool filtered = useEventTopicFilter();
+        auto createPullPointSubscription =
+            [&] (struct soap* soap) {
+                ceatePullPointSubscription.Filter =
+                    filtered ? NewTopicFilter(soap, eventTopicExpression) : nullptr;
+                return soap_call___tev__CreatePullPointSubscription(
+                    soap,
+                    eventsEndpoint.c_str(),
+                    nullptr,
+                    &ceatePullPointSubscription,
+                    createPullPointSubscriptionResponse);
+            };
+        status = session.call("CreatePullPointSubscription", createPullPointSubscription);
+        if(status != SOAP_OK && filtered && IsRequestRejected(status)) {
+            onEventTopicFilterRejected("CreatePullPointSubscription");
+            filtered = false;
+            status = session.call("CreatePullPointSubscription", createPullPointSubscription);
+        }
         if(status != SOAP_OK) {
-            const char* faultString = soap_fault_string(soap);
+            const char* faultString = session.faultString();
             GError* error = g_error_new_literal(SoapDomain, status, faultString ? faultString : "CreatePullPointSubscription failed");
-            g_task_return_error(task, error);
-            return;
+            g_propagate_error(outError, error);
+            return false;
         }
 
-        self.eventSubscriptionEndpoint = createPullPointSubscriptionResponse.SubscriptionReference.Address;
-        self.eventSubscriptionTime = std::chrono::steady_clock::now();
+        eventSubscriptionEndpoint = createPullPointSubscriptionResponse.SubscriptionReference.Address;
+        eventSubscriptionTime = std::chrono::steady_clock::now();
         renewRequired = false;
     } else {
-        const auto timeElapsed = std::chrono::steady_clock::now() - self.eventSubscriptionTime;
+        const auto timeElapsed = std::chrono::steady_clock::now() - eventSubscriptionTime;
         renewRequired = timeElapsed > PullSubscriptionRefreshInterval;
     }
 
@@ -360,73 +778,118 @@ void OnvifPlayer::Private::requestMotionEventTaskFunc(
         std::string TerminationTime = PullSubscriptionDuration;
         renew.TerminationTime = &TerminationTime;
         _wsnt__RenewResponse renewResponse;
-        AddAuth(soap, self.username, self.password);
-        status = soap_call___tev__Renew(
-            soap,
-            self.eventSubscriptionEndpoint.c_str(),
-            nullptr,
-            &renew,
-            renewResponse);
+        status = session.call(
+            "Renew",
+            [&] (struct soap* soap) {
+                return soap_call___tev__Renew(
+                    soap,
+                    eventSubscriptionEndpoint.c_str(),
+                    nullptr,
+                    &renew,
+                    renewResponse);
+            });
         if(status != SOAP_OK) {
-            self.eventSubscriptionEndpoint.clear();
+            eventSubscriptionEndpoint.clear();
 
-            const char* faultString = soap_fault_string(soap);
+            const char* faultString = session.faultString();
             GError* error = g_error_new_literal(SoapDomain, status, faultString ? faultString : "Renew failed");
-            g_task_return_error(task, error);
-            return;
+            g_propagate_error(outError, error);
+            return false;
         }
 
-        self.eventSubscriptionTime = std::chrono::steady_clock::now();
+        eventSubscriptionTime = std::chrono::steady_clock::now();
     }
 
     _tev__PullMessages pullMessages;
     pullMessages.Timeout = PullMessagesTimeout;
     pullMessages.MessageLimit = PullMessagesLimit;
-    _tev__PullMessagesResponse pullMessagesResponse;
-    AddAuth(soap, self.username, self.password);
-    status = soap_call___tev__PullMessages(
-        soap,
-        self.eventSubscriptionEndpoint.c_str(),
-        nullptr,
-        &pullMessages,
-        pullMessagesResponse);
+    // response is received as is to avoid building DOM for every notification message
+    const char* responseBody = nullptr;
+    size_t responseBodySize = 0;
+    status = session.call(
+        "PullMessages",
+        [&] (struct soap* soap) {
+            if(soap_send___tev__PullMessages(
+                    soap,
+                    eventSubscriptionEndpoint.c_str(),
+                    nullptr,
+                    &pullMessages) != SOAP_OK ||
+                soap_begin_recv(soap) != SOAP_OK)
+            {
+                return soap_closesock(soap);
+            }
+
+            responseBody = soap_http_get_body(soap, &responseBodySize);
+            if(!responseBody || soap_end_recv(soap) != SOAP_OK)
+                return soap_closesock(soap);
+
+            return SOAP_OK;
+        });
     if(status != SOAP_OK) {
-        const char* faultString = soap_fault_string(soap);
+        eventSubscriptionEndpoint.clear();
+
+        const char* faultString = session.faultString();
         GError* error = g_error_new_literal(SoapDomain, status, faultString ? faultString : "PullMessages failed");
-        g_task_return_error(task, error);
-        return;
+        g_propagate_error(outError, error);
+        return false;
     }
 
-    for(const wsnt__NotificationMessageHolderType* messageHolder: pullMessagesResponse.wsnt__NotificationMessage) {
-        const soap_dom_element& message = messageHolder->Message.__any;
-        soap_dom_element* data = message.elt_get("tt:Data");
-        if(!data) {
-            GError* error =
-                g_error_new_literal(
-                    Domain,
-                    NOTIFICATION_MESSAGE_HAS_NO_DATA_ELEMENT,
-                    "Notification message has no data element");
-            g_task_return_error(task, error);
-            return;
-        }
-
-        soap_dom_element* simpleItem = data->elt_get("tt:SimpleItem");
-        for(;simpleItem; simpleItem = simpleItem->get_next()) {
-            const soap_dom_attribute* name = simpleItem->att_get("Name");
-            if(!name || !name->get_text()) continue;
-            if(name->get_text() != std::string("IsMotion")) continue;
+    const auto parseStartTime = std::chrono::steady_clock::now();
+    OnvifEvent events[PullMessagesLimit];
+    size_t eventsCount = 0;
+    const OnvifNotificationParseResult parseResult =
+        ParseOnvifNotifications(
+            std::string_view(responseBody, responseBodySize),
+            events,
+            PullMessagesLimit,
+            &eventsCount);
+    log->debug(
+        "{} notification message(s) parsed in {} us",
+        eventsCount,
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - parseStartTime).count());
+
+    switch(parseResult) {
+    case OnvifNotificationParseResult::Ok:
+        break;
+    case OnvifNotificationParseResult::Fault: {
+        eventSubscriptionEndpoint.clear();
+
+        GError* error = g_error_new_literal(SoapDomain, SOAP_FAULT, "PullMessages failed");
+        g_propagate_error(outError, error);
+        return false;
+    }
+    case OnvifNotificationParseResult::Malformed: {
+        GError* error =
+            g_error_new_literal(
+                Domain,
+                MALFORMED_NOTIFICATION_MESSAGE,
+                "PullMessages response is malformed");
+        g_propagate_error(outError, error);
+        return false;
+    }
+    }
 
-            const soap_dom_attribute* value = simpleItem->att_get("Value");
-            if(!value || !value->get_text()) continue;
+    FindMotionState(events, eventsCount, isMotion);
 
-            gboolean isMotion = value->is_true();
+    return true;
+}
 
-            g_task_return_boolean(task, isMotion);
-            return;
-        }
-    }
+bool OnvifPlayer::Private::useEventTopicFilter() const noexcept
+{
+    return !eventTopicExpression.empty() && !eventTopicFilterRejected;
+}
 
-    g_task_return_boolean(task, false);
+void OnvifPlayer::Private::onEventTopicFilterRejected(const char* request) noexcept
+{
+    eventTopicFilterRejected = true;
+
+    const char* faultString = session.faultString();
+    log->warn(
+        "Camera rejected {} with topic filter \"{}\" ({}). Subscribing to all topics...",
+        request,
+        eventTopicExpression,
+        faultString ? faultString : "unknown reason");
 }
 
 void OnvifPlayer::Private::requestMediaUris() noexcept
@@ -471,25 +934,151 @@ void OnvifPlayer::Private::requestMediaUris() noexcept
     mediaUrlRequestTaskPtr.reset(task);
 
     g_task_set_return_on_cancel(task, true);
-    g_task_set_task_data(task, const_cast<OnvifPlayer::Private*>(this), nullptr);
+    g_task_set_task_data(task, this, nullptr);
 
-    g_task_run_in_thread(task, requestMediaUrisTaskFunc);
+    runTask(task, requestMediaUrisTaskFunc);
 }
 
 void OnvifPlayer::Private::onMediaUris(std::unique_ptr<MediaUris>& mediaUris) noexcept
 {
     log->info("Media stream uri discovered: {}", mediaUris->streamUri);
+    ReportStartupStage("ONVIF discovery finished");
+
+    // discovery outran main loop
+    if(cachedPlaySource) {
+        g_source_destroy(cachedPlaySource.get());
+        cachedPlaySource.reset();
+        cachedMediaUris.reset();
+    }
+
+    const bool cachedUrisConfirmed =
+        playingCachedUris &&
+        this->mediaUris->streamUri == mediaUris->streamUri &&
+        this->mediaUris->substreamUri == mediaUris->substreamUri;
+    playingCachedUris = false;
 
     this->mediaUris.swap(mediaUris);
 
+    if(discoveryCache)
+        saveDiscoveryCache();
+
+    overloadStartTime = headroomStartTime = profileSwitchTime = std::chrono::steady_clock::time_point();
+    profileStepMetric->set(this->mediaUris->profileStep);
+
     if(trackMotion) {
-        startMotionEventRequestTimeout();
+        if(connectedCallback)
+            connectedCallback(*owner);
+
+        // with motion callback playback is controlled by the caller
+        if(!motionCallback) {
+            if(preMotionBuffer)
+                preMotionBuffer->start(this->mediaUris->streamUri);
+            else if(motionPreviewStandby)
+                prepareStandby();
+        }
+
+        switch(motionEvents) {
+        case StreamSource::MotionEvents::Poll:
+            startMotionEventRequestTimeout();
+            break;
+        case StreamSource::MotionEvents::Pump:
+            startEventPump();
+            break;
+        case StreamSource::MotionEvents::Push:
+            startPushSubscription();
+            break;
+        }
+    } else if(cachedUrisConfirmed) {
+        log->info("Cached media stream uri is confirmed by discovery");
     } else {
-        if(!owner->UrlPlayer::play(this->mediaUris->streamUri))
+        if(!owner->UrlPlayer::play(this->mediaUris->streamUri, this->mediaUris->substreamUri))
             onError();
     }
 }
 
+void OnvifPlayer::Private::startFromDiscoveryCache() noexcept
+{
+    if(!coldStart)
+        return;
+
+    coldStart = false;
+
+    if(!discoveryCache)
+        return;
+
+    std::optional<DiscoveryCacheEntry> entry = LoadDiscoveryCache(discoveryCacheKey);
+    if(!entry) {
+        log->info("There are no cached discovery results for the device");
+        return;
+    }
+
+    {
+        // there is no discovery task yet, so it's not contended
+        OnvifSession::Lock lock(session);
+        session.setEndpoints(entry->mediaEndpoint, entry->eventsEndpoint);
+    }
+
+    // motion tracking is started only with discovered uris
+    if(trackMotion)
+        return;
+
+    cachedMediaUris.reset(new MediaUris {
+        .streamUri = entry->streamUri,
+        .substreamUri = entry->substreamUri });
+
+    // GStreamer could be still initializing, so playback is started from main loop
+    cachedPlaySource.reset(g_idle_source_new());
+    GSource* idleSource = cachedPlaySource.get();
+    g_source_set_callback(
+        idleSource,
+        [] (gpointer userData) -> gboolean {
+            OnvifPlayer::Private* self = static_cast<OnvifPlayer::Private*>(userData);
+            self->cachedPlaySource.reset();
+            self->playCachedMediaUris();
+            return G_SOURCE_REMOVE;
+        },
+        this,
+        nullptr);
+    g_source_attach(idleSource, g_main_context_get_thread_default());
+}
+
+void OnvifPlayer::Private::playCachedMediaUris() noexcept
+{
+    log->info("Starting cached media stream uri while discovery revalidates it: {}", cachedMediaUris->streamUri);
+
+    mediaUris = std::move(cachedMediaUris);
+    playingCachedUris = true;
+
+    if(!owner->UrlPlayer::play(mediaUris->streamUri, mediaUris->substreamUri)) {
+        playingCachedUris = false;
+        mediaUris.reset();
+    }
+}
+
+void OnvifPlayer::Private::saveDiscoveryCache() noexcept
+{
+    SaveDiscoveryCache(
+        discoveryCacheKey,
+        DiscoveryCacheEntry {
+            .mediaEndpoint = mediaUris->mediaEndpoint,
+            .eventsEndpoint = mediaUris->eventsEndpoint,
+            .streamUri = mediaUris->streamUri,
+            .substreamUri = mediaUris->substreamUri });
+}
+
+void OnvifPlayer::Private::onPlaybackEos() noexcept
+{
+    if(playingCachedUris) {
+        // discovery in progress will provide actual uris
+        log->warn("Cached media stream uri is not playable anymore. Waiting for discovery...");
+        playingCachedUris = false;
+        mediaUris.reset();
+        return;
+    }
+
+    onError();
+}
+
 void OnvifPlayer::Private::startMotionEventRequestTimeout(bool increaseDelay) noexcept
 {
     assert(!moitionEventRequestTimeoutSource);
@@ -505,7 +1094,7 @@ void OnvifPlayer::Private::startMotionEventRequestTimeout(bool increaseDelay) no
         };
 
     lastMoitionEventRequestTimeout = increaseDelay ?
-        std::min(16u, lastMoitionEventRequestTimeout * 2) :
+        std::min<unsigned>(MAX_MOTION_EVENT_REQUEST_TIMEOUT, lastMoitionEventRequestTimeout * 2) :
         MOTION_EVENT_REQUEST_TIMEOUT;
 
     moitionEventRequestTimeoutSource =
@@ -556,21 +1145,413 @@ void OnvifPlayer::Private::requestMotionEvent() noexcept
         this,
         nullptr);
 
-    g_task_run_in_thread(task, requestMotionEventTaskFunc);
+    runTask(task, requestMotionEventTaskFunc);
 }
 
 void OnvifPlayer::Private::onMotionEvent(gboolean isMotion) noexcept
 {
     if(isMotion) {
         log->info("Motion detected!");
+        motionEventsMetric->add();
+
+        if(motionCallback) {
+            motionCallback(*owner);
+            return;
+        }
 
-        if(!owner->isPlaying())
-            owner->UrlPlayer::play(mediaUris->streamUri);
+        if(!owner->isPlaying()) {
+            if(preMotionBuffer && preMotionBuffer->isReady())
+                owner->UrlPlayer::play(PreMotionBufferUri);
+            else
+                owner->UrlPlayer::play(mediaUris->streamUri, mediaUris->substreamUri);
+        }
 
         startPreviewStopTimeout();
     }
 }
 
+void OnvifPlayer::Private::startEventPump() noexcept
+{
+    assert(!eventPumpThread.joinable());
+
+    log->info("Starting motion event pump...");
+
+    motionEventQueue =
+        std::make_unique<MainLoopQueue<MotionEvent, 16>>(
+            g_main_context_get_thread_default(),
+            [this] (MotionEvent& event) { onQueuedMotionEvent(event); });
+
+    eventPumpStopRequested = false;
+    eventPumpThread = std::thread(&Private::eventPumpThreadFunc, this);
+}
+
+void OnvifPlayer::Private::eventPumpThreadFunc() noexcept
+{
+    unsigned retryTimeout = 0;
+
+    // next PullMessages is issued as soon as previous one returned
+    // (but not earlier than MinPullMessagesInterval after previous one was issued),
+    // so latency is limited only by camera
+    while(!eventPumpStopRequested) {
+        const auto requestTime = std::chrono::steady_clock::now();
+
+        GError* error = nullptr;
+        gboolean isMotion = FALSE;
+        if(pullMotionEvent(&isMotion, &error)) {
+            retryTimeout = 0;
+
+            if(isMotion) {
+                const bool posted =
+                    motionEventQueue->post(
+                        MotionEvent { isMotion, std::chrono::steady_clock::now() });
+                if(!posted)
+                    log->warn("Motion event queue is full. Event dropped");
+            }
+
+            const auto nextRequestTime = requestTime + MinPullMessagesInterval;
+            if(std::chrono::steady_clock::now() < nextRequestTime) {
+                std::unique_lock<std::mutex> lock(eventPumpMutex);
+                eventPumpStopCondition.wait_until(
+                    lock,
+                    nextRequestTime,
+                    [this] () { return eventPumpStopRequested.load(); });
+            }
+
+            continue;
+        }
+
+        GErrorPtr errorPtr(error);
+        if(eventPumpStopRequested)
+            break;
+
+        retryTimeout =
+            std::clamp<unsigned>(
+                retryTimeout * 2,
+                MOTION_EVENT_REQUEST_TIMEOUT,
+                MAX_MOTION_EVENT_REQUEST_TIMEOUT);
+
+        log->error(
+            "[{}] {}. Retrying within {} seconds...",
+            g_quark_to_string(errorPtr->domain),
+            errorPtr->message,
+            retryTimeout);
+
+        std::unique_lock<std::mutex> lock(eventPumpMutex);
+        eventPumpStopCondition.wait_for(
+            lock,
+            std::chrono::seconds(retryTimeout),
+            [this] () { return eventPumpStopRequested.load(); });
+    }
+}
+
+void OnvifPlayer::Private::onQueuedMotionEvent(const MotionEvent& event) noexcept
+{
+    log->debug(
+        "Motion event delivered to main loop in {} us",
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - event.pullTime).count());
+
+    onMotionEvent(event.isMotion);
+}
+
+void OnvifPlayer::Private::stopEventPump() noexcept
+{
+    if(!eventPumpThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(eventPumpMutex);
+        eventPumpStopRequested = true;
+    }
+    eventPumpStopCondition.notify_all();
+
+    // to unblock PullMessages in progress
+    session.interrupt();
+
+    eventPumpThread.join();
+
+    motionEventQueue.reset();
+}
+
+void OnvifPlayer::Private::pushSubscriptionTaskFunc(
+    GTask* task,
+    gpointer sourceObject,
+    gpointer taskData,
+    GCancellable* cancellable)
+{
+    OnvifPlayer::Private& self = *static_cast<OnvifPlayer::Private*>(taskData);
+    RunningTask runningTask(self);
+
+    GError* error = nullptr;
+    if(self.subscribePush(&error))
+        g_task_return_boolean(task, TRUE);
+    else
+        g_task_return_error(task, error);
+}
+
+void OnvifPlayer::Private::startPushSubscription() noexcept
+{
+    log->info("Starting motion events push subscription...");
+
+    notifyEventQueue =
+        std::make_unique<MainLoopQueue<MotionEvent, 16>>(
+            g_main_context_get_thread_default(),
+            [this] (MotionEvent& event) { onQueuedMotionEvent(event); });
+
+    notifyListener =
+        std::make_unique<HttpListener>(
+            [this] (const HttpListener::Request& request) { return onNotify(request); });
+    if(!notifyListener->listen(notifyPort, false)) {
+        fallbackToPull();
+        return;
+    }
+
+    requestPushSubscription();
+}
+
+bool OnvifPlayer::Private::resolveNotifyConsumerAddress(
+    const std::string& eventsEndpoint,
+    GError** outError) noexcept
+{
+    std::string host = notifyHost;
+    if(host.empty()) {
+        // local address used to reach camera should be reachable from camera too
+        GUriPtr uriPtr(g_uri_parse(eventsEndpoint.c_str(), G_URI_FLAGS_NONE, outError));
+        GUri* uri = uriPtr.get();
+        if(!uri)
+            return false;
+
+        const gint port = g_uri_get_port(uri);
+        ObjectPtr<GSocketConnectable> cameraPtr(
+            g_network_address_new(g_uri_get_host(uri), port > 0 ? port : 80));
+        ObjectPtr<GSocketAddressEnumerator> enumeratorPtr(
+            g_socket_connectable_enumerate(cameraPtr.get()));
+        ObjectPtr<GSocketAddress> cameraAddressPtr(
+            g_socket_address_enumerator_next(enumeratorPtr.get(), nullptr, outError));
+        GSocketAddress* cameraAddress = cameraAddressPtr.get();
+        if(!cameraAddress)
+            return false;
+
+        ObjectPtr<GSocket> socketPtr(
+            g_socket_new(
+                g_socket_address_get_family(cameraAddress),
+                G_SOCKET_TYPE_DATAGRAM,
+                G_SOCKET_PROTOCOL_UDP,
+                outError));
+        GSocket* socket = socketPtr.get();
+        if(!socket || !g_socket_connect(socket, cameraAddress, nullptr, outError))
+            return false;
+
+        ObjectPtr<GSocketAddress> localAddressPtr(g_socket_get_local_address(socket, outError));
+        if(!localAddressPtr)
+            return false;
+
+        GInetAddress* localAddress =
+            g_inet_socket_address_get_address(G_INET_SOCKET_ADDRESS(localAddressPtr.get()));
+        GCharPtr localAddressStringPtr(g_inet_address_to_string(localAddress));
+        host = localAddressStringPtr.get();
+    }
+
+    GCharPtr consumerAddressPtr(
+        g_uri_join(
+            G_URI_FLAGS_NONE,
+            "http",
+            nullptr, // userinfo
+            host.c_str(),
+            notifyListener->port(),
+            NotifyPath,
+            nullptr, // query
+            nullptr)); // fragment
+    notifyConsumerAddress = consumerAddressPtr.get();
+
+    return true;
+}
+
+bool OnvifPlayer::Private::subscribePush(GError** outError) noexcept
+{
+    soap_status status;
+
+    OnvifSession::Lock lock(session);
+
+    if(!pushSubscriptionEndpoint.empty()) {
+        _wsnt__Renew renew;
+        std::string TerminationTime = PushSubscriptionDuration;
+        renew.TerminationTime = &TerminationTime;
+        _wsnt__RenewResponse renewResponse;
+        status = session.call(
+            "Renew",
+            [&] (struct soap* soap) {
+                return soap_call___tev__Renew(
+                    soap,
+                    pushSubscriptionEndpoint.c_str(),
+                    nullptr,
+                    &renew,
+                    renewResponse);
+            });
+        if(status == SOAP_OK)
+            return true;
+
+        // subscription is lost, trying to subscribe again
+        pushSubscriptionEndpoint.clear();
+    }
+
+    std::string eventsEndpoint;
+    status = session.eventsEndpoint(&eventsEndpoint);
+    if(status != SOAP_OK) {
+        const char* faultString = session.faultString();
+        GError* error = g_error_new_literal(SoapDomain, status, faultString ? faultString : "GetCapabilities failed");
+        g_propagate_error(outError, error);
+        return false;
+    }
+
+    if(notifyConsumerAddress.empty() && !resolveNotifyConsumerAddress(eventsEndpoint, outError))
+        return false;
+
+    _wsnt__Subscribe subscribe;
+    subscribe.ConsumerReference.Address = const_cast<char*>(notifyConsumerAddress.c_str());
+    std::string InitialTerminationTime = PushSubscriptionDuration;
+    subscribe.InitialTerminationTime = &InitialTerminationTime;
+    _wsnt__SubscribeResponse subscribeResponse;
+    bool filtered = useEventTopicFilter();
+    auto subscribeCall =
+        [&] (struct soap* soap) {
+            subscribe.Filter = filtered ? NewTopicFilter(soap, eventTopicExpression) : nullptr;
+            return soap_call___tev__Subscribe(
+                soap,
+                eventsEndpoint.c_str(),
+                nullptr,
+                &subscribe,
+                subscribeResponse);
+        };
+    status = session.call("Subscribe", subscribeCall);
+    if(status != SOAP_OK && filtered && IsRequestRejected(status)) {
+        onEventTopicFilterRejected("Subscribe");
+        filtered = false;
+        status = session.call("Subscribe", subscribeCall);
+    }
+    if(status != SOAP_OK) {
+        const char* faultString = session.faultString();
+        GError* error = g_error_new_literal(SoapDomain, status, faultString ? faultString : "Subscribe failed");
+        g_propagate_error(outError, error);
+        return false;
+    }
+
+    pushSubscriptionEndpoint = subscribeResponse.SubscriptionReference.Address;
+
+    return true;
+}
+
+void OnvifPlayer::Private::requestPushSubscription() noexcept
+{
+    auto readyCallback =
+        [] (GObject* sourceObject, GAsyncResult* result, gpointer userData) {
+            g_return_if_fail(g_task_is_valid(result, sourceObject));
+
+            GError* error = nullptr;
+            g_task_propagate_boolean(G_TASK(result), &error);
+            GErrorPtr errorPtr(error);
+            if(errorPtr) {
+                MonitorLog()->error(
+                    "[{}] {}",
+                    g_quark_to_string(errorPtr->domain),
+                    errorPtr->message);
+
+                if(errorPtr->code != G_IO_ERROR_CANCELLED) {
+                    // has error but not cancelled (i.e. owner is still available)
+                    OnvifPlayer::Private* self =
+                        reinterpret_cast<OnvifPlayer::Private*>(userData);
+                    self->onPushSubscriptionFailed(errorPtr.get());
+                }
+            } else {
+                // no error and not cancelled yet
+                OnvifPlayer::Private* self =
+                    reinterpret_cast<OnvifPlayer::Private*>(userData);
+                self->lastPushSubscriptionRetryTimeout = 0;
+                self->startPushSubscriptionTimeout(PullSubscriptionRefreshInterval.count());
+            }
+        };
+
+    GCancellable* cancellable = g_cancellable_new();
+    GTask* task = g_task_new(nullptr, cancellable, readyCallback, this);
+    pushSubscriptionTaskCancellablePtr.reset(cancellable);
+    pushSubscriptionTaskPtr.reset(task);
+
+    g_task_set_return_on_cancel(task, true);
+    g_task_set_task_data(task, this, nullptr);
+
+    runTask(task, pushSubscriptionTaskFunc);
+}
+
+void OnvifPlayer::Private::startPushSubscriptionTimeout(unsigned timeout) noexcept
+{
+    assert(!pushSubscriptionTimeoutSource);
+
+    auto timeoutFunc =
+        [] (gpointer userData) -> gboolean {
+            Private* p = static_cast<Private*>(userData);
+
+            p->pushSubscriptionTimeoutSource = 0;
+            p->requestPushSubscription();
+
+            return FALSE;
+        };
+
+    pushSubscriptionTimeoutSource =
+        timeoutAddSeconds(
+            timeout,
+            timeoutFunc,
+            this);
+}
+
+void OnvifPlayer::Private::onPushSubscriptionFailed(const GError* error) noexcept
+{
+    if(IsNetworkError(error, SoapDomain)) {
+        lastPushSubscriptionRetryTimeout =
+            std::clamp<unsigned>(
+                lastPushSubscriptionRetryTimeout * 2,
+                MOTION_EVENT_REQUEST_TIMEOUT,
+                MAX_MOTION_EVENT_REQUEST_TIMEOUT);
+        startPushSubscriptionTimeout(lastPushSubscriptionRetryTimeout);
+    } else {
+        log->warn("Camera doesn't accept push subscription. Falling back to pull...");
+        fallbackToPull();
+    }
+}
+
+HttpListener::Response OnvifPlayer::Private::onNotify(const HttpListener::Request& request) noexcept
+{
+    if(request.method != "POST")
+        return { .status = 405 };
+
+    OnvifEvent events[NotifyMessagesLimit];
+    size_t eventsCount = 0;
+    const OnvifNotificationParseResult parseResult =
+        ParseOnvifNotifications(request.body, events, NotifyMessagesLimit, &eventsCount);
+    if(parseResult != OnvifNotificationParseResult::Ok) {
+        log->warn("Failed to parse Notify message");
+        return { .status = 400 };
+    }
+
+    gboolean isMotion = FALSE;
+    if(FindMotionState(events, eventsCount, &isMotion) && isMotion) {
+        const bool posted =
+            notifyEventQueue->post(
+                MotionEvent { isMotion, std::chrono::steady_clock::now() });
+        if(!posted)
+            log->warn("Motion event queue is full. Event dropped");
+    }
+
+    return {};
+}
+
+void OnvifPlayer::Private::fallbackToPull() noexcept
+{
+    if(notifyListener)
+        notifyListener->stop();
+
+    startEventPump();
+}
+
 void OnvifPlayer::Private::startPreviewStopTimeout() noexcept
 {
     if(previewStopTimeoutSource) {
@@ -584,7 +1565,13 @@ void OnvifPlayer::Private::startPreviewStopTimeout() noexcept
 
             MonitorLog()->info("Stopping preview by timeout...");
 
-            p->owner->stop();
+            if(p->preMotionBuffer)
+                p->preMotionBuffer->stopPlayback();
+            // standby is re-armed on the same RTSP session
+            if(p->motionPreviewStandby)
+                p->prepareStandby();
+            else
+                p->owner->stop();
 
             p->previewStopTimeoutSource = 0;
             return FALSE;
@@ -597,39 +1584,203 @@ void OnvifPlayer::Private::startPreviewStopTimeout() noexcept
             this);
 }
 
+void OnvifPlayer::Private::prepareStandby() noexcept
+{
+    log->info("Preparing standby pipeline...");
+
+    if(!owner->UrlPlayer::prepare(mediaUris->streamUri))
+        log->warn("Failed to prepare standby pipeline. Preview will be started from scratch");
+}
+
+void OnvifPlayer::Private::onSourceSetup(GstElement* source) noexcept
+{
+    GstElementFactory* factory = gst_element_get_factory(source);
+    if(!factory || g_strcmp0(GST_OBJECT_NAME(factory), "appsrc") != 0)
+        return;
+
+    preMotionBuffer->setupPlayback(source);
+}
+
+void OnvifPlayer::Private::onStandbyEos() noexcept
+{
+    if(standbyRestartTimeoutSource)
+        return;
+
+    auto timeoutFunc =
+        [] (gpointer userData) -> gboolean {
+            Private* p = static_cast<Private*>(userData);
+
+            p->standbyRestartTimeoutSource = 0;
+            if(!p->owner->isPlaying() && !p->owner->isPrepared())
+                p->prepareStandby();
+
+            return FALSE;
+        };
+
+    log->info("Scheduling standby pipeline restart within {} seconds...", STANDBY_RESTART_TIMEOUT);
+
+    standbyRestartTimeoutSource =
+        timeoutAddSeconds(
+            STANDBY_RESTART_TIMEOUT,
+            timeoutFunc,
+            this);
+}
+
+void OnvifPlayer::Private::onDecodeLoad(const UrlPlayer::DecodeLoad& load) noexcept
+{
+    // standby pipeline doesn't decode at all
+    if(!mediaUris || mediaUris->profileSteps.size() < 2 || !owner->isPlaying())
+        return;
+
+    const auto now = std::chrono::steady_clock::now();
+    const std::vector<ProfileStep>& steps = mediaUris->profileSteps;
+    const size_t step = mediaUris->profileStep;
+
+    // late frames are already being dropped to keep up
+    const bool overloaded =
+        step > 0 &&
+        (load.degradationLevel >= 2 || load.busyRatio > OverBudgetBusyRatio);
+
+    bool headroom = false;
+    if(step + 1 < steps.size() && load.degradationLevel == 0 && load.lateFrames == 0) {
+        // decode time is expected to grow proportionally to pixel rate
+        const double expectedBusyRatio = load.busyRatio *
+            steps[step + 1].profile.pixelRate() / steps[step].profile.pixelRate();
+        headroom = expectedBusyRatio < StepUpBusyRatioBudget;
+    }
+
+    if(!overloaded)
+        overloadStartTime = std::chrono::steady_clock::time_point();
+    else if(overloadStartTime == std::chrono::steady_clock::time_point())
+        overloadStartTime = now;
+
+    if(!headroom)
+        headroomStartTime = std::chrono::steady_clock::time_point();
+    else if(headroomStartTime == std::chrono::steady_clock::time_point())
+        headroomStartTime = now;
+
+    if(now - profileSwitchTime < ProfileSwitchHoldTime)
+        return;
+
+    if(overloaded && now - overloadStartTime >= OverloadHoldTime) {
+        log->warn(
+            "Decode load is over budget (degradation level {}, decoder busy {}%)",
+            load.degradationLevel,
+            static_cast<int>(load.busyRatio * 100));
+        switchProfileStep(step - 1);
+    } else if(headroom && now - headroomStartTime >= HeadroomHoldTime) {
+        log->info(
+            "Decode load has headroom (decoder busy {}%)",
+            static_cast<int>(load.busyRatio * 100));
+        switchProfileStep(step + 1);
+    }
+}
+
+void OnvifPlayer::Private::switchProfileStep(size_t step) noexcept
+{
+    const ProfileStep& from = mediaUris->profileSteps[mediaUris->profileStep];
+    const ProfileStep& to = mediaUris->profileSteps[step];
+    log->info(
+        "Switching media profile \"{}\" ({}x{}) -> \"{}\" ({}x{})...",
+        from.profile.token,
+        from.profile.width,
+        from.profile.height,
+        to.profile.token,
+        to.profile.width,
+        to.profile.height);
+
+    mediaUris->profileStep = step;
+    mediaUris->streamUri = to.streamUri;
+
+    overloadStartTime = headroomStartTime = std::chrono::steady_clock::time_point();
+    profileSwitchTime = std::chrono::steady_clock::now();
+    profileStepMetric->set(step);
+    profileSwitchesMetric->add();
+
+    // with persistent sink the last frame of previous profile stays on screen
+    // until the first one of the new profile
+    if(!owner->UrlPlayer::play(mediaUris->streamUri))
+        onError();
+}
+
 
 OnvifPlayer::OnvifPlayer(
     const std::string& url,
     const std::optional<std::string>& username,
     const std::optional<std::string>& password,
-    bool trackMotion,
-    std::chrono::seconds motionPreviewDuration,
-    bool showVideoStats,
-    bool sync,
+    const StreamSource& source,
+    const VideoOutput& videoOutput,
     const EosCallback& eosCallback) noexcept :
     UrlPlayer(
-        showVideoStats,
-        sync,
-        trackMotion ?
-            UrlPlayer::EosCallback() :
-            [eosCallback] (UrlPlayer& player) { eosCallback(static_cast<OnvifPlayer&>(player)); }),
+        videoOutput.showStats,
+        videoOutput.sync,
+        source.trackMotion ?
+            (source.motionPreviewStandby ?
+                [this] (UrlPlayer&) { _p->onStandbyEos(); } :
+                UrlPlayer::EosCallback()) :
+            [this] (UrlPlayer&) { _p->onPlaybackEos(); }),
     _p(std::make_unique<OnvifPlayer::Private>(
         this,
         url,
         username,
         password,
-        trackMotion,
-        motionPreviewDuration,
+        source,
+        videoOutput,
         eosCallback))
 {
+    setLeanRtspPipeline(source.leanPipeline, source.rtspLatency);
+    setStallTimeout(videoOutput.stallTimeout);
+    setLatencyControl(videoOutput.latencyTarget, videoOutput.maxCatchUpRate);
+    // with "decode-degradation" disabled decode load is measured without frames skipping
+    setDecodeDegradation(videoOutput.decodeDegradation, videoOutput.degradedFramerate);
+    if(_p->adaptiveProfile) {
+        setDecodeLoadCallback(
+            [this] (UrlPlayer&, const DecodeLoad& load) { _p->onDecodeLoad(load); });
+    }
+    // profile switch restarts source, and only persistent sink keeps last frame on screen meanwhile
+    if(_p->adaptiveProfile && !videoOutput.persistentSink)
+        _p->log->warn("\"persistent-sink\" is forced by \"adaptive-profile\"");
+    if(_p->adaptiveProfile && source.leanPipeline)
+        _p->log->warn("Lean pipeline doesn't keep video sink, so profile switches will show black frames");
+    setPersistentSink(videoOutput.persistentSink || _p->adaptiveProfile);
+
+    if(source.trackMotion && source.preMotionBuffer.count() > 0) {
+        _p->preMotionBuffer =
+            std::make_unique<PreMotionBuffer>(
+                source.preMotionBuffer,
+                static_cast<size_t>(source.preMotionBufferSize) * 1024 * 1024);
+        setSourceSetupCallback([this] (GstElement* source) { _p->onSourceSetup(source); });
+    }
 }
 
 OnvifPlayer::~OnvifPlayer()
 {
+    if(_p->preMotionBuffer) {
+        // playback pipeline could be still waiting for buffered frames
+        _p->preMotionBuffer->stopPlayback();
+        UrlPlayer::stop();
+    }
+
     g_cancellable_cancel(_p->mediaUrlRequestTaskCancellablePtr.get());
 
     g_cancellable_cancel(_p->motionEventRequestTaskCancellablePtr.get());
 
+    _p->stopEventPump();
+
+    g_cancellable_cancel(_p->pushSubscriptionTaskCancellablePtr.get());
+
+    // cancelled tasks could be still blocked in SOAP calls
+    _p->session.close();
+    _p->waitTasks();
+
+    if(_p->pushSubscriptionTimeoutSource) {
+        g_source_destroy(_p->pushSubscriptionTimeoutSource.get());
+    }
+
+    if(_p->notifyListener) {
+        _p->notifyListener->stop();
+    }
+
     if(_p->moitionEventRequestTimeoutSource) {
         g_source_destroy(_p->moitionEventRequestTimeoutSource.get());
     }
@@ -637,9 +1788,48 @@ OnvifPlayer::~OnvifPlayer()
     if(_p->previewStopTimeoutSource) {
         g_source_destroy(_p->previewStopTimeoutSource.get());
     }
+
+    if(_p->standbyRestartTimeoutSource) {
+        g_source_destroy(_p->standbyRestartTimeoutSource.get());
+    }
+
+    if(_p->cachedPlaySource) {
+        g_source_destroy(_p->cachedPlaySource.get());
+    }
+}
+
+void OnvifPlayer::setMotionCallback(const MotionCallback& motionCallback) noexcept
+{
+    _p->motionCallback = motionCallback;
+}
+
+void OnvifPlayer::setConnectedCallback(const ConnectedCallback& connectedCallback) noexcept
+{
+    _p->connectedCallback = connectedCallback;
+
+    if(!_p->trackMotion) {
+        setFirstFrameCallback(
+            [this] (UrlPlayer&) {
+                if(_p->connectedCallback)
+                    _p->connectedCallback(*this);
+            });
+    }
+}
+
+const std::string& OnvifPlayer::streamUri() const noexcept
+{
+    static const std::string empty;
+    return _p->mediaUris ? _p->mediaUris->streamUri : empty;
+}
+
+const std::string& OnvifPlayer::substreamUri() const noexcept
+{
+    static const std::string empty;
+    return _p->mediaUris ? _p->mediaUris->substreamUri : empty;
 }
 
 void OnvifPlayer::play() noexcept
 {
+    _p->startFromDiscoveryCache();
     _p->requestMediaUris();
 }
@@ -7,6 +7,7 @@
 #include <memory>
 #include <chrono>
 
+#include "Config.h"
 #include "UrlPlayer.h"
 
 
@@ -18,21 +19,34 @@ public:
         DEVICE_MEDIA_PROFILE_HAS_NO_STREAM_URI = 2,
         NOTIFICATION_MESSAGE_HAS_NO_DATA_ELEMENT = 3,
         NOTIFICATION_MESSAGE_DOES_NOT_CONTAIN_MOTION_EVENT = 4,
+        MALFORMED_NOTIFICATION_MESSAGE = 5,
     };
 
     typedef std::function<void (OnvifPlayer&)> EosCallback;
+    typedef std::function<void (OnvifPlayer&)> MotionCallback;
+    typedef std::function<void (OnvifPlayer&)> ConnectedCallback;
 
     OnvifPlayer(
         const std::string& url,
         const std::optional<std::string>& username,
         const std::optional<std::string>& password,
-        bool trackMotion,
-        std::chrono::seconds motionPreviewDuration,
-        bool showVideoStats,
-        bool sync,
+        const StreamSource&,
+        const VideoOutput&,
         const EosCallback&) noexcept;
     ~OnvifPlayer();
 
+    // if set, motion events are only reported to callback
+    // and playback is left to the caller
+    void setMotionCallback(const MotionCallback&) noexcept;
+
+    // called when media stream uri is discovered if motion is tracked,
+    // or when the first frame is shown otherwise
+    void setConnectedCallback(const ConnectedCallback&) noexcept;
+
+    // empty until discovered by play()
+    const std::string& streamUri() const noexcept;
+    const std::string& substreamUri() const noexcept;
+
     void play() noexcept;
 
 private:
@@ -0,0 +1,157 @@
+#include "OnvifProfile.h"
+
+#include <algorithm>
+#include <cassert>
+#include <optional>
+
+
+namespace {
+
+// codecs cheap to decode (and usually hardware accelerated) go first
+unsigned EncodingRank(const std::string& encoding)
+{
+    if(encoding == "H264")
+        return 3;
+    if(encoding == "H265")
+        return 2;
+    if(encoding == "MPEG4")
+        return 1;
+
+    return 0;
+}
+
+// true if "a" provides better quality than "b"
+bool IsBetter(const OnvifProfileInfo& a, const OnvifProfileInfo& b)
+{
+    const unsigned long long aArea = static_cast<unsigned long long>(a.width) * a.height;
+    const unsigned long long bArea = static_cast<unsigned long long>(b.width) * b.height;
+    if(aArea != bArea)
+        return aArea > bArea;
+
+    if(EncodingRank(a.encoding) != EncodingRank(b.encoding))
+        return EncodingRank(a.encoding) > EncodingRank(b.encoding);
+
+    if(a.frameRate != b.frameRate)
+        return a.frameRate > b.frameRate;
+
+    return a.bitrate < b.bitrate;
+}
+
+// true if "a" is cheaper to receive and decode than "b"
+bool IsLighter(const OnvifProfileInfo& a, const OnvifProfileInfo& b)
+{
+    if(a.pixelRate() != b.pixelRate())
+        return a.pixelRate() < b.pixelRate();
+
+    if(EncodingRank(a.encoding) != EncodingRank(b.encoding))
+        return EncodingRank(a.encoding) > EncodingRank(b.encoding);
+
+    return a.bitrate < b.bitrate;
+}
+
+}
+
+bool OnvifProfileLimits::fits(const OnvifProfileInfo& profile) const noexcept
+{
+    if(maxWidth && profile.width > maxWidth)
+        return false;
+    if(maxHeight && profile.height > maxHeight)
+        return false;
+    if(maxBitrate && profile.bitrate > maxBitrate)
+        return false;
+    if(maxPixelRate && profile.pixelRate() > maxPixelRate)
+        return false;
+
+    return true;
+}
+
+size_t SelectOnvifProfile(
+    const std::vector<OnvifProfileInfo>& profiles,
+    const OnvifProfileLimits& limits,
+    const char** reason) noexcept
+{
+    assert(!profiles.empty());
+
+    if(limits.empty()) {
+        *reason = "no limits configured, first profile is used";
+        return 0;
+    }
+
+    std::optional<size_t> best;
+    std::optional<size_t> lightest;
+    for(size_t i = 0; i < profiles.size(); ++i) {
+        const OnvifProfileInfo& profile = profiles[i];
+        if(!profile.hasVideo())
+            continue;
+
+        if(limits.fits(profile) && (!best || IsBetter(profile, profiles[*best])))
+            best = i;
+
+        if(!lightest || IsLighter(profile, profiles[*lightest]))
+            lightest = i;
+    }
+
+    if(best) {
+        *reason = "best quality profile fitting limits";
+        return *best;
+    }
+
+    if(lightest) {
+        *reason = "no profile fits limits, the lightest one is used";
+        return *lightest;
+    }
+
+    *reason = "profiles have no video encoder configuration, first profile is used";
+    return 0;
+}
+
+size_t LightestOnvifProfile(const std::vector<OnvifProfileInfo>& profiles) noexcept
+{
+    size_t lightest = 0;
+    for(size_t i = 1; i < profiles.size(); ++i) {
+        const OnvifProfileInfo& profile = profiles[i];
+        if(!profile.hasVideo())
+            continue;
+
+        if(!profiles[lightest].hasVideo() || IsLighter(profile, profiles[lightest]))
+            lightest = i;
+    }
+
+    return lightest;
+}
+
+std::vector<size_t> OnvifProfileLadder(
+    const std::vector<OnvifProfileInfo>& profiles,
+    size_t selected) noexcept
+{
+    assert(selected < profiles.size());
+
+    const OnvifProfileInfo& selectedProfile = profiles[selected];
+    if(!selectedProfile.hasVideo())
+        return { selected };
+
+    std::vector<size_t> ladder;
+    for(size_t i = 0; i < profiles.size(); ++i) {
+        const OnvifProfileInfo& profile = profiles[i];
+        if(i != selected && profile.hasVideo() && IsLighter(profile, selectedProfile) &&
+            profile.pixelRate() < selectedProfile.pixelRate())
+        {
+            ladder.push_back(i);
+        }
+    }
+
+    std::sort(
+        ladder.begin(),
+        ladder.end(),
+        [&profiles] (size_t a, size_t b) { return IsLighter(profiles[a], profiles[b]); });
+    ladder.erase(
+        std::unique(
+            ladder.begin(),
+            ladder.end(),
+            [&profiles] (size_t a, size_t b) { return profiles[a].pixelRate() == profiles[b].pixelRate(); }),
+        ladder.end());
+
+    ladder.push_back(selected);
+
+    return ladder;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+
+// Video parameters of ONVIF media profile.
+// 0 means parameter is unknown.
+struct OnvifProfileInfo
+{
+    std::string token;
+    std::string encoding;
+    unsigned width = 0;
+    unsigned height = 0;
+    unsigned frameRate = 0;
+    unsigned bitrate = 0; // kbps
+
+    bool hasVideo() const noexcept { return width && height; }
+    unsigned long long pixelRate() const noexcept
+        { return static_cast<unsigned long long>(width) * height * (frameRate ? frameRate : 1); }
+};
+
+// 0 means no limit
+struct OnvifProfileLimits
+{
+    unsigned maxWidth = 0;
+    unsigned maxHeight = 0;
+    unsigned maxBitrate = 0; // kbps
+    unsigned long long maxPixelRate = 0; // pixels per second to decode
+
+    bool empty() const noexcept
+        { return !maxWidth && !maxHeight && !maxBitrate && !maxPixelRate; }
+    bool fits(const OnvifProfileInfo&) const noexcept;
+};
+
+// Picks profile with the best quality which still fits limits.
+// If there is no such profile the lightest one is used.
+// Returns index of selected profile and sets static description of the choice to reason.
+size_t SelectOnvifProfile(
+    const std::vector<OnvifProfileInfo>& profiles,
+    const OnvifProfileLimits& limits,
+    const char** reason) noexcept;
+
+// returns index of profile cheapest to receive and decode
+size_t LightestOnvifProfile(const std::vector<OnvifProfileInfo>& profiles) noexcept;
+
+// Returns indexes of video profiles not heavier than selected one ordered from the lightest,
+// so selected profile is the last one. Profiles with the same pixel rate are represented by the lightest of them.
+std::vector<size_t> OnvifProfileLadder(
+    const std::vector<OnvifProfileInfo>& profiles,
+    size_t selected) noexcept;
@@ -0,0 +1,318 @@
+#include "OnvifSession.h"
+
+#include <sys/socket.h>
+
+#include <gsoap/plugin/wsseapi.h>
+
+#include <CxxPtr/GlibPtr.h>
+
+
+namespace {
+
+const int ConnectTimeout = 10; // seconds
+const int IoTimeout = 30; // seconds, should be greater than any PullMessages timeout
+
+}
+
+OnvifSession::Lock::Lock(OnvifSession& session) noexcept :
+    _session(session),
+    _guard(session._mutex)
+{
+}
+
+OnvifSession::Lock::~Lock()
+{
+    struct soap* soap = _session._soap;
+
+    soap_destroy(soap);
+    soap_end(soap);
+}
+
+OnvifSession::OnvifSession(
+    const std::string& url,
+    const std::optional<std::string>& username,
+    const std::optional<std::string>& password) noexcept :
+    _log(MonitorLog()),
+    _url(url),
+    _username(username),
+    _password(password)
+{
+    struct soap* soap = _soap;
+
+    soap_set_mode(soap, SOAP_IO_KEEPALIVE);
+    soap->connect_timeout = ConnectTimeout;
+    soap->send_timeout = IoTimeout;
+    soap->recv_timeout = IoTimeout;
+
+    soap->user = this;
+    _defaultOpen = soap->fopen;
+    soap->fopen = &OnvifSession::onOpen;
+    _defaultCloseSocket = soap->fclosesocket;
+    soap->fclosesocket = &OnvifSession::onCloseSocket;
+}
+
+SOAP_SOCKET OnvifSession::onOpen(
+    struct soap* soap,
+    const char* endpoint,
+    const char* host,
+    int port)
+{
+    OnvifSession* self = static_cast<OnvifSession*>(soap->user);
+
+    {
+        std::lock_guard<std::mutex> socketLock(self->_socketMutex);
+        if(self->_closed) {
+            soap->error = SOAP_TCP_ERROR;
+            return SOAP_INVALID_SOCKET;
+        }
+    }
+
+    const SOAP_SOCKET socket = self->_defaultOpen(soap, endpoint, host, port);
+
+    std::lock_guard<std::mutex> socketLock(self->_socketMutex);
+    self->_socket = socket;
+
+    // closed while connecting
+    if(self->_closed && soap_valid_socket(socket))
+        shutdown(socket, SHUT_RDWR);
+
+    return socket;
+}
+
+int OnvifSession::onCloseSocket(struct soap* soap, SOAP_SOCKET socket)
+{
+    OnvifSession* self = static_cast<OnvifSession*>(soap->user);
+
+    // socket is forgotten before it's closed,
+    // so interrupt() can't shutdown descriptor reused by somebody else
+    {
+        std::lock_guard<std::mutex> socketLock(self->_socketMutex);
+        if(self->_socket == socket)
+            self->_socket = SOAP_INVALID_SOCKET;
+    }
+
+    return self->_defaultCloseSocket(soap, socket);
+}
+
+void OnvifSession::interrupt() noexcept
+{
+    std::lock_guard<std::mutex> socketLock(_socketMutex);
+
+    if(soap_valid_socket(_socket))
+        shutdown(_socket, SHUT_RDWR);
+}
+
+void OnvifSession::close() noexcept
+{
+    std::lock_guard<std::mutex> socketLock(_socketMutex);
+
+    _closed = true;
+
+    if(soap_valid_socket(_socket))
+        shutdown(_socket, SHUT_RDWR);
+}
+
+void OnvifSession::addAuth() noexcept
+{
+    if(!_username && !_password) return;
+
+    soap_wsse_add_UsernameTokenDigest(
+        _soap,
+        nullptr,
+        _username ? _username->c_str() : "",
+        _password ? _password->c_str() : "");
+}
+
+OnvifSession::CallMetrics& OnvifSession::callMetrics(const char* name) noexcept
+{
+    auto it = _callMetrics.find(name);
+    if(it != _callMetrics.end())
+        return it->second;
+
+    const MetricLabels labels = { { "device", MetricsUrlLabel(_url) }, { "call", name } };
+    CallMetrics metrics {
+        .calls = RegisterMetric(
+            MetricType::Counter, "monitor_onvif_calls_total", "ONVIF calls", labels),
+        .failedCalls = RegisterMetric(
+            MetricType::Counter, "monitor_onvif_failed_calls_total", "Failed ONVIF calls", labels),
+        .lastLatency = RegisterMetric(
+            MetricType::Gauge, "monitor_onvif_call_latency_us", "Round trip time of the last ONVIF call", labels),
+        .totalLatency = RegisterMetric(
+            MetricType::Counter, "monitor_onvif_call_latency_us_total", "Sum of ONVIF calls round trip times", labels),
+    };
+
+    return _callMetrics.emplace(name, metrics).first->second;
+}
+
+void OnvifSession::onCallFinished(
+    const char* name,
+    soap_status status,
+    std::chrono::microseconds latency) noexcept
+{
+    const uint64_t latencyUs = latency.count();
+
+    ++_stats.calls;
+    _stats.lastCallLatency = latencyUs;
+    _stats.totalCallLatency += latencyUs;
+    if(latencyUs > _stats.maxCallLatency)
+        _stats.maxCallLatency = latencyUs;
+
+    CallMetrics& metrics = callMetrics(name);
+    metrics.calls->add();
+    metrics.lastLatency->set(latencyUs);
+    metrics.totalLatency->add(latencyUs);
+
+    if(status != SOAP_OK) {
+        ++_stats.failedCalls;
+        metrics.failedCalls->add();
+
+        // connection state and cached endpoints can't be trusted anymore
+        soap_closesock(_soap);
+        invalidateEndpoints();
+    }
+
+    _log->debug(
+        "[OnvifSession] {} {} in {} ms (round-trips saved: {})",
+        name,
+        status == SOAP_OK ? "succeeded" : "failed",
+        latencyUs / 1000,
+        _stats.roundTripsSaved.load());
+}
+
+const char* OnvifSession::faultString() noexcept
+{
+    return soap_fault_string(_soap);
+}
+
+soap_status OnvifSession::requestCapabilities() noexcept
+{
+    _tds__GetCapabilities getCapabilities;
+    getCapabilities.Category.push_back(tt__CapabilityCategory::All);
+    _tds__GetCapabilitiesResponse getCapabilitiesResponse;
+    const soap_status status = call(
+        "GetCapabilities",
+        [&] (struct soap* soap) {
+            return soap_call___tds__GetCapabilities(
+                soap,
+                _url.c_str(),
+                nullptr,
+                &getCapabilities,
+                getCapabilitiesResponse);
+        });
+    if(status != SOAP_OK)
+        return status;
+
+    const tt__Capabilities* capabilities = getCapabilitiesResponse.Capabilities;
+    if(capabilities && capabilities->Media)
+        _mediaEndpoint = capabilities->Media->XAddr;
+    if(capabilities && capabilities->Events)
+        _eventsEndpoint = capabilities->Events->XAddr;
+
+    return SOAP_OK;
+}
+
+soap_status OnvifSession::mediaEndpoint(std::string* endpoint) noexcept
+{
+    if(_mediaEndpoint.empty()) {
+        const soap_status status = requestCapabilities();
+        if(status != SOAP_OK)
+            return status;
+
+        if(_mediaEndpoint.empty())
+            return SOAP_NO_DATA;
+    } else {
+        ++_stats.roundTripsSaved;
+    }
+
+    *endpoint = _mediaEndpoint;
+
+    return SOAP_OK;
+}
+
+soap_status OnvifSession::eventsEndpoint(std::string* endpoint) noexcept
+{
+    if(_eventsEndpoint.empty()) {
+        const soap_status status = requestCapabilities();
+        if(status != SOAP_OK)
+            return status;
+
+        if(_eventsEndpoint.empty())
+            return SOAP_NO_DATA;
+    } else {
+        ++_stats.roundTripsSaved;
+    }
+
+    *endpoint = _eventsEndpoint;
+
+    return SOAP_OK;
+}
+
+void OnvifSession::invalidateEndpoints() noexcept
+{
+    _mediaEndpoint.clear();
+    _eventsEndpoint.clear();
+}
+
+void OnvifSession::setEndpoints(const std::string& mediaEndpoint, const std::string& eventsEndpoint) noexcept
+{
+    _mediaEndpoint = mediaEndpoint;
+    _eventsEndpoint = eventsEndpoint;
+}
+
+bool SplitOnvifUrl(
+    const std::string& url,
+    std::string* deviceUrl,
+    std::optional<std::string>* username,
+    std::optional<std::string>* password) noexcept
+{
+    gchar *scheme;
+    gchar *user;
+    gchar *pass;
+    gchar *authParams;
+    gchar *host;
+    gint port;
+    gchar *path;
+    gchar *query;
+    gchar *fragment;
+    if(!g_uri_split_with_user(
+        url.c_str(),
+        G_URI_FLAGS_HAS_PASSWORD,
+        &scheme,
+        &user,
+        &pass,
+        &authParams,
+        &host,
+        &port,
+        &path,
+        &query,
+        &fragment,
+        nullptr))
+    {
+        return false;
+    }
+
+    GCharPtr schemePtr(scheme);
+    GCharPtr userPtr(user);
+    GCharPtr passwordPtr(pass);
+    GCharPtr authParamsPtr(authParams);
+    GCharPtr hostPtr(host);
+    GCharPtr pathPtr(path);
+    GCharPtr queryPtr(query);
+    GCharPtr fragmentPtr(fragment);
+    GCharPtr urlPtr(
+        g_uri_join(
+            G_URI_FLAGS_NONE,
+            scheme,
+            nullptr, // userinfo
+            host,
+            port,
+            path,
+            query,
+            fragment));
+
+    *deviceUrl = urlPtr.get();
+    *username = userPtr ? std::optional<std::string>(userPtr.get()) : std::optional<std::string>();
+    *password = passwordPtr ? std::optional<std::string>(passwordPtr.get()) : std::optional<std::string>();
+
+    return true;
+}
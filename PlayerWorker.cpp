@@ -0,0 +1,404 @@
+#include "PlayerWorker.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+
+#include <glib-unix.h>
+
+#include <fcntl.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "StageTiming.h"
+#include "ThreadPolicy.h"
+#include "UrlPlayer.h"
+#include "VideoSink.h"
+
+
+const char *const PlayerWorkerArg = "--player-worker";
+
+namespace {
+
+const int WorkerSocketFd = 3;
+const char *const WorkerSocketFdString = "3";
+const size_t MaxMessageSize = 8192;
+constexpr std::chrono::milliseconds MinHeartbeatInterval = std::chrono::milliseconds(50);
+
+const char *const PingMessage = "ping";
+const char *const PongMessage = "pong";
+const char *const FirstFrameMessage = "first-frame";
+const char *const EosMessage = "eos";
+const char *const PlayMessagePrefix = "play\n"; // followed by "url\nsubstream url"
+
+bool SendMessage(int fd, const std::string& message)
+{
+    return send(fd, message.data(), message.size(), MSG_NOSIGNAL | MSG_DONTWAIT) == static_cast<ssize_t>(message.size());
+}
+
+// returns false if peer has gone
+bool ReceiveMessage(int fd, GIOCondition condition, std::string* message)
+{
+    message->clear();
+
+    if(condition & G_IO_IN) {
+        char buffer[MaxMessageSize];
+        const ssize_t size = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if(size > 0) {
+            message->assign(buffer, size);
+            return true;
+        }
+
+        if(size < 0 && (errno == EAGAIN || errno == EINTR))
+            return true;
+    }
+
+    return false;
+}
+
+}
+
+struct PlayerWorkerSupervisor::Worker
+{
+    ~Worker();
+
+    PlayerWorkerSupervisor* owner;
+    pid_t pid;
+    int fd;
+    GSourcePtr ioSourcePtr;
+    gint64 lastReplyTime; // monotonic
+    // set by child watch, since reaped pid could be already reused by another process
+    std::shared_ptr<bool> exited;
+
+    void kill() noexcept;
+};
+
+void PlayerWorkerSupervisor::Worker::kill() noexcept
+{
+    if(!*exited)
+        ::kill(pid, SIGKILL);
+}
+
+PlayerWorkerSupervisor::Worker::~Worker()
+{
+    if(ioSourcePtr)
+        g_source_destroy(ioSourcePtr.get());
+
+    close(fd);
+    kill(); // process is reaped by child watch added on spawn
+}
+
+PlayerWorkerSupervisor::PlayerWorkerSupervisor(
+    const PlayerWorkerConfig& config,
+    const EosCallback& eosCallback,
+    const FirstFrameCallback& firstFrameCallback) noexcept :
+    _log(MonitorLog()),
+    _config(config),
+    _eosCallback(eosCallback),
+    _firstFrameCallback(firstFrameCallback),
+    _restartsMetric(
+        RegisterMetric(MetricType::Counter, "monitor_player_worker_restarts_total", "Player worker processes replaced after crash or hang")),
+    _recoveryTimeMetric(
+        RegisterMetric(MetricType::Gauge, "monitor_player_worker_recovery_ms", "Time from player worker loss to the first frame of its replacement"))
+{
+    const std::chrono::milliseconds heartbeatInterval =
+        std::max(_config.heartbeatTimeout / 4, MinHeartbeatInterval);
+    _heartbeatSourcePtr.reset(g_timeout_source_new(heartbeatInterval.count()));
+    GSource* heartbeatSource = _heartbeatSourcePtr.get();
+    g_source_set_callback(
+        heartbeatSource,
+        [] (gpointer userData) -> gboolean {
+            static_cast<PlayerWorkerSupervisor*>(userData)->onHeartbeat();
+            return G_SOURCE_CONTINUE;
+        },
+        this,
+        nullptr);
+    g_source_attach(heartbeatSource, g_main_context_get_thread_default());
+
+    if(_config.killInterval.count() > 0) {
+        _log->warn("Player worker will be killed every {} seconds to measure recovery time", _config.killInterval.count());
+
+        _killSourcePtr.reset(g_timeout_source_new_seconds(_config.killInterval.count()));
+        GSource* killSource = _killSourcePtr.get();
+        g_source_set_callback(
+            killSource,
+            [] (gpointer userData) -> gboolean {
+                PlayerWorkerSupervisor* self = static_cast<PlayerWorkerSupervisor*>(userData);
+                if(self->_active) {
+                    self->_log->info("Killing player worker {}...", self->_active->pid);
+                    self->_active->kill();
+                }
+                return G_SOURCE_CONTINUE;
+            },
+            this,
+            nullptr);
+        g_source_attach(killSource, g_main_context_get_thread_default());
+    }
+}
+
+PlayerWorkerSupervisor::~PlayerWorkerSupervisor()
+{
+    if(_heartbeatSourcePtr)
+        g_source_destroy(_heartbeatSourcePtr.get());
+    if(_killSourcePtr)
+        g_source_destroy(_killSourcePtr.get());
+}
+
+std::unique_ptr<PlayerWorkerSupervisor::Worker> PlayerWorkerSupervisor::spawn() noexcept
+{
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0) {
+        _log->error("Failed to create player worker socket: {}", g_strerror(errno));
+        return nullptr;
+    }
+
+    const pid_t pid = fork();
+    if(pid < 0) {
+        _log->error("Failed to fork player worker: {}", g_strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return nullptr;
+    }
+
+    if(pid == 0) {
+        // only async-signal-safe calls are allowed until exec
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if(fds[1] == WorkerSocketFd)
+            fcntl(WorkerSocketFd, F_SETFD, 0);
+        else
+            dup2(fds[1], WorkerSocketFd);
+        execl("/proc/self/exe", "Monitor", PlayerWorkerArg, WorkerSocketFdString, nullptr);
+        _exit(127);
+    }
+
+    close(fds[1]);
+
+    auto exited = std::make_shared<bool>(false);
+
+    // could outlive Worker, so it owns its own reference to exited flag
+    GSource* childWatchSource = g_child_watch_source_new(pid);
+    g_source_set_callback(
+        childWatchSource,
+        reinterpret_cast<GSourceFunc>(+ [] (GPid pid, gint status, gpointer userData) {
+            MonitorLog()->debug("Player worker {} exited with status {}", pid, status);
+            *(*static_cast<std::shared_ptr<bool>*>(userData)) = true;
+            g_spawn_close_pid(pid);
+        }),
+        new std::shared_ptr<bool>(exited),
+        [] (gpointer userData) { delete static_cast<std::shared_ptr<bool>*>(userData); });
+    g_source_attach(childWatchSource, g_main_context_get_thread_default());
+    g_source_unref(childWatchSource);
+
+    std::unique_ptr<Worker> worker(new Worker { this, pid, fds[0], {}, g_get_monotonic_time(), exited });
+    watch(worker.get());
+
+    _log->info("Player worker {} started", pid);
+
+    return worker;
+}
+
+void PlayerWorkerSupervisor::watch(Worker* worker) noexcept
+{
+    worker->ioSourcePtr.reset(
+        g_unix_fd_source_new(worker->fd, static_cast<GIOCondition>(G_IO_IN | G_IO_HUP | G_IO_ERR)));
+    GSource* ioSource = worker->ioSourcePtr.get();
+    g_source_set_callback(
+        ioSource,
+        reinterpret_cast<GSourceFunc>(+ [] (gint fd, GIOCondition condition, gpointer userData) -> gboolean {
+            Worker* worker = static_cast<Worker*>(userData);
+            PlayerWorkerSupervisor* self = worker->owner;
+
+            std::string message;
+            if(!ReceiveMessage(fd, condition, &message)) {
+                if(worker == self->_active.get())
+                    self->onWorkerLost("has exited");
+                else
+                    self->_spare = self->spawn();
+                return G_SOURCE_REMOVE; // worker is destroyed already
+            }
+
+            worker->lastReplyTime = g_get_monotonic_time();
+            if(worker == self->_active.get() && !message.empty())
+                self->onMessage(message);
+
+            return G_SOURCE_CONTINUE;
+        }),
+        worker,
+        nullptr);
+    g_source_attach(ioSource, g_main_context_get_thread_default());
+}
+
+void PlayerWorkerSupervisor::send(Worker* worker, const std::string& message) noexcept
+{
+    if(!SendMessage(worker->fd, message))
+        _log->warn("Failed to send message to player worker {}", worker->pid);
+}
+
+void PlayerWorkerSupervisor::sendPlay() noexcept
+{
+    if(!_active || !_urls)
+        return;
+
+    send(_active.get(), PlayMessagePrefix + _urls->first + "\n" + _urls->second);
+}
+
+void PlayerWorkerSupervisor::play(const std::string& url, const std::string& substreamUrl) noexcept
+{
+    _urls.emplace(url, substreamUrl);
+
+    if(!_active)
+        _active = spawn();
+    if(!_spare)
+        _spare = spawn();
+
+    if(!_active) {
+        if(_eosCallback)
+            _eosCallback();
+        return;
+    }
+
+    sendPlay();
+}
+
+void PlayerWorkerSupervisor::onMessage(const std::string& message) noexcept
+{
+    if(message == FirstFrameMessage) {
+        if(_failureTime) {
+            const auto recoveryTime =
+                std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - *_failureTime);
+            _failureTime.reset();
+
+            _recoveryTimeMetric->set(recoveryTime.count());
+            _log->info("Player worker recovered in {} ms", recoveryTime.count());
+        }
+
+        if(_firstFrameCallback)
+            _firstFrameCallback();
+    } else if(message == EosMessage) {
+        if(_eosCallback)
+            _eosCallback();
+    }
+}
+
+void PlayerWorkerSupervisor::onHeartbeat() noexcept
+{
+    const gint64 now = g_get_monotonic_time();
+    const gint64 timeout = std::chrono::microseconds(_config.heartbeatTimeout).count();
+
+    if(_spare && now - _spare->lastReplyTime > timeout) {
+        _log->warn("Spare player worker {} doesn't respond. Restarting it...", _spare->pid);
+        _spare = spawn();
+    }
+
+    if(_active && now - _active->lastReplyTime > timeout) {
+        onWorkerLost("doesn't respond");
+        return;
+    }
+
+    if(_active)
+        send(_active.get(), PingMessage);
+    if(_spare)
+        send(_spare.get(), PingMessage);
+}
+
+void PlayerWorkerSupervisor::onWorkerLost(const char* reason) noexcept
+{
+    _log->warn("Player worker {} {}. Switching to spare one...", _active->pid, reason);
+    _restartsMetric->add();
+
+    // the previous replacement failed too, so it's up to reconnect backoff
+    const bool repeatedFailure = _failureTime.has_value();
+    if(!repeatedFailure)
+        _failureTime = std::chrono::steady_clock::now();
+
+    _active = std::move(_spare);
+    if(!_active)
+        _active = spawn();
+    _spare = spawn();
+
+    if(_active && !repeatedFailure)
+        sendPlay();
+    else if(_eosCallback)
+        _eosCallback();
+}
+
+int PlayerWorkerMain(const Config& config, int socketFd) noexcept
+{
+    const std::shared_ptr<spdlog::logger>& log = MonitorLog();
+
+    GMainContextPtr contextPtr(g_main_context_new());
+    GMainContext* context = contextPtr.get();
+    g_main_context_push_thread_default(context);
+
+    GMainLoopPtr loopPtr(g_main_loop_new(context, FALSE));
+    GMainLoop* loop = loopPtr.get();
+
+    StartThreadPolicy(config.threadPolicy);
+    SetVideoOutputBackend(config.videoOutput);
+
+    if(config.stageTiming)
+        StartStageTiming(config.stageTimingInterval, config.stageTimingFile);
+
+    UrlPlayer player(
+        config.videoOutput.showStats,
+        config.videoOutput.sync,
+        [socketFd] (UrlPlayer&) { SendMessage(socketFd, EosMessage); });
+    if(config.source)
+        player.setLeanRtspPipeline(config.source->leanPipeline, config.source->rtspLatency);
+    player.setStallTimeout(config.videoOutput.stallTimeout);
+    player.setLatencyControl(config.videoOutput.latencyTarget, config.videoOutput.maxCatchUpRate);
+    player.setDecodeDegradation(config.videoOutput.decodeDegradation, config.videoOutput.degradedFramerate);
+    player.setPersistentSink(config.videoOutput.persistentSink);
+    player.setFirstFrameCallback([socketFd] (UrlPlayer&) { SendMessage(socketFd, FirstFrameMessage); });
+
+    struct WorkerState
+    {
+        UrlPlayer* player;
+        GMainLoop* loop;
+    } state { &player, loop };
+
+    GSourcePtr ioSourcePtr(
+        g_unix_fd_source_new(socketFd, static_cast<GIOCondition>(G_IO_IN | G_IO_HUP | G_IO_ERR)));
+    g_source_set_callback(
+        ioSourcePtr.get(),
+        reinterpret_cast<GSourceFunc>(+ [] (gint fd, GIOCondition condition, gpointer userData) -> gboolean {
+            WorkerState* state = static_cast<WorkerState*>(userData);
+
+            std::string message;
+            if(!ReceiveMessage(fd, condition, &message)) {
+                MonitorLog()->info("Supervisor has gone. Exiting...");
+                g_main_loop_quit(state->loop);
+                return G_SOURCE_REMOVE;
+            }
+
+            if(message == PingMessage) {
+                SendMessage(fd, PongMessage);
+            } else if(g_str_has_prefix(message.c_str(), PlayMessagePrefix)) {
+                const std::string urls = message.substr(strlen(PlayMessagePrefix));
+                const std::string::size_type separator = urls.find('\n');
+                const std::string url = urls.substr(0, separator);
+                const std::string substreamUrl =
+                    separator == std::string::npos ? std::string() : urls.substr(separator + 1);
+                if(!state->player->play(url, substreamUrl))
+                    SendMessage(fd, EosMessage);
+            }
+
+            return G_SOURCE_CONTINUE;
+        }),
+        &state,
+        nullptr);
+    g_source_attach(ioSourcePtr.get(), context);
+
+    log->info("Player worker is ready");
+
+    g_main_loop_run(loop);
+
+    g_source_destroy(ioSourcePtr.get());
+    player.stop();
+
+    return 0;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <glib.h>
+
+#include <CxxPtr/GlibPtr.h>
+
+#include "Config.h"
+#include "Log.h"
+#include "Metrics.h"
+
+
+// command line argument switching process to worker mode, followed by socket fd number
+extern const char *const PlayerWorkerArg;
+
+// Plays url in separate worker process (the same executable started with PlayerWorkerArg),
+// so crashed or hung pipeline doesn't take down the main process.
+// Spare worker is kept started, so recovery needs only pipeline startup.
+class PlayerWorkerSupervisor
+{
+public:
+    typedef std::function<void ()> EosCallback;
+    typedef std::function<void ()> FirstFrameCallback;
+
+    PlayerWorkerSupervisor(
+        const PlayerWorkerConfig&,
+        const EosCallback&,
+        const FirstFrameCallback&) noexcept;
+    ~PlayerWorkerSupervisor();
+
+    // url is replayed by every new worker until the next play()
+    void play(const std::string& url, const std::string& substreamUrl) noexcept;
+
+private:
+    struct Worker;
+
+    std::unique_ptr<Worker> spawn() noexcept;
+    void watch(Worker*) noexcept;
+    void send(Worker*, const std::string& message) noexcept;
+    void sendPlay() noexcept;
+    void onMessage(const std::string& message) noexcept;
+    void onHeartbeat() noexcept;
+    void onWorkerLost(const char* reason) noexcept;
+
+private:
+    const std::shared_ptr<spdlog::logger> _log;
+    const PlayerWorkerConfig _config;
+    const EosCallback _eosCallback;
+    const FirstFrameCallback _firstFrameCallback;
+
+    std::unique_ptr<Worker> _active;
+    std::unique_ptr<Worker> _spare;
+
+    std::optional<std::pair<std::string, std::string>> _urls; // main and substream
+
+    GSourcePtr _heartbeatSourcePtr;
+    GSourcePtr _killSourcePtr;
+
+    std::optional<std::chrono::steady_clock::time_point> _failureTime;
+
+    MetricValue *const _restartsMetric;
+    MetricValue *const _recoveryTimeMetric;
+};
+
+// has to be called with initialized GStreamer, returns exit code
+int PlayerWorkerMain(const Config&, int socketFd) noexcept;
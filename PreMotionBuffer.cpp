@@ -0,0 +1,470 @@
+#include "PreMotionBuffer.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+
+#include <CxxPtr/GlibPtr.h>
+#include <CxxPtr/GstPtr.h>
+
+#include "Log.h"
+#include "FrameRing.h"
+#include "ThreadPolicy.h"
+
+
+namespace {
+
+const size_t MaxFrameSize = 1024 * 1024;
+const guint PlaybackBuffers = 6;
+const unsigned MaxFrameRate = 60;
+const double CatchUpRate = 1.25;
+const gint64 LiveMargin = 200 * GST_MSECOND;
+const guint RestartTimeout = 5; // seconds
+constexpr std::chrono::milliseconds FlushCheckInterval = std::chrono::milliseconds(100);
+
+const char *const EncodedVideoCaps = "video/x-h264; video/x-h265";
+
+}
+
+struct PreMotionBuffer::Private
+{
+    Private(std::chrono::seconds duration, size_t capacity) noexcept;
+    ~Private();
+
+    bool createIngestPipeline() noexcept;
+    void destroyIngestPipeline() noexcept;
+    void scheduleRestart() noexcept;
+
+    gboolean onBusMessage(GstMessage*) noexcept;
+    void onPadAdded(GstPad*) noexcept;
+    GstFlowReturn onNewSample(GstElement* appSink) noexcept;
+    void onNeedData(GstElement* appSrc) noexcept;
+
+    const std::shared_ptr<spdlog::logger> log;
+    const std::chrono::seconds duration;
+
+    std::string url;
+    GstElementPtr pipelinePtr;
+    GSourcePtr restartTimeoutSourcePtr;
+
+    GstBufferPool* bufferPool;
+
+    mutable std::mutex mutex;
+    std::condition_variable frameAdded;
+
+    // guarded by mutex
+    FrameRing ring;
+    GstCaps* caps = nullptr;
+    bool playbackActive = false;
+    uint64_t playbackSequence = 0;
+    uint64_t playbackFirstPts = 0;
+    uint64_t playbackLivePts = 0;
+    bool playbackCaughtUp = false;
+    std::chrono::steady_clock::time_point playbackStartTime;
+};
+
+PreMotionBuffer::Private::Private(std::chrono::seconds duration, size_t capacity) noexcept :
+    log(MonitorLog()),
+    duration(duration),
+    bufferPool(gst_buffer_pool_new()),
+    ring(capacity, duration.count() * MaxFrameRate * 2, duration.count() * GST_SECOND)
+{
+    // playback buffers are allocated once and reused
+    GstStructure* config = gst_buffer_pool_get_config(bufferPool);
+    gst_buffer_pool_config_set_params(config, nullptr, MaxFrameSize, PlaybackBuffers, PlaybackBuffers);
+    gst_buffer_pool_set_config(bufferPool, config);
+    if(!gst_buffer_pool_set_active(bufferPool, TRUE))
+        log->error("Failed to preallocate pre-motion buffer playback buffers");
+}
+
+PreMotionBuffer::Private::~Private()
+{
+    gst_buffer_pool_set_active(bufferPool, FALSE);
+    gst_object_unref(bufferPool);
+
+    if(caps)
+        gst_caps_unref(caps);
+}
+
+bool PreMotionBuffer::Private::createIngestPipeline() noexcept
+{
+    GstElementPtr pipelinePtr(gst_pipeline_new(nullptr));
+    GstElement* pipeline = pipelinePtr.get();
+    if(!pipeline) {
+        log->error("Failed to create pipeline element");
+        return false;
+    }
+
+    GstElement* decodebin = gst_element_factory_make("uridecodebin", nullptr);
+    if(!decodebin) {
+        log->error("Failed to create \"uridecodebin\" element");
+        return false;
+    }
+    gst_bin_add(GST_BIN(pipeline), decodebin);
+
+    // stop at encoded video
+    GstCaps* stopCaps = gst_caps_from_string(EncodedVideoCaps);
+    g_object_set(decodebin, "uri", url.c_str(), "caps", stopCaps, nullptr);
+    gst_caps_unref(stopCaps);
+
+    auto onPadAddedCallback =
+        + [] (GstElement*, GstPad* pad, gpointer userData)
+    {
+        static_cast<Private*>(userData)->onPadAdded(pad);
+    };
+    g_signal_connect(decodebin, "pad-added", G_CALLBACK(onPadAddedCallback), this);
+
+    auto onBusMessageCallback =
+        + [] (GstBus* bus, GstMessage* message, gpointer userData) -> gboolean
+    {
+        return static_cast<Private*>(userData)->onBusMessage(message);
+    };
+    GstBusPtr busPtr(gst_pipeline_get_bus(GST_PIPELINE(pipeline)));
+    gst_bus_add_watch(busPtr.get(), onBusMessageCallback, this);
+
+    ApplyThreadPolicy(pipeline);
+
+    this->pipelinePtr.swap(pipelinePtr);
+
+    return true;
+}
+
+void PreMotionBuffer::Private::destroyIngestPipeline() noexcept
+{
+    if(!pipelinePtr)
+        return;
+
+    GstElement* pipeline = pipelinePtr.get();
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+
+    GstBusPtr busPtr(gst_pipeline_get_bus(GST_PIPELINE(pipeline)));
+    gst_bus_remove_watch(busPtr.get());
+
+    pipelinePtr.reset();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    ring.clear();
+    frameAdded.notify_all();
+}
+
+void PreMotionBuffer::Private::scheduleRestart() noexcept
+{
+    if(restartTimeoutSourcePtr)
+        return;
+
+    log->info("Restarting pre-motion buffer ingest within {} seconds...", RestartTimeout);
+
+    restartTimeoutSourcePtr.reset(g_timeout_source_new_seconds(RestartTimeout));
+    GSource* timeoutSource = restartTimeoutSourcePtr.get();
+    g_source_set_callback(
+        timeoutSource,
+        [] (gpointer userData) -> gboolean {
+            Private* self = static_cast<Private*>(userData);
+            self->restartTimeoutSourcePtr.reset();
+
+            if(self->createIngestPipeline())
+                gst_element_set_state(self->pipelinePtr.get(), GST_STATE_PLAYING);
+            else
+                self->scheduleRestart();
+
+            return G_SOURCE_REMOVE;
+        },
+        this,
+        nullptr);
+    g_source_attach(timeoutSource, g_main_context_get_thread_default());
+}
+
+gboolean PreMotionBuffer::Private::onBusMessage(GstMessage* message) noexcept
+{
+    switch(GST_MESSAGE_TYPE(message)) {
+        case GST_MESSAGE_EOS:
+            log->warn("Pre-motion buffer ingest got EOS");
+            destroyIngestPipeline();
+            scheduleRestart();
+            break;
+        case GST_MESSAGE_ERROR: {
+            GError* error = nullptr;
+            gst_message_parse_error(message, &error, nullptr);
+            GErrorPtr errorPtr(error);
+            log->error("Pre-motion buffer ingest failed: {}", error->message);
+
+            destroyIngestPipeline();
+            scheduleRestart();
+            break;
+        }
+        default:
+            break;
+    }
+
+    return TRUE;
+}
+
+void PreMotionBuffer::Private::onPadAdded(GstPad* pad) noexcept
+{
+    GstElement* pipeline = pipelinePtr.get();
+
+    GstCaps* padCaps = gst_pad_get_current_caps(pad);
+    if(!padCaps)
+        padCaps = gst_pad_query_caps(pad, nullptr);
+    const gchar* mediaType =
+        padCaps && !gst_caps_is_empty(padCaps) ?
+            gst_structure_get_name(gst_caps_get_structure(padCaps, 0)) :
+            nullptr;
+
+    const char* parserName = nullptr;
+    const char* outputCaps = nullptr;
+    if(g_strcmp0(mediaType, "video/x-h264") == 0) {
+        parserName = "h264parse";
+        outputCaps = "video/x-h264, stream-format=byte-stream, alignment=au";
+    } else if(g_strcmp0(mediaType, "video/x-h265") == 0) {
+        parserName = "h265parse";
+        outputCaps = "video/x-h265, stream-format=byte-stream, alignment=au";
+    }
+
+    if(padCaps)
+        gst_caps_unref(padCaps);
+
+    if(!parserName) {
+        // all other streams are not used
+        GstElement* fakeSink = gst_element_factory_make("fakesink", nullptr);
+        g_object_set(fakeSink, "sync", FALSE, "async", FALSE, nullptr);
+        gst_bin_add(GST_BIN(pipeline), fakeSink);
+        gst_element_sync_state_with_parent(fakeSink);
+
+        GstPadPtr fakeSinkPadPtr(gst_element_get_static_pad(fakeSink, "sink"));
+        gst_pad_link(pad, fakeSinkPadPtr.get());
+        return;
+    }
+
+    GstElement* parser = gst_element_factory_make(parserName, nullptr);
+    GstElement* capsFilter = gst_element_factory_make("capsfilter", nullptr);
+    GstElement* appSink = gst_element_factory_make("appsink", nullptr);
+    if(!parser || !capsFilter || !appSink) {
+        log->error("Failed to create pre-motion buffer ingest elements");
+        if(parser) gst_object_unref(parser);
+        if(capsFilter) gst_object_unref(capsFilter);
+        if(appSink) gst_object_unref(appSink);
+        return;
+    }
+
+    // SPS/PPS before every keyframe, so every GOP is decodable on its own
+    g_object_set(parser, "config-interval", -1, nullptr);
+
+    GstCaps* filterCaps = gst_caps_from_string(outputCaps);
+    g_object_set(capsFilter, "caps", filterCaps, nullptr);
+    gst_caps_unref(filterCaps);
+
+    g_object_set(appSink, "emit-signals", TRUE, "sync", FALSE, nullptr);
+    auto onNewSampleCallback =
+        + [] (GstElement* appSink, gpointer userData) -> GstFlowReturn
+    {
+        return static_cast<Private*>(userData)->onNewSample(appSink);
+    };
+    g_signal_connect(appSink, "new-sample", G_CALLBACK(onNewSampleCallback), this);
+
+    gst_bin_add_many(GST_BIN(pipeline), parser, capsFilter, appSink, nullptr);
+    gst_element_link_many(parser, capsFilter, appSink, nullptr);
+    gst_element_sync_state_with_parent(appSink);
+    gst_element_sync_state_with_parent(capsFilter);
+    gst_element_sync_state_with_parent(parser);
+
+    GstPadPtr parserPadPtr(gst_element_get_static_pad(parser, "sink"));
+    gst_pad_link(pad, parserPadPtr.get());
+
+    log->info("Pre-motion buffer ingest started with {}", parserName);
+}
+
+// called from streaming thread
+GstFlowReturn PreMotionBuffer::Private::onNewSample(GstElement* appSink) noexcept
+{
+    GstSample* sample = nullptr;
+    g_signal_emit_by_name(appSink, "pull-sample", &sample);
+    if(!sample)
+        return GST_FLOW_EOS;
+
+    GstBuffer* buffer = gst_sample_get_buffer(sample);
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+    if(!GST_CLOCK_TIME_IS_VALID(pts))
+        pts = GST_BUFFER_DTS(buffer);
+
+    GstMapInfo mapInfo;
+    if(!GST_CLOCK_TIME_IS_VALID(pts) || !gst_buffer_map(buffer, &mapInfo, GST_MAP_READ)) {
+        gst_sample_unref(sample);
+        return GST_FLOW_OK;
+    }
+
+    if(mapInfo.size <= MaxFrameSize) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        gst_caps_replace(&caps, gst_sample_get_caps(sample));
+        ring.push(
+            mapInfo.data,
+            mapInfo.size,
+            pts,
+            GST_BUFFER_DURATION_IS_VALID(buffer) ? GST_BUFFER_DURATION(buffer) : 0,
+            !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT));
+        frameAdded.notify_all();
+    }
+
+    gst_buffer_unmap(buffer, &mapInfo);
+    gst_sample_unref(sample);
+
+    return GST_FLOW_OK;
+}
+
+// called from appsrc streaming thread
+void PreMotionBuffer::Private::onNeedData(GstElement* appSrc) noexcept
+{
+    GstBuffer* buffer = nullptr;
+    if(gst_buffer_pool_acquire_buffer(bufferPool, &buffer, nullptr) != GST_FLOW_OK)
+        return;
+
+    GstPadPtr srcPadPtr(gst_element_get_static_pad(appSrc, "src"));
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    FrameRing::Frame frame;
+    for(;;) {
+        if(!playbackActive || GST_PAD_IS_FLUSHING(srcPadPtr.get())) {
+            lock.unlock();
+            gst_buffer_unref(buffer);
+            return;
+        }
+
+        if(!ring.empty() && playbackSequence < ring.firstSequence()) {
+            log->warn(
+                "Pre-motion buffer playback is too slow. {} frame(s) skipped",
+                ring.firstSequence() - playbackSequence);
+            playbackSequence = ring.firstSequence();
+        }
+
+        if(ring.get(playbackSequence, &frame))
+            break;
+
+        frameAdded.wait_for(lock, FlushCheckInterval);
+    }
+
+    ++playbackSequence;
+
+    gst_buffer_fill(buffer, 0, frame.data, frame.size);
+    gst_buffer_set_size(buffer, frame.size);
+
+    // replayed faster than real time but never ahead of frame's arrival.
+    // Reordered (B-)frames could have PTS below the first keyframe's one
+    const gint64 replayTime =
+        std::max<gint64>(
+            0,
+            static_cast<gint64>(
+                (static_cast<gint64>(frame.pts) - static_cast<gint64>(playbackFirstPts)) / CatchUpRate));
+    const gint64 liveTime =
+        static_cast<gint64>(frame.pts) - static_cast<gint64>(playbackLivePts) + LiveMargin;
+    const bool caughtUpNow = !playbackCaughtUp && liveTime >= replayTime;
+    if(caughtUpNow)
+        playbackCaughtUp = true;
+
+    lock.unlock();
+
+    GST_BUFFER_PTS(buffer) = std::max(replayTime, liveTime);
+    GST_BUFFER_DTS(buffer) = GST_CLOCK_TIME_NONE;
+    GST_BUFFER_DURATION(buffer) =
+        frame.duration ? static_cast<GstClockTime>(frame.duration / CatchUpRate) : GST_CLOCK_TIME_NONE;
+    if(frame.keyframe)
+        GST_BUFFER_FLAG_UNSET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    else
+        GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+    if(caughtUpNow) {
+        log->info(
+            "Pre-motion buffer playback caught up with live in {} ms",
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - playbackStartTime).count());
+    }
+
+    GstFlowReturn flowReturn;
+    g_signal_emit_by_name(appSrc, "push-buffer", buffer, &flowReturn);
+    gst_buffer_unref(buffer);
+}
+
+PreMotionBuffer::PreMotionBuffer(std::chrono::seconds duration, size_t capacity) noexcept :
+    _p(std::make_unique<Private>(duration, capacity))
+{
+    _p->log->info(
+        "Pre-motion buffer: {} seconds, {} MiB preallocated",
+        duration.count(),
+        (capacity + MaxFrameSize * PlaybackBuffers) / (1024 * 1024));
+}
+
+PreMotionBuffer::~PreMotionBuffer()
+{
+    stop();
+}
+
+bool PreMotionBuffer::start(const std::string& url) noexcept
+{
+    stop();
+
+    _p->url = url;
+    if(!_p->createIngestPipeline())
+        return false;
+
+    gst_element_set_state(_p->pipelinePtr.get(), GST_STATE_PLAYING);
+
+    return true;
+}
+
+void PreMotionBuffer::stop() noexcept
+{
+    stopPlayback();
+
+    if(_p->restartTimeoutSourcePtr) {
+        g_source_destroy(_p->restartTimeoutSourcePtr.get());
+        _p->restartTimeoutSourcePtr.reset();
+    }
+
+    _p->destroyIngestPipeline();
+}
+
+bool PreMotionBuffer::isReady() const noexcept
+{
+    std::lock_guard<std::mutex> lock(_p->mutex);
+
+    return _p->caps && !_p->ring.empty();
+}
+
+void PreMotionBuffer::setupPlayback(GstElement* appSrc) noexcept
+{
+    std::lock_guard<std::mutex> lock(_p->mutex);
+
+    g_object_set(
+        appSrc,
+        "format", GST_FORMAT_TIME,
+        "is-live", FALSE,
+        "caps", _p->caps,
+        nullptr);
+
+    auto onNeedDataCallback =
+        + [] (GstElement* appSrc, guint, gpointer userData)
+    {
+        static_cast<Private*>(userData)->onNeedData(appSrc);
+    };
+    g_signal_connect(appSrc, "need-data", G_CALLBACK(onNeedDataCallback), _p.get());
+
+    _p->playbackActive = true;
+    _p->playbackSequence = _p->ring.firstSequence();
+    _p->playbackFirstPts = _p->ring.firstPts();
+    _p->playbackLivePts = _p->ring.lastPts();
+    _p->playbackCaughtUp = false;
+    _p->playbackStartTime = std::chrono::steady_clock::now();
+
+    _p->log->info(
+        "Replaying {} ms of pre-motion video...",
+        (_p->playbackLivePts - _p->playbackFirstPts) / GST_MSECOND);
+}
+
+void PreMotionBuffer::stopPlayback() noexcept
+{
+    std::lock_guard<std::mutex> lock(_p->mutex);
+
+    _p->playbackActive = false;
+    _p->frameAdded.notify_all();
+}
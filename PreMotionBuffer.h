@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include <gst/gst.h>
+
+
+// Keeps the latest encoded video of the stream in preallocated memory
+// and replays it through appsrc slightly faster than real time until it catches up with live.
+class PreMotionBuffer
+{
+public:
+    PreMotionBuffer(std::chrono::seconds duration, size_t capacity) noexcept;
+    ~PreMotionBuffer();
+
+    bool start(const std::string& url) noexcept;
+    void stop() noexcept;
+
+    bool isReady() const noexcept;
+
+    // to call from "source-setup" signal handler of playbin with "appsrc://" uri
+    void setupPlayback(GstElement* appSrc) noexcept;
+    void stopPlayback() noexcept;
+
+private:
+    struct Private;
+    std::unique_ptr<Private> _p;
+};
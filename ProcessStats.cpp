@@ -0,0 +1,87 @@
+#include "ProcessStats.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <dirent.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+
+std::string ProcStatusValue(const char* name)
+{
+    std::ifstream status("/proc/self/status");
+    const size_t nameLength = strlen(name);
+
+    std::string line;
+    while(std::getline(status, line)) {
+        if(line.compare(0, nameLength, name) != 0 || line.size() <= nameLength || line[nameLength] != ':')
+            continue;
+
+        const std::string::size_type valueStart = line.find_first_not_of(" \t", nameLength + 1);
+        return valueStart == std::string::npos ? std::string() : line.substr(valueStart);
+    }
+
+    return std::string();
+}
+
+std::chrono::microseconds ProcessCpuTime()
+{
+    rusage usage {};
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return std::chrono::microseconds(0);
+
+    return
+        std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+        std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+}
+
+std::vector<ThreadCpuTime> ThreadCpuTimes()
+{
+    std::vector<ThreadCpuTime> threads;
+
+    DIR* tasks = opendir("/proc/self/task");
+    if(!tasks)
+        return threads;
+
+    const long ticksPerSecond = sysconf(_SC_CLK_TCK);
+
+    while(dirent* entry = readdir(tasks)) {
+        if(entry->d_name[0] == '.')
+            continue;
+
+        std::ifstream statFile(std::string("/proc/self/task/") + entry->d_name + "/stat");
+        std::string stat;
+        if(!std::getline(statFile, stat))
+            continue;
+
+        // "tid (comm) state ..." where comm could contain spaces and parentheses
+        const std::string::size_type commStart = stat.find('(');
+        const std::string::size_type commEnd = stat.rfind(')');
+        if(commStart == std::string::npos || commEnd == std::string::npos || commEnd < commStart)
+            continue;
+
+        // utime and stime are 14th and 15th fields, state is the 3rd one
+        std::istringstream fields(stat.substr(commEnd + 1));
+        std::string field;
+        unsigned long long utime = 0;
+        unsigned long long stime = 0;
+        for(unsigned i = 3; i <= 15 && fields >> field; ++i) {
+            if(i == 14)
+                utime = strtoull(field.c_str(), nullptr, 10);
+            else if(i == 15)
+                stime = strtoull(field.c_str(), nullptr, 10);
+        }
+
+        threads.push_back({
+            static_cast<pid_t>(atoi(entry->d_name)),
+            stat.substr(commStart + 1, commEnd - commStart - 1),
+            std::chrono::microseconds((utime + stime) * 1000000 / (ticksPerSecond > 0 ? ticksPerSecond : 100)) });
+    }
+
+    closedir(tasks);
+
+    return threads;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+
+// value of /proc/self/status field (like "Threads" or "VmRSS"), empty if it's not available
+std::string ProcStatusValue(const char* name);
+
+// user + system CPU time consumed by the whole process
+std::chrono::microseconds ProcessCpuTime();
+
+struct ThreadCpuTime
+{
+    pid_t tid;
+    std::string name;
+    std::chrono::microseconds cpuTime; // user + system
+};
+
+// all threads of the process, from /proc/self/task
+std::vector<ThreadCpuTime> ThreadCpuTimes();
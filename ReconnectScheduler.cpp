@@ -0,0 +1,129 @@
+#include "ReconnectScheduler.h"
+
+#include <algorithm>
+
+
+namespace {
+
+constexpr std::chrono::milliseconds FirstRetryDelay = std::chrono::milliseconds(250);
+constexpr std::chrono::milliseconds FirstRetryJitter = std::chrono::milliseconds(100);
+constexpr std::chrono::milliseconds BaseBackoffDelay = std::chrono::seconds(1);
+constexpr std::chrono::milliseconds MaxBackoffDelay = std::chrono::seconds(30);
+constexpr unsigned MaxBackoffLevel = 6; // BaseBackoffDelay << (MaxBackoffLevel - 1) exceeds MaxBackoffDelay
+
+}
+
+ReconnectScheduler::ReconnectScheduler(const std::string& name) noexcept :
+    _log(MonitorLog()),
+    _name(name),
+    _attemptsMetric(
+        RegisterMetric(MetricType::Counter, "monitor_reconnect_attempts_total", "Reconnect attempts", { { "source", name } })),
+    _recoveriesMetric(
+        RegisterMetric(MetricType::Counter, "monitor_recoveries_total", "Successful reconnects after failure", { { "source", name } })),
+    _backoffLevelMetric(
+        RegisterMetric(MetricType::Gauge, "monitor_reconnect_backoff_level", "Current reconnect backoff level", { { "source", name } })),
+    _timeToRecoverMetric(
+        RegisterMetric(MetricType::Gauge, "monitor_time_to_recover_ms", "Time from failure to the last recovery", { { "source", name } }))
+{
+}
+
+ReconnectScheduler::~ReconnectScheduler()
+{
+    if(_timeoutSourcePtr)
+        g_source_destroy(_timeoutSourcePtr.get());
+}
+
+void ReconnectScheduler::setReconnectCallback(const ReconnectCallback& callback) noexcept
+{
+    _reconnectCallback = callback;
+}
+
+std::chrono::milliseconds ReconnectScheduler::nextDelay() noexcept
+{
+    const unsigned level = _stats.backoffLevel;
+    _stats.backoffLevel = std::min(level + 1, MaxBackoffLevel);
+    _backoffLevelMetric->set(_stats.backoffLevel);
+
+    if(level == 0) {
+        return FirstRetryDelay +
+            std::chrono::milliseconds(g_random_int_range(0, FirstRetryJitter.count() + 1));
+    }
+
+    // "equal jitter": half of delay is fixed, another half is random
+    const std::chrono::milliseconds delay =
+        std::min<std::chrono::milliseconds>(BaseBackoffDelay * (1 << (level - 1)), MaxBackoffDelay);
+    return delay / 2 +
+        std::chrono::milliseconds(g_random_int_range(0, delay.count() / 2 + 1));
+}
+
+void ReconnectScheduler::onFailure() noexcept
+{
+    if(!_failed) {
+        _failed = true;
+        _failureTime = std::chrono::steady_clock::now();
+    }
+
+    if(_timeoutSourcePtr) {
+        _log->debug("[{}] Reconnect is already scheduled", _name);
+        return;
+    }
+
+    const std::chrono::milliseconds delay = nextDelay();
+    _log->info(
+        "[{}] Scheduling reconnect within {} ms (backoff level {})...",
+        _name,
+        delay.count(),
+        _stats.backoffLevel);
+
+    _timeoutSourcePtr.reset(g_timeout_source_new(delay.count()));
+    GSource* timeoutSource = _timeoutSourcePtr.get();
+    g_source_set_callback(
+        timeoutSource,
+        [] (gpointer userData) -> gboolean {
+            static_cast<ReconnectScheduler*>(userData)->reconnect();
+            return G_SOURCE_REMOVE;
+        },
+        this,
+        nullptr);
+    g_source_attach(timeoutSource, g_main_context_get_thread_default());
+}
+
+void ReconnectScheduler::reconnect() noexcept
+{
+    _timeoutSourcePtr.reset();
+
+    ++_stats.attempts;
+    _attemptsMetric->add();
+
+    if(_reconnectCallback)
+        _reconnectCallback();
+}
+
+void ReconnectScheduler::onSuccess() noexcept
+{
+    _stats.backoffLevel = 0;
+    _backoffLevelMetric->set(0);
+
+    if(!_failed)
+        return;
+
+    _failed = false;
+
+    const auto timeToRecover =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - _failureTime);
+
+    ++_stats.recoveries;
+    _stats.lastTimeToRecover = timeToRecover;
+    _stats.maxTimeToRecover = std::max(_stats.maxTimeToRecover, timeToRecover);
+    _recoveriesMetric->add();
+    _timeToRecoverMetric->set(timeToRecover.count());
+
+    _log->info(
+        "[{}] Recovered in {} ms (attempts: {}, recoveries: {}, max time to recover: {} ms)",
+        _name,
+        timeToRecover.count(),
+        _stats.attempts,
+        _stats.recoveries,
+        _stats.maxTimeToRecover.count());
+}
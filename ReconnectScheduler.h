@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+#include <CxxPtr/GlibPtr.h>
+
+#include "Log.h"
+#include "Metrics.h"
+
+
+// Reconnect state of single source.
+// The first retry after success is almost immediate to get over short network glitches,
+// following ones are delayed exponentially with jitter up to the cap.
+class ReconnectScheduler
+{
+public:
+    struct Stats
+    {
+        uint64_t attempts = 0;
+        uint64_t recoveries = 0;
+        unsigned backoffLevel = 0; // 0 - next retry is the fast one
+        std::chrono::milliseconds lastTimeToRecover = std::chrono::milliseconds(0);
+        std::chrono::milliseconds maxTimeToRecover = std::chrono::milliseconds(0);
+    };
+
+    typedef std::function<void ()> ReconnectCallback;
+
+    explicit ReconnectScheduler(const std::string& name) noexcept;
+    ~ReconnectScheduler();
+
+    void setReconnectCallback(const ReconnectCallback&) noexcept;
+
+    // schedules reconnect if it's not scheduled yet
+    void onFailure() noexcept;
+    // resets backoff
+    void onSuccess() noexcept;
+
+    bool isScheduled() const noexcept { return !!_timeoutSourcePtr; }
+    const Stats& stats() const noexcept { return _stats; }
+
+private:
+    std::chrono::milliseconds nextDelay() noexcept;
+    void reconnect() noexcept;
+
+private:
+    const std::shared_ptr<spdlog::logger> _log;
+    const std::string _name;
+
+    ReconnectCallback _reconnectCallback;
+
+    GSourcePtr _timeoutSourcePtr;
+    bool _failed = false;
+    std::chrono::steady_clock::time_point _failureTime;
+
+    Stats _stats;
+
+    MetricValue *const _attemptsMetric;
+    MetricValue *const _recoveriesMetric;
+    MetricValue *const _backoffLevelMetric;
+    MetricValue *const _timeToRecoverMetric;
+};
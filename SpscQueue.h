@@ -0,0 +1,52 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+
+// Lock free bounded queue for exactly one producer thread and one consumer thread
+template<typename T, size_t Capacity>
+class SpscQueue
+{
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity should be power of 2");
+
+public:
+    // to call only from producer thread
+    bool push(T&& item) noexcept
+    {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if(tail - _head.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        _items[tail & (Capacity - 1)] = std::move(item);
+        _tail.store(tail + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    // to call only from consumer thread
+    bool pop(T* item) noexcept
+    {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if(head == _tail.load(std::memory_order_acquire))
+            return false;
+
+        *item = std::move(_items[head & (Capacity - 1)]);
+        _head.store(head + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    bool empty() const noexcept
+    {
+        return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::array<T, Capacity> _items;
+
+    alignas(64) std::atomic<size_t> _head = 0; // next item to pop
+    alignas(64) std::atomic<size_t> _tail = 0; // next slot to push
+};
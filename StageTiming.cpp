@@ -0,0 +1,321 @@
+#include "StageTiming.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include <CxxPtr/GlibPtr.h>
+
+#include "Log.h"
+
+
+namespace {
+
+const char *const LatencyTracers = "latency(flags=pipeline+element)";
+const char *const TracerCategoryName = "GST_TRACER";
+const char *const CaptureToSinkStage = "capture-to-sink";
+const char *const BusDispatchStage = "bus-dispatch";
+
+const size_t MaxSamplesPerStage = 1024;
+const size_t MaxStages = 64;
+constexpr std::chrono::seconds MaxCaptureLatency = std::chrono::seconds(60);
+constexpr gint64 NtpToUnixEpochOffset = G_GINT64_CONSTANT(2208988800); // seconds
+
+struct Samples
+{
+    std::vector<int64_t> values; // microseconds
+    size_t next = 0;
+    uint64_t count = 0;
+};
+
+struct StageTimingState
+{
+    std::shared_ptr<spdlog::logger> log;
+
+    std::mutex mutex;
+    std::map<std::string, Samples> stages;
+
+    std::string dumpFile;
+    GSourcePtr dumpTimeoutSourcePtr;
+
+    GstCaps* ntpTimestampCaps;
+    GQuark postTimeQuark;
+};
+
+StageTimingState* State = nullptr; // lives until process exit
+
+// "avdec_h264-3" -> "avdec_h264", so restarted pipelines share statistics
+std::string StageName(const char* prefix, const char* elementName)
+{
+    std::string name = elementName ? elementName : "";
+    while(!name.empty() && g_ascii_isdigit(name.back()))
+        name.pop_back();
+    if(!name.empty() && name.back() == '-')
+        name.pop_back();
+
+    return std::string(prefix) + name;
+}
+
+void OnTracerRecord(const gchar* record)
+{
+    GstStructure* structure = gst_structure_from_string(record, nullptr);
+    if(!structure)
+        return;
+
+    guint64 time = 0;
+    if(gst_structure_has_name(structure, "element-latency")) {
+        if(gst_structure_get_uint64(structure, "time", &time)) {
+            AddStageSample(
+                StageName("element:", gst_structure_get_string(structure, "element")),
+                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds(time)));
+        }
+    } else if(gst_structure_has_name(structure, "latency")) {
+        if(gst_structure_get_uint64(structure, "time", &time)) {
+            AddStageSample(
+                StageName("pipeline:", gst_structure_get_string(structure, "src-element")) +
+                    StageName("->", gst_structure_get_string(structure, "sink-element")),
+                std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds(time)));
+        }
+    }
+
+    gst_structure_free(structure);
+}
+
+// replaces default log function to keep tracer records out of stderr
+void LogFunction(
+    GstDebugCategory* category,
+    GstDebugLevel level,
+    const gchar* file,
+    const gchar* function,
+    gint line,
+    GObject* object,
+    GstDebugMessage* message,
+    gpointer /*userData*/)
+{
+    if(g_strcmp0(gst_debug_category_get_name(category), TracerCategoryName) == 0) {
+        OnTracerRecord(gst_debug_message_get(message));
+        return;
+    }
+
+    gst_debug_log_default(category, level, file, function, line, object, message, nullptr);
+}
+
+int64_t Percentile(std::vector<int64_t>& values, unsigned percent)
+{
+    const size_t index = (values.size() - 1) * percent / 100;
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+void AppendJsonString(std::string* out, const std::string& value)
+{
+    *out += '"';
+    for(const char c: value) {
+        if(c == '"' || c == '\\')
+            *out += '\\';
+        if(static_cast<unsigned char>(c) >= 0x20)
+            *out += c;
+    }
+    *out += '"';
+}
+
+void DumpStageTiming()
+{
+    std::map<std::string, Samples> stages;
+    {
+        std::lock_guard<std::mutex> lock(State->mutex);
+        stages.swap(State->stages);
+    }
+
+    if(stages.empty())
+        return;
+
+    std::string json = "{\"time\":" + std::to_string(g_get_real_time() / 1000) + ",\"stages\":{";
+    bool first = true;
+    for(auto& [name, samples]: stages) {
+        std::vector<int64_t>& values = samples.values;
+        if(values.empty())
+            continue;
+
+        if(!first)
+            json += ',';
+        first = false;
+
+        AppendJsonString(&json, name);
+        json += ":{\"count\":" + std::to_string(samples.count);
+        json += ",\"p50_us\":" + std::to_string(Percentile(values, 50));
+        json += ",\"p99_us\":" + std::to_string(Percentile(values, 99));
+        json += ",\"max_us\":" + std::to_string(*std::max_element(values.begin(), values.end()));
+        json += '}';
+    }
+    json += "}}";
+
+    State->log->info("Stage timing: {}", json);
+
+    if(State->dumpFile.empty())
+        return;
+
+    if(FILE* file = fopen(State->dumpFile.c_str(), "a")) {
+        fprintf(file, "%s\n", json.c_str());
+        fclose(file);
+    } else {
+        State->log->warn("Failed to open \"{}\" to dump stage timing", State->dumpFile);
+    }
+}
+
+GstPadProbeReturn OnSinkBuffer(GstPad* pad, GstPadProbeInfo* info, gpointer /*userData*/)
+{
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstReferenceTimestampMeta* meta =
+        gst_buffer_get_reference_timestamp_meta(buffer, State->ntpTimestampCaps);
+    if(!meta)
+        return GST_PAD_PROBE_OK;
+
+    const gint64 nowNtp =
+        (g_get_real_time() + NtpToUnixEpochOffset * G_USEC_PER_SEC) * 1000; // nanoseconds
+    const gint64 latency = nowNtp - static_cast<gint64>(meta->timestamp);
+
+    // clocks are not synchronized
+    if(latency < 0 || std::chrono::nanoseconds(latency) > MaxCaptureLatency)
+        return GST_PAD_PROBE_OK;
+
+    AddStageSample(
+        CaptureToSinkStage,
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::nanoseconds(latency)));
+
+    return GST_PAD_PROBE_OK;
+}
+
+GstBusSyncReply OnBusMessagePosted(GstBus*, GstMessage* message, gpointer /*userData*/)
+{
+    gint64* postTime = g_new(gint64, 1);
+    *postTime = g_get_monotonic_time();
+    gst_mini_object_set_qdata(GST_MINI_OBJECT(message), State->postTimeQuark, postTime, g_free);
+
+    return GST_BUS_PASS;
+}
+
+void InstrumentElement(GstElement* element)
+{
+    GstElementFactory* factory = gst_element_get_factory(element);
+    if(factory && g_strcmp0(GST_OBJECT_NAME(factory), "rtspsrc") == 0) {
+        // capture time from RTCP SR
+        if(g_object_class_find_property(G_OBJECT_GET_CLASS(element), "add-reference-timestamp-meta"))
+            g_object_set(element, "add-reference-timestamp-meta", TRUE, nullptr);
+        return;
+    }
+
+    if(GST_IS_BIN(element) || !GST_OBJECT_FLAG_IS_SET(element, GST_ELEMENT_FLAG_SINK))
+        return;
+
+    GstPadPtr padPtr(gst_element_get_static_pad(element, "sink"));
+    if(padPtr)
+        gst_pad_add_probe(padPtr.get(), GST_PAD_PROBE_TYPE_BUFFER, OnSinkBuffer, nullptr, nullptr);
+}
+
+}
+
+void PrepareStageTiming() noexcept
+{
+    // keep tracers configured by user
+    g_setenv("GST_TRACERS", LatencyTracers, FALSE);
+}
+
+void StartStageTiming(std::chrono::seconds dumpInterval, const std::string& dumpFile) noexcept
+{
+    if(State)
+        return;
+
+    State = new StageTimingState;
+    State->log = MonitorLog();
+    State->dumpFile = dumpFile;
+    State->ntpTimestampCaps = gst_caps_new_empty_simple("timestamp/x-ntp");
+    State->postTimeQuark = g_quark_from_static_string("monitor-bus-post-time");
+
+    gst_debug_set_threshold_for_name(TracerCategoryName, GST_LEVEL_TRACE);
+    gst_debug_remove_log_function(gst_debug_log_default);
+    gst_debug_add_log_function(LogFunction, nullptr, nullptr);
+
+    State->dumpTimeoutSourcePtr.reset(g_timeout_source_new_seconds(dumpInterval.count()));
+    GSource* timeoutSource = State->dumpTimeoutSourcePtr.get();
+    g_source_set_callback(
+        timeoutSource,
+        [] (gpointer) -> gboolean {
+            DumpStageTiming();
+            return G_SOURCE_CONTINUE;
+        },
+        nullptr,
+        nullptr);
+    g_source_attach(timeoutSource, g_main_context_get_thread_default());
+
+    State->log->info(
+        "Stage timing is enabled. Dumping every {} seconds{}{}",
+        dumpInterval.count(),
+        dumpFile.empty() ? "" : " to ",
+        dumpFile);
+}
+
+void InstrumentPipeline(GstElement* pipeline) noexcept
+{
+    if(!State)
+        return;
+
+    GstIterator* iterator = gst_bin_iterate_recurse(GST_BIN(pipeline));
+    gst_iterator_foreach(
+        iterator,
+        [] (const GValue* item, gpointer) {
+            InstrumentElement(GST_ELEMENT(g_value_get_object(item)));
+        },
+        nullptr);
+    gst_iterator_free(iterator);
+
+    auto onDeepElementAdded =
+        + [] (GstBin* bin, GstBin* subBin, GstElement* element, gpointer) {
+            InstrumentElement(element);
+        };
+    g_signal_connect(pipeline, "deep-element-added", G_CALLBACK(onDeepElementAdded), nullptr);
+
+    GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+    gst_bus_set_sync_handler(bus, OnBusMessagePosted, nullptr, nullptr);
+    gst_object_unref(bus);
+}
+
+void OnBusMessageDispatched(GstMessage* message) noexcept
+{
+    if(!State)
+        return;
+
+    const gint64* postTime =
+        static_cast<const gint64*>(gst_mini_object_get_qdata(GST_MINI_OBJECT(message), State->postTimeQuark));
+    if(!postTime)
+        return;
+
+    AddStageSample(BusDispatchStage, std::chrono::microseconds(g_get_monotonic_time() - *postTime));
+}
+
+void AddStageSample(const std::string& stage, std::chrono::microseconds sample) noexcept
+{
+    if(!State)
+        return;
+
+    std::lock_guard<std::mutex> lock(State->mutex);
+
+    auto it = State->stages.find(stage);
+    if(it == State->stages.end()) {
+        if(State->stages.size() >= MaxStages)
+            return;
+
+        it = State->stages.emplace(stage, Samples()).first;
+        it->second.values.reserve(MaxSamplesPerStage);
+    }
+
+    Samples& samples = it->second;
+    if(samples.values.size() < MaxSamplesPerStage)
+        samples.values.push_back(sample.count());
+    else
+        samples.values[samples.next] = sample.count();
+    samples.next = (samples.next + 1) % MaxSamplesPerStage;
+    ++samples.count;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+#include <gst/gst.h>
+
+
+// Per stage latency statistics of all GStreamer pipelines of the process.
+// Element and pipeline latencies are taken from GStreamer "latency" tracer,
+// capture to sink latency - from reference timestamps of frames
+// (available if camera sends RTCP SR and clocks of both sides are synchronized).
+// Bus dispatch latency is time from posting message to pipeline bus
+// to handling it in bus watch of the thread owning pipeline.
+// p50/p99 of every interval are dumped to log and file as single line JSON documents.
+
+// has to be called before gst_init()
+void PrepareStageTiming() noexcept;
+
+// requires thread default main context,
+// dumpFile is not used if empty
+void StartStageTiming(std::chrono::seconds dumpInterval, const std::string& dumpFile) noexcept;
+
+// does nothing if stage timing is not started
+void InstrumentPipeline(GstElement* pipeline) noexcept;
+
+// to be called from bus watch of pipeline instrumented with InstrumentPipeline()
+void OnBusMessageDispatched(GstMessage*) noexcept;
+
+void AddStageSample(const std::string& stage, std::chrono::microseconds) noexcept;
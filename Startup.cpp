@@ -0,0 +1,64 @@
+#include "Startup.h"
+
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "Log.h"
+#include "Metrics.h"
+
+
+namespace {
+
+// static initialization happens right before main()
+const std::chrono::steady_clock::time_point ProcessStartTime = std::chrono::steady_clock::now();
+
+std::shared_future<void> GstInitDone;
+
+std::mutex ReportedStagesMutex;
+std::set<std::string> ReportedStages;
+
+}
+
+void StartGstInit(std::function<void ()>&& gstInit) noexcept
+{
+    std::promise<void> gstInitPromise;
+    GstInitDone = gstInitPromise.get_future().share();
+
+    std::thread(
+        [gstInit = std::move(gstInit), gstInitPromise = std::move(gstInitPromise)] () mutable {
+            gstInit();
+            ReportStartupStage("GStreamer initialized");
+            gstInitPromise.set_value();
+        }).detach();
+}
+
+void WaitGstInit() noexcept
+{
+    if(GstInitDone.valid())
+        GstInitDone.wait();
+}
+
+void ReportStartupStage(const char* stage) noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(ReportedStagesMutex);
+        if(!ReportedStages.insert(stage).second)
+            return;
+    }
+
+    const auto elapsed =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - ProcessStartTime);
+
+    MonitorLog()->info("Startup: {} in {} ms since process start", stage, elapsed.count());
+
+    RegisterMetric(
+        MetricType::Gauge,
+        "monitor_startup_stage_ms",
+        "Time since process start to startup stage",
+        { { "stage", stage } })->set(elapsed.count());
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <functional>
+
+
+// Process startup timeline.
+// GStreamer initialization (mostly plugin registry loading) runs on background thread,
+// so it's overlapped with ONVIF discovery, and time since process start
+// is reported for every startup stage up to the first shown frame.
+
+// gstInit is called on background thread
+void StartGstInit(std::function<void ()>&& gstInit) noexcept;
+
+// blocks until gstInit is finished, has to be called before any GStreamer usage,
+// does nothing if StartGstInit() wasn't called
+void WaitGstInit() noexcept;
+
+// only the first report of every stage is logged, could be called from any thread
+void ReportStartupStage(const char* stage) noexcept;
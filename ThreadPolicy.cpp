@@ -0,0 +1,322 @@
+#include "ThreadPolicy.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <map>
+#include <mutex>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <CxxPtr/GlibPtr.h>
+
+#include "Log.h"
+#include "ProcessStats.h"
+
+
+namespace {
+
+struct ThreadPolicyState
+{
+    std::shared_ptr<spdlog::logger> log;
+    ThreadPolicy policy;
+
+    cpu_set_t mediaCores;
+    std::once_flag taskPoolCreated;
+    GstTaskPool* taskPool = nullptr; // created with the first pipeline, when GStreamer is initialized
+    std::atomic<bool> realtimeFailed = false;
+    std::atomic<bool> nicenessFailed = false;
+
+    GSourcePtr cpuReportSourcePtr;
+    std::map<pid_t, std::chrono::microseconds> lastCpuTimes;
+    gint64 lastReportTime = 0;
+};
+
+ThreadPolicyState* State = nullptr; // lives until process exit
+
+struct PolicyThread
+{
+    GstTaskPoolFunction func;
+    gpointer data;
+    pthread_t thread;
+    bool realtime;
+};
+
+struct PolicyTaskPool
+{
+    GstTaskPool parent;
+};
+
+struct PolicyTaskPoolClass
+{
+    GstTaskPoolClass parentClass;
+};
+
+G_DEFINE_TYPE(PolicyTaskPool, policy_task_pool, GST_TYPE_TASK_POOL)
+
+void* PolicyThreadFunc(void* userData)
+{
+    PolicyThread* thread = static_cast<PolicyThread*>(userData);
+
+    if(!thread->realtime &&
+        setpriority(PRIO_PROCESS, syscall(SYS_gettid), State->policy.niceness) != 0 &&
+        !State->nicenessFailed.exchange(true))
+    {
+        State->log->warn(
+            "Failed to set niceness {} of streaming thread: {}",
+            State->policy.niceness,
+            g_strerror(errno));
+    }
+
+    thread->func(thread->data);
+
+    return nullptr;
+}
+
+int CreatePolicyThread(PolicyThread* thread, bool realtime)
+{
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &State->mediaCores);
+    if(realtime) {
+        sched_param param {};
+        param.sched_priority = State->policy.realtimePriority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
+    thread->realtime = realtime;
+    const int result = pthread_create(&thread->thread, &attr, PolicyThreadFunc, thread);
+    pthread_attr_destroy(&attr);
+
+    return result;
+}
+
+gpointer PolicyTaskPoolPush(GstTaskPool*, GstTaskPoolFunction func, gpointer data, GError** error)
+{
+    PolicyThread* thread = new PolicyThread { func, data, {}, false };
+
+    int result;
+    if(State->policy.realtime && !State->realtimeFailed) {
+        result = CreatePolicyThread(thread, true);
+        if(result == EPERM) {
+            if(!State->realtimeFailed.exchange(true))
+                State->log->warn("Not permitted to use SCHED_FIFO. Streaming threads will use niceness instead");
+            result = CreatePolicyThread(thread, false);
+        }
+    } else {
+        result = CreatePolicyThread(thread, false);
+    }
+
+    if(result != 0) {
+        g_set_error(
+            error,
+            G_THREAD_ERROR,
+            G_THREAD_ERROR_AGAIN,
+            "Failed to create streaming thread: %s",
+            g_strerror(result));
+        delete thread;
+        return nullptr;
+    }
+
+    return thread;
+}
+
+void PolicyTaskPoolJoin(GstTaskPool*, gpointer id)
+{
+    PolicyThread* thread = static_cast<PolicyThread*>(id);
+    pthread_join(thread->thread, nullptr);
+    delete thread;
+}
+
+void policy_task_pool_class_init(PolicyTaskPoolClass* klass)
+{
+    GstTaskPoolClass* poolClass = GST_TASK_POOL_CLASS(klass);
+
+    // every task gets its own thread, so default GThreadPool is not needed
+    poolClass->prepare = [] (GstTaskPool*, GError**) {};
+    poolClass->cleanup = [] (GstTaskPool*) {};
+    poolClass->push = PolicyTaskPoolPush;
+    poolClass->join = PolicyTaskPoolJoin;
+}
+
+void policy_task_pool_init(PolicyTaskPool*)
+{
+}
+
+void OnStreamStatus(GstBus*, GstMessage* message, gpointer)
+{
+    GstStreamStatusType type;
+    GstElement* owner = nullptr;
+    gst_message_parse_stream_status(message, &type, &owner);
+    if(type != GST_STREAM_STATUS_TYPE_CREATE)
+        return;
+
+    // posted synchronously before task is started, so it's still possible to change its pool
+    const GValue* value = gst_message_get_stream_status_object(message);
+    if(!value || G_VALUE_TYPE(value) != GST_TYPE_TASK)
+        return;
+
+    gst_task_set_pool(GST_TASK(g_value_get_object(value)), State->taskPool);
+}
+
+std::string CoresString(const cpu_set_t& cores)
+{
+    std::string out;
+    for(int core = 0; core < CPU_SETSIZE; ++core) {
+        if(!CPU_ISSET(core, &cores))
+            continue;
+
+        if(!out.empty())
+            out += ',';
+        out += std::to_string(core);
+    }
+
+    return out;
+}
+
+// all cores except media ones if control cores are not configured
+cpu_set_t ControlCores(const ThreadPolicy& policy)
+{
+    cpu_set_t controlCores;
+    CPU_ZERO(&controlCores);
+    if(policy.controlCores.empty()) {
+        const long coresCount = sysconf(_SC_NPROCESSORS_ONLN);
+        for(long core = 0; core < coresCount && core < CPU_SETSIZE; ++core) {
+            if(std::find(policy.mediaCores.begin(), policy.mediaCores.end(), static_cast<unsigned>(core)) == policy.mediaCores.end())
+                CPU_SET(core, &controlCores);
+        }
+    } else {
+        for(const unsigned core: policy.controlCores)
+            CPU_SET(core, &controlCores);
+    }
+
+    return controlCores;
+}
+
+void ReportThreadCpu()
+{
+    const gint64 now = g_get_monotonic_time();
+    const std::vector<ThreadCpuTime> threads = ThreadCpuTimes();
+
+    if(State->lastReportTime) {
+        const double interval = static_cast<double>(now - State->lastReportTime);
+
+        std::vector<std::pair<double, const ThreadCpuTime*>> usage;
+        for(const ThreadCpuTime& thread: threads) {
+            const auto it = State->lastCpuTimes.find(thread.tid);
+            // newly seen thread has only baseline recorded and is reported from the next interval,
+            // otherwise its whole lifetime CPU time would be charged to the current one
+            if(it == State->lastCpuTimes.end())
+                continue;
+
+            usage.emplace_back(100 * (thread.cpuTime - it->second).count() / interval, &thread);
+        }
+        std::sort(
+            usage.begin(),
+            usage.end(),
+            [] (const auto& a, const auto& b) { return a.first > b.first; });
+
+        std::string report;
+        for(const auto& [percent, thread]: usage) {
+            if(percent < 0.1)
+                break;
+
+            char threadUsage[64];
+            snprintf(threadUsage, sizeof(threadUsage), "%s%s(%d) %.1f%%",
+                report.empty() ? "" : ", ",
+                thread->name.c_str(),
+                thread->tid,
+                percent);
+            report += threadUsage;
+        }
+
+        State->log->info("Threads CPU usage: {}", report.empty() ? "idle" : report);
+    }
+
+    State->lastCpuTimes.clear();
+    for(const ThreadCpuTime& thread: threads)
+        State->lastCpuTimes.emplace(thread.tid, thread.cpuTime);
+    State->lastReportTime = now;
+}
+
+}
+
+void ConfineControlThreads(const ThreadPolicy& policy) noexcept
+{
+    if(policy.mediaCores.empty())
+        return;
+
+    const cpu_set_t controlCores = ControlCores(policy);
+
+    // threads created later inherit affinity of the main thread
+    if(CPU_COUNT(&controlCores) == 0) {
+        MonitorLog()->warn("There are no cores left for control threads. They are not confined");
+    } else if(const int result = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &controlCores)) {
+        MonitorLog()->warn("Failed to confine control threads: {}", g_strerror(result));
+    }
+}
+
+void StartThreadPolicy(const ThreadPolicy& policy) noexcept
+{
+    if(State)
+        return;
+
+    State = new ThreadPolicyState;
+    State->log = MonitorLog();
+    State->policy = policy;
+
+    if(!policy.mediaCores.empty()) {
+        CPU_ZERO(&State->mediaCores);
+        for(const unsigned core: policy.mediaCores)
+            CPU_SET(core, &State->mediaCores);
+
+        const cpu_set_t controlCores = ControlCores(policy);
+
+        State->log->info(
+            "Thread policy: streaming threads on cores {} with {}, control threads on cores {}",
+            CoresString(State->mediaCores),
+            policy.realtime ?
+                "SCHED_FIFO priority " + std::to_string(policy.realtimePriority) :
+                "niceness " + std::to_string(policy.niceness),
+            CPU_COUNT(&controlCores) ? CoresString(controlCores) : "any");
+    }
+
+    if(policy.cpuReportInterval.count() > 0) {
+        State->cpuReportSourcePtr.reset(g_timeout_source_new_seconds(policy.cpuReportInterval.count()));
+        GSource* timeoutSource = State->cpuReportSourcePtr.get();
+        g_source_set_callback(
+            timeoutSource,
+            [] (gpointer) -> gboolean {
+                ReportThreadCpu();
+                return G_SOURCE_CONTINUE;
+            },
+            nullptr,
+            nullptr);
+        g_source_attach(timeoutSource, g_main_context_get_thread_default());
+
+        ReportThreadCpu(); // to have base for the first report
+    }
+}
+
+void ApplyThreadPolicy(GstElement* pipeline) noexcept
+{
+    if(!State || State->policy.mediaCores.empty())
+        return;
+
+    std::call_once(State->taskPoolCreated, [] () {
+        State->taskPool = GST_TASK_POOL(g_object_new(policy_task_pool_get_type(), nullptr));
+        gst_object_ref_sink(State->taskPool);
+    });
+
+    GstBus* bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+    gst_bus_enable_sync_message_emission(bus);
+    g_signal_connect(bus, "sync-message::stream-status", G_CALLBACK(OnStreamStatus), nullptr);
+    gst_object_unref(bus);
+}
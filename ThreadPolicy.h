@@ -0,0 +1,22 @@
+#pragma once
+
+#include <gst/gst.h>
+
+#include "Config.h"
+
+
+// GStreamer streaming threads of instrumented pipelines are created by own GstTaskPool
+// pinned to media cores with elevated priority,
+// while all other threads inherit control cores affinity from the main thread.
+
+// confines main thread, and so all threads created after, to control cores.
+// Has to be called from main thread before any other thread is created,
+// including GStreamer initialization one
+void ConfineControlThreads(const ThreadPolicy&) noexcept;
+
+// has to be called from main thread with thread default main context
+// after ConfineControlThreads(), doesn't require GStreamer to be initialized
+void StartThreadPolicy(const ThreadPolicy&) noexcept;
+
+// does nothing if media cores are not configured
+void ApplyThreadPolicy(GstElement* pipeline) noexcept;
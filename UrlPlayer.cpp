@@ -1,21 +1,210 @@
 #include "UrlPlayer.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#include <CxxPtr/GlibPtr.h>
 #include <CxxPtr/GstPtr.h>
 
+#include "DecodeDegrader.h"
+#include "FrameTrace.h"
+#include "LatencyController.h"
 #include "Log.h"
+#include "Metrics.h"
+#include "ProcessStats.h"
+#include "StageTiming.h"
+#include "Startup.h"
+#include "ThreadPolicy.h"
+#include "VideoSink.h"
+#include "VideoSourceBin.h"
+
+
+namespace {
+
+const char *const FirstFrameMessageName = "first-frame";
+const char *const MainStreamReadyMessageName = "main-stream-ready";
+const char *const SourceEosMessageName = "source-eos";
+
+// source could need much more time to connect than to deliver next frame
+constexpr std::chrono::milliseconds StartupStallAllowance = std::chrono::seconds(10);
+constexpr std::chrono::milliseconds MinStallCheckInterval = std::chrono::milliseconds(50);
+constexpr std::chrono::milliseconds MaxStallCheckInterval = std::chrono::milliseconds(1000);
+
+struct RtpCodec
+{
+    const char* encodingName;
+    const char* depayloader;
+    const char* parser;
+    const char* mediaType;
+};
+
+const RtpCodec RtpCodecs[] = {
+    { "H264", "rtph264depay", "h264parse", "video/x-h264" },
+    { "H265", "rtph265depay", "h265parse", "video/x-h265" },
+    { "JPEG", "rtpjpegdepay", "jpegparse", "image/jpeg" },
+    { "VP8", "rtpvp8depay", nullptr, "video/x-vp8" },
+    { "VP9", "rtpvp9depay", nullptr, "video/x-vp9" },
+};
+
+// picks decoder with the highest rank, i.e. hardware one if it's available and preferred
+GstElement* CreateDecoder(const char* mediaType)
+{
+    GList* decoders =
+        gst_element_factory_list_get_elements(
+            GST_ELEMENT_FACTORY_TYPE_DECODER | GST_ELEMENT_FACTORY_TYPE_MEDIA_VIDEO |
+                GST_ELEMENT_FACTORY_TYPE_MEDIA_IMAGE,
+            GST_RANK_MARGINAL);
+
+    GstCaps* caps = gst_caps_new_simple(mediaType, "parsed", G_TYPE_BOOLEAN, TRUE, nullptr);
+    GList* suitable = gst_element_factory_list_filter(decoders, caps, GST_PAD_SINK, FALSE);
+    gst_caps_unref(caps);
+    gst_plugin_feature_list_free(decoders);
+
+    suitable = g_list_sort(suitable, gst_plugin_feature_rank_compare_func);
 
+    GstElement* decoder = nullptr;
+    for(GList* item = suitable; item && !decoder; item = g_list_next(item))
+        decoder = gst_element_factory_create(GST_ELEMENT_FACTORY(item->data), nullptr);
+
+    gst_plugin_feature_list_free(suitable);
+
+    return decoder;
+}
+
+// standby pipeline keeps RTSP session playing, but doesn't decode
+enum class StandbyGate: uint8_t {
+    Open,
+    Closed, // encoded frames are dropped before decoder
+    WaitKeyframe, // until the first frame decodable on its own
+};
+
+struct FirstFrameProbeData
+{
+    const std::chrono::steady_clock::time_point startTime;
+    const bool fromStandby;
+};
+
+struct PlayerMetrics
+{
+    explicit PlayerMetrics(const std::string& player);
+
+    MetricValue* renderedFrames;
+    MetricValue* droppedFrames;
+    MetricValue* lateFrames;
+    MetricValue* decoderQosEvents;
+    MetricValue* receivedBytes;
+    MetricValue* jitterBufferDelay; // microseconds
+};
+
+PlayerMetrics::PlayerMetrics(const std::string& player)
+{
+    const MetricLabels labels = { { "player", player } };
+
+    renderedFrames =
+        RegisterMetric(MetricType::Counter, "monitor_rendered_frames_total", "Frames reached video sink", labels);
+    droppedFrames =
+        RegisterMetric(MetricType::Counter, "monitor_dropped_frames_total", "Frames dropped by video sink", labels);
+    lateFrames =
+        RegisterMetric(MetricType::Counter, "monitor_late_frames_total", "Late frames reported by video sink QoS", labels);
+    decoderQosEvents =
+        RegisterMetric(MetricType::Counter, "monitor_decoder_qos_events_total", "QoS messages from elements other than sink", labels);
+    receivedBytes =
+        RegisterMetric(MetricType::Counter, "monitor_received_bytes_total", "Encoded video bytes reached decoder", labels);
+    jitterBufferDelay =
+        RegisterMetric(MetricType::Gauge, "monitor_jitterbuffer_delay_us", "Time last packet spent in jitter buffer", labels);
+}
+
+}
 
 struct UrlPlayer::Private
 {
     Private(UrlPlayer* owner, const UrlPlayer::EosCallback& eosCallback);
 
+    GstElementPtr createVideoSink() noexcept;
+    PlayerMetrics& playerMetrics() noexcept;
+    void setPipeline(GstElementPtr& pipelinePtr, GstElement* sink, const std::string& url) noexcept;
+    void instrumentPipeline(GstElement* pipeline) noexcept;
+    void instrumentElement(GstElement*) noexcept;
+    void onQos(GstMessage*) noexcept;
+    bool createPipeline(const std::string& url) noexcept;
+    bool createLeanRtspPipeline(const std::string& url) noexcept;
+    bool createPersistentPipeline(const std::string& url) noexcept;
+    bool attachSource(const std::string& url) noexcept;
+    void detachSource() noexcept;
+    void onSourceLost() noexcept;
+    void onRtspPadAdded(GstPad*) noexcept;
+    void postLeanPipelineError(const char* message) noexcept;
+    bool createProgressivePipeline(const std::string& url, const std::string& substreamUrl) noexcept;
+    void watchFirstFrame(bool fromStandby) noexcept;
+    void watchMainStream() noexcept;
+    void startStallWatchdog() noexcept;
+    void stopStallWatchdog() noexcept;
+    void gateDecoder(GstElement*) noexcept;
+    void checkStall() noexcept;
+
     gboolean onBusMessage(GstMessage*);
+    void onFirstFrame(const GstStructure*) noexcept;
+    void onMainStreamReady() noexcept;
+    void dropSubstream() noexcept;
 
     UrlPlayer *const owner;
     const UrlPlayer::EosCallback eosCallback;
+    UrlPlayer::SourceSetupCallback sourceSetupCallback;
+    UrlPlayer::FirstFrameCallback firstFrameCallback;
+    UrlPlayer::DecodeLoadCallback decodeLoadCallback;
+    bool leanRtspPipeline = false;
+    unsigned rtspLatency = 0; // ms
+    bool persistentSink = false;
+    std::chrono::milliseconds latencyTarget = std::chrono::milliseconds(0); // 0 - disabled
+    unsigned maxCatchUpRate = 0; // percent
+    bool decodeDegradation = false;
+    unsigned degradedFramerate = 0;
+    std::string metricsName = "main";
+    // registered on first use, so setMetricsName() doesn't leave unused series behind
+    std::unique_ptr<PlayerMetrics> metrics;
+    guint64 lastQosDropped = 0; // of current pipeline
 
     std::shared_ptr<spdlog::logger> log;
     GstElementPtr pipelinePtr;
+    GstElement* videoSink = nullptr; // owned by pipeline
+    // declared after pipeline to be destroyed (and detached) before it
+    std::unique_ptr<LatencyController> latencyController;
+    std::unique_ptr<DecodeDegrader> decodeDegrader;
+
+    std::string url;
+    bool standby = false;
+
+    // lean rtsp and persistent sink pipelines only
+    GstElement* convert = nullptr; // owned by pipeline
+
+    // lean rtsp pipeline only
+    bool videoStreamSelected = false;
+
+    // persistent sink pipeline only
+    bool persistentPipeline = false;
+    GstElement* sourceBin = nullptr; // owned by pipeline, nullptr while detached
+
+    // progressive startup only
+    GstElement* selector = nullptr; // owned by pipeline
+    GstElement* substreamBin = nullptr; // owned by pipeline
+    GstPadPtr substreamSelectorPadPtr;
+    GstPadPtr mainSelectorPadPtr;
+    std::chrono::steady_clock::time_point progressiveStartTime;
+
+    // stall watchdog
+    std::chrono::milliseconds stallTimeout = std::chrono::milliseconds(0);
+    std::atomic<gint64> lastBufferTime = 0; // monotonic time, 0 - no buffers yet
+    gint64 watchdogStartTime = 0;
+    GSourcePtr stallCheckSourcePtr;
+    GstPadPtr stallProbePadPtr; // persistent sink pad outlives source reconnects
+    gulong stallProbeId = 0;
+    unsigned stallsCount = 0;
+
+    // applies to all decoders of current pipeline
+    std::atomic<StandbyGate> standbyGate = StandbyGate::Open;
 };
 
 UrlPlayer::Private::Private(UrlPlayer* owner, const UrlPlayer::EosCallback& eosCallback):
@@ -25,13 +214,875 @@ UrlPlayer::Private::Private(UrlPlayer* owner, const UrlPlayer::EosCallback& eosC
 {
 }
 
+GstElementPtr UrlPlayer::Private::createVideoSink() noexcept
+{
+    return CreateVideoSink(owner->_showVideoStats, owner->_sync);
+}
+
+PlayerMetrics& UrlPlayer::Private::playerMetrics() noexcept
+{
+    if(!metrics)
+        metrics = std::make_unique<PlayerMetrics>(metricsName);
+
+    return *metrics;
+}
+
+void UrlPlayer::Private::setPipeline(
+    GstElementPtr& pipelinePtr,
+    GstElement* sink,
+    const std::string& url) noexcept
+{
+    auto onBusMessageCallback =
+        + [] (GstBus* bus, GstMessage* message, gpointer userData) -> gboolean
+    {
+        Private* self = static_cast<Private*>(userData);
+        return self->onBusMessage(message);
+    };
+    GstBusPtr busPtr(gst_pipeline_get_bus(GST_PIPELINE(pipelinePtr.get())));
+    gst_bus_add_watch(busPtr.get(), onBusMessageCallback, this);
+
+    // load callback alone needs only measurements, without frames skipping
+    if((decodeDegradation || decodeLoadCallback) && !decodeDegrader) {
+        decodeDegrader =
+            std::make_unique<DecodeDegrader>(degradedFramerate, metricsName, !decodeDegradation);
+        decodeDegrader->setLoadCallback(
+            [this] (DecodeDegrader::Level level, unsigned lateFrames, double busyRatio) {
+                if(decodeLoadCallback) {
+                    decodeLoadCallback(
+                        *owner,
+                        UrlPlayer::DecodeLoad { static_cast<unsigned>(level), lateFrames, busyRatio });
+                }
+            });
+    }
+
+    InstrumentPipeline(pipelinePtr.get());
+    ApplyThreadPolicy(pipelinePtr.get());
+    instrumentPipeline(pipelinePtr.get());
+    lastQosDropped = 0;
+
+    if(decodeDegrader)
+        decodeDegrader->start();
+
+    if(latencyTarget.count() > 0 && owner->_sync) {
+        if(!latencyController)
+            latencyController = std::make_unique<LatencyController>(latencyTarget, maxCatchUpRate, metricsName);
+        latencyController->attach(pipelinePtr.get(), sink);
+    }
+
+    this->pipelinePtr.swap(pipelinePtr);
+    this->videoSink = sink;
+    this->url = url;
+}
+
+void UrlPlayer::Private::instrumentPipeline(GstElement* pipeline) noexcept
+{
+    GstIterator* iterator = gst_bin_iterate_recurse(GST_BIN(pipeline));
+    GValue item = G_VALUE_INIT;
+    while(gst_iterator_next(iterator, &item) == GST_ITERATOR_OK) {
+        instrumentElement(GST_ELEMENT(g_value_get_object(&item)));
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iterator);
+
+    auto onDeepElementAdded =
+        + [] (GstBin* bin, GstBin* subBin, GstElement* element, gpointer userData) {
+            static_cast<Private*>(userData)->instrumentElement(element);
+        };
+    g_signal_connect(pipeline, "deep-element-added", G_CALLBACK(onDeepElementAdded), this);
+}
+
+void UrlPlayer::Private::instrumentElement(GstElement* element) noexcept
+{
+    if(GST_IS_BIN(element))
+        return;
+
+    // copy is owned by probe, so metrics name could be changed at any time
+    auto addProbe =
+        [this] (GstElement* element, const char* padName, GstPadProbeType type, GstPadProbeCallback callback) {
+            GstPadPtr padPtr(gst_element_get_static_pad(element, padName));
+            if(!padPtr)
+                return;
+
+            gst_pad_add_probe(
+                padPtr.get(),
+                type,
+                callback,
+                new PlayerMetrics(playerMetrics()),
+                [] (gpointer userData) { delete static_cast<PlayerMetrics*>(userData); });
+        };
+
+    GstElementFactory* factory = gst_element_get_factory(element);
+    const gchar* klass =
+        factory ? gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS) : nullptr;
+
+    if(GST_OBJECT_FLAG_IS_SET(element, GST_ELEMENT_FLAG_SINK)) {
+        addProbe(
+            element,
+            "sink",
+            GST_PAD_PROBE_TYPE_BUFFER,
+            [] (GstPad*, GstPadProbeInfo*, gpointer userData) -> GstPadProbeReturn {
+                static_cast<PlayerMetrics*>(userData)->renderedFrames->add();
+                return GST_PAD_PROBE_OK;
+            });
+    } else if(klass && strstr(klass, "Decoder") && strstr(klass, "Video")) {
+        // goes first, so frames dropped in standby are not counted
+        gateDecoder(element);
+
+        addProbe(
+            element,
+            "sink",
+            GST_PAD_PROBE_TYPE_BUFFER,
+            [] (GstPad*, GstPadProbeInfo* info, gpointer userData) -> GstPadProbeReturn {
+                static_cast<PlayerMetrics*>(userData)->receivedBytes->add(
+                    gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info)));
+                return GST_PAD_PROBE_OK;
+            });
+
+        if(decodeDegrader)
+            decodeDegrader->instrumentDecoder(element);
+
+        TraceDecoder(element);
+    } else if(factory && g_strcmp0(GST_OBJECT_NAME(factory), "rtpjitterbuffer") == 0) {
+        addProbe(
+            element,
+            "src",
+            static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+            [] (GstPad* pad, GstPadProbeInfo* info, gpointer userData) -> GstPadProbeReturn {
+                GstBuffer* buffer = nullptr;
+                if(info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+                    GstBufferList* list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+                    if(gst_buffer_list_length(list) > 0)
+                        buffer = gst_buffer_list_get(list, 0);
+                } else {
+                    buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+                }
+                if(!buffer || !GST_BUFFER_DTS_IS_VALID(buffer))
+                    return GST_PAD_PROBE_OK;
+
+                GstElement* jitterBuffer = GST_PAD_PARENT(pad);
+                GstClock* clock = gst_element_get_clock(jitterBuffer);
+                if(!clock)
+                    return GST_PAD_PROBE_OK;
+
+                // DTS of packet leaving jitter buffer is still its arrival running time
+                const GstClockTime runningTime =
+                    gst_clock_get_time(clock) - gst_element_get_base_time(jitterBuffer);
+                gst_object_unref(clock);
+
+                if(runningTime > GST_BUFFER_DTS(buffer)) {
+                    static_cast<PlayerMetrics*>(userData)->jitterBufferDelay->set(
+                        GST_TIME_AS_USECONDS(runningTime - GST_BUFFER_DTS(buffer)));
+                }
+
+                return GST_PAD_PROBE_OK;
+            });
+    }
+}
+
+void UrlPlayer::Private::onQos(GstMessage* message) noexcept
+{
+    GstObject* source = GST_MESSAGE_SRC(message);
+    if(!GST_IS_ELEMENT(source) || !GST_OBJECT_FLAG_IS_SET(source, GST_ELEMENT_FLAG_SINK)) {
+        playerMetrics().decoderQosEvents->add();
+        // decoder drops frames it's not able to decode in time
+        if(decodeDegrader)
+            decodeDegrader->onLateFrame();
+        return;
+    }
+
+    gint64 jitter = 0;
+    gst_message_parse_qos_values(message, &jitter, nullptr, nullptr);
+    if(jitter > 0) {
+        playerMetrics().lateFrames->add();
+        if(decodeDegrader)
+            decodeDegrader->onLateFrame();
+    }
+
+    GstFormat format = GST_FORMAT_UNDEFINED;
+    guint64 processed = 0;
+    guint64 dropped = 0;
+    gst_message_parse_qos_stats(message, &format, &processed, &dropped);
+    if(format == GST_FORMAT_BUFFERS && dropped != G_MAXUINT64 && dropped > lastQosDropped) {
+        playerMetrics().droppedFrames->add(dropped - lastQosDropped);
+        lastQosDropped = dropped;
+    }
+}
+
+bool UrlPlayer::Private::createPipeline(const std::string& url) noexcept
+{
+    if(leanRtspPipeline && g_str_has_prefix(url.c_str(), "rtsp"))
+        return createLeanRtspPipeline(url);
+
+    if(persistentSink && !sourceSetupCallback)
+        return createPersistentPipeline(url);
+
+    GstElementPtr pipelinePtr(gst_pipeline_new(nullptr));
+    GstElement* pipeline = pipelinePtr.get();
+    if(!pipeline) {
+        log->error("Failed to create pipeline element");
+        return false;
+    }
+
+    GstElementPtr playbinPtr(gst_element_factory_make("playbin3", nullptr));
+    GstElement* playbin = playbinPtr.get();
+    if(!playbin) {
+        log->error("Failed to create \"playbin3\" element");
+        return false;
+    }
+
+    GstElementPtr sinkPtr = createVideoSink();
+    GstElement* sink = sinkPtr.get();
+    if(!sink)
+        return false;
+
+    g_object_set(playbin, "video-sink", sinkPtr.release(), nullptr);
+
+    if(sourceSetupCallback) {
+        auto onSourceSetupCallback =
+            + [] (GstElement* playbin, GstElement* source, gpointer userData)
+        {
+            Private* self = static_cast<Private*>(userData);
+            self->sourceSetupCallback(source);
+        };
+        g_signal_connect(playbin, "source-setup", G_CALLBACK(onSourceSetupCallback), this);
+    }
+
+    gst_bin_add_many(GST_BIN(pipeline), playbinPtr.release(), nullptr);
+
+    g_object_set(playbin, "uri", url.c_str(), nullptr);
+
+    setPipeline(pipelinePtr, sink, url);
+
+    return true;
+}
+
+bool UrlPlayer::Private::createPersistentPipeline(const std::string& url) noexcept
+{
+    GstElementPtr pipelinePtr(gst_pipeline_new(nullptr));
+    GstElement* pipeline = pipelinePtr.get();
+    if(!pipeline) {
+        log->error("Failed to create pipeline element");
+        return false;
+    }
+
+    GstElement* convert = gst_element_factory_make("videoconvert", nullptr);
+    GstElement* scale = gst_element_factory_make("videoscale", nullptr);
+    if(!convert || !scale) {
+        log->error("Failed to create \"videoconvert\" or \"videoscale\" element");
+        if(convert) gst_object_unref(convert);
+        if(scale) gst_object_unref(scale);
+        return false;
+    }
+
+    GstElementPtr sinkPtr = createVideoSink();
+    GstElement* sink = sinkPtr.get();
+    if(!sink) {
+        gst_object_unref(convert);
+        gst_object_unref(scale);
+        return false;
+    }
+
+    gst_bin_add_many(GST_BIN(pipeline), convert, scale, sinkPtr.release(), nullptr);
+    if(!gst_element_link_many(convert, scale, sink, nullptr)) {
+        log->error("Failed to link video sink");
+        return false;
+    }
+
+    setPipeline(pipelinePtr, sink, url);
+    this->convert = convert;
+    persistentPipeline = true;
+
+    if(!attachSource(url)) {
+        // pipeline is installed already, so it has to be torn down as on stop()
+        owner->stop();
+        return false;
+    }
+
+    return true;
+}
+
+bool UrlPlayer::Private::attachSource(const std::string& url) noexcept
+{
+    GstElement* pipeline = pipelinePtr.get();
+
+    GstElement* bin = CreateVideoSourceBin(url);
+    if(!bin)
+        return false;
+
+    gst_bin_add(GST_BIN(pipeline), bin);
+    if(!gst_element_link(bin, convert)) {
+        log->error("Failed to link source of \"{}\"", url);
+        gst_bin_remove(GST_BIN(pipeline), bin);
+        return false;
+    }
+
+    // EOS would finish the sink too, so source end is reported separately
+    auto eosCallback =
+        [] (GstPad* pad, GstPadProbeInfo* info, gpointer userData) -> GstPadProbeReturn {
+            GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+            if(GST_EVENT_TYPE(event) != GST_EVENT_EOS)
+                return GST_PAD_PROBE_OK;
+
+            GstElement* bin = gst_pad_get_parent_element(pad);
+            if(bin) {
+                gst_element_post_message(
+                    bin,
+                    gst_message_new_application(
+                        GST_OBJECT(bin),
+                        gst_structure_new_empty(SourceEosMessageName)));
+                gst_object_unref(bin);
+            }
+
+            return GST_PAD_PROBE_DROP;
+        };
+    GstPadPtr srcPadPtr(gst_element_get_static_pad(bin, "src"));
+    gst_pad_add_probe(srcPadPtr.get(), GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, eosCallback, nullptr, nullptr);
+
+    sourceBin = bin;
+    this->url = url;
+
+    if(decodeDegrader)
+        decodeDegrader->start();
+
+    gst_element_sync_state_with_parent(bin);
+
+    return true;
+}
+
+void UrlPlayer::Private::detachSource() noexcept
+{
+    if(!sourceBin)
+        return;
+
+    GstElement* bin = sourceBin;
+    sourceBin = nullptr;
+
+    gst_element_set_locked_state(bin, TRUE);
+    gst_element_set_state(bin, GST_STATE_NULL);
+    gst_bin_remove(GST_BIN(pipelinePtr.get()), bin);
+}
+
+void UrlPlayer::Private::onSourceLost() noexcept
+{
+    if(!eosCallback) {
+        // nobody is going to reconnect, so there is no reason to keep last frame
+        owner->stop();
+        return;
+    }
+
+    log->info("Source of \"{}\" is lost. Keeping last frame on screen until reconnect...", url);
+
+    stopStallWatchdog();
+    detachSource();
+
+    eosCallback(*owner);
+}
+
+bool UrlPlayer::Private::createLeanRtspPipeline(const std::string& url) noexcept
+{
+    GstElementPtr pipelinePtr(gst_pipeline_new(nullptr));
+    GstElement* pipeline = pipelinePtr.get();
+    if(!pipeline) {
+        log->error("Failed to create pipeline element");
+        return false;
+    }
+
+    GstElement* source = gst_element_factory_make("rtspsrc", nullptr);
+    if(!source) {
+        log->error("Failed to create \"rtspsrc\" element");
+        return false;
+    }
+    gst_bin_add(GST_BIN(pipeline), source);
+
+    g_object_set(source, "location", url.c_str(), "latency", rtspLatency, nullptr);
+
+    // only the first video stream is set up, so there is no audio branch at all
+    auto onSelectStreamCallback =
+        + [] (GstElement*, guint /*num*/, GstCaps* caps, gpointer userData) -> gboolean
+    {
+        Private* self = static_cast<Private*>(userData);
+
+        const GstStructure* structure = gst_caps_get_structure(caps, 0);
+        if(g_strcmp0(gst_structure_get_string(structure, "media"), "video") != 0)
+            return FALSE;
+
+        if(self->videoStreamSelected)
+            return FALSE;
+
+        self->videoStreamSelected = true;
+        return TRUE;
+    };
+    g_signal_connect(source, "select-stream", G_CALLBACK(onSelectStreamCallback), this);
+
+    auto onPadAddedCallback =
+        + [] (GstElement*, GstPad* pad, gpointer userData)
+    {
+        static_cast<Private*>(userData)->onRtspPadAdded(pad);
+    };
+    g_signal_connect(source, "pad-added", G_CALLBACK(onPadAddedCallback), this);
+
+    GstElement* convert = gst_element_factory_make("videoconvert", nullptr);
+    if(!convert) {
+        log->error("Failed to create \"videoconvert\" element");
+        return false;
+    }
+    gst_bin_add(GST_BIN(pipeline), convert);
+
+    GstElementPtr sinkPtr = createVideoSink();
+    GstElement* sink = sinkPtr.get();
+    if(!sink)
+        return false;
+    gst_bin_add(GST_BIN(pipeline), sinkPtr.release());
+
+    if(!gst_element_link(convert, sink)) {
+        log->error("Failed to link video sink");
+        return false;
+    }
+
+    setPipeline(pipelinePtr, sink, url);
+
+    this->convert = convert;
+    this->videoStreamSelected = false;
+
+    return true;
+}
+
+// called from rtspsrc thread
+void UrlPlayer::Private::onRtspPadAdded(GstPad* pad) noexcept
+{
+    GstPadPtr convertPadPtr(gst_element_get_static_pad(convert, "sink"));
+    if(gst_pad_is_linked(convertPadPtr.get()))
+        return;
+
+    GstCaps* caps = gst_pad_get_current_caps(pad);
+    if(!caps)
+        caps = gst_pad_query_caps(pad, nullptr);
+    const GstStructure* structure =
+        caps && !gst_caps_is_empty(caps) ? gst_caps_get_structure(caps, 0) : nullptr;
+    const gchar* encodingName =
+        structure ? gst_structure_get_string(structure, "encoding-name") : nullptr;
+
+    const RtpCodec* codec = nullptr;
+    for(const RtpCodec& rtpCodec: RtpCodecs) {
+        if(encodingName && g_ascii_strcasecmp(rtpCodec.encodingName, encodingName) == 0) {
+            codec = &rtpCodec;
+            break;
+        }
+    }
+
+    if(!codec) {
+        log->error("Lean pipeline doesn't support \"{}\" encoding", encodingName ? encodingName : "");
+        if(caps)
+            gst_caps_unref(caps);
+        return;
+    }
+
+    if(caps)
+        gst_caps_unref(caps);
+
+    GstElement* pipeline = pipelinePtr.get();
+
+    GstElement* depayloader = gst_element_factory_make(codec->depayloader, nullptr);
+    GstElement* parser = codec->parser ? gst_element_factory_make(codec->parser, nullptr) : nullptr;
+    GstElement* decoder = CreateDecoder(codec->mediaType);
+    if(!depayloader || (codec->parser && !parser) || !decoder) {
+        log->error("Failed to create lean pipeline elements for {}", codec->encodingName);
+        if(depayloader) gst_object_unref(depayloader);
+        if(parser) gst_object_unref(parser);
+        if(decoder) gst_object_unref(decoder);
+        postLeanPipelineError("Failed to create lean pipeline elements");
+        return;
+    }
+
+    log->info(
+        "Lean pipeline: {} -> {} -> {}",
+        codec->depayloader,
+        codec->parser ? codec->parser : "no parser",
+        GST_OBJECT_NAME(gst_element_get_factory(decoder)));
+
+    gst_bin_add_many(GST_BIN(pipeline), depayloader, decoder, nullptr);
+    if(parser)
+        gst_bin_add(GST_BIN(pipeline), parser);
+
+    const bool linked =
+        parser ?
+            gst_element_link_many(depayloader, parser, decoder, convert, nullptr) :
+            gst_element_link_many(depayloader, decoder, convert, nullptr);
+    if(!linked) {
+        log->error("Failed to link {} to video sink", codec->depayloader);
+        postLeanPipelineError("Failed to link lean pipeline");
+        return;
+    }
+
+    gst_element_sync_state_with_parent(decoder);
+    if(parser)
+        gst_element_sync_state_with_parent(parser);
+    gst_element_sync_state_with_parent(depayloader);
+
+    GstPadPtr depayloaderPadPtr(gst_element_get_static_pad(depayloader, "sink"));
+    if(gst_pad_link(pad, depayloaderPadPtr.get()) != GST_PAD_LINK_OK) {
+        log->error("Failed to link rtspsrc to {}", codec->depayloader);
+        postLeanPipelineError("Failed to link rtspsrc");
+    }
+}
+
+// called from rtspsrc thread,
+// bus handler will log it and finish playback as with any other pipeline error
+void UrlPlayer::Private::postLeanPipelineError(const char* message) noexcept
+{
+    GstElement* pipeline = pipelinePtr.get();
+
+    GError* error = g_error_new_literal(GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION, message);
+    gst_element_post_message(
+        pipeline,
+        gst_message_new_error(GST_OBJECT(pipeline), error, nullptr));
+    g_error_free(error);
+}
+
+// substream and main stream are decoded in parallel and feed input-selector,
+// which is switched to main stream as soon as it has first decoded frame
+bool UrlPlayer::Private::createProgressivePipeline(
+    const std::string& url,
+    const std::string& substreamUrl) noexcept
+{
+    GstElementPtr pipelinePtr(gst_pipeline_new(nullptr));
+    GstElement* pipeline = pipelinePtr.get();
+    if(!pipeline) {
+        log->error("Failed to create pipeline element");
+        return false;
+    }
+
+    GstElement* substreamBin = CreateVideoSourceBin(substreamUrl);
+    if(!substreamBin)
+        return false;
+    gst_bin_add(GST_BIN(pipeline), substreamBin);
+
+    GstElement* mainBin = CreateVideoSourceBin(url);
+    if(!mainBin)
+        return false;
+    gst_bin_add(GST_BIN(pipeline), mainBin);
+
+    GstElement* selector = gst_element_factory_make("input-selector", nullptr);
+    if(!selector) {
+        log->error("Failed to create \"input-selector\" element");
+        return false;
+    }
+    // inactive stream is just dropped
+    g_object_set(selector, "sync-streams", FALSE, nullptr);
+    gst_bin_add(GST_BIN(pipeline), selector);
+
+    GstElement* convert = gst_element_factory_make("videoconvert", nullptr);
+    if(!convert) {
+        log->error("Failed to create \"videoconvert\" element");
+        return false;
+    }
+    gst_bin_add(GST_BIN(pipeline), convert);
+
+    GstElementPtr sinkPtr = createVideoSink();
+    GstElement* sink = sinkPtr.get();
+    if(!sink)
+        return false;
+    gst_bin_add(GST_BIN(pipeline), sinkPtr.release());
+
+    GstPadPtr substreamSelectorPadPtr(gst_element_request_pad_simple(selector, "sink_%u"));
+    GstPadPtr mainSelectorPadPtr(gst_element_request_pad_simple(selector, "sink_%u"));
+    GstPadPtr substreamSrcPadPtr(gst_element_get_static_pad(substreamBin, "src"));
+    GstPadPtr mainSrcPadPtr(gst_element_get_static_pad(mainBin, "src"));
+    if(
+        gst_pad_link(substreamSrcPadPtr.get(), substreamSelectorPadPtr.get()) != GST_PAD_LINK_OK ||
+        gst_pad_link(mainSrcPadPtr.get(), mainSelectorPadPtr.get()) != GST_PAD_LINK_OK ||
+        !gst_element_link_many(selector, convert, sink, nullptr))
+    {
+        log->error("Failed to link progressive startup pipeline");
+        return false;
+    }
+
+    g_object_set(selector, "active-pad", substreamSelectorPadPtr.get(), nullptr);
+
+    setPipeline(pipelinePtr, sink, url);
+
+    this->selector = selector;
+    this->substreamBin = substreamBin;
+    this->substreamSelectorPadPtr.swap(substreamSelectorPadPtr);
+    this->mainSelectorPadPtr.swap(mainSelectorPadPtr);
+    this->progressiveStartTime = std::chrono::steady_clock::now();
+
+    watchMainStream();
+
+    return true;
+}
+
+void UrlPlayer::Private::watchFirstFrame(bool fromStandby) noexcept
+{
+    GstPadPtr padPtr(gst_element_get_static_pad(videoSink, "sink"));
+    GstPad* pad = padPtr.get();
+    if(!pad) {
+        log->warn("Failed to get video sink pad. First frame time will not be measured");
+        return;
+    }
+
+    auto probeCallback =
+        [] (GstPad* pad, GstPadProbeInfo* info, gpointer userData) -> GstPadProbeReturn {
+            const FirstFrameProbeData& data = *static_cast<FirstFrameProbeData*>(userData);
+
+            const auto elapsed =
+                std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - data.startTime);
+
+            GstElement* sink = gst_pad_get_parent_element(pad);
+            if(sink) {
+                GstStructure* structure =
+                    gst_structure_new(
+                        FirstFrameMessageName,
+                        "elapsed", G_TYPE_INT64, static_cast<gint64>(elapsed.count()),
+                        "standby", G_TYPE_BOOLEAN, data.fromStandby ? TRUE : FALSE,
+                        nullptr);
+                gst_element_post_message(
+                    sink,
+                    gst_message_new_application(GST_OBJECT(sink), structure));
+                gst_object_unref(sink);
+            }
+
+            return GST_PAD_PROBE_REMOVE;
+        };
+
+    gst_pad_add_probe(
+        pad,
+        GST_PAD_PROBE_TYPE_BUFFER,
+        probeCallback,
+        new FirstFrameProbeData { std::chrono::steady_clock::now(), fromStandby },
+        [] (gpointer userData) { delete static_cast<FirstFrameProbeData*>(userData); });
+}
+
+void UrlPlayer::Private::startStallWatchdog() noexcept
+{
+    stopStallWatchdog();
+
+    if(stallTimeout.count() == 0)
+        return;
+
+    GstPadPtr padPtr(gst_element_get_static_pad(videoSink, "sink"));
+    GstPad* pad = padPtr.get();
+    if(!pad) {
+        log->warn("Failed to get video sink pad. Stall watchdog is disabled");
+        return;
+    }
+
+    lastBufferTime = 0;
+    watchdogStartTime = g_get_monotonic_time();
+
+    auto probeCallback =
+        [] (GstPad* pad, GstPadProbeInfo* info, gpointer userData) -> GstPadProbeReturn {
+            Private* self = static_cast<Private*>(userData);
+            self->lastBufferTime.store(g_get_monotonic_time(), std::memory_order_relaxed);
+            return GST_PAD_PROBE_OK;
+        };
+    stallProbeId = gst_pad_add_probe(
+        pad,
+        static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+        probeCallback,
+        this,
+        nullptr);
+    stallProbePadPtr = std::move(padPtr);
+
+    const std::chrono::milliseconds checkInterval =
+        std::clamp(stallTimeout / 4, MinStallCheckInterval, MaxStallCheckInterval);
+
+    stallCheckSourcePtr.reset(g_timeout_source_new(checkInterval.count()));
+    GSource* timeoutSource = stallCheckSourcePtr.get();
+    g_source_set_callback(
+        timeoutSource,
+        [] (gpointer userData) -> gboolean {
+            static_cast<Private*>(userData)->checkStall();
+            return G_SOURCE_CONTINUE;
+        },
+        this,
+        nullptr);
+    g_source_attach(timeoutSource, g_main_context_get_thread_default());
+}
+
+// Standby pipeline is kept PLAYING, since cameras drop RTSP sessions
+// which were set up but never played or kept alive.
+// Encoded frames are dropped before decoder, so standby costs depayloading only,
+// and video sink doesn't get even caps until playback is resumed.
+void UrlPlayer::Private::gateDecoder(GstElement* decoder) noexcept
+{
+    GstPadPtr sinkPadPtr(gst_element_get_static_pad(decoder, "sink"));
+    GstPadPtr srcPadPtr(gst_element_get_static_pad(decoder, "src"));
+    if(!sinkPadPtr || !srcPadPtr)
+        return;
+
+    auto sinkProbeCallback =
+        [] (GstPad*, GstPadProbeInfo* info, gpointer userData) -> GstPadProbeReturn {
+            Private* self = static_cast<Private*>(userData);
+
+            switch(self->standbyGate.load(std::memory_order_relaxed)) {
+            case StandbyGate::Open:
+                return GST_PAD_PROBE_OK;
+            case StandbyGate::Closed:
+                return GST_PAD_PROBE_DROP;
+            case StandbyGate::WaitKeyframe:
+                break;
+            }
+
+            GstBuffer* buffer = nullptr;
+            if(info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST) {
+                GstBufferList* list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+                if(gst_buffer_list_length(list) > 0)
+                    buffer = gst_buffer_list_get(list, 0);
+            } else {
+                buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+            }
+            if(!buffer || GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT))
+                return GST_PAD_PROBE_DROP;
+
+            // decoder has to know previous frames were skipped
+            if(!(info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)) {
+                buffer = gst_buffer_make_writable(buffer);
+                GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DISCONT);
+                GST_PAD_PROBE_INFO_DATA(info) = buffer;
+            }
+
+            // gate could be already closed again meanwhile
+            StandbyGate expected = StandbyGate::WaitKeyframe;
+            self->standbyGate.compare_exchange_strong(expected, StandbyGate::Open);
+
+            return GST_PAD_PROBE_OK;
+        };
+    gst_pad_add_probe(
+        sinkPadPtr.get(),
+        static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+        sinkProbeCallback,
+        this,
+        nullptr);
+
+    // frames still inside decoder when standby is re-armed on playing pipeline
+    auto srcProbeCallback =
+        [] (GstPad*, GstPadProbeInfo*, gpointer userData) -> GstPadProbeReturn {
+            Private* self = static_cast<Private*>(userData);
+            return self->standbyGate.load(std::memory_order_relaxed) == StandbyGate::Open ?
+                GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+        };
+    gst_pad_add_probe(
+        srcPadPtr.get(),
+        static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST),
+        srcProbeCallback,
+        this,
+        nullptr);
+}
+
+void UrlPlayer::Private::stopStallWatchdog() noexcept
+{
+    if(stallProbePadPtr) {
+        if(stallProbeId)
+            gst_pad_remove_probe(stallProbePadPtr.get(), stallProbeId);
+        stallProbePadPtr.reset();
+        stallProbeId = 0;
+    }
+
+    if(!stallCheckSourcePtr)
+        return;
+
+    g_source_destroy(stallCheckSourcePtr.get());
+    stallCheckSourcePtr.reset();
+}
+
+void UrlPlayer::Private::checkStall() noexcept
+{
+    const gint64 now = g_get_monotonic_time();
+    const gint64 lastBufferTime = this->lastBufferTime.load(std::memory_order_relaxed);
+
+    const std::chrono::microseconds sinceLastBuffer(now - (lastBufferTime ? lastBufferTime : watchdogStartTime));
+    const std::chrono::milliseconds allowedStall =
+        lastBufferTime ? stallTimeout : stallTimeout + StartupStallAllowance;
+    if(sinceLastBuffer < allowedStall)
+        return;
+
+    ++stallsCount;
+    log->warn(
+        "Video stalled: no frames for {} ms {} (stall #{}). Restarting playback...",
+        std::chrono::duration_cast<std::chrono::milliseconds>(sinceLastBuffer).count(),
+        lastBufferTime ? "after last one" : "since start",
+        stallsCount);
+
+    stopStallWatchdog();
+    if(persistentPipeline)
+        onSourceLost();
+    else
+        owner->onEos();
+}
+
+void UrlPlayer::Private::watchMainStream() noexcept
+{
+    auto probeCallback =
+        [] (GstPad* pad, GstPadProbeInfo* info, gpointer userData) -> GstPadProbeReturn {
+            GstElement* selector = gst_pad_get_parent_element(pad);
+            if(selector) {
+                gst_element_post_message(
+                    selector,
+                    gst_message_new_application(
+                        GST_OBJECT(selector),
+                        gst_structure_new_empty(MainStreamReadyMessageName)));
+                gst_object_unref(selector);
+            }
+
+            return GST_PAD_PROBE_REMOVE;
+        };
+
+    gst_pad_add_probe(
+        mainSelectorPadPtr.get(),
+        GST_PAD_PROBE_TYPE_BUFFER,
+        probeCallback,
+        nullptr,
+        nullptr);
+}
+
 gboolean UrlPlayer::Private::onBusMessage(GstMessage* message)
 {
+    OnBusMessageDispatched(message);
+
     switch(GST_MESSAGE_TYPE(message)) {
         case GST_MESSAGE_EOS:
             owner->onEos();
             break;
+        case GST_MESSAGE_QOS:
+            onQos(message);
+            break;
         case GST_MESSAGE_ERROR: {
+            GstObject* source = GST_MESSAGE_SRC(message);
+            // failed elements could post several errors,
+            // and the following ones are dispatched when they are already removed from pipeline
+            if(source != GST_OBJECT(pipelinePtr.get()) &&
+                !gst_object_has_as_ancestor(source, GST_OBJECT(pipelinePtr.get())))
+            {
+                break; // from already detached source or dropped substream
+            }
+
+            if(persistentPipeline) {
+                if(sourceBin && gst_object_has_as_ancestor(source, GST_OBJECT(sourceBin))) {
+                    GError* error = nullptr;
+                    gst_message_parse_error(message, &error, nullptr);
+                    GErrorPtr errorPtr(error);
+                    log->error("Source of \"{}\" failed: {}", url, error->message);
+
+                    onSourceLost();
+                    break;
+                }
+            }
+
+            if(substreamBin && gst_object_has_as_ancestor(source, GST_OBJECT(substreamBin))) {
+                // main stream could still be fine
+                GError* error = nullptr;
+                gst_message_parse_error(message, &error, nullptr);
+                GErrorPtr errorPtr(error);
+                log->warn("Substream failed: {}. Waiting for main stream...", error->message);
+
+                g_object_set(selector, "active-pad", mainSelectorPadPtr.get(), nullptr);
+                dropSubstream();
+                break;
+            }
+
             gchar* debug = nullptr;
             GError* error = nullptr;
             gst_message_parse_error(message, &error, &debug);
@@ -48,6 +1099,20 @@ gboolean UrlPlayer::Private::onBusMessage(GstMessage* message)
             owner->onEos();
             break;
         }
+        case GST_MESSAGE_APPLICATION: {
+            const GstStructure* structure = gst_message_get_structure(message);
+            if(gst_structure_has_name(structure, FirstFrameMessageName))
+                onFirstFrame(structure);
+            else if(gst_structure_has_name(structure, MainStreamReadyMessageName))
+                onMainStreamReady();
+            else if(
+                gst_structure_has_name(structure, SourceEosMessageName) &&
+                sourceBin && GST_MESSAGE_SRC(message) == GST_OBJECT(sourceBin))
+            {
+                onSourceLost();
+            }
+            break;
+        }
         default:
             break;
     }
@@ -55,6 +1120,60 @@ gboolean UrlPlayer::Private::onBusMessage(GstMessage* message)
     return TRUE;
 }
 
+void UrlPlayer::Private::onFirstFrame(const GstStructure* structure) noexcept
+{
+    gint64 elapsed = 0;
+    gst_structure_get_int64(structure, "elapsed", &elapsed);
+
+    gboolean fromStandby = FALSE;
+    gst_structure_get_boolean(structure, "standby", &fromStandby);
+
+    log->info(
+        "First frame reached video sink in {} ms after {} (threads: {}, RSS: {})",
+        elapsed / 1000,
+        fromStandby ? "resume from standby" : "cold start",
+        ProcStatusValue("Threads"),
+        ProcStatusValue("VmRSS"));
+
+    if(!fromStandby)
+        ReportStartupStage("first frame shown");
+
+    if(firstFrameCallback)
+        firstFrameCallback(*owner);
+}
+
+void UrlPlayer::Private::onMainStreamReady() noexcept
+{
+    if(!substreamBin)
+        return;
+
+    // sink keeps showing last substream frame until first main stream one arrives
+    g_object_set(selector, "active-pad", mainSelectorPadPtr.get(), nullptr);
+
+    log->info(
+        "Switched to main stream in {} ms after start",
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - progressiveStartTime).count());
+
+    dropSubstream();
+}
+
+void UrlPlayer::Private::dropSubstream() noexcept
+{
+    if(!substreamBin)
+        return;
+
+    GstElement* substreamBin = this->substreamBin;
+    this->substreamBin = nullptr;
+
+    gst_element_set_locked_state(substreamBin, TRUE);
+    gst_element_set_state(substreamBin, GST_STATE_NULL);
+    gst_bin_remove(GST_BIN(pipelinePtr.get()), substreamBin);
+
+    gst_element_release_request_pad(selector, substreamSelectorPadPtr.get());
+    substreamSelectorPadPtr.reset();
+}
+
 UrlPlayer::UrlPlayer(
     bool showVideoStats,
     bool sync,
@@ -67,6 +1186,7 @@ UrlPlayer::UrlPlayer(
 
 UrlPlayer::~UrlPlayer()
 {
+    _p->stopStallWatchdog();
 }
 
 
@@ -78,63 +1198,182 @@ void UrlPlayer::onEos() noexcept
     stop();
 }
 
+void UrlPlayer::setSourceSetupCallback(const SourceSetupCallback& callback) noexcept
+{
+    _p->sourceSetupCallback = callback;
+}
+
+void UrlPlayer::setFirstFrameCallback(const FirstFrameCallback& callback) noexcept
+{
+    _p->firstFrameCallback = callback;
+}
+
+void UrlPlayer::setStallTimeout(std::chrono::milliseconds stallTimeout) noexcept
+{
+    _p->stallTimeout = stallTimeout;
+}
+
+void UrlPlayer::setPersistentSink(bool enable) noexcept
+{
+    _p->persistentSink = enable;
+}
+
+void UrlPlayer::setMetricsName(const std::string& name) noexcept
+{
+    _p->metricsName = name;
+    // will be recreated with new name for the next pipeline
+    _p->metrics.reset();
+    _p->latencyController.reset();
+    _p->decodeDegrader.reset();
+}
+
+void UrlPlayer::setDecodeDegradation(bool enable, unsigned degradedFramerate) noexcept
+{
+    _p->decodeDegradation = enable;
+    _p->degradedFramerate = degradedFramerate;
+    _p->decodeDegrader.reset();
+}
+
+void UrlPlayer::setLatencyControl(std::chrono::milliseconds target, unsigned maxCatchUpRate) noexcept
+{
+    _p->latencyTarget = target;
+    _p->maxCatchUpRate = maxCatchUpRate;
+    _p->latencyController.reset();
+}
+
+void UrlPlayer::setDecodeLoadCallback(const DecodeLoadCallback& callback) noexcept
+{
+    _p->decodeLoadCallback = callback;
+    _p->decodeDegrader.reset();
+}
+
+void UrlPlayer::setLeanRtspPipeline(bool enable, unsigned latency) noexcept
+{
+    _p->leanRtspPipeline = enable;
+    _p->rtspLatency = latency;
+}
+
 bool UrlPlayer::isPlaying() const noexcept
 {
-    return !!_p->pipelinePtr;
+    return !!_p->pipelinePtr && !_p->standby && (!_p->persistentPipeline || _p->sourceBin);
 }
 
-bool UrlPlayer::play(const std::string& url) noexcept
+bool UrlPlayer::isPrepared() const noexcept
 {
+    return !!_p->pipelinePtr && _p->standby;
+}
+
+bool UrlPlayer::prepare(const std::string& url) noexcept
+{
+    if(isPrepared() && _p->url == url)
+        return true;
+
+    if(isPlaying() && _p->url == url && !_p->substreamBin) {
+        // RTSP session is kept as is, only decoding is stopped
+        _p->stopStallWatchdog();
+        _p->standby = true;
+        _p->standbyGate = StandbyGate::Closed;
+
+        return true;
+    }
+
     stop();
 
-    GstElementPtr pipelinePtr(gst_pipeline_new(nullptr));
-    GstElement* pipeline = pipelinePtr.get();
-    if(!pipeline) {
-        _p->log->error("Failed to create pipeline element");
+    if(!_p->createPipeline(url))
         return false;
+
+    _p->standby = true;
+    _p->standbyGate = StandbyGate::Closed;
+    gst_element_set_state(_p->pipelinePtr.get(), GST_STATE_PLAYING);
+
+    return true;
+}
+
+bool UrlPlayer::play(const std::string& url) noexcept
+{
+    if(isPrepared() && _p->url == url) {
+        _p->standby = false;
+        _p->standbyGate = StandbyGate::WaitKeyframe;
+        _p->watchFirstFrame(true);
+        _p->startStallWatchdog();
+
+        return true;
     }
 
-    GstElementPtr playbinPtr(gst_element_factory_make("playbin3", nullptr));
-    GstElement* playbin = playbinPtr.get();
-    if(!playbin) {
-        _p->log->error("Failed to create \"playbin3\" element");
-        return false;
+    if(_p->persistentPipeline && !_p->standby) {
+        // sink keeps showing last frame until the first one of new source
+        _p->stopStallWatchdog();
+        _p->detachSource();
+        if(_p->attachSource(url)) {
+            _p->watchFirstFrame(false);
+            _p->startStallWatchdog();
+            return true;
+        }
+
+        _p->log->warn("Failed to attach new source to existing pipeline. Recreating pipeline...");
     }
 
-    GstElementPtr sinkPtr(_showVideoStats ?
-        gst_element_factory_make("fpsdisplaysink", nullptr) :
-        gst_element_factory_make("autovideosink", nullptr));
-    GstElement* sink = sinkPtr.get();
-    g_object_set(sink, "sync", _sync ? TRUE : FALSE, nullptr);
+    stop();
 
-    g_object_set(playbin, "video-sink", sinkPtr.release(), nullptr);
+    if(!_p->createPipeline(url))
+        return false;
 
-    gst_bin_add_many(GST_BIN(pipeline), playbinPtr.release(), nullptr);
+    _p->watchFirstFrame(false);
+    _p->startStallWatchdog();
+    gst_element_set_state(_p->pipelinePtr.get(), GST_STATE_PLAYING);
 
-    auto onBusMessageCallback =
-        + [] (GstBus* bus, GstMessage* message, gpointer userData) -> gboolean
+    return true;
+}
+
+bool UrlPlayer::play(const std::string& url, const std::string& substreamUrl) noexcept
+{
+    if(
+        substreamUrl.empty() || substreamUrl == url ||
+        (isPrepared() && _p->url == url) ||
+        (_p->persistentPipeline && !_p->standby)) // last frame is shown already
     {
-        UrlPlayer* self = static_cast<UrlPlayer*>(userData);
-        return self->_p->onBusMessage(message);
-    };
-    GstBusPtr busPtr(gst_pipeline_get_bus(GST_PIPELINE(pipeline)));
-    gst_bus_add_watch(busPtr.get(), onBusMessageCallback, this);
+        return play(url);
+    }
 
-    g_object_set(playbin, "uri", url.c_str(), nullptr);
-    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    stop();
+
+    if(!_p->createProgressivePipeline(url, substreamUrl)) {
+        _p->log->warn("Failed to create progressive startup pipeline. Playing main stream only...");
+        return play(url);
+    }
 
-    _p->pipelinePtr.swap(pipelinePtr);
+    _p->watchFirstFrame(false);
+    _p->startStallWatchdog();
+    gst_element_set_state(_p->pipelinePtr.get(), GST_STATE_PLAYING);
 
     return true;
 }
 
 void UrlPlayer::stop() noexcept
 {
+    _p->stopStallWatchdog();
+
     if(!_p->pipelinePtr)
         return;
 
+    if(_p->latencyController)
+        _p->latencyController->detach();
+    if(_p->decodeDegrader)
+        _p->decodeDegrader->stop();
+
     GstElement* pipeline = _p->pipelinePtr.get();
     gst_element_set_state(pipeline, GST_STATE_NULL);
 
     _p->pipelinePtr.reset();
+    _p->videoSink = nullptr;
+    _p->convert = nullptr;
+    _p->persistentPipeline = false;
+    _p->sourceBin = nullptr;
+    _p->selector = nullptr;
+    _p->substreamBin = nullptr;
+    _p->substreamSelectorPadPtr.reset();
+    _p->mainSelectorPadPtr.reset();
+    _p->url.clear();
+    _p->standby = false;
+    _p->standbyGate = StandbyGate::Open;
 }
@@ -1,14 +1,30 @@
 #pragma once
 
+#include <chrono>
 #include <string>
 #include <memory>
 #include <functional>
 
+typedef struct _GstElement GstElement;
+
 
 class UrlPlayer
 {
 public:
     typedef std::function<void (UrlPlayer&)> EosCallback;
+    // called when playbin creates source element for uri
+    typedef std::function<void (GstElement* source)> SourceSetupCallback;
+    typedef std::function<void (UrlPlayer&)> FirstFrameCallback;
+
+    struct DecodeLoad
+    {
+        unsigned degradationLevel; // 0 - full decoding, 3 - keyframes only
+        unsigned lateFrames; // during last measurement interval
+        double busyRatio; // share of time decoder was busy during last measurement interval
+    };
+    // called periodically, with decode degradation disabled load is only measured
+    // and degradationLevel is the one degradation would use
+    typedef std::function<void (UrlPlayer&, const DecodeLoad&)> DecodeLoadCallback;
 
     UrlPlayer(
         bool showVideoStats,
@@ -16,8 +32,43 @@ public:
         const EosCallback& eosCallback) noexcept;
     ~UrlPlayer();
 
+    void setSourceSetupCallback(const SourceSetupCallback&) noexcept;
+    // called when first frame of started playback reaches video sink
+    void setFirstFrameCallback(const FirstFrameCallback&) noexcept;
+    // rtsp:// urls will be played with
+    // rtspsrc -> depayloader -> parser -> decoder -> videoconvert -> sink
+    // instead of playbin3
+    void setLeanRtspPipeline(bool enable, unsigned latency) noexcept;
+    // playback is finished as on EOS if video sink gets no buffers for stallTimeout,
+    // 0 - disabled
+    void setStallTimeout(std::chrono::milliseconds stallTimeout) noexcept;
+    // plays with uridecodebin3 -> videoconvert -> videoscale -> sink
+    // and on source failure removes only uridecodebin3, so the last frame stays on screen
+    // and following play() attaches new source to the same sink.
+    // Not used together with lean rtsp pipeline or source setup callback
+    void setPersistentSink(bool enable) noexcept;
+    // renders frames earlier (via sink "ts-offset") if they wait in sink longer than target,
+    // catching up not faster than maxCatchUpRate percents of real time.
+    // Works only with sync enabled, 0 target - disabled
+    void setLatencyControl(std::chrono::milliseconds target, unsigned maxCatchUpRate) noexcept;
+    // under CPU pressure (late frames) skips non-reference frames,
+    // then caps framerate to degradedFramerate, then decodes keyframes only,
+    // and steps back when there are no late frames for a while
+    void setDecodeDegradation(bool enable, unsigned degradedFramerate) noexcept;
+    void setDecodeLoadCallback(const DecodeLoadCallback&) noexcept;
+    // value of "player" label of exported metrics, "main" by default
+    void setMetricsName(const std::string&) noexcept;
+
     bool isPlaying() const noexcept;
+    bool isPrepared() const noexcept;
+
+    // keeps RTSP session playing, but drops encoded frames before decoder,
+    // so following play() with the same url has only to wait for the next keyframe.
+    // Pipeline already playing the same url is switched to standby without reconnect
+    bool prepare(const std::string& url) noexcept;
     bool play(const std::string& url) noexcept;
+    // shows substream until main stream has first frame decoded
+    bool play(const std::string& url, const std::string& substreamUrl) noexcept;
     void stop() noexcept;
 
 private:
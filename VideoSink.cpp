@@ -0,0 +1,56 @@
+#include "VideoSink.h"
+
+#include "FrameTrace.h"
+#include "Log.h"
+
+
+namespace {
+
+VideoOutput::Backend Backend = VideoOutput::Backend::Display;
+
+}
+
+void SetVideoOutputBackend(const VideoOutput& videoOutput) noexcept
+{
+    Backend = videoOutput.backend;
+
+    switch(Backend) {
+    case VideoOutput::Backend::Display:
+        break;
+    case VideoOutput::Backend::FakeSink:
+        MonitorLog()->info("Video output is headless, frames are discarded");
+        break;
+    case VideoOutput::Backend::Trace:
+        MonitorLog()->info("Video output is headless, frames timing is traced");
+        StartFrameTrace(videoOutput.traceFile);
+        break;
+    }
+}
+
+GstElementPtr CreateVideoSink(bool showStats, bool sync) noexcept
+{
+    const char* factoryName = "autovideosink";
+    if(Backend != VideoOutput::Backend::Display)
+        factoryName = "fakesink";
+    else if(showStats)
+        factoryName = "fpsdisplaysink";
+
+    GstElementPtr sinkPtr(gst_element_factory_make(factoryName, nullptr));
+    GstElement* sink = sinkPtr.get();
+    if(!sink) {
+        MonitorLog()->error("Failed to create \"{}\" element", factoryName);
+        return sinkPtr;
+    }
+
+    g_object_set(sink, "sync", sync ? TRUE : FALSE, nullptr);
+
+    if(Backend != VideoOutput::Backend::Display) {
+        // like real video sinks, to keep QoS based logic working
+        g_object_set(sink, "qos", TRUE, "enable-last-sample", FALSE, nullptr);
+    }
+
+    if(Backend == VideoOutput::Backend::Trace)
+        TraceSink(sink);
+
+    return sinkPtr;
+}
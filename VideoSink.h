@@ -0,0 +1,14 @@
+#pragma once
+
+#include <gst/gst.h>
+
+#include <CxxPtr/GstPtr.h>
+
+#include "Config.h"
+
+
+// process wide, has to be called before the first sink is created
+void SetVideoOutputBackend(const VideoOutput&) noexcept;
+
+// sink of selected backend, showStats is ignored by headless ones
+GstElementPtr CreateVideoSink(bool showStats, bool sync) noexcept;
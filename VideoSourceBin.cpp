@@ -0,0 +1,66 @@
+#include "VideoSourceBin.h"
+
+#include <CxxPtr/GstPtr.h>
+
+#include "Log.h"
+
+
+GstElement* CreateVideoSourceBin(const std::string& url)
+{
+    GstElementPtr binPtr(gst_bin_new(nullptr));
+    GstElement* bin = binPtr.get();
+
+    GstElement* decodebin = gst_element_factory_make("uridecodebin3", nullptr);
+    if(!decodebin) {
+        MonitorLog()->error("Failed to create \"uridecodebin3\" element");
+        return nullptr;
+    }
+    gst_bin_add(GST_BIN(bin), decodebin);
+
+    GstElement* queue = gst_element_factory_make("queue", nullptr);
+    if(!queue) {
+        MonitorLog()->error("Failed to create \"queue\" element");
+        return nullptr;
+    }
+    gst_bin_add(GST_BIN(bin), queue);
+
+    GstPadPtr queueSrcPadPtr(gst_element_get_static_pad(queue, "src"));
+    gst_element_add_pad(bin, gst_ghost_pad_new("src", queueSrcPadPtr.get()));
+
+    auto onPadAddedCallback =
+        + [] (GstElement* decodebin, GstPad* pad, gpointer userData)
+    {
+        GstElement* queue = static_cast<GstElement*>(userData);
+
+        GstCaps* caps = gst_pad_get_current_caps(pad);
+        if(!caps)
+            caps = gst_pad_query_caps(pad, nullptr);
+        const bool isVideo =
+            caps && !gst_caps_is_empty(caps) &&
+            g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "video/");
+        if(caps)
+            gst_caps_unref(caps);
+
+        GstPadPtr queueSinkPadPtr(gst_element_get_static_pad(queue, "sink"));
+        if(isVideo && !gst_pad_is_linked(queueSinkPadPtr.get())) {
+            gst_pad_link(pad, queueSinkPadPtr.get());
+            return;
+        }
+
+        // all other streams are not used
+        GstElement* fakeSink = gst_element_factory_make("fakesink", nullptr);
+        g_object_set(fakeSink, "sync", FALSE, "async", FALSE, nullptr);
+        GstObject* bin = gst_element_get_parent(decodebin);
+        gst_bin_add(GST_BIN(bin), fakeSink);
+        gst_object_unref(bin);
+        gst_element_sync_state_with_parent(fakeSink);
+
+        GstPadPtr fakeSinkPadPtr(gst_element_get_static_pad(fakeSink, "sink"));
+        gst_pad_link(pad, fakeSinkPadPtr.get());
+    };
+    g_signal_connect(decodebin, "pad-added", G_CALLBACK(onPadAddedCallback), queue);
+
+    g_object_set(decodebin, "uri", url.c_str(), nullptr);
+
+    return binPtr.release();
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+#include <gst/gst.h>
+
+
+// uridecodebin3 with the first decoded video stream exposed on "src" pad,
+// all other streams are dropped
+GstElement* CreateVideoSourceBin(const std::string& url);
@@ -1,4 +1,10 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <deque>
+#include <optional>
+
+#include <sched.h>
 
 #include <glib.h>
 
@@ -22,21 +28,50 @@
 
 #include "Log.h"
 #include "Monitor.h"
+#include "PlayerWorker.h"
+#include "StageTiming.h"
+#include "Startup.h"
+#include "ThreadPolicy.h"
 
 
 static const auto Log = MonitorLog;
 
+static void LookupMotionEvents(
+    config_setting_t* sourceConfig,
+    StreamSource::MotionEvents* motionEvents)
+{
+    const char* motionEventsMode = nullptr;
+    if(config_setting_lookup_string(sourceConfig, "motion-events", &motionEventsMode) != CONFIG_FALSE) {
+        if(0 == g_ascii_strcasecmp(motionEventsMode, "poll")) {
+            *motionEvents = StreamSource::MotionEvents::Poll;
+        } else if(0 == g_ascii_strcasecmp(motionEventsMode, "pump")) {
+            *motionEvents = StreamSource::MotionEvents::Pump;
+        } else if(0 == g_ascii_strcasecmp(motionEventsMode, "push")) {
+            *motionEvents = StreamSource::MotionEvents::Push;
+        } else {
+            Log()->error("\"motion-events\" value is invalid. It should be \"poll\", \"pump\" or \"push\"");
+        }
+    }
+}
 
 static bool LoadConfig(Config* config)
 {
-    const std::deque<std::string> configDirs = ::ConfigDirs();
-    if(configDirs.empty())
-        return false;
+    std::deque<std::string> configFiles;
+    // allows tools/ scripts to run with temporary config
+    if(const gchar* configFile = g_getenv("MONITOR_CONFIG")) {
+        configFiles.emplace_back(configFile);
+    } else {
+        const std::deque<std::string> configDirs = ::ConfigDirs();
+        if(configDirs.empty())
+            return false;
+
+        for(const std::string& configDir: configDirs)
+            configFiles.emplace_back(configDir + "/monitor.conf");
+    }
 
     Config loadedConfig = *config;
 
-    for(const std::string& configDir: configDirs) {
-        const std::string configFile = configDir + "/monitor.conf";
+    for(const std::string& configFile: configFiles) {
         if(!g_file_test(configFile.c_str(), G_FILE_TEST_IS_REGULAR)) {
             Log()->info("Config file \"{}\" not found", configFile);
             continue;
@@ -126,6 +161,22 @@ static bool LoadConfig(Config* config)
                             spdlog::level::critical - std::min<int>(lwsLogLevel, spdlog::level::critical));
                 }
             }
+
+            gboolean stageTiming = FALSE;
+            if(config_setting_lookup_bool(debugConfig, "stage-timing", &stageTiming) != CONFIG_FALSE)
+                loadedConfig.stageTiming = stageTiming != FALSE;
+
+            int stageTimingInterval = 0;
+            if(config_setting_lookup_int(debugConfig, "stage-timing-interval", &stageTimingInterval) != CONFIG_FALSE && stageTimingInterval > 0)
+                loadedConfig.stageTimingInterval = std::chrono::seconds(stageTimingInterval);
+
+            const char* stageTimingFile = nullptr;
+            if(config_setting_lookup_string(debugConfig, "stage-timing-file", &stageTimingFile) != CONFIG_FALSE)
+                loadedConfig.stageTimingFile = stageTimingFile;
+
+            int signallingLoad = 0;
+            if(config_setting_lookup_int(debugConfig, "signalling-load", &signallingLoad) != CONFIG_FALSE)
+                loadedConfig.signallingLoad = std::chrono::milliseconds(std::clamp(signallingLoad, 0, 90));
         }
 
         config_setting_t* recordServerConfig = config_lookup(&config, "record-server");
@@ -177,6 +228,82 @@ static bool LoadConfig(Config* config)
             int previewDuration = 0;
             config_setting_lookup_int(sourceConfig, "motion-preview-time", &previewDuration);
 
+            gboolean previewStandby = FALSE;
+            config_setting_lookup_bool(sourceConfig, "motion-preview-standby", &previewStandby);
+
+            int preMotionBuffer = 0;
+            config_setting_lookup_int(sourceConfig, "pre-motion-buffer", &preMotionBuffer);
+
+            int preMotionBufferSize = 0;
+            config_setting_lookup_int(sourceConfig, "pre-motion-buffer-size", &preMotionBufferSize);
+
+            if(preMotionBuffer > 0 && previewStandby) {
+                Log()->warn("\"motion-preview-standby\" is not used together with \"pre-motion-buffer\"");
+                previewStandby = FALSE;
+            }
+
+            StreamSource::MotionEvents motionEvents = StreamSource::MotionEvents::Poll;
+            LookupMotionEvents(sourceConfig, &motionEvents);
+
+            int notifyPort = 0;
+            if(config_setting_lookup_int(sourceConfig, "notify-port", &notifyPort) != CONFIG_FALSE) {
+                if(
+                    notifyPort < std::numeric_limits<uint16_t>::min() ||
+                    notifyPort > std::numeric_limits<uint16_t>::max()
+                ) {
+                    Log()->error(
+                        "\"notify-port\" value is invalid. In should be in [{}, {}]",
+                        std::numeric_limits<uint16_t>::min(),
+                        std::numeric_limits<uint16_t>::max());
+                    notifyPort = 0;
+                }
+            }
+
+            const char* notifyHost = "";
+            config_setting_lookup_string(sourceConfig, "notify-host", &notifyHost);
+
+            gboolean leanPipeline = FALSE;
+            config_setting_lookup_bool(sourceConfig, "lean-pipeline", &leanPipeline);
+
+            int rtspLatency = -1;
+            config_setting_lookup_int(sourceConfig, "rtsp-latency", &rtspLatency);
+
+            gboolean progressiveStartup = FALSE;
+            config_setting_lookup_bool(sourceConfig, "progressive-startup", &progressiveStartup);
+
+            gboolean adaptiveProfile = FALSE;
+            config_setting_lookup_bool(sourceConfig, "adaptive-profile", &adaptiveProfile);
+
+            gboolean discoveryCache = TRUE;
+            config_setting_lookup_bool(sourceConfig, "discovery-cache", &discoveryCache);
+
+            const char* substreamUrl = "";
+            config_setting_lookup_string(sourceConfig, "substream-url", &substreamUrl);
+
+            std::vector<std::string> eventTopics;
+            if(config_setting_t* eventTopicsConfig = config_setting_get_member(sourceConfig, "event-topics")) {
+                if(config_setting_is_array(eventTopicsConfig) != CONFIG_FALSE ||
+                   config_setting_is_list(eventTopicsConfig) != CONFIG_FALSE)
+                {
+                    const int count = config_setting_length(eventTopicsConfig);
+                    for(int i = 0; i < count; ++i) {
+                        const char* topic = config_setting_get_string_elem(eventTopicsConfig, i);
+                        if(topic && topic[0] != '\0')
+                            eventTopics.emplace_back(topic);
+                        else
+                            Log()->error("\"event-topics\" should contain only non empty strings");
+                    }
+                } else {
+                    Log()->error("\"event-topics\" should be an array of strings");
+                }
+            }
+
+            int maxBitrate = 0;
+            config_setting_lookup_int(sourceConfig, "max-bitrate", &maxBitrate);
+
+            int maxPixelRate = 0;
+            config_setting_lookup_int(sourceConfig, "max-pixel-rate", &maxPixelRate);
+
             StreamSource::Type sourceType = StreamSource::Type::WebRTSP;
             const char* url;
             bool useTls = false;
@@ -281,18 +408,219 @@ static bool LoadConfig(Config* config)
                 .recordToken = {},
                 .client = clientConfig,
                 .uri = uri,
+                .substreamUri = sourceType == StreamSource::Type::Url ? substreamUrl : "",
                 .accessToken = passwordPtr ? passwordPtr.get() : "",
                 .trackMotion = trackMotion != FALSE,
+                .motionPreviewStandby = previewStandby != FALSE,
+                .leanPipeline = leanPipeline != FALSE,
+                .progressiveStartup = progressiveStartup != FALSE,
+                .adaptiveProfile = adaptiveProfile != FALSE,
+                .discoveryCache = discoveryCache != FALSE,
+                .motionEvents = motionEvents,
+                .notifyPort = static_cast<unsigned short>(notifyPort),
+                .notifyHost = notifyHost,
+                .eventTopics = eventTopics,
+                .maxBitrate = static_cast<unsigned>(std::max(0, maxBitrate)),
+                .maxPixelRate = static_cast<unsigned>(std::max(0, maxPixelRate)),
             };
 
             if(previewDuration > 0) {
                 loadedConfig.source->motionPreviewDuration =
                     std::chrono::seconds(std::max(3, previewDuration));
             }
+
+            if(rtspLatency >= 0)
+                loadedConfig.source->rtspLatency = rtspLatency;
+
+            if(preMotionBuffer > 0)
+                loadedConfig.source->preMotionBuffer = std::chrono::seconds(preMotionBuffer);
+
+            if(preMotionBufferSize > 0)
+                loadedConfig.source->preMotionBufferSize = preMotionBufferSize;
+        }
+
+        config_setting_t* sourcesConfig = !recordServerConfig ? config_lookup(&config, "sources") : nullptr;
+        if(sourcesConfig && config_setting_is_list(sourcesConfig) != CONFIG_FALSE) {
+            const int count = config_setting_length(sourcesConfig);
+            for(int i = 0; i < count; ++i) {
+                config_setting_t* mosaicSourceConfig = config_setting_get_elem(sourcesConfig, i);
+                const char* mosaicUrl = nullptr;
+                if(
+                    config_setting_is_group(mosaicSourceConfig) == CONFIG_FALSE ||
+                    config_setting_lookup_string(mosaicSourceConfig, "url", &mosaicUrl) == CONFIG_FALSE ||
+                    mosaicUrl[0] == '\0'
+                ) {
+                    Log()->error("\"sources\" should contain only groups with non empty \"url\"");
+                    continue;
+                }
+
+                loadedConfig.sources.push_back(StreamSource {
+                    .type = StreamSource::Type::Url,
+                    .localServer = {},
+                    .recordToken = {},
+                    .client = {},
+                    .uri = mosaicUrl,
+                    .accessToken = {},
+                    .trackMotion = false,
+                });
+            }
+        } else if(sourcesConfig) {
+            Log()->error("\"sources\" should be a list of groups");
+        }
+
+        config_setting_t* motionSwitchConfig = !recordServerConfig ? config_lookup(&config, "motion-switch") : nullptr;
+        if(motionSwitchConfig && config_setting_is_group(motionSwitchConfig) != CONFIG_FALSE) {
+            int dwellTime = 0;
+            if(config_setting_lookup_int(motionSwitchConfig, "dwell-time", &dwellTime) != CONFIG_FALSE && dwellTime >= 0)
+                loadedConfig.motionSwitch.dwellTime = std::chrono::seconds(dwellTime);
+
+            config_setting_t* camerasConfig = config_setting_get_member(motionSwitchConfig, "cameras");
+            if(camerasConfig && config_setting_is_list(camerasConfig) != CONFIG_FALSE) {
+                const int count = config_setting_length(camerasConfig);
+                for(int i = 0; i < count; ++i) {
+                    config_setting_t* cameraConfig = config_setting_get_elem(camerasConfig, i);
+                    const char* onvifUrl = nullptr;
+                    if(
+                        config_setting_is_group(cameraConfig) == CONFIG_FALSE ||
+                        config_setting_lookup_string(cameraConfig, "onvif", &onvifUrl) == CONFIG_FALSE ||
+                        onvifUrl[0] == '\0'
+                    ) {
+                        Log()->error("\"cameras\" should contain only groups with non empty \"onvif\"");
+                        continue;
+                    }
+
+                    int priority = 0;
+                    config_setting_lookup_int(cameraConfig, "priority", &priority);
+
+                    int previewDuration = 0;
+                    config_setting_lookup_int(cameraConfig, "motion-preview-time", &previewDuration);
+
+                    StreamSource::MotionEvents motionEvents = StreamSource::MotionEvents::Pump;
+                    LookupMotionEvents(cameraConfig, &motionEvents);
+
+                    StreamSource camera {
+                        .type = StreamSource::Type::Onvif,
+                        .localServer = {},
+                        .recordToken = {},
+                        .client = {},
+                        .uri = onvifUrl,
+                        .accessToken = {},
+                        .trackMotion = true,
+                        .motionEvents = motionEvents,
+                        .priority = priority,
+                    };
+                    if(previewDuration > 0)
+                        camera.motionPreviewDuration = std::chrono::seconds(std::max(3, previewDuration));
+
+                    loadedConfig.motionSwitch.cameras.push_back(camera);
+                }
+            } else {
+                Log()->error("\"cameras\" of \"motion-switch\" should be a list of groups");
+            }
+        }
+
+        config_setting_t* metricsConfig = config_lookup(&config, "metrics");
+        if(metricsConfig && config_setting_is_group(metricsConfig) != CONFIG_FALSE) {
+            int metricsPort = 0;
+            if(config_setting_lookup_int(metricsConfig, "port", &metricsPort) != CONFIG_FALSE) {
+                if(
+                    metricsPort < std::numeric_limits<uint16_t>::min() ||
+                    metricsPort > std::numeric_limits<uint16_t>::max()
+                ) {
+                    Log()->error(
+                        "\"port\" value is invalid. In should be in [{}, {}]",
+                        std::numeric_limits<uint16_t>::min(),
+                        std::numeric_limits<uint16_t>::max());
+                } else {
+                    loadedConfig.metricsPort = static_cast<unsigned short>(metricsPort);
+                }
+            }
+
+            gboolean loopbackOnly = FALSE;
+            if(config_setting_lookup_bool(metricsConfig, "loopback-only", &loopbackOnly) != CONFIG_FALSE)
+                loadedConfig.metricsLoopbackOnly = loopbackOnly != FALSE;
+        }
+
+        config_setting_t* threadPolicyConfig = config_lookup(&config, "thread-policy");
+        if(threadPolicyConfig && config_setting_is_group(threadPolicyConfig) != CONFIG_FALSE) {
+            ThreadPolicy& threadPolicy = loadedConfig.threadPolicy;
+
+            auto lookupCores =
+                [threadPolicyConfig] (const char* name, std::vector<unsigned>* cores) {
+                    config_setting_t* coresConfig = config_setting_get_member(threadPolicyConfig, name);
+                    if(!coresConfig)
+                        return;
+
+                    if(config_setting_is_array(coresConfig) == CONFIG_FALSE) {
+                        Log()->error("\"{}\" should be an array of core numbers", name);
+                        return;
+                    }
+
+                    const int count = config_setting_length(coresConfig);
+                    for(int i = 0; i < count; ++i) {
+                        const int core = config_setting_get_int_elem(coresConfig, i);
+                        if(core >= 0 && core < CPU_SETSIZE)
+                            cores->push_back(core);
+                        else
+                            Log()->error("\"{}\" contains invalid core number {}", name, core);
+                    }
+                };
+            lookupCores("media-cores", &threadPolicy.mediaCores);
+            lookupCores("control-cores", &threadPolicy.controlCores);
+
+            gboolean realtime = FALSE;
+            if(config_setting_lookup_bool(threadPolicyConfig, "realtime", &realtime) != CONFIG_FALSE)
+                threadPolicy.realtime = realtime != FALSE;
+
+            int realtimePriority = 0;
+            if(config_setting_lookup_int(threadPolicyConfig, "realtime-priority", &realtimePriority) != CONFIG_FALSE)
+                threadPolicy.realtimePriority = std::clamp(realtimePriority, 1, 99);
+
+            int niceness = 0;
+            if(config_setting_lookup_int(threadPolicyConfig, "nice", &niceness) != CONFIG_FALSE)
+                threadPolicy.niceness = std::clamp(niceness, -20, 19);
+
+            int cpuReportInterval = 0;
+            if(config_setting_lookup_int(threadPolicyConfig, "cpu-report-interval", &cpuReportInterval) != CONFIG_FALSE)
+                threadPolicy.cpuReportInterval = std::chrono::seconds(std::max(0, cpuReportInterval));
+        }
+
+        config_setting_t* playerWorkerConfig = config_lookup(&config, "player-worker");
+        if(playerWorkerConfig && config_setting_is_group(playerWorkerConfig) != CONFIG_FALSE) {
+            PlayerWorkerConfig& playerWorker = loadedConfig.playerWorker;
+
+            gboolean enabled = FALSE;
+            if(config_setting_lookup_bool(playerWorkerConfig, "enabled", &enabled) != CONFIG_FALSE)
+                playerWorker.enabled = enabled != FALSE;
+
+            int heartbeatTimeout = 0;
+            if(config_setting_lookup_int(playerWorkerConfig, "heartbeat-timeout", &heartbeatTimeout) != CONFIG_FALSE && heartbeatTimeout > 0)
+                playerWorker.heartbeatTimeout = std::chrono::milliseconds(std::max(heartbeatTimeout, 200));
+
+            int killInterval = 0;
+            if(config_setting_lookup_int(playerWorkerConfig, "kill-interval", &killInterval) != CONFIG_FALSE)
+                playerWorker.killInterval = std::chrono::seconds(std::max(0, killInterval));
         }
 
         config_setting_t* videoOutputConfig = config_lookup(&config, "video-output");
         if(videoOutputConfig && config_setting_is_group(videoOutputConfig) != CONFIG_FALSE) {
+            const char* backend = nullptr;
+            if(config_setting_lookup_string(videoOutputConfig, "backend", &backend) != CONFIG_FALSE) {
+                if(0 == g_ascii_strcasecmp(backend, "display")) {
+                    loadedConfig.videoOutput.backend = VideoOutput::Backend::Display;
+                } else if(0 == g_ascii_strcasecmp(backend, "fakesink")) {
+                    loadedConfig.videoOutput.backend = VideoOutput::Backend::FakeSink;
+                } else if(0 == g_ascii_strcasecmp(backend, "trace")) {
+                    loadedConfig.videoOutput.backend = VideoOutput::Backend::Trace;
+                } else {
+                    Log()->error("\"backend\" value is invalid. It should be \"display\", \"fakesink\" or \"trace\"");
+                }
+            }
+
+            const char* traceFile = nullptr;
+            if(config_setting_lookup_string(videoOutputConfig, "trace-file", &traceFile) != CONFIG_FALSE && traceFile[0] != '\0')
+                loadedConfig.videoOutput.traceFile = traceFile;
+
             gboolean showStats = FALSE;
             if(config_setting_lookup_bool(videoOutputConfig, "show-stats", &showStats) != CONFIG_FALSE)
                 loadedConfig.videoOutput.showStats = showStats != FALSE;
@@ -300,12 +628,56 @@ static bool LoadConfig(Config* config)
             gboolean sync = TRUE;
             if(config_setting_lookup_bool(videoOutputConfig, "sync", &sync) != CONFIG_FALSE)
                 loadedConfig.videoOutput.sync = sync != FALSE;
+
+            int maxWidth = 0;
+            if(config_setting_lookup_int(videoOutputConfig, "max-width", &maxWidth) != CONFIG_FALSE)
+                loadedConfig.videoOutput.maxWidth = std::max(0, maxWidth);
+
+            int maxHeight = 0;
+            if(config_setting_lookup_int(videoOutputConfig, "max-height", &maxHeight) != CONFIG_FALSE)
+                loadedConfig.videoOutput.maxHeight = std::max(0, maxHeight);
+
+            gboolean persistentSink = TRUE;
+            if(config_setting_lookup_bool(videoOutputConfig, "persistent-sink", &persistentSink) != CONFIG_FALSE)
+                loadedConfig.videoOutput.persistentSink = persistentSink != FALSE;
+
+            int stallTimeout = 0;
+            if(config_setting_lookup_int(videoOutputConfig, "stall-timeout", &stallTimeout) != CONFIG_FALSE)
+                loadedConfig.videoOutput.stallTimeout = std::chrono::milliseconds(std::max(0, stallTimeout));
+
+            int latencyTarget = 0;
+            if(config_setting_lookup_int(videoOutputConfig, "latency-target", &latencyTarget) != CONFIG_FALSE)
+                loadedConfig.videoOutput.latencyTarget = std::chrono::milliseconds(std::max(0, latencyTarget));
+
+            int maxCatchUpRate = 0;
+            if(config_setting_lookup_int(videoOutputConfig, "max-catch-up-rate", &maxCatchUpRate) != CONFIG_FALSE && maxCatchUpRate > 0)
+                loadedConfig.videoOutput.maxCatchUpRate = std::min(maxCatchUpRate, 50);
+
+            gboolean decodeDegradation = TRUE;
+            if(config_setting_lookup_bool(videoOutputConfig, "decode-degradation", &decodeDegradation) != CONFIG_FALSE)
+                loadedConfig.videoOutput.decodeDegradation = decodeDegradation != FALSE;
+
+            int degradedFramerate = 0;
+            if(config_setting_lookup_int(videoOutputConfig, "degraded-framerate", &degradedFramerate) != CONFIG_FALSE && degradedFramerate > 0)
+                loadedConfig.videoOutput.degradedFramerate = degradedFramerate;
+
+            gboolean mediaThread = TRUE;
+            if(config_setting_lookup_bool(videoOutputConfig, "media-thread", &mediaThread) != CONFIG_FALSE)
+                loadedConfig.videoOutput.mediaThread = mediaThread != FALSE;
+
+            int mosaicWidth = 0;
+            if(config_setting_lookup_int(videoOutputConfig, "mosaic-width", &mosaicWidth) != CONFIG_FALSE && mosaicWidth > 0)
+                loadedConfig.videoOutput.mosaicWidth = mosaicWidth;
+
+            int mosaicHeight = 0;
+            if(config_setting_lookup_int(videoOutputConfig, "mosaic-height", &mosaicHeight) != CONFIG_FALSE && mosaicHeight > 0)
+                loadedConfig.videoOutput.mosaicHeight = mosaicHeight;
         }
     }
 
     bool success = true;
 
-    if(!loadedConfig.source) {
+    if(!loadedConfig.source && loadedConfig.sources.empty() && loadedConfig.motionSwitch.cameras.empty()) {
         Log()->error("\"source\" config is missing");
         success = false;
     }
@@ -331,7 +703,25 @@ int main(int argc, char *argv[])
     InitGstRtStreamingLogger(config.logLevel);
     InitMonitorLogger(config.logLevel);
 
-    LibGst libGst;
+    if(config.stageTiming)
+        PrepareStageTiming();
+
+    // before GStreamer initialization thread
+    ConfineControlThreads(config.threadPolicy);
+
+    if(argc == 3 && strcmp(argv[1], PlayerWorkerArg) == 0) {
+        LibGst libGst;
+        return PlayerWorkerMain(config, atoi(argv[2]));
+    }
+
+    // plugin registry loading is overlapped with ONVIF discovery
+    std::optional<LibGst> libGst;
+    StartGstInit([&libGst] () { libGst.emplace(); });
+
+    const int result = MonitorMain(config);
+
+    // initialization thread could be still running on early exit
+    WaitGstInit();
 
-    return MonitorMain(config);
+    return result;
 }
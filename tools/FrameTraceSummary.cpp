@@ -0,0 +1,155 @@
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "FrameTraceFormat.h"
+
+
+// Summarizes frame trace written by "trace" video output backend:
+// rendered fps, frame interval jitter and latency percentiles.
+
+namespace {
+
+struct Percentiles
+{
+    size_t count = 0;
+    double p50 = 0;
+    double p90 = 0;
+    double p99 = 0;
+    double max = 0;
+};
+
+// values are microseconds
+Percentiles CalcPercentiles(std::vector<int64_t> values)
+{
+    Percentiles out;
+    if(values.empty())
+        return out;
+
+    std::sort(values.begin(), values.end());
+
+    auto at = [&values] (double quantile) {
+        const size_t index = static_cast<size_t>(quantile * (values.size() - 1) + 0.5);
+        return values[index] / 1000.;
+    };
+
+    out.count = values.size();
+    out.p50 = at(0.5);
+    out.p90 = at(0.9);
+    out.p99 = at(0.99);
+    out.max = values.back() / 1000.;
+
+    return out;
+}
+
+void PrintPercentiles(const char* name, const Percentiles& percentiles)
+{
+    if(!percentiles.count) {
+        printf("%-14s no data\n", name);
+        return;
+    }
+
+    printf(
+        "%-14s p50 %7.2f  p90 %7.2f  p99 %7.2f  max %7.2f ms (%zu frames)\n",
+        name,
+        percentiles.p50,
+        percentiles.p90,
+        percentiles.p99,
+        percentiles.max,
+        percentiles.count);
+}
+
+bool ReadTrace(const char* file, std::vector<FrameTraceRecord>* records)
+{
+    FILE* in = fopen(file, "rb");
+    if(!in) {
+        fprintf(stderr, "Failed to open \"%s\": %s\n", file, strerror(errno));
+        return false;
+    }
+
+    FrameTraceHeader header {};
+    if(fread(&header, sizeof(header), 1, in) != 1 ||
+        memcmp(header.magic, FrameTraceMagic, sizeof(header.magic)) != 0)
+    {
+        fprintf(stderr, "\"%s\" is not a frame trace\n", file);
+        fclose(in);
+        return false;
+    }
+
+    if(header.version != FrameTraceVersion || header.recordSize != sizeof(FrameTraceRecord)) {
+        fprintf(stderr, "Unsupported frame trace version %u\n", header.version);
+        fclose(in);
+        return false;
+    }
+
+    FrameTraceRecord record;
+    while(fread(&record, sizeof(record), 1, in) == 1)
+        records->push_back(record);
+
+    fclose(in);
+
+    return true;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc != 2) {
+        fprintf(stderr, "Usage: %s <trace file>\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<FrameTraceRecord> records;
+    if(!ReadTrace(argv[1], &records))
+        return 1;
+
+    if(records.size() < 2) {
+        fprintf(stderr, "Not enough frames in trace\n");
+        return 1;
+    }
+
+    std::vector<int64_t> intervals;
+    std::vector<int64_t> decodeTimes;
+    std::vector<int64_t> sinkWaitTimes;
+    std::vector<int64_t> totalTimes;
+    intervals.reserve(records.size());
+    for(size_t i = 0; i < records.size(); ++i) {
+        const FrameTraceRecord& record = records[i];
+
+        if(i > 0)
+            intervals.push_back(record.renderTime - records[i - 1].renderTime);
+        if(record.arrivalTime && record.decodedTime)
+            decodeTimes.push_back(record.decodedTime - record.arrivalTime);
+        if(record.decodedTime)
+            sinkWaitTimes.push_back(record.renderTime - record.decodedTime);
+        if(record.arrivalTime)
+            totalTimes.push_back(record.renderTime - record.arrivalTime);
+    }
+
+    const double duration = (records.back().renderTime - records.front().renderTime) / 1000000.;
+
+    double meanInterval = 0;
+    for(const int64_t interval: intervals)
+        meanInterval += interval;
+    meanInterval /= intervals.size();
+
+    // deviation of frame interval from its mean
+    double jitter = 0;
+    for(const int64_t interval: intervals)
+        jitter += (interval - meanInterval) * (interval - meanInterval);
+    jitter = std::sqrt(jitter / intervals.size());
+
+    printf("frames         %zu in %.2f s\n", records.size(), duration);
+    printf("fps            %.2f\n", duration > 0 ? (records.size() - 1) / duration : 0.);
+    printf("jitter         %.2f ms (stddev of %.2f ms mean frame interval)\n", jitter / 1000., meanInterval / 1000.);
+    PrintPercentiles("interval", CalcPercentiles(intervals));
+    PrintPercentiles("decode", CalcPercentiles(std::move(decodeTimes)));
+    PrintPercentiles("sink wait", CalcPercentiles(std::move(sinkWaitTimes)));
+    PrintPercentiles("total latency", CalcPercentiles(std::move(totalTimes)));
+
+    return 0;
+}
@@ -0,0 +1,744 @@
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include <glib-unix.h>
+#include <gio/gio.h>
+
+#ifdef WITH_RTSP_SERVER
+#include <gst/gst.h>
+#include <gst/rtsp-server/rtsp-server.h>
+#endif
+
+#include <CxxPtr/GlibPtr.h>
+#include <CxxPtr/GioPtr.h>
+
+#include "HttpListener.h"
+
+
+// Minimal ONVIF device to run Monitor against without real camera.
+// Answers discovery with two H.264 media profiles ("main" and "sub"),
+// toggles motion state periodically and delivers it with PullMessages
+// or Notify messages, and serves both profiles as RTSP streams of test video
+// if built with gst-rtsp-server.
+
+namespace {
+
+const char *const SoapContentType = "application/soap+xml; charset=utf-8";
+const char *const MediaPath = "/onvif/media";
+const char *const EventsPath = "/onvif/events";
+const char *const PullSubscriptionPath = "/onvif/pull/";
+const char *const PushSubscriptionPath = "/onvif/push/";
+const char *const MotionTopic = "tns1:RuleEngine/CellMotionDetector/Motion";
+
+const unsigned MaxPullWait = 4; // seconds, less than PullMessages timeout Monitor asks for
+const size_t MaxPulledEvents = 16;
+const size_t MaxKeptEvents = 64;
+
+const char *const EnvelopeStart =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<env:Envelope"
+    " xmlns:env=\"http://www.w3.org/2003/05/soap-envelope\""
+    " xmlns:wsa5=\"http://www.w3.org/2005/08/addressing\""
+    " xmlns:tt=\"http://www.onvif.org/ver10/schema\""
+    " xmlns:tds=\"http://www.onvif.org/ver10/device/wsdl\""
+    " xmlns:trt=\"http://www.onvif.org/ver10/media/wsdl\""
+    " xmlns:tev=\"http://www.onvif.org/ver10/events/wsdl\""
+    " xmlns:wsnt=\"http://docs.oasis-open.org/wsn/b-2\""
+    " xmlns:ter=\"http://www.onvif.org/ver10/error\""
+    " xmlns:wsrf-rw=\"http://docs.oasis-open.org/wsrf/rw-2\""
+    " xmlns:wsntw=\"http://docs.oasis-open.org/wsn/bw-2\""
+    " xmlns:tns1=\"http://www.onvif.org/ver10/topics\">"
+    "<env:Body>";
+const char *const EnvelopeEnd = "</env:Body></env:Envelope>\n";
+
+struct Options
+{
+    gint port = 8080;
+    gchar* host = nullptr;
+    gint motionPeriod = 10; // seconds
+    gint responseDelay = 0; // ms
+    gboolean noPush = FALSE;
+    gchar* mainResolution = nullptr;
+    gchar* mainUri = nullptr;
+    gchar* subUri = nullptr;
+#ifdef WITH_RTSP_SERVER
+    gint rtspPort = 8554;
+#endif
+};
+
+struct Profile
+{
+    const char* token;
+    unsigned width;
+    unsigned height;
+    unsigned frameRate;
+    unsigned bitrate; // kbps
+    std::string uri;
+};
+
+struct MotionEvent
+{
+    uint64_t sequence;
+    bool isMotion;
+    std::string utcTime;
+};
+
+struct Subscription
+{
+    bool push;
+    std::string consumerAddress; // push only
+    uint64_t lastSequence; // pull only
+    bool initialized; // pull only, current state was delivered already
+};
+
+struct Device
+{
+    std::string baseUrl;
+    unsigned responseDelay; // ms
+    bool push;
+    Profile profiles[2];
+
+    std::mutex mutex;
+    std::condition_variable eventsCondition;
+    std::deque<MotionEvent> events;
+    uint64_t nextSequence = 1;
+    bool stopping = false;
+
+    std::map<unsigned, Subscription> subscriptions;
+    unsigned nextSubscriptionId = 1;
+};
+
+std::string UtcTime(int offsetMinutes = 0)
+{
+    GDateTime* now = g_date_time_new_now_utc();
+    GDateTime* time = g_date_time_add_minutes(now, offsetMinutes);
+    GCharPtr timePtr(g_date_time_format(time, "%Y-%m-%dT%H:%M:%SZ"));
+    g_date_time_unref(time);
+    g_date_time_unref(now);
+
+    return timePtr.get();
+}
+
+std::string TerminationTime()
+{
+    return UtcTime(2);
+}
+
+std::string_view LocalName(std::string_view name)
+{
+    const std::string_view::size_type colon = name.rfind(':');
+    return colon == std::string_view::npos ? name : name.substr(colon + 1);
+}
+
+// local name of the first element inside SOAP Body
+std::string_view Operation(std::string_view message)
+{
+    std::string_view::size_type pos = 0;
+    for(;;) {
+        pos = message.find("Body", pos);
+        if(pos == std::string_view::npos || pos == 0)
+            return {};
+
+        const char prev = message[pos - 1];
+        if(prev == '<' || prev == ':')
+            break;
+
+        pos += 4;
+    }
+
+    pos = message.find('>', pos);
+    if(pos == std::string_view::npos)
+        return {};
+
+    pos = message.find('<', pos);
+    if(pos == std::string_view::npos)
+        return {};
+
+    const std::string_view::size_type nameStart = pos + 1;
+    const std::string_view::size_type nameEnd = message.find_first_of(" \t\r\n/>", nameStart);
+    if(nameEnd == std::string_view::npos)
+        return {};
+
+    return LocalName(message.substr(nameStart, nameEnd - nameStart));
+}
+
+// text content of the first element with specified local name
+std::string_view ElementValue(std::string_view message, std::string_view localName)
+{
+    std::string_view::size_type pos = 0;
+    while((pos = message.find(localName, pos)) != std::string_view::npos) {
+        const std::string_view::size_type nameEnd = pos + localName.size();
+        const bool nameStarts = pos > 0 && (message[pos - 1] == '<' || message[pos - 1] == ':');
+        const bool nameEnds = nameEnd < message.size() && (message[nameEnd] == '>' || message[nameEnd] == ' ');
+        if(!nameStarts || !nameEnds) {
+            pos = nameEnd;
+            continue;
+        }
+
+        const std::string_view::size_type valueStart = message.find('>', nameEnd);
+        if(valueStart == std::string_view::npos)
+            return {};
+
+        const std::string_view::size_type valueEnd = message.find('<', valueStart);
+        if(valueEnd == std::string_view::npos)
+            return {};
+
+        return message.substr(valueStart + 1, valueEnd - valueStart - 1);
+    }
+
+    return {};
+}
+
+HttpListener::Response SoapResponse(const std::string& body)
+{
+    HttpListener::Response response;
+    response.contentType = SoapContentType;
+    response.body = EnvelopeStart + body + EnvelopeEnd;
+    return response;
+}
+
+HttpListener::Response SoapFault(const char* subcode, const char* reason)
+{
+    HttpListener::Response response =
+        SoapResponse(
+            std::string("<env:Fault>"
+                "<env:Code><env:Value>env:Receiver</env:Value>"
+                "<env:Subcode><env:Value>") + subcode + "</env:Value></env:Subcode>"
+                "</env:Code>"
+                "<env:Reason><env:Text xml:lang=\"en\">" + reason + "</env:Text></env:Reason>"
+                "</env:Fault>");
+    response.status = 500;
+    return response;
+}
+
+std::string NotificationMessage(const MotionEvent& event, bool initialized)
+{
+    return
+        std::string("<wsnt:NotificationMessage>"
+            "<wsnt:Topic Dialect=\"http://www.onvif.org/ver10/tev/topicExpression/ConcreteSet\">") +
+            MotionTopic + "</wsnt:Topic>"
+            "<wsnt:Message>"
+            "<tt:Message UtcTime=\"" + event.utcTime + "\""
+                " PropertyOperation=\"" + (initialized ? "Initialized" : "Changed") + "\">"
+            "<tt:Source>"
+            "<tt:SimpleItem Name=\"VideoSourceConfigurationToken\" Value=\"VideoSource\"/>"
+            "<tt:SimpleItem Name=\"Rule\" Value=\"MotionDetectorRule\"/>"
+            "</tt:Source>"
+            "<tt:Data>"
+            "<tt:SimpleItem Name=\"IsMotion\" Value=\"" + (event.isMotion ? "true" : "false") + "\"/>"
+            "</tt:Data>"
+            "</tt:Message>"
+            "</wsnt:Message>"
+            "</wsnt:NotificationMessage>";
+}
+
+std::string ProfileXml(const Profile& profile)
+{
+    const std::string token = profile.token;
+    return
+        "<trt:Profiles token=\"" + token + "\" fixed=\"true\">"
+        "<tt:Name>" + token + "</tt:Name>"
+        "<tt:VideoEncoderConfiguration token=\"encoder_" + token + "\">"
+        "<tt:Name>encoder_" + token + "</tt:Name>"
+        "<tt:UseCount>1</tt:UseCount>"
+        "<tt:Encoding>H264</tt:Encoding>"
+        "<tt:Resolution>"
+        "<tt:Width>" + std::to_string(profile.width) + "</tt:Width>"
+        "<tt:Height>" + std::to_string(profile.height) + "</tt:Height>"
+        "</tt:Resolution>"
+        "<tt:Quality>5</tt:Quality>"
+        "<tt:RateControl>"
+        "<tt:FrameRateLimit>" + std::to_string(profile.frameRate) + "</tt:FrameRateLimit>"
+        "<tt:EncodingInterval>1</tt:EncodingInterval>"
+        "<tt:BitrateLimit>" + std::to_string(profile.bitrate) + "</tt:BitrateLimit>"
+        "</tt:RateControl>"
+        "<tt:SessionTimeout>PT60S</tt:SessionTimeout>"
+        "</tt:VideoEncoderConfiguration>"
+        "</trt:Profiles>";
+}
+
+HttpListener::Response OnGetCapabilities(Device& device)
+{
+    return SoapResponse(
+        "<tds:GetCapabilitiesResponse><tds:Capabilities>"
+        "<tt:Events>"
+        "<tt:XAddr>" + device.baseUrl + EventsPath + "</tt:XAddr>"
+        "<tt:WSSubscriptionPolicySupport>false</tt:WSSubscriptionPolicySupport>"
+        "<tt:WSPullPointSupport>true</tt:WSPullPointSupport>"
+        "<tt:WSPausableSubscriptionManagerInterfaceSupport>false</tt:WSPausableSubscriptionManagerInterfaceSupport>"
+        "</tt:Events>"
+        "<tt:Media>"
+        "<tt:XAddr>" + device.baseUrl + MediaPath + "</tt:XAddr>"
+        "<tt:StreamingCapabilities>"
+        "<tt:RTPMulticast>false</tt:RTPMulticast>"
+        "<tt:RTP_TCP>true</tt:RTP_TCP>"
+        "<tt:RTP_RTSP_TCP>true</tt:RTP_RTSP_TCP>"
+        "</tt:StreamingCapabilities>"
+        "</tt:Media>"
+        "</tds:Capabilities></tds:GetCapabilitiesResponse>");
+}
+
+HttpListener::Response OnGetProfiles(Device& device)
+{
+    std::string body = "<trt:GetProfilesResponse>";
+    for(const Profile& profile: device.profiles)
+        body += ProfileXml(profile);
+    body += "</trt:GetProfilesResponse>";
+
+    return SoapResponse(body);
+}
+
+HttpListener::Response OnGetStreamUri(Device& device, std::string_view request)
+{
+    const std::string_view token = ElementValue(request, "ProfileToken");
+    for(const Profile& profile: device.profiles) {
+        if(token != profile.token)
+            continue;
+
+        return SoapResponse(
+            "<trt:GetStreamUriResponse><trt:MediaUri>"
+            "<tt:Uri>" + profile.uri + "</tt:Uri>"
+            "<tt:InvalidAfterConnect>false</tt:InvalidAfterConnect>"
+            "<tt:InvalidAfterReboot>false</tt:InvalidAfterReboot>"
+            "<tt:Timeout>PT0S</tt:Timeout>"
+            "</trt:MediaUri></trt:GetStreamUriResponse>");
+    }
+
+    return SoapFault("ter:InvalidArgVal", "No such profile");
+}
+
+HttpListener::Response OnCreatePullPointSubscription(Device& device)
+{
+    unsigned id;
+    {
+        std::lock_guard<std::mutex> lock(device.mutex);
+        id = device.nextSubscriptionId++;
+        // current state is delivered with the first PullMessages
+        const uint64_t lastSequence = device.events.empty() ? 0 : device.events.back().sequence - 1;
+        device.subscriptions.emplace(id, Subscription { false, {}, lastSequence, false });
+    }
+
+    printf("Pull point subscription %u created\n", id);
+
+    return SoapResponse(
+        "<tev:CreatePullPointSubscriptionResponse>"
+        "<tev:SubscriptionReference>"
+        "<wsa5:Address>" + device.baseUrl + PullSubscriptionPath + std::to_string(id) + "</wsa5:Address>"
+        "</tev:SubscriptionReference>"
+        "<wsnt:CurrentTime>" + UtcTime() + "</wsnt:CurrentTime>"
+        "<wsnt:TerminationTime>" + TerminationTime() + "</wsnt:TerminationTime>"
+        "</tev:CreatePullPointSubscriptionResponse>");
+}
+
+HttpListener::Response OnPullMessages(Device& device, unsigned id)
+{
+    std::string messages;
+    {
+        std::unique_lock<std::mutex> lock(device.mutex);
+
+        auto it = device.subscriptions.find(id);
+        if(it == device.subscriptions.end() || it->second.push)
+            return SoapFault("wsrf-rw:ResourceUnknownFault", "Unknown subscription");
+
+        // long polling like real cameras do
+        device.eventsCondition.wait_for(
+            lock,
+            std::chrono::seconds(MaxPullWait),
+            [&device, id] () {
+                auto it = device.subscriptions.find(id);
+                return
+                    device.stopping ||
+                    it == device.subscriptions.end() ||
+                    (!device.events.empty() && device.events.back().sequence > it->second.lastSequence);
+            });
+
+        it = device.subscriptions.find(id);
+        if(it == device.subscriptions.end())
+            return SoapFault("wsrf-rw:ResourceUnknownFault", "Unknown subscription");
+
+        Subscription& subscription = it->second;
+        size_t pulled = 0;
+        for(const MotionEvent& event: device.events) {
+            if(event.sequence <= subscription.lastSequence)
+                continue;
+            if(++pulled > MaxPulledEvents)
+                break;
+
+            messages += NotificationMessage(event, !subscription.initialized);
+            subscription.lastSequence = event.sequence;
+            subscription.initialized = true;
+        }
+    }
+
+    return SoapResponse(
+        "<tev:PullMessagesResponse>"
+        "<tev:CurrentTime>" + UtcTime() + "</tev:CurrentTime>"
+        "<tev:TerminationTime>" + TerminationTime() + "</tev:TerminationTime>" +
+        messages +
+        "</tev:PullMessagesResponse>");
+}
+
+HttpListener::Response OnSubscribe(Device& device, std::string_view request)
+{
+    if(!device.push)
+        return SoapFault("wsntw:SubscribeCreationFailedFault", "Push subscriptions are disabled");
+
+    // WS-Addressing header could have its own Address elements
+    const std::string_view::size_type consumerReference = request.find("ConsumerReference");
+    const std::string consumerAddress(
+        consumerReference == std::string_view::npos ?
+            std::string_view() :
+            ElementValue(request.substr(consumerReference), "Address"));
+    if(consumerAddress.empty())
+        return SoapFault("ter:InvalidArgVal", "Consumer address is missing");
+
+    unsigned id;
+    {
+        std::lock_guard<std::mutex> lock(device.mutex);
+        id = device.nextSubscriptionId++;
+        device.subscriptions.emplace(id, Subscription { true, consumerAddress, 0, true });
+    }
+
+    printf("Push subscription %u created for \"%s\"\n", id, consumerAddress.c_str());
+
+    return SoapResponse(
+        "<wsnt:SubscribeResponse>"
+        "<wsnt:SubscriptionReference>"
+        "<wsa5:Address>" + device.baseUrl + PushSubscriptionPath + std::to_string(id) + "</wsa5:Address>"
+        "</wsnt:SubscriptionReference>"
+        "<wsnt:CurrentTime>" + UtcTime() + "</wsnt:CurrentTime>"
+        "<wsnt:TerminationTime>" + TerminationTime() + "</wsnt:TerminationTime>"
+        "</wsnt:SubscribeResponse>");
+}
+
+HttpListener::Response OnRenew(Device& device, unsigned id)
+{
+    {
+        std::lock_guard<std::mutex> lock(device.mutex);
+        if(device.subscriptions.find(id) == device.subscriptions.end())
+            return SoapFault("wsrf-rw:ResourceUnknownFault", "Unknown subscription");
+    }
+
+    return SoapResponse(
+        "<wsnt:RenewResponse>"
+        "<wsnt:TerminationTime>" + TerminationTime() + "</wsnt:TerminationTime>"
+        "<wsnt:CurrentTime>" + UtcTime() + "</wsnt:CurrentTime>"
+        "</wsnt:RenewResponse>");
+}
+
+HttpListener::Response OnUnsubscribe(Device& device, unsigned id)
+{
+    {
+        std::lock_guard<std::mutex> lock(device.mutex);
+        device.subscriptions.erase(id);
+    }
+
+    printf("Subscription %u removed\n", id);
+
+    return SoapResponse("<wsnt:UnsubscribeResponse/>");
+}
+
+// returns 0 if path is not subscription one
+unsigned SubscriptionId(const std::string& path)
+{
+    for(const char* prefix: { PullSubscriptionPath, PushSubscriptionPath }) {
+        if(g_str_has_prefix(path.c_str(), prefix))
+            return static_cast<unsigned>(strtoul(path.c_str() + strlen(prefix), nullptr, 10));
+    }
+
+    return 0;
+}
+
+HttpListener::Response HandleRequest(Device& device, const HttpListener::Request& request)
+{
+    if(request.method != "POST") {
+        HttpListener::Response response;
+        response.status = 405;
+        return response;
+    }
+
+    const std::string_view operation = Operation(request.body);
+    printf("%s %.*s\n", request.path.c_str(), static_cast<int>(operation.size()), operation.data());
+
+    const unsigned subscriptionId = SubscriptionId(request.path);
+    if(subscriptionId) {
+        if(operation == "PullMessages")
+            return OnPullMessages(device, subscriptionId);
+        if(operation == "Renew")
+            return OnRenew(device, subscriptionId);
+        if(operation == "Unsubscribe")
+            return OnUnsubscribe(device, subscriptionId);
+    } else if(operation == "GetCapabilities" || operation == "GetProfiles" || operation == "GetStreamUri") {
+        // emulates slow camera for startup measurements
+        if(device.responseDelay)
+            std::this_thread::sleep_for(std::chrono::milliseconds(device.responseDelay));
+
+        if(operation == "GetCapabilities")
+            return OnGetCapabilities(device);
+        if(operation == "GetProfiles")
+            return OnGetProfiles(device);
+        return OnGetStreamUri(device, request.body);
+    } else if(operation == "CreatePullPointSubscription") {
+        return OnCreatePullPointSubscription(device);
+    } else if(operation == "Subscribe") {
+        return OnSubscribe(device, request.body);
+    }
+
+    return SoapFault("ter:ActionNotSupported", "Operation is not supported by mock device");
+}
+
+void SendNotify(const std::string& consumerAddress, const MotionEvent& event)
+{
+    GUriPtr uriPtr(g_uri_parse(consumerAddress.c_str(), G_URI_FLAGS_NONE, nullptr));
+    GUri* uri = uriPtr.get();
+    if(!uri || !g_uri_get_host(uri)) {
+        fprintf(stderr, "Invalid consumer address \"%s\"\n", consumerAddress.c_str());
+        return;
+    }
+
+    const std::string body =
+        EnvelopeStart +
+        ("<wsnt:Notify>" + NotificationMessage(event, false) + "</wsnt:Notify>") +
+        EnvelopeEnd;
+    const std::string request =
+        std::string("POST ") + (*g_uri_get_path(uri) ? g_uri_get_path(uri) : "/") + " HTTP/1.1\r\n"
+        "Host: " + g_uri_get_host(uri) + "\r\n"
+        "Content-Type: " + SoapContentType + "\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n"
+        "\r\n" +
+        body;
+
+    GError* error = nullptr;
+    ObjectPtr<GSocketClient> clientPtr(g_socket_client_new());
+    g_socket_client_set_timeout(clientPtr.get(), 5);
+    ObjectPtr<GSocketConnection> connectionPtr(
+        g_socket_client_connect_to_host(
+            clientPtr.get(),
+            g_uri_get_host(uri),
+            g_uri_get_port(uri) > 0 ? g_uri_get_port(uri) : 80,
+            nullptr,
+            &error));
+    GErrorPtr errorPtr(error);
+    if(!connectionPtr) {
+        fprintf(stderr, "Failed to connect to \"%s\": %s\n", consumerAddress.c_str(), errorPtr->message);
+        return;
+    }
+
+    gsize bytesWritten = 0;
+    GOutputStream* output = g_io_stream_get_output_stream(G_IO_STREAM(connectionPtr.get()));
+    if(!g_output_stream_write_all(output, request.data(), request.size(), &bytesWritten, nullptr, nullptr)) {
+        fprintf(stderr, "Failed to send Notify to \"%s\"\n", consumerAddress.c_str());
+        return;
+    }
+
+    // status line is enough to see if consumer accepted it
+    char status[64] = {};
+    GInputStream* input = g_io_stream_get_input_stream(G_IO_STREAM(connectionPtr.get()));
+    g_input_stream_read(input, status, sizeof(status) - 1, nullptr, nullptr);
+    if(char* lineEnd = strpbrk(status, "\r\n"))
+        *lineEnd = '\0';
+
+    printf("Notify (IsMotion=%s) sent to \"%s\": %s\n",
+        event.isMotion ? "true" : "false",
+        consumerAddress.c_str(),
+        status);
+}
+
+void MotionThreadFunc(Device& device, unsigned motionPeriod)
+{
+    bool isMotion = false;
+
+    std::unique_lock<std::mutex> lock(device.mutex);
+    while(!device.stopping) {
+        MotionEvent event { device.nextSequence++, isMotion, UtcTime() };
+        device.events.push_back(event);
+        if(device.events.size() > MaxKeptEvents)
+            device.events.pop_front();
+
+        std::deque<std::string> consumers;
+        for(const auto& pair: device.subscriptions) {
+            if(pair.second.push)
+                consumers.push_back(pair.second.consumerAddress);
+        }
+
+        device.eventsCondition.notify_all();
+
+        printf("Motion %s\n", isMotion ? "started" : "stopped");
+
+        lock.unlock();
+        for(const std::string& consumer: consumers)
+            SendNotify(consumer, event);
+        lock.lock();
+
+        isMotion = !isMotion;
+        device.eventsCondition.wait_for(
+            lock,
+            std::chrono::seconds(motionPeriod),
+            [&device] () { return device.stopping; });
+    }
+}
+
+#ifdef WITH_RTSP_SERVER
+void AddRtspStream(GstRTSPMountPoints* mountPoints, const Profile& profile)
+{
+    GstRTSPMediaFactory* factory = gst_rtsp_media_factory_new();
+
+    const std::string launch =
+        "( videotestsrc is-live=true pattern=" + std::string(profile.width > 1000 ? "smpte" : "ball") +
+        " ! video/x-raw,width=" + std::to_string(profile.width) +
+        ",height=" + std::to_string(profile.height) +
+        ",framerate=" + std::to_string(profile.frameRate) + "/1"
+        " ! timeoverlay"
+        " ! x264enc tune=zerolatency speed-preset=ultrafast"
+        " bitrate=" + std::to_string(profile.bitrate) +
+        " key-int-max=" + std::to_string(profile.frameRate) +
+        " ! rtph264pay name=pay0 pt=96 )";
+    gst_rtsp_media_factory_set_launch(factory, launch.c_str());
+    // every client gets the same stream, so N viewers cost single encoder
+    gst_rtsp_media_factory_set_shared(factory, TRUE);
+
+    const std::string path = std::string("/") + profile.token;
+    gst_rtsp_mount_points_add_factory(mountPoints, path.c_str(), factory);
+}
+
+bool StartRtspServer(const Device& device, unsigned port)
+{
+    GstRTSPServer* server = gst_rtsp_server_new();
+    const std::string service = std::to_string(port);
+    gst_rtsp_server_set_service(server, service.c_str());
+
+    GstRTSPMountPoints* mountPoints = gst_rtsp_server_get_mount_points(server);
+    for(const Profile& profile: device.profiles)
+        AddRtspStream(mountPoints, profile);
+    g_object_unref(mountPoints);
+
+    // server lives until process exit
+    return gst_rtsp_server_attach(server, nullptr) != 0;
+}
+#endif
+
+}
+
+int main(int argc, char *argv[])
+{
+    // output is followed by scripts through pipe
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+
+    Options options;
+    GOptionEntry entries[] = {
+        { "port", 'p', 0, G_OPTION_ARG_INT, &options.port, "ONVIF HTTP port (default 8080)", "PORT" },
+        { "host", 0, 0, G_OPTION_ARG_STRING, &options.host, "Host used in service addresses (default 127.0.0.1)", "HOST" },
+        { "motion-period", 'm', 0, G_OPTION_ARG_INT, &options.motionPeriod, "Seconds between motion state changes (default 10)", "SECONDS" },
+        { "response-delay", 'd', 0, G_OPTION_ARG_INT, &options.responseDelay, "Delay of discovery responses (default 0)", "MS" },
+        { "no-push", 0, 0, G_OPTION_ARG_NONE, &options.noPush, "Reject push (Notify) subscriptions", nullptr },
+        { "main-resolution", 0, 0, G_OPTION_ARG_STRING, &options.mainResolution, "Resolution of \"main\" profile (default 1280x720)", "WxH" },
+        { "main-uri", 0, 0, G_OPTION_ARG_STRING, &options.mainUri, "Stream uri of \"main\" profile", "URI" },
+        { "sub-uri", 0, 0, G_OPTION_ARG_STRING, &options.subUri, "Stream uri of \"sub\" profile", "URI" },
+#ifdef WITH_RTSP_SERVER
+        { "rtsp-port", 'r', 0, G_OPTION_ARG_INT, &options.rtspPort, "RTSP port (default 8554)", "PORT" },
+#endif
+        { nullptr }
+    };
+
+    GOptionContext* context = g_option_context_new(nullptr);
+    g_option_context_add_main_entries(context, entries, nullptr);
+#ifdef WITH_RTSP_SERVER
+    g_option_context_add_group(context, gst_init_get_option_group());
+#endif
+    GError* error = nullptr;
+    if(!g_option_context_parse(context, &argc, &argv, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(context);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    unsigned mainWidth = 1280;
+    unsigned mainHeight = 720;
+    if(options.mainResolution &&
+        sscanf(options.mainResolution, "%ux%u", &mainWidth, &mainHeight) != 2)
+    {
+        fprintf(stderr, "Invalid \"main\" profile resolution\n");
+        return EXIT_FAILURE;
+    }
+
+    const std::string host = options.host ? options.host : "127.0.0.1";
+
+    Device device;
+    device.baseUrl = "http://" + host + ":" + std::to_string(options.port);
+    device.responseDelay = std::max(0, options.responseDelay);
+    device.push = !options.noPush;
+    device.profiles[0] = { "main", mainWidth, mainHeight, 25, 4096, {} };
+    device.profiles[1] = { "sub", 640, 360, 15, 512, {} };
+
+#ifdef WITH_RTSP_SERVER
+    const std::string rtspUrl = "rtsp://" + host + ":" + std::to_string(options.rtspPort) + "/";
+#else
+    const std::string rtspUrl = "rtsp://" + host + ":8554/";
+#endif
+    device.profiles[0].uri = options.mainUri ? options.mainUri : rtspUrl + device.profiles[0].token;
+    device.profiles[1].uri = options.subUri ? options.subUri : rtspUrl + device.profiles[1].token;
+
+    GMainLoopPtr loopPtr(g_main_loop_new(nullptr, FALSE));
+    GMainLoop* loop = loopPtr.get();
+
+#ifdef WITH_RTSP_SERVER
+    if(!options.mainUri || !options.subUri) {
+        if(!StartRtspServer(device, options.rtspPort)) {
+            fprintf(stderr, "Failed to start RTSP server on port %d\n", options.rtspPort);
+            return EXIT_FAILURE;
+        }
+        printf("Serving RTSP streams on port %d\n", options.rtspPort);
+    }
+#endif
+
+    HttpListener listener(
+        [&device] (const HttpListener::Request& request) {
+            return HandleRequest(device, request);
+        });
+    if(!listener.listen(options.port, false))
+        return EXIT_FAILURE;
+
+    std::thread motionThread(MotionThreadFunc, std::ref(device), std::max(1, options.motionPeriod));
+
+    auto quit =
+        [] (gpointer userData) -> gboolean {
+            g_main_loop_quit(static_cast<GMainLoop*>(userData));
+            return G_SOURCE_REMOVE;
+        };
+    g_unix_signal_add(SIGINT, quit, loop);
+    g_unix_signal_add(SIGTERM, quit, loop);
+
+    printf("Mock ONVIF device is available at %s/\n", device.baseUrl.c_str());
+
+    g_main_loop_run(loop);
+
+    {
+        std::lock_guard<std::mutex> lock(device.mutex);
+        device.stopping = true;
+    }
+    device.eventsCondition.notify_all();
+
+    listener.stop();
+    motionThread.join();
+
+    g_free(options.host);
+    g_free(options.mainResolution);
+    g_free(options.mainUri);
+    g_free(options.subUri);
+
+    return EXIT_SUCCESS;
+}
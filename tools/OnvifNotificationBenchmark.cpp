@@ -0,0 +1,305 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string_view>
+
+#include "OnvifNotification.h"
+
+
+// Checks ONVIF notification parser against recorded PullMessages responses
+// and measures time spent to parse each of them.
+
+namespace {
+
+const char MotionOnResponse[] =
+R"(<?xml version="1.0" encoding="UTF-8"?>
+<SOAP-ENV:Envelope xmlns:SOAP-ENV="http://www.w3.org/2003/05/soap-envelope" xmlns:wsa5="http://www.w3.org/2005/08/addressing" xmlns:tt="http://www.onvif.org/ver10/schema" xmlns:wsnt="http://docs.oasis-open.org/wsn/b-2" xmlns:tev="http://www.onvif.org/ver10/events/wsdl" xmlns:tns1="http://www.onvif.org/ver10/topics">
+<SOAP-ENV:Header>
+<wsa5:MessageID>urn:uuid:3c1e1a3e-0f4b-4c55-9a2c-6d0f6c7a2a11</wsa5:MessageID>
+<wsa5:To SOAP-ENV:mustUnderstand="true">http://192.168.1.64/onvif/Events/PullSubManager_2024-05-11T10:12:03Z_1</wsa5:To>
+<wsa5:Action SOAP-ENV:mustUnderstand="true">http://www.onvif.org/ver10/events/wsdl/PullPointSubscription/PullMessagesResponse</wsa5:Action>
+</SOAP-ENV:Header>
+<SOAP-ENV:Body>
+<tev:PullMessagesResponse>
+<tev:CurrentTime>2024-05-11T10:12:41Z</tev:CurrentTime>
+<tev:TerminationTime>2024-05-11T10:13:41Z</tev:TerminationTime>
+<wsnt:NotificationMessage>
+<wsnt:Topic Dialect="http://www.onvif.org/ver10/tev/topicExpression/ConcreteSet">tns1:RuleEngine/CellMotionDetector/Motion</wsnt:Topic>
+<wsnt:Message>
+<tt:Message UtcTime="2024-05-11T10:12:41Z" PropertyOperation="Changed">
+<tt:Source>
+<tt:SimpleItem Name="VideoSourceConfigurationToken" Value="VideoSourceToken"/>
+<tt:SimpleItem Name="VideoAnalyticsConfigurationToken" Value="VideoAnalyticsToken"/>
+<tt:SimpleItem Name="Rule" Value="MyMotionDetectorRule"/>
+</tt:Source>
+<tt:Data>
+<tt:SimpleItem Name="IsMotion" Value="true"/>
+</tt:Data>
+</tt:Message>
+</wsnt:Message>
+</wsnt:NotificationMessage>
+</tev:PullMessagesResponse>
+</SOAP-ENV:Body>
+</SOAP-ENV:Envelope>
+)";
+
+const char MotionOffResponse[] =
+R"(<?xml version="1.0" encoding="UTF-8"?>
+<env:Envelope xmlns:env="http://www.w3.org/2003/05/soap-envelope" xmlns:tt="http://www.onvif.org/ver10/schema" xmlns:wsnt="http://docs.oasis-open.org/wsn/b-2" xmlns:tev="http://www.onvif.org/ver10/events/wsdl" xmlns:tns1="http://www.onvif.org/ver10/topics">
+<env:Body>
+<tev:PullMessagesResponse>
+<tev:CurrentTime>2024-05-11T10:12:52Z</tev:CurrentTime>
+<tev:TerminationTime>2024-05-11T10:13:52Z</tev:TerminationTime>
+<wsnt:NotificationMessage>
+<wsnt:Topic Dialect="http://www.onvif.org/ver10/tev/topicExpression/ConcreteSet">tns1:VideoSource/MotionAlarm</wsnt:Topic>
+<wsnt:Message>
+<tt:Message UtcTime='2024-05-11T10:12:52Z' PropertyOperation='Changed'>
+<tt:Source>
+<tt:SimpleItem Name='Source' Value='VideoSource_1'/>
+</tt:Source>
+<tt:Data>
+<tt:SimpleItem Name='State' Value='false'/>
+<tt:SimpleItem Name='IsMotion' Value='0'/>
+</tt:Data>
+</tt:Message>
+</wsnt:Message>
+</wsnt:NotificationMessage>
+</tev:PullMessagesResponse>
+</env:Body>
+</env:Envelope>
+)";
+
+const char FaultResponse[] =
+R"(<?xml version="1.0" encoding="UTF-8"?>
+<SOAP-ENV:Envelope xmlns:SOAP-ENV="http://www.w3.org/2003/05/soap-envelope" xmlns:ter="http://www.onvif.org/ver10/error" xmlns:wsrf-rw="http://docs.oasis-open.org/wsrf/rw-2">
+<SOAP-ENV:Body>
+<SOAP-ENV:Fault>
+<SOAP-ENV:Code>
+<SOAP-ENV:Value>SOAP-ENV:Receiver</SOAP-ENV:Value>
+<SOAP-ENV:Subcode>
+<SOAP-ENV:Value>wsrf-rw:ResourceUnknownFault</SOAP-ENV:Value>
+</SOAP-ENV:Subcode>
+</SOAP-ENV:Code>
+<SOAP-ENV:Reason>
+<SOAP-ENV:Text xml:lang="en">Subscription is not found</SOAP-ENV:Text>
+</SOAP-ENV:Reason>
+</SOAP-ENV:Fault>
+</SOAP-ENV:Body>
+</SOAP-ENV:Envelope>
+)";
+
+const char MultiMessageResponse[] =
+R"(<?xml version="1.0" encoding="UTF-8"?>
+<SOAP-ENV:Envelope xmlns:SOAP-ENV="http://www.w3.org/2003/05/soap-envelope" xmlns:tt="http://www.onvif.org/ver10/schema" xmlns:wsnt="http://docs.oasis-open.org/wsn/b-2" xmlns:tev="http://www.onvif.org/ver10/events/wsdl" xmlns:tns1="http://www.onvif.org/ver10/topics">
+<SOAP-ENV:Body>
+<tev:PullMessagesResponse>
+<tev:CurrentTime>2024-05-11T10:15:07Z</tev:CurrentTime>
+<tev:TerminationTime>2024-05-11T10:16:07Z</tev:TerminationTime>
+<wsnt:NotificationMessage>
+<wsnt:Topic Dialect="http://www.onvif.org/ver10/tev/topicExpression/ConcreteSet">tns1:Device/Trigger/DigitalInput</wsnt:Topic>
+<wsnt:Message>
+<tt:Message UtcTime="2024-05-11T10:15:05Z" PropertyOperation="Initialized">
+<tt:Source>
+<tt:SimpleItem Name="InputToken" Value="DigitalInputToken"/>
+</tt:Source>
+<tt:Data>
+<tt:SimpleItem Name="LogicalState" Value="false"/>
+</tt:Data>
+</tt:Message>
+</wsnt:Message>
+</wsnt:NotificationMessage>
+<wsnt:NotificationMessage>
+<wsnt:Topic Dialect="http://www.onvif.org/ver10/tev/topicExpression/ConcreteSet">tns1:RuleEngine/CellMotionDetector/Motion</wsnt:Topic>
+<wsnt:Message>
+<tt:Message UtcTime="2024-05-11T10:15:06Z" PropertyOperation="Changed">
+<tt:Source>
+<tt:SimpleItem Name="VideoSourceConfigurationToken" Value="VideoSourceToken"/>
+<tt:SimpleItem Name="Rule" Value="MyMotionDetectorRule"/>
+</tt:Source>
+<tt:Data>
+<tt:SimpleItem Name="IsMotion" Value="true"/>
+</tt:Data>
+</tt:Message>
+</wsnt:Message>
+</wsnt:NotificationMessage>
+<wsnt:NotificationMessage>
+<wsnt:Topic Dialect="http://www.onvif.org/ver10/tev/topicExpression/ConcreteSet">tns1:RuleEngine/TamperDetector/Tamper</wsnt:Topic>
+<wsnt:Message>
+<tt:Message UtcTime="2024-05-11T10:15:06Z" PropertyOperation="Changed">
+<tt:Source>
+<tt:SimpleItem Name="VideoSourceConfigurationToken" Value="VideoSourceToken"/>
+</tt:Source>
+<tt:Data>
+<tt:SimpleItem Name="IsTamper" Value="false"/>
+</tt:Data>
+</tt:Message>
+</wsnt:Message>
+</wsnt:NotificationMessage>
+<wsnt:NotificationMessage>
+<wsnt:Topic Dialect="http://www.onvif.org/ver10/tev/topicExpression/ConcreteSet">tns1:RuleEngine/CellMotionDetector/Motion</wsnt:Topic>
+<wsnt:Message>
+<tt:Message UtcTime="2024-05-11T10:15:07Z" PropertyOperation="Changed">
+<tt:Source>
+<tt:SimpleItem Name="VideoSourceConfigurationToken" Value="VideoSourceToken"/>
+<tt:SimpleItem Name="Rule" Value="MyMotionDetectorRule"/>
+</tt:Source>
+<tt:Data>
+<tt:SimpleItem Name="IsMotion" Value="false"/>
+</tt:Data>
+</tt:Message>
+</wsnt:Message>
+</wsnt:NotificationMessage>
+</tev:PullMessagesResponse>
+</SOAP-ENV:Body>
+</SOAP-ENV:Envelope>
+)";
+
+enum {
+    MaxEvents = 16,
+};
+
+const unsigned Iterations = 100000;
+
+// how IsMotion of event is expected to be reported
+enum class Motion {
+    None, // no IsMotion item
+    On,
+    Off,
+};
+
+struct Payload
+{
+    const char* name;
+    std::string_view message;
+    OnvifNotificationParseResult expectedResult;
+    size_t expectedEventsCount;
+    Motion expectedMotion[MaxEvents];
+};
+
+const Payload Payloads[] = {
+    {
+        "motion on",
+        MotionOnResponse,
+        OnvifNotificationParseResult::Ok,
+        1,
+        { Motion::On },
+    },
+    {
+        "motion off",
+        MotionOffResponse,
+        OnvifNotificationParseResult::Ok,
+        1,
+        { Motion::Off },
+    },
+    {
+        "fault",
+        FaultResponse,
+        OnvifNotificationParseResult::Fault,
+        0,
+        {},
+    },
+    {
+        "multi message",
+        MultiMessageResponse,
+        OnvifNotificationParseResult::Ok,
+        4,
+        { Motion::None, Motion::On, Motion::None, Motion::Off },
+    },
+};
+
+Motion EventMotion(const OnvifEvent& event)
+{
+    const std::string_view* value = event.value(OnvifEvent::Section::Data, "IsMotion");
+    if(!value)
+        return Motion::None;
+
+    return IsXsdTrue(*value) ? Motion::On : Motion::Off;
+}
+
+bool Check(const Payload& payload)
+{
+    OnvifEvent events[MaxEvents];
+    size_t eventsCount = 0;
+    const OnvifNotificationParseResult result =
+        ParseOnvifNotifications(payload.message, events, MaxEvents, &eventsCount);
+
+    if(result != payload.expectedResult) {
+        fprintf(stderr, "%s: unexpected parse result %d\n", payload.name, static_cast<int>(result));
+        return false;
+    }
+
+    if(result != OnvifNotificationParseResult::Ok)
+        return true;
+
+    if(eventsCount != payload.expectedEventsCount) {
+        fprintf(
+            stderr,
+            "%s: %zu events parsed instead of %zu\n",
+            payload.name,
+            eventsCount,
+            payload.expectedEventsCount);
+        return false;
+    }
+
+    for(size_t i = 0; i < eventsCount; ++i) {
+        if(events[i].topic.empty() || events[i].utcTime.empty()) {
+            fprintf(stderr, "%s: event %zu has no topic or time\n", payload.name, i);
+            return false;
+        }
+
+        if(EventMotion(events[i]) != payload.expectedMotion[i]) {
+            fprintf(stderr, "%s: unexpected motion state of event %zu\n", payload.name, i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void Measure(const Payload& payload)
+{
+    OnvifEvent events[MaxEvents];
+    size_t eventsCount = 0;
+    size_t totalEvents = 0; // to not let compiler throw parsing away
+
+    const auto startTime = std::chrono::steady_clock::now();
+    for(unsigned i = 0; i < Iterations; ++i) {
+        ParseOnvifNotifications(payload.message, events, MaxEvents, &eventsCount);
+        totalEvents += eventsCount;
+    }
+    const auto elapsed =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - startTime);
+
+    const double perParse = static_cast<double>(elapsed.count()) / Iterations;
+    printf(
+        "%-14s %5zu bytes %8.0f ns/parse %8.1f MB/s (%zu events)\n",
+        payload.name,
+        payload.message.size(),
+        perParse,
+        payload.message.size() / perParse * 1000,
+        totalEvents / Iterations);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+    bool failed = false;
+    for(const Payload& payload: Payloads) {
+        if(!Check(payload))
+            failed = true;
+    }
+
+    if(failed)
+        return EXIT_FAILURE;
+
+    // "--check" just verifies parsed values
+    if(argc > 1 && std::string_view(argv[1]) == "--check")
+        return EXIT_SUCCESS;
+
+    for(const Payload& payload: Payloads)
+        Measure(payload);
+
+    return EXIT_SUCCESS;
+}
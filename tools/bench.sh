@@ -0,0 +1,393 @@
+#!/bin/bash
+#
+# Runs Monitor against local MockOnvifDevice (built with gst-rtsp-server)
+# with headless video output and reports measurements or check results.
+#
+# Usage: bench.sh <scenario>
+#   push      motion events delivered with Notify end to end, and fallback to pull
+#   lean      time to first frame, CPU, RSS and threads of lean pipeline vs playbin3
+#   mosaic    CPU, RSS and threads of 4 and 9 tiles mosaic vs the same number of Monitor processes
+#   profiles  adaptive profile transitions between mock device streams and time to first frame of every one
+#   startup   time from process start to ONVIF discovery finish and first frame with discovery cache off and on
+#
+# Environment:
+#   BUILD_DIR   directory with Monitor and MockOnvifDevice binaries (current one by default)
+#   RUNS        runs per measured variant (5 by default)
+#   ONVIF_PORT  port of mock ONVIF device (18080 by default)
+#   RTSP_PORT   port of mock RTSP server (18554 by default)
+#   SAMPLE_TIME seconds CPU usage is measured for (10 by default)
+#   TILE_STREAM mock device profile played by every tile or process ("sub" by default)
+#   MAIN_RESOLUTION  "main" profile resolution for profiles scenario, should overload decoder
+#               (3840x2160 by default)
+#   PROFILES_TIME  seconds profiles scenario runs for (150 by default)
+#   RESPONSE_DELAY ms mock device delays every discovery response for (200 by default)
+
+set -u
+
+BUILD_DIR=${BUILD_DIR:-.}
+MONITOR=${MONITOR:-$BUILD_DIR/Monitor}
+MOCK=${MOCK:-$BUILD_DIR/MockOnvifDevice}
+RUNS=${RUNS:-5}
+ONVIF_PORT=${ONVIF_PORT:-18080}
+RTSP_PORT=${RTSP_PORT:-18554}
+SAMPLE_TIME=${SAMPLE_TIME:-10}
+TILE_STREAM=${TILE_STREAM:-sub}
+MAIN_RESOLUTION=${MAIN_RESOLUTION:-3840x2160}
+PROFILES_TIME=${PROFILES_TIME:-150}
+RESPONSE_DELAY=${RESPONSE_DELAY:-200}
+
+ONVIF_URL="http://127.0.0.1:$ONVIF_PORT/"
+RTSP_URL="rtsp://127.0.0.1:$RTSP_PORT"
+
+WORK_DIR=$(mktemp -d)
+PIDS=()
+
+cleanup() {
+    for pid in "${PIDS[@]}"; do
+        kill "$pid" 2>/dev/null
+    done
+    wait 2>/dev/null
+    rm -rf "$WORK_DIR"
+}
+trap cleanup EXIT
+
+die() {
+    echo "$*" >&2
+    exit 1
+}
+
+# wait_for_line <file> <regex> <timeout seconds>
+# prints the first matching line, fails on timeout
+wait_for_line() {
+    local deadline=$((SECONDS + $3))
+    while [ $SECONDS -lt $deadline ]; do
+        if grep -m1 -E "$2" "$1" 2>/dev/null; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    return 1
+}
+
+# start_mock [MockOnvifDevice options...]
+start_mock() {
+    "$MOCK" --port "$ONVIF_PORT" --rtsp-port "$RTSP_PORT" "$@" > "$WORK_DIR/mock.log" 2>&1 &
+    MOCK_PID=$!
+    PIDS+=("$MOCK_PID")
+    wait_for_line "$WORK_DIR/mock.log" "Mock ONVIF device is available" 10 > /dev/null ||
+        die "Mock ONVIF device failed to start: $(cat "$WORK_DIR/mock.log")"
+}
+
+stop_mock() {
+    kill "$MOCK_PID" 2>/dev/null
+    wait "$MOCK_PID" 2>/dev/null
+}
+
+# write_config <file> <source settings> [video-output settings]
+write_config() {
+    cat > "$1" <<EOF
+source: {
+$2
+}
+
+video-output: {
+  backend: "fakesink"
+${3:-}
+}
+EOF
+}
+
+# write_mosaic_config <file> <tiles count>
+write_mosaic_config() {
+    local tiles="" i
+    for i in $(seq "$2"); do
+        tiles+="${tiles:+,}
+  { url: \"$RTSP_URL/$TILE_STREAM\" }"
+    done
+
+    cat > "$1" <<EOF
+sources: ($tiles
+)
+
+video-output: {
+  backend: "fakesink"
+}
+EOF
+}
+
+# wait_for_count <file> <regex> <count> <timeout seconds>
+wait_for_count() {
+    local deadline=$((SECONDS + $4))
+    while [ $SECONDS -lt $deadline ]; do
+        if [ "$(count "$1" "$2")" -ge "$3" ]; then
+            return 0
+        fi
+        sleep 0.1
+    done
+    return 1
+}
+
+# start_monitor <config> <log>, pid is left in MONITOR_PID
+start_monitor() {
+    MONITOR_CONFIG="$1" "$MONITOR" > "$2" 2>&1 &
+    MONITOR_PID=$!
+    PIDS+=("$MONITOR_PID")
+}
+
+stop_monitor() {
+    kill "$1" 2>/dev/null
+    wait "$1" 2>/dev/null
+}
+
+# median of numbers on stdin
+median() {
+    sort -n | awk '{ values[NR] = $1 } END { if(NR) print values[int((NR + 1) / 2)]; else print "-" }'
+}
+
+# column <n> <file>, median of n-th column
+column() {
+    awk -v n="$1" '{ print $n }' "$2" | median
+}
+
+cpu_ticks() {
+    local total=0 pid
+    for pid in "$@"; do
+        total=$((total + $(awk '{ print $14 + $15 }' "/proc/$pid/stat")))
+    done
+    echo "$total"
+}
+
+# sample_processes <pid>...
+# prints CPU usage (percents of single core), RSS (MiB) and threads summed over processes
+sample_processes() {
+    local before after rss=0 threads=0 pid
+    before=$(cpu_ticks "$@")
+    sleep "$SAMPLE_TIME"
+    after=$(cpu_ticks "$@")
+    for pid in "$@"; do
+        rss=$((rss + $(awk '/^VmRSS:/ { print $2 }' "/proc/$pid/status")))
+        threads=$((threads + $(awk '/^Threads:/ { print $2 }' "/proc/$pid/status")))
+    done
+    echo "$(((after - before) * 100 / ($(getconf CLK_TCK) * SAMPLE_TIME))) $((rss / 1024)) $threads"
+}
+
+# count <file> <regex>
+count() {
+    local matches
+    matches=$(grep -c -E "$2" "$1" 2>/dev/null)
+    echo "${matches:-0}"
+}
+
+# check <description> <count>, passes if count is not 0
+check() {
+    if [ "$2" -gt 0 ]; then
+        echo "  PASS  $1 ($2)"
+    else
+        echo "  FAIL  $1"
+        FAILED=1
+    fi
+}
+
+# check_none <description> <count>, passes if count is 0
+check_none() {
+    if [ "$2" -eq 0 ]; then
+        echo "  PASS  $1"
+    else
+        echo "  FAIL  $1 ($2)"
+        FAILED=1
+    fi
+}
+
+bench_push() {
+    FAILED=0
+    local config="$WORK_DIR/push.conf"
+    write_config "$config" "
+  onvif: \"$ONVIF_URL\"
+  track-motion: true
+  motion-preview-time: 2
+  motion-events: \"push\""
+
+    echo "Push subscription:"
+    start_mock --motion-period 3
+    start_monitor "$config" "$WORK_DIR/monitor.log"
+    sleep 15
+    stop_monitor "$MONITOR_PID"
+    stop_mock
+
+    check "Subscribe accepted by device" "$(count "$WORK_DIR/mock.log" "Push subscription [0-9]+ created")"
+    check "Notify with motion accepted by Monitor" "$(count "$WORK_DIR/mock.log" "Notify \(IsMotion=true\).*HTTP/1.1 20[02]")"
+    check "Motion detected by Monitor" "$(count "$WORK_DIR/monitor.log" "Motion detected!")"
+    check_none "No PullMessages issued" "$(count "$WORK_DIR/mock.log" "PullMessages")"
+
+    echo "Device rejecting push subscription:"
+    start_mock --motion-period 3 --no-push
+    start_monitor "$config" "$WORK_DIR/monitor.log"
+    sleep 15
+    stop_monitor "$MONITOR_PID"
+    stop_mock
+
+    check "Fallback to pull" "$(count "$WORK_DIR/monitor.log" "Falling back to pull")"
+    check "PullMessages issued" "$(count "$WORK_DIR/mock.log" "PullMessages")"
+    check "Motion detected by Monitor" "$(count "$WORK_DIR/monitor.log" "Motion detected!")"
+
+    return $FAILED
+}
+
+bench_lean() {
+    start_mock
+
+    local lean
+    for lean in false true; do
+        local config="$WORK_DIR/lean-$lean.conf"
+        local results="$WORK_DIR/lean-$lean.results"
+        write_config "$config" "
+  url: \"$RTSP_URL/main\"
+  lean-pipeline: $lean"
+
+        local run
+        for run in $(seq "$RUNS"); do
+            start_monitor "$config" "$WORK_DIR/monitor.log"
+            local line
+            line=$(wait_for_line "$WORK_DIR/monitor.log" "First frame reached video sink in [0-9]+ ms" 30) ||
+                die "No video with lean-pipeline: $lean: $(tail -n 20 "$WORK_DIR/monitor.log")"
+            local firstFrame
+            firstFrame=$(sed -E 's/.* in ([0-9]+) ms.*/\1/' <<< "$line")
+            echo "$firstFrame $(sample_processes "$MONITOR_PID")" >> "$results"
+            stop_monitor "$MONITOR_PID"
+        done
+
+        printf "lean-pipeline: %-5s first frame %5s ms  CPU %3s%%  RSS %4s MiB  threads %3s  (median of %s runs)\n" \
+            "$lean" \
+            "$(column 1 "$results")" \
+            "$(column 2 "$results")" \
+            "$(column 3 "$results")" \
+            "$(column 4 "$results")" \
+            "$RUNS"
+    done
+}
+
+bench_mosaic() {
+    start_mock
+
+    local tiles
+    for tiles in 4 9; do
+        local config="$WORK_DIR/mosaic.conf"
+        write_mosaic_config "$config" "$tiles"
+        start_monitor "$config" "$WORK_DIR/monitor.log"
+        wait_for_count "$WORK_DIR/monitor.log" "Tile of .* is up" "$tiles" 60 ||
+            die "Not all mosaic tiles are up: $(tail -n 20 "$WORK_DIR/monitor.log")"
+        local stats
+        stats=($(sample_processes "$MONITOR_PID"))
+        stop_monitor "$MONITOR_PID"
+        printf "%s tiles mosaic:      CPU %4s%%  RSS %5s MiB  threads %4s\n" "$tiles" "${stats[@]}"
+
+        config="$WORK_DIR/single.conf"
+        write_config "$config" "
+  url: \"$RTSP_URL/$TILE_STREAM\""
+        local pids=() i
+        for i in $(seq "$tiles"); do
+            start_monitor "$config" "$WORK_DIR/monitor-$i.log"
+            pids+=("$MONITOR_PID")
+        done
+        for i in $(seq "$tiles"); do
+            wait_for_line "$WORK_DIR/monitor-$i.log" "First frame reached video sink" 60 > /dev/null ||
+                die "No video in process $i: $(tail -n 20 "$WORK_DIR/monitor-$i.log")"
+        done
+        stats=($(sample_processes "${pids[@]}"))
+        for i in "${pids[@]}"; do
+            stop_monitor "$i"
+        done
+        printf "%s Monitor processes: CPU %4s%%  RSS %5s MiB  threads %4s\n" "$tiles" "${stats[@]}"
+    done
+}
+
+bench_profiles() {
+    FAILED=0
+    local config="$WORK_DIR/profiles.conf"
+    write_config "$config" "
+  onvif: \"$ONVIF_URL\"
+  adaptive-profile: true
+  discovery-cache: false" "
+  persistent-sink: true"
+
+    start_mock --main-resolution "$MAIN_RESOLUTION"
+    start_monitor "$config" "$WORK_DIR/monitor.log"
+    sleep "$PROFILES_TIME"
+    stop_monitor "$MONITOR_PID"
+
+    # every switch is followed by first frame of new profile
+    awk '
+        /Switching media profile/ { sub(/.*Switching media profile /, ""); transition = $0; next }
+        transition && /First frame reached video sink in/ {
+            match($0, /in [0-9]+ ms/)
+            printf "  %s first frame of new profile in %s\n", transition, substr($0, RSTART + 3, RLENGTH - 3)
+            transition = ""
+        }
+        transition && /Source of .* is lost/ { printf "  %s source lost\n", transition; transition = "" }
+    ' "$WORK_DIR/monitor.log"
+
+    check "Stepped down to lighter profile" "$(count "$WORK_DIR/monitor.log" "Switching media profile \"main\"")"
+    check "Stepped back up to heavier profile" "$(count "$WORK_DIR/monitor.log" "Switching media profile \"sub\"")"
+    check_none "No pipeline errors" "$(count "$WORK_DIR/monitor.log" "Got error from GStreamer pipeline")"
+
+    if [ "$FAILED" -ne 0 ]; then
+        echo "Transitions depend on decoder load: try other MAIN_RESOLUTION or longer PROFILES_TIME"
+    fi
+
+    return $FAILED
+}
+
+bench_startup() {
+    start_mock --response-delay "$RESPONSE_DELAY"
+
+    # discovery cache is kept in temporary directory
+    unset SNAP_DATA
+    export XDG_CACHE_HOME="$WORK_DIR/cache"
+
+    local cache
+    for cache in false true; do
+        local config="$WORK_DIR/startup-$cache.conf"
+        local results="$WORK_DIR/startup-$cache.results"
+        write_config "$config" "
+  onvif: \"$ONVIF_URL\"
+  discovery-cache: $cache"
+
+        rm -rf "$XDG_CACHE_HOME"
+
+        # the first run fills discovery cache and warms up file system caches
+        local run
+        for run in $(seq 0 "$RUNS"); do
+            start_monitor "$config" "$WORK_DIR/monitor.log"
+            wait_for_line "$WORK_DIR/monitor.log" "Startup: first frame shown" 30 > /dev/null ||
+                die "No video with discovery-cache: $cache: $(tail -n 20 "$WORK_DIR/monitor.log")"
+            wait_for_line "$WORK_DIR/monitor.log" "Startup: ONVIF discovery finished" 10 > /dev/null
+            stop_monitor "$MONITOR_PID"
+
+            [ "$run" -eq 0 ] && continue
+
+            local discovery firstFrame
+            discovery=$(sed -n -E 's/.*Startup: ONVIF discovery finished in ([0-9]+) ms.*/\1/p' "$WORK_DIR/monitor.log")
+            firstFrame=$(sed -n -E 's/.*Startup: first frame shown in ([0-9]+) ms.*/\1/p' "$WORK_DIR/monitor.log")
+            echo "${discovery:--} $firstFrame $(count "$WORK_DIR/monitor.log" "Starting cached media stream uri")" >> "$results"
+        done
+
+        printf "discovery-cache: %-5s discovery finished %5s ms  first frame %5s ms  cache used in %s of %s runs\n" \
+            "$cache" \
+            "$(column 1 "$results")" \
+            "$(column 2 "$results")" \
+            "$(awk '{ used += $3 > 0 } END { print used + 0 }' "$results")" \
+            "$RUNS"
+    done
+}
+
+[ -x "$MONITOR" ] || die "Monitor binary is not found at \"$MONITOR\""
+[ -x "$MOCK" ] || die "MockOnvifDevice binary is not found at \"$MOCK\""
+
+case "${1:-}" in
+    push) bench_push ;;
+    lean) bench_lean ;;
+    mosaic) bench_mosaic ;;
+    profiles) bench_profiles ;;
+    startup) bench_startup ;;
+    *) die "Usage: $0 <push|lean|mosaic|profiles|startup>" ;;
+esac